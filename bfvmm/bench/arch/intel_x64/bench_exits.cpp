@@ -0,0 +1,411 @@
+//
+// Bareflank Extended APIs
+//
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+
+#include <intrinsics.h>
+
+#include <hve/arch/intel_x64/hve.h>
+#include <hve/arch/intel_x64/mmio_decoder.h>
+#include <hve/arch/intel_x64/vic.h>
+#include <support/arch/intel_x64/test_support.h>
+
+#ifdef _HIPPOMOCKS__ENABLE_CFUNC_MOCKING_SUPPORT
+
+// -----------------------------------------------------------------------------
+// Allocation Counting
+// -----------------------------------------------------------------------------
+
+uint64_t g_allocations{0};
+
+void *
+operator new(std::size_t size)
+{
+    g_allocations++;
+
+    if (auto ptr = std::malloc(size)) {
+        return ptr;
+    }
+
+    throw std::bad_alloc();
+}
+
+void
+operator delete(void *ptr) noexcept
+{ std::free(ptr); }
+
+void
+operator delete(void *ptr, std::size_t size) noexcept
+{
+    bfignored(size);
+    std::free(ptr);
+}
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+namespace reason = vmcs_n::exit_reason::basic_exit_reason;
+
+// -----------------------------------------------------------------------------
+// Driver
+// -----------------------------------------------------------------------------
+
+// Each stream is first run for a warm-up pass (which fills the mocked
+// VMCS/MSR maps and any lazily allocated handler state), then timed, and
+// must not allocate once warm. The default is sized for the unit test
+// run; set EAPIS_BENCH_EXITS to change the number of timed exits per
+// stream (e.g. 100000 for stable numbers).
+
+static uint64_t
+bench_exits()
+{
+    if (auto str = std::getenv("EAPIS_BENCH_EXITS")) {
+        return std::strtoull(str, nullptr, 0);
+    }
+
+    return 1000U;
+}
+
+template<typename F>
+static uint64_t
+run_stream(const char *name, F f)
+{
+    const auto exits = bench_exits();
+    const auto warmup = exits / 10U + 1U;
+
+    for (auto i = 0ULL; i < warmup; ++i) {
+        f(i);
+    }
+
+    const auto allocations = g_allocations;
+    const auto start = std::chrono::steady_clock::now();
+
+    for (auto i = 0ULL; i < exits; ++i) {
+        f(i);
+    }
+
+    const auto stop = std::chrono::steady_clock::now();
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+
+    const auto count = static_cast<double>(exits != 0U ? exits : 1U);
+
+    std::cout << std::left << std::setw(24) << name
+              << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << static_cast<double>(ns) / count << " ns/exit"
+              << std::setw(10) << static_cast<double>(g_allocations - allocations) / count
+              << " allocs/exit" << '\n';
+
+    return g_allocations - allocations;
+}
+
+static void
+set_exit_reason(uint64_t val)
+{ g_vmcs_fields[vmcs_n::exit_reason::addr] = val; }
+
+// -----------------------------------------------------------------------------
+// Handlers
+// -----------------------------------------------------------------------------
+
+static bool
+bench_cpuid_handler(gsl::not_null<vmcs_t *> vmcs, cpuid::info_t &info)
+{
+    bfignored(vmcs);
+    bfignored(info);
+
+    return true;
+}
+
+static bool
+bench_rdmsr_handler(gsl::not_null<vmcs_t *> vmcs, rdmsr::info_t &info)
+{
+    bfignored(vmcs);
+
+    info.val = 0x42U;
+    return true;
+}
+
+static bool
+bench_wrmsr_handler(gsl::not_null<vmcs_t *> vmcs, wrmsr::info_t &info)
+{
+    bfignored(vmcs);
+
+    info.ignore_write = true;
+    return true;
+}
+
+static bool
+bench_io_handler(gsl::not_null<vmcs_t *> vmcs, io_instruction::info_t &info)
+{
+    bfignored(vmcs);
+
+    info.ignore_write = true;
+    return true;
+}
+
+mmio_decoder::insn_bytes_t g_guest_insn{};
+
+static const uint8_t *
+bench_map_guest(
+    uint64_t rip, uint64_t cr3, uint64_t len, bfvmm::x64::unique_map<uint8_t> &map)
+{
+    bfignored(rip);
+    bfignored(cr3);
+    bfignored(len);
+    bfignored(map);
+
+    return g_guest_insn.data();
+}
+
+static bool
+bench_ept_handler(gsl::not_null<vmcs_t *> vmcs, ept_violation::info_t &info)
+{
+    bfignored(vmcs);
+    bfignored(info);
+
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// Streams
+// -----------------------------------------------------------------------------
+
+TEST_CASE("bench: cpuid storm")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto ehlr = hve->exit_handler();
+
+    const std::array<std::pair<uint64_t, uint64_t>, 4> leaves = {{
+        {0x0U, 0x0U}, {0x1U, 0x0U}, {0x7U, 0x0U}, {0x80000001U, 0x0U}
+    }};
+
+    for (const auto &leaf : leaves) {
+        hve->add_cpuid_handler(
+            leaf.first, leaf.second, cpuid::handler_delegate_t::create<bench_cpuid_handler>()
+        );
+    }
+
+    set_exit_reason(reason::cpuid);
+
+    const auto allocations = run_stream("cpuid storm", [&](uint64_t i) {
+        const auto &leaf = leaves.at(i & 0x3U);
+
+        g_save_state.rax = leaf.first;
+        g_save_state.rcx = leaf.second;
+
+        ehlr->handle(ehlr);
+    });
+
+    CHECK(allocations == 0U);
+}
+
+TEST_CASE("bench: msr mix")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto ehlr = hve->exit_handler();
+
+    const std::array<uint64_t, 4> msrs = {{
+        0x1BU, 0x3AU, 0x277U, 0xC0000080U
+    }};
+
+    for (const auto msr : msrs) {
+        g_msrs[msr] = 0x0U;
+
+        hve->add_rdmsr_handler(msr, rdmsr::handler_delegate_t::create<bench_rdmsr_handler>());
+        hve->add_wrmsr_handler(msr, wrmsr::handler_delegate_t::create<bench_wrmsr_handler>());
+    }
+
+    // Three reads for every write, cycling through the MSRs
+
+    const auto allocations = run_stream("msr mix", [&](uint64_t i) {
+        g_save_state.rcx = msrs.at((i >> 2U) & 0x3U);
+
+        if ((i & 0x3U) != 0U) {
+            set_exit_reason(reason::rdmsr);
+        }
+        else {
+            g_save_state.rax = i;
+            g_save_state.rdx = 0U;
+            set_exit_reason(reason::wrmsr);
+        }
+
+        ehlr->handle(ehlr);
+    });
+
+    CHECK(allocations == 0U);
+}
+
+TEST_CASE("bench: port io burst")
+{
+    namespace io_n = vmcs_n::exit_qualification::io_instruction;
+
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto ehlr = hve->exit_handler();
+
+    const uint64_t port = 0x3F8U;
+
+    hve->add_io_instruction_handler(
+        port,
+        io_instruction::handler_delegate_t::create<bench_io_handler>(),
+        io_instruction::handler_delegate_t::create<bench_io_handler>()
+    );
+
+    // A UART-style burst of byte writes to the data port. The handler
+    // drops the write so no port is touched on the host.
+
+    set_exit_reason(reason::io_instruction);
+    g_vmcs_fields[vmcs_n::exit_qualification::addr] =
+        (io_n::direction_of_access::out << io_n::direction_of_access::from) |
+        (io_n::operand_encoding::dx << io_n::operand_encoding::from);
+
+    const auto allocations = run_stream("port io burst", [&](uint64_t i) {
+        g_save_state.rdx = port;
+        g_save_state.rax = i & 0xFFU;
+
+        ehlr->handle(ehlr);
+    });
+
+    CHECK(allocations == 0U);
+}
+
+TEST_CASE("bench: ept violation burst")
+{
+    namespace qual_n = vmcs_n::exit_qualification::ept_violation;
+
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto ehlr = hve->exit_handler();
+
+    hve->add_ept_read_violation_handler(
+        ept_violation::handler_delegate_t::create<bench_ept_handler>()
+    );
+
+    set_exit_reason(reason::ept_violation);
+    g_vmcs_fields[vmcs_n::exit_qualification::addr] = qual_n::data_read::mask;
+
+    const auto allocations = run_stream("ept violation burst", [&](uint64_t i) {
+        const auto gpa = 0x100000000ULL + ((i & 0xFFU) << 12U);
+
+        g_vmcs_fields[vmcs_n::guest_physical_address::addr] = gpa;
+        g_vmcs_fields[vmcs_n::guest_linear_address::addr] = gpa;
+
+        ehlr->handle(ehlr);
+    });
+
+    CHECK(allocations == 0U);
+}
+
+TEST_CASE("bench: interrupt flood")
+{
+    namespace entry_intr_info = vmcs_n::vm_entry_interruption_information;
+    namespace exit_intr_info = vmcs_n::vm_exit_interruption_information;
+
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto ehlr = hve->exit_handler();
+    msrs_n::ia32_x2apic_sivr::vector::set(0U);
+    auto vic = setup_vic(hve.get());
+
+    open_interrupt_window();
+
+    // Every external interrupt exit is injected straight away (the window
+    // is open) and then retired by the guest's EOI, so each iteration
+    // accounts for two exits: the interrupt and the EOI write
+
+    const auto allocations = run_stream("interrupt flood (x2)", [&](uint64_t i) {
+        const auto vector = 0x20U + (i % 0xE0U);
+
+        set_exit_reason(reason::external_interrupt);
+        g_vmcs_fields[exit_intr_info::addr] = set_bits(
+            g_vmcs_fields[exit_intr_info::addr], exit_intr_info::vector::mask,
+            (vector << exit_intr_info::vector::from)
+        );
+
+        entry_intr_info::valid_bit::disable();
+        ehlr->handle(ehlr);
+
+        wrmsr::info_t info = {};
+        vic.handle_x2apic_eoi_write(hve->vmcs(), info);
+    });
+
+    CHECK(allocations == 0U);
+}
+
+// The guest's memory is not mapped here, so a miss only counts the decode
+// and the cache update: on hardware it also pays for the page walk and
+// the mapping of the code, which a hit never does
+
+TEST_CASE("bench: mmio decode hit")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vmcs = hve->vmcs();
+
+    mocks.OnCallFunc(mmio_decoder::map_guest).Do(bench_map_guest);
+
+    mmio_decoder decoder;
+    vmcs->save_state()->rip = 0x1000U;
+
+    // mov [rdi + 0x20], ecx
+
+    g_guest_insn = {0x89, 0x4F, 0x20};
+
+    const auto allocations = run_stream("mmio decode hit", [&](uint64_t i) {
+        bfignored(i);
+        decoder.decode(vmcs, true);
+    });
+
+    CHECK(allocations == 0U);
+}
+
+TEST_CASE("bench: mmio decode miss")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vmcs = hve->vmcs();
+
+    mocks.OnCallFunc(mmio_decoder::map_guest).Do(bench_map_guest);
+
+    mmio_decoder decoder;
+    vmcs->save_state()->rip = 0x1000U;
+
+    // mov [rdi + 0x20], ecx/edx: the code at RIP changes on every exit
+
+    g_guest_insn = {0x89, 0x4F, 0x20};
+
+    const auto allocations = run_stream("mmio decode miss", [&](uint64_t i) {
+        g_guest_insn.at(1) = ((i & 0x1U) != 0U) ? 0x57U : 0x4FU;
+        decoder.decode(vmcs, true);
+    });
+
+    CHECK(allocations == 0U);
+}
+
+}
+}
+
+#endif
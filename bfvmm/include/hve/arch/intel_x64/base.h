@@ -21,16 +21,17 @@
 
 #include <bfgsl.h>
 
+#include <new>
+#include <array>
 #include <list>
+#include <vector>
+#include <iterator>
+#include <type_traits>
 #include <unordered_map>
 
 #include <bfvmm/hve/arch/intel_x64/vmcs/vmcs.h>
 #include <bfvmm/hve/arch/intel_x64/exit_handler/exit_handler.h>
 
-#ifndef EAPIS_LOG_MAX
-#define EAPIS_LOG_MAX 10
-#endif
-
 // -----------------------------------------------------------------------------
 // Exports
 // -----------------------------------------------------------------------------
@@ -63,6 +64,7 @@ namespace vmcs_n = ::intel_x64::vmcs;
 // -----------------------------------------------------------------------------
 
 using vmcs_t = bfvmm::intel_x64::vmcs;
+using save_state_t = bfvmm::intel_x64::save_state_t;
 using exit_handler_t = bfvmm::intel_x64::exit_handler;
 
 // -----------------------------------------------------------------------------
@@ -74,6 +76,295 @@ namespace eapis
 namespace intel_x64
 {
 
+/// Bit Scan Reverse
+///
+/// Returns the index of the most significant set bit. This is a fixed
+/// six-step binary search rather than a compiler builtin so that it
+/// behaves the same with every toolchain the extensions are built with.
+///
+/// @expects val != 0
+/// @ensures
+///
+/// @param val the value to scan
+/// @return the index of the most significant set bit in val
+///
+inline uint64_t
+bit_scan_reverse(uint64_t val) noexcept
+{
+    auto index = 0ULL;
+
+    if ((val & 0xFFFFFFFF00000000ULL) != 0U) {
+        index += 32U;
+        val >>= 32U;
+    }
+
+    if ((val & 0xFFFF0000ULL) != 0U) {
+        index += 16U;
+        val >>= 16U;
+    }
+
+    if ((val & 0xFF00ULL) != 0U) {
+        index += 8U;
+        val >>= 8U;
+    }
+
+    if ((val & 0xF0ULL) != 0U) {
+        index += 4U;
+        val >>= 4U;
+    }
+
+    if ((val & 0xCULL) != 0U) {
+        index += 2U;
+        val >>= 2U;
+    }
+
+    if ((val & 0x2ULL) != 0U) {
+        index += 1U;
+    }
+
+    return index;
+}
+
+/// General-Purpose Register Members
+///
+/// The save_state_t member of each general-purpose register, indexed by
+/// the register's 4-bit encoding (rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+/// r8-r15). This is the encoding used by the general_purpose_register
+/// field of the exit qualification, by the VM-exit instruction information
+/// and by the ModRM reg/rm fields (extended by REX), so every handler and
+/// decoder can address the guest's registers by index.
+///
+constexpr const std::array<uintptr_t save_state_t::*, 16> gpr_members = {{
+    &save_state_t::rax,
+    &save_state_t::rcx,
+    &save_state_t::rdx,
+    &save_state_t::rbx,
+    &save_state_t::rsp,
+    &save_state_t::rbp,
+    &save_state_t::rsi,
+    &save_state_t::rdi,
+    &save_state_t::r08,
+    &save_state_t::r09,
+    &save_state_t::r10,
+    &save_state_t::r11,
+    &save_state_t::r12,
+    &save_state_t::r13,
+    &save_state_t::r14,
+    &save_state_t::r15
+}};
+
+/// Guest General-Purpose Register
+///
+/// Returns the guest register with the given encoding (see gpr_members).
+/// The lookup is a single indexed load with no branches. Only the low
+/// four bits of index are used, which is the full width of every
+/// register encoding above.
+///
+/// @expects
+/// @ensures
+///
+/// @param vmcs the vmcs containing the guest register state
+/// @param index the encoding of the register
+/// @return a reference to the register in the vmcs's save state
+///
+inline uintptr_t &
+guest_gpr(gsl::not_null<vmcs_t *> vmcs, uint64_t index) noexcept
+{
+    save_state_t *state = vmcs->save_state();
+    return state->*gpr_members[index & 0xFU];
+}
+
+/// Handler Chain
+///
+/// Stores the delegates registered for an exit. The first N delegates are
+/// stored inline and any additional delegates are stored in a contiguous
+/// overflow buffer, so walking the chain on an exit does not chase heap
+/// nodes. Like std::list::push_front, the most recently added delegate is
+/// visited first.
+///
+template<typename T, std::size_t N = 2>
+class handler_chain
+{
+public:
+
+    /// Iterator
+    ///
+    /// Visits the delegates from the most recently added to the first
+    /// added.
+    ///
+    class const_iterator
+    {
+    public:
+
+        /// @cond
+
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T *;
+        using reference = const T &;
+
+        const_iterator(const handler_chain *chain, std::size_t index) noexcept :
+            m_chain{chain},
+            m_index{index}
+        { }
+
+        reference operator*() const
+        { return m_chain->at_pos(m_chain->m_size - m_index - 1); }
+
+        pointer operator->() const
+        { return &m_chain->at_pos(m_chain->m_size - m_index - 1); }
+
+        const_iterator &operator++() noexcept
+        { ++m_index; return *this; }
+
+        const_iterator operator++(int) noexcept
+        { auto tmp = *this; ++m_index; return tmp; }
+
+        bool operator==(const const_iterator &other) const noexcept
+        { return m_index == other.m_index; }
+
+        bool operator!=(const const_iterator &other) const noexcept
+        { return m_index != other.m_index; }
+
+        /// @endcond
+
+    private:
+
+        const handler_chain *m_chain;
+        std::size_t m_index;
+    };
+
+public:
+
+    /// Default Constructor
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    handler_chain() = default;
+
+    /// Destructor
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    ~handler_chain()
+    { this->clear_inline(); }
+
+    /// Push Front
+    ///
+    /// Adds a delegate to the chain. The delegate is visited before all
+    /// of the delegates that were previously added.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param t the delegate to add
+    ///
+    void push_front(T &&t)
+    {
+        if (m_size < N) {
+            new (&m_inline[m_size]) T(std::move(t));
+        }
+        else {
+            m_overflow.push_back(std::move(t));
+        }
+
+        ++m_size;
+    }
+
+    /// Empty
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return returns true if no delegates have been added
+    ///
+    bool empty() const noexcept
+    { return m_size == 0; }
+
+    /// Size
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return returns the number of delegates in the chain
+    ///
+    std::size_t size() const noexcept
+    { return m_size; }
+
+    /// @cond
+
+    const_iterator begin() const noexcept
+    { return const_iterator(this, 0); }
+
+    const_iterator end() const noexcept
+    { return const_iterator(this, m_size); }
+
+    /// @endcond
+
+private:
+
+    const T &at_pos(std::size_t pos) const
+    {
+        if (GSL_LIKELY(pos < N)) {
+            return *reinterpret_cast<const T *>(&m_inline[pos]);
+        }
+
+        return m_overflow[pos - N];
+    }
+
+    void clear_inline() noexcept
+    {
+        for (std::size_t i = 0; i < m_size && i < N; ++i) {
+            reinterpret_cast<T *>(&m_inline[i])->~T();
+        }
+    }
+
+    void move_from(handler_chain &other) noexcept
+    {
+        for (std::size_t i = 0; i < other.m_size && i < N; ++i) {
+            new (&m_inline[i]) T(std::move(*reinterpret_cast<T *>(&other.m_inline[i])));
+        }
+
+        m_size = other.m_size;
+        m_overflow = std::move(other.m_overflow);
+
+        other.clear_inline();
+        other.m_size = 0;
+        other.m_overflow.clear();
+    }
+
+private:
+
+    std::array<typename std::aligned_storage<sizeof(T), alignof(T)>::type, N> m_inline;
+    std::size_t m_size{0};
+    std::vector<T> m_overflow;
+
+public:
+
+    /// @cond
+
+    handler_chain(handler_chain &&other) noexcept
+    { this->move_from(other); }
+
+    handler_chain &operator=(handler_chain &&other) noexcept
+    {
+        if (this != &other) {
+            this->clear_inline();
+            this->move_from(other);
+        }
+
+        return *this;
+    }
+
+    handler_chain(const handler_chain &) = delete;
+    handler_chain &operator=(const handler_chain &) = delete;
+
+    /// @endcond
+};
+
 /// Base
 ///
 /// Provides an interface for shared features of handlers for the various
@@ -125,7 +416,7 @@ public:
     /// @ensures
     ///
     void disable_log()
-    { m_log_enabled = true; }
+    { m_log_enabled = false; }
 
     /// Dump Log
     ///
@@ -139,27 +430,6 @@ public:
     ///
     virtual void dump_log() = 0;
 
-    /// Add Record to Log
-    ///
-    /// Example:
-    /// @code
-    /// this->add_record();
-    /// @endcode
-    ///
-    /// @expects
-    /// @ensures
-    ///
-    /// @param log The log to add a record to
-    /// @param record The record to add to the log
-    ///
-    template<typename T> void
-    add_record(std::list<T> &log, const T &record)
-    {
-        if (log.size() < EAPIS_LOG_MAX) {
-            log.push_back(record);
-        }
-    }
-
 protected:
 
     /// Emulate read of general-purpose register
@@ -181,62 +451,25 @@ protected:
     /// @return the value written by the guest to the given gpr
     ///
     uintptr_t emulate_rdgpr(gsl::not_null<vmcs_t *> vmcs)
+    { return emulate_rdgpr(vmcs, vmcs_n::exit_qualification::get()); }
+
+    /// Emulate read of general-purpose register (Qualification)
+    ///
+    /// Same as emulate_rdgpr(vmcs), but decodes the register from the
+    /// given exit qualification instead of reading it from the VMCS (see
+    /// exit_context).
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param vmcs The vmcs containing the guest register state
+    /// @param qual the exit qualification of the current exit
+    /// @return the value written by the guest to the given gpr
+    ///
+    uintptr_t emulate_rdgpr(gsl::not_null<vmcs_t *> vmcs, vmcs_n::value_type qual)
     {
         using namespace vmcs_n::exit_qualification::control_register_access;
-
-        switch (general_purpose_register::get())
-        {
-            case general_purpose_register::rax:
-                return vmcs->save_state()->rax;
-
-            case general_purpose_register::rbx:
-                return vmcs->save_state()->rbx;
-
-            case general_purpose_register::rcx:
-                return vmcs->save_state()->rcx;
-
-            case general_purpose_register::rdx:
-                return vmcs->save_state()->rdx;
-
-            case general_purpose_register::rsp:
-                return vmcs->save_state()->rsp;
-
-            case general_purpose_register::rbp:
-                return vmcs->save_state()->rbp;
-
-            case general_purpose_register::rsi:
-                return vmcs->save_state()->rsi;
-
-            case general_purpose_register::rdi:
-                return vmcs->save_state()->rdi;
-
-            case general_purpose_register::r8:
-                return vmcs->save_state()->r08;
-
-            case general_purpose_register::r9:
-                return vmcs->save_state()->r09;
-
-            case general_purpose_register::r10:
-                return vmcs->save_state()->r10;
-
-            case general_purpose_register::r11:
-                return vmcs->save_state()->r11;
-
-            case general_purpose_register::r12:
-                return vmcs->save_state()->r12;
-
-            case general_purpose_register::r13:
-                return vmcs->save_state()->r13;
-
-            case general_purpose_register::r14:
-                return vmcs->save_state()->r14;
-
-            case general_purpose_register::r15:
-                return vmcs->save_state()->r15;
-
-            default:
-                throw std::runtime_error("emulate_rdgpr: unknown index");
-        }
+        return guest_gpr(vmcs, general_purpose_register::get(qual));
     }
 
     /// Emulate write of general-purpose register
@@ -258,85 +491,34 @@ protected:
     /// @param val the to write to the guest register
     ///
     void emulate_wrgpr(gsl::not_null<vmcs_t *> vmcs, uintptr_t val)
+    { emulate_wrgpr(vmcs, val, vmcs_n::exit_qualification::get()); }
+
+    /// Emulate write of general-purpose register (Qualification)
+    ///
+    /// Same as emulate_wrgpr(vmcs, val), but decodes the register from the
+    /// given exit qualification instead of reading it from the VMCS (see
+    /// exit_context).
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param vmcs the vmcs containing the guest register state
+    /// @param val the to write to the guest register
+    /// @param qual the exit qualification of the current exit
+    ///
+    void emulate_wrgpr(
+        gsl::not_null<vmcs_t *> vmcs, uintptr_t val, vmcs_n::value_type qual)
     {
         using namespace vmcs_n::exit_qualification::control_register_access;
-
-        switch (general_purpose_register::get()) {
-            case general_purpose_register::rax:
-                vmcs->save_state()->rax = val;
-                return;
-
-            case general_purpose_register::rbx:
-                vmcs->save_state()->rbx = val;
-                return;
-
-            case general_purpose_register::rcx:
-                vmcs->save_state()->rcx = val;
-                return;
-
-            case general_purpose_register::rdx:
-                vmcs->save_state()->rdx = val;
-                return;
-
-            case general_purpose_register::rsp:
-                vmcs->save_state()->rsp = val;
-                return;
-
-            case general_purpose_register::rbp:
-                vmcs->save_state()->rbp = val;
-                return;
-
-            case general_purpose_register::rsi:
-                vmcs->save_state()->rsi = val;
-                return;
-
-            case general_purpose_register::rdi:
-                vmcs->save_state()->rdi = val;
-                return;
-
-            case general_purpose_register::r8:
-                vmcs->save_state()->r08 = val;
-                return;
-
-            case general_purpose_register::r9:
-                vmcs->save_state()->r09 = val;
-                return;
-
-            case general_purpose_register::r10:
-                vmcs->save_state()->r10 = val;
-                return;
-
-            case general_purpose_register::r11:
-                vmcs->save_state()->r11 = val;
-                return;
-
-            case general_purpose_register::r12:
-                vmcs->save_state()->r12 = val;
-                return;
-
-            case general_purpose_register::r13:
-                vmcs->save_state()->r13 = val;
-                return;
-
-            case general_purpose_register::r14:
-                vmcs->save_state()->r14 = val;
-                return;
-
-            case general_purpose_register::r15:
-                vmcs->save_state()->r15 = val;
-                return;
-
-            default:
-                throw std::runtime_error("emulate_wrgpr: unknown index");
-        }
+        guest_gpr(vmcs, general_purpose_register::get(qual)) = val;
     }
 
 protected:
 
     /// Log enabled
     ///
-    /// If true, *each* class derived from base will log exit-reason-specific
-    /// information on exit (provided also that NDEBUG == 0).
+    /// If true, *each* class derived from base will record exit-reason-specific
+    /// information on exit in the vCPU's trace ring (see trace_ring).
     //
     bool m_log_enabled{false};
 
@@ -20,6 +20,9 @@
 #define CONTROL_REGISTER_INTEL_X64_EAPIS_H
 
 #include "base.h"
+#include "exit_context.h"
+#include "exit_profile.h"
+#include "trace_ring.h"
 
 // -----------------------------------------------------------------------------
 // Definitions
@@ -268,6 +271,30 @@ public:
     ///
     void enable_wrcr8_exiting();
 
+    /// Disable Read CR8 Exiting
+    ///
+    /// Example:
+    /// @code
+    /// this->disable_rdcr8_exiting();
+    /// @endcode
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    void disable_rdcr8_exiting();
+
+    /// Disable Write CR8 Exiting
+    ///
+    /// Example:
+    /// @code
+    /// this->disable_wrcr8_exiting();
+    /// @endcode
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    void disable_wrcr8_exiting();
+
 public:
 
     /// Dump Log
@@ -304,26 +331,16 @@ private:
 
 private:
 
-    gsl::not_null<exit_handler_t *> m_exit_handler;
-
-    std::list<handler_delegate_t> m_wrcr0_handlers;
-    std::list<handler_delegate_t> m_rdcr3_handlers;
-    std::list<handler_delegate_t> m_wrcr3_handlers;
-    std::list<handler_delegate_t> m_wrcr4_handlers;
-    std::list<handler_delegate_t> m_rdcr8_handlers;
-    std::list<handler_delegate_t> m_wrcr8_handlers;
-
-private:
-
-    struct record_t {
-        uint64_t val;
-        uint64_t shadow;
-    };
+    gsl::not_null<exit_profile *> m_exit_profile;
+    gsl::not_null<trace_ring *> m_trace_ring;
+    gsl::not_null<exit_context *> m_exit_context;
 
-    std::list<record_t> m_cr0_log;
-    std::list<record_t> m_cr3_log;
-    std::list<record_t> m_cr4_log;
-    std::list<record_t> m_cr8_log;
+    handler_chain<handler_delegate_t> m_wrcr0_handlers;
+    handler_chain<handler_delegate_t> m_rdcr3_handlers;
+    handler_chain<handler_delegate_t> m_wrcr3_handlers;
+    handler_chain<handler_delegate_t> m_wrcr4_handlers;
+    handler_chain<handler_delegate_t> m_rdcr8_handlers;
+    handler_chain<handler_delegate_t> m_wrcr8_handlers;
 
 public:
 
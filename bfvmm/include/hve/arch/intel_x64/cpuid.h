@@ -19,7 +19,13 @@
 #ifndef CPUID_INTEL_X64_EAPIS_H
 #define CPUID_INTEL_X64_EAPIS_H
 
+#include <map>
+#include <array>
+#include <vector>
+
 #include "base.h"
+#include "exit_profile.h"
+#include "trace_ring.h"
 
 // -----------------------------------------------------------------------------
 // Definitions
@@ -30,27 +36,6 @@ namespace eapis
 namespace intel_x64
 {
 
-/// Pair hash
-///
-/// Provides a hash function for std::pair
-///
-struct pair_hash {
-
-    /// Call operator
-    ///
-    /// @expects
-    /// @ensures
-    ///
-    /// @param p the pair to hash
-    /// @return the hash of p
-    ///
-    template <typename T1, typename T2>
-    std::size_t operator () (const std::pair<T1,T2> &p) const {
-        return ((std::hash<T1>{}(p.first) & 0x00000000FFFFFFFF) > 0) |
-               ((std::hash<T2>{}(p.second) & 0xFFFFFFFF00000000) > 32);
-    }
-};
-
 class hve;
 
 /// CPUID
@@ -58,6 +43,22 @@ class hve;
 /// Provides an interface for registering handlers for cpuid exits
 /// at a given (leaf, subleaf).
 ///
+/// Handlers are stored in a dispatch table that is indexed directly by
+/// leaf for the basic (0x0 - 0x3F) and extended (0x80000000 - 0x8000003F)
+/// ranges. All other leaves (e.g. hypervisor leaves) are stored in a sparse
+/// table. Each leaf has a set of subleaf specific handlers and a set of
+/// handlers that are called for any subleaf.
+///
+/// The result of each registered (leaf, subleaf) is read from hardware once,
+/// when it is first registered, and cached with its policies (e.g. force a
+/// feature bit to 0) applied, so a cpuid exit that only needs a policy is a
+/// table read. Leaves that report state the guest can change or that differ
+/// between cores (leaf 0x1's OSXSAVE and APIC ID, leaf 0x7's OSPKE, the
+/// x2APIC ID in leaves 0xB and 0x1F, and leaf 0xD's XSAVE sizes, which
+/// follow XCR0) are never cached: they are executed on each exit and the
+/// policies are applied to the live result. Other leaves can opt out of
+/// the cache with disable_result_cache.
+///
 class EXPORT_EAPIS_HVE cpuid : public base
 {
 public:
@@ -72,6 +73,17 @@ public:
     ///
     using subleaf_t = uint64_t;
 
+    /// Register
+    ///
+    /// Identifies the output register a policy applies to
+    ///
+    enum class reg_t : std::size_t {
+        rax = 0,
+        rbx = 1,
+        rcx = 2,
+        rdx = 3
+    };
+
     /// Info
     ///
     /// This struct is created by cpuid::handle before being
@@ -165,6 +177,100 @@ public:
     void add_handler(
         leaf_t leaf, subleaf_t subleaf, handler_delegate_t &&d);
 
+    /// Add CPUID Handler (Any Subleaf)
+    ///
+    /// @note the handler is called for every subleaf of the provided leaf.
+    ///       Subleaf specific handlers registered for the same leaf are
+    ///       always called before handlers registered with this function.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param leaf the cpuid leaf to call d
+    /// @param d the handler to call when an exit occurs
+    ///
+    void add_handler(
+        leaf_t leaf, handler_delegate_t &&d);
+
+public:
+
+    /// Force Set Bits
+    ///
+    /// Forces the provided bits of reg to 1 for the given (leaf, subleaf).
+    /// Once a policy is registered, the (leaf, subleaf) is always emulated,
+    /// even if none of the registered handlers (if any) handle the exit.
+    ///
+    /// Example:
+    /// @code
+    /// // Report the hypervisor present bit in leaf 1
+    /// this->force_set_bits(0x1, 0x0, cpuid::reg_t::rcx, 0x80000000);
+    /// @endcode
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param leaf the cpuid leaf to apply the policy to
+    /// @param subleaf the cpuid subleaf to apply the policy to
+    /// @param reg the register to apply the policy to
+    /// @param bits the bits to set
+    ///
+    void force_set_bits(
+        leaf_t leaf, subleaf_t subleaf, reg_t reg, uint64_t bits);
+
+    /// Force Clear Bits
+    ///
+    /// Forces the provided bits of reg to 0 for the given (leaf, subleaf).
+    ///
+    /// Example:
+    /// @code
+    /// // Hide VMX support in leaf 1
+    /// this->force_clear_bits(0x1, 0x0, cpuid::reg_t::rcx, 0x00000020);
+    /// @endcode
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param leaf the cpuid leaf to apply the policy to
+    /// @param subleaf the cpuid subleaf to apply the policy to
+    /// @param reg the register to apply the policy to
+    /// @param bits the bits to clear
+    ///
+    void force_clear_bits(
+        leaf_t leaf, subleaf_t subleaf, reg_t reg, uint64_t bits);
+
+    /// Force Value
+    ///
+    /// Replaces the result of the given (leaf, subleaf) with constants.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param leaf the cpuid leaf to apply the policy to
+    /// @param subleaf the cpuid subleaf to apply the policy to
+    /// @param rax the value of rax returned to the guest
+    /// @param rbx the value of rbx returned to the guest
+    /// @param rcx the value of rcx returned to the guest
+    /// @param rdx the value of rdx returned to the guest
+    ///
+    void force_value(
+        leaf_t leaf, subleaf_t subleaf,
+        uint64_t rax, uint64_t rbx, uint64_t rcx, uint64_t rdx);
+
+    /// Disable Result Cache
+    ///
+    /// Executes CPUID on every exit for the given (leaf, subleaf) instead of
+    /// returning the result cached when it was registered. Policies and
+    /// handlers are applied to the live result. Leaves 0x1, 0x7, 0xB, 0xD
+    /// and 0x1F are never cached.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param leaf the cpuid leaf to execute on every exit
+    /// @param subleaf the cpuid subleaf to execute on every exit
+    ///
+    void disable_result_cache(leaf_t leaf, subleaf_t subleaf);
+
 public:
 
     /// Dump Log
@@ -189,21 +295,43 @@ public:
 
 private:
 
-    exit_handler_t *m_exit_handler;
-    std::unordered_map<std::pair<leaf_t, subleaf_t>, std::list<handler_delegate_t>, pair_hash> m_handlers;
+    struct subleaf_entry_t {
+        subleaf_t subleaf;
+        std::array<uint64_t, 4> result;
+        bool has_policy;
+        bool cached;
+        handler_chain<handler_delegate_t> handlers;
+
+        std::array<uint64_t, 4> hardware;
+        std::array<uint64_t, 4> set_bits;
+        std::array<uint64_t, 4> clear_bits;
+        std::array<uint64_t, 4> value;
+        bool has_value;
+    };
+
+    struct leaf_entry_t {
+        handler_chain<handler_delegate_t> any_subleaf;
+        std::vector<subleaf_entry_t> subleaves;
+    };
+
+    leaf_entry_t *find_leaf(leaf_t leaf);
+    leaf_entry_t &get_leaf(leaf_t leaf);
+
+    subleaf_entry_t *find_subleaf(leaf_entry_t &entry, subleaf_t subleaf);
+    subleaf_entry_t &get_subleaf(leaf_t leaf, subleaf_t subleaf);
+
+    void apply_policy(
+        const subleaf_entry_t &entry, const std::array<uint64_t, 4> &in,
+        std::array<uint64_t, 4> &out);
 
 private:
 
-    struct cpuid_record_t {
-        uint64_t leaf;
-        uint64_t subleaf;
-        uint64_t rax;
-        uint64_t rbx;
-        uint64_t rcx;
-        uint64_t rdx;
-    };
+    exit_profile *m_exit_profile;
+    trace_ring *m_trace_ring;
 
-    std::list<cpuid_record_t> m_log;
+    std::array<leaf_entry_t, 0x40> m_basic_leaves;
+    std::array<leaf_entry_t, 0x40> m_extended_leaves;
+    std::map<leaf_t, leaf_entry_t> m_other_leaves;
 
 public:
 
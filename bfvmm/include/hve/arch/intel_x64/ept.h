@@ -22,6 +22,7 @@
 
 #include "ept/types.h"
 #include "ept/intrinsics.h"
+#include "ept/page_table_pool.h"
 #include "ept/memory_map.h"
 #include "ept/helpers.h"
 #include "ept_violation.h"
@@ -34,7 +34,8 @@ namespace ept
 {
 
 /// Calculate the VMCS extended page table pointer (EPTP) field for the given
-/// memory map
+/// memory map. The EPT accessed and dirty flags are enabled in the EPTP if
+/// they are enabled for the memory map.
 ///
 /// @expects
 /// @ensures
@@ -195,6 +196,208 @@ void identity_map_4k(memory_map &mem_map, gpa_t gpa);
 ///
 void identity_map_4k(memory_map &mem_map, gpa_t gpa, memory_attr_t mattr);
 
+//--------------------------------------------------------------------------
+// Ranges
+//--------------------------------------------------------------------------
+
+/// Map a range of memory from the guest physical address to host physical
+/// address. The range is decomposed into the fewest 1GB, 2MB and 4KB pages
+/// that the alignment of gpa, hpa and the remaining size allow.
+///
+/// @expects gpa, hpa and size are 4KB aligned
+/// @ensures
+///
+/// @param mem_map the memory map to add the mapping to
+/// @param gpa the guest physical address to map from
+/// @param hpa the host physical address to map to
+/// @param size the number of bytes to map
+///
+/// @return Returns the number of pages used to map the range
+///
+uint64_t map_range(memory_map &mem_map, gpa_t gpa, hpa_t hpa, uint64_t size);
+
+/// Map a range of memory from the guest physical address to host physical
+/// address with the given memory attributes. The range is decomposed into
+/// the fewest 1GB, 2MB and 4KB pages that the alignment of gpa, hpa and the
+/// remaining size allow.
+///
+/// @expects gpa, hpa and size are 4KB aligned
+/// @ensures
+///
+/// @param mem_map the memory map to add the mapping to
+/// @param gpa the guest physical address to map from
+/// @param hpa the host physical address to map to
+/// @param size the number of bytes to map
+/// @param mattr page table entry memory attributes to be applied to the mapping
+///
+/// @return Returns the number of pages used to map the range
+///
+uint64_t map_range(
+    memory_map &mem_map, gpa_t gpa, hpa_t hpa, uint64_t size, memory_attr_t mattr);
+
+/// Identity map a range of memory from the guest physical address
+///
+/// @expects gpa and size are 4KB aligned
+/// @ensures
+///
+/// @param mem_map the memory map to add the mapping to
+/// @param gpa the guest physical address to map from
+/// @param size the number of bytes to map
+///
+/// @return Returns the number of pages used to map the range
+///
+uint64_t identity_map_range(memory_map &mem_map, gpa_t gpa, uint64_t size);
+
+/// Identity map a range of memory from the guest physical address with the
+/// given memory attributes
+///
+/// @expects gpa and size are 4KB aligned
+/// @ensures
+///
+/// @param mem_map the memory map to add the mapping to
+/// @param gpa the guest physical address to map from
+/// @param size the number of bytes to map
+/// @param mattr page table entry memory attributes to be applied to the mapping
+///
+/// @return Returns the number of pages used to map the range
+///
+uint64_t identity_map_range(
+    memory_map &mem_map, gpa_t gpa, uint64_t size, memory_attr_t mattr);
+
+//--------------------------------------------------------------------------
+// Splitting and merging
+//--------------------------------------------------------------------------
+
+/// Split the large page that maps the given guest physical address until
+/// gpa is mapped by a page no larger than the given size (see
+/// memory_map::split)
+///
+/// @expects size is 2MB or 4KB
+/// @ensures
+///
+/// @param mem_map the memory map that maps gpa
+/// @param gpa the guest physical address to split at
+/// @param size the largest page size that may map gpa after the split
+///
+/// @return Returns the leaf extended page table entry that maps gpa
+///
+epte_t &split(memory_map &mem_map, gpa_t gpa, uint64_t size);
+
+/// Split the page that maps the given guest physical address down to a
+/// 4KB page
+///
+/// @expects
+/// @ensures
+///
+/// @param mem_map the memory map that maps gpa
+/// @param gpa the guest physical address to split at
+///
+/// @return Returns the 4KB extended page table entry that maps gpa
+///
+epte_t &split_4k(memory_map &mem_map, gpa_t gpa);
+
+/// Merge the page table that covers the given guest physical address back
+/// into a single page of the given size, if its entries allow it (see
+/// memory_map::merge)
+///
+/// @expects size is 1GB or 2MB
+/// @ensures
+///
+/// @param mem_map the memory map that maps gpa
+/// @param gpa the guest physical address to merge at
+/// @param size the page size to merge into
+///
+/// @return Returns true if gpa is mapped by a page of the given size (or
+///     larger) on return, false otherwise
+///
+bool merge(memory_map &mem_map, gpa_t gpa, uint64_t size);
+
+//--------------------------------------------------------------------------
+// Accessed and dirty flags
+//--------------------------------------------------------------------------
+
+/// Harvest (report and clear) the dirty flags of the guest physical range
+/// [gpa, gpa + size), one bit per 4KB page (see memory_map::harvest_dirty)
+///
+/// @expects gpa and size are 4KB aligned
+/// @ensures
+///
+/// @param mem_map the memory map to harvest
+/// @param gpa the first guest physical address to harvest
+/// @param size the number of bytes to harvest
+/// @param bitmap the bitmap to fill in
+///
+/// @return Returns the number of dirty 4KB pages
+///
+uint64_t harvest_dirty(
+    memory_map &mem_map, gpa_t gpa, uint64_t size, gsl::span<uint64_t> bitmap);
+
+/// Harvest (report and clear) the accessed flags of the guest physical
+/// range [gpa, gpa + size), one bit per 4KB page (see
+/// memory_map::harvest_accessed)
+///
+/// @expects gpa and size are 4KB aligned
+/// @ensures
+///
+/// @param mem_map the memory map to harvest
+/// @param gpa the first guest physical address to harvest
+/// @param size the number of bytes to harvest
+/// @param bitmap the bitmap to fill in
+///
+/// @return Returns the number of accessed 4KB pages
+///
+uint64_t harvest_accessed(
+    memory_map &mem_map, gpa_t gpa, uint64_t size, gsl::span<uint64_t> bitmap);
+
+//--------------------------------------------------------------------------
+// Access rights
+//--------------------------------------------------------------------------
+
+/// Set the access rights of the page that maps the given guest physical
+/// address. The change is batched, and is not guaranteed to be visible to
+/// the guest until flush(mem_map) is called.
+///
+/// @expects
+/// @ensures
+///
+/// @param mem_map the memory map that maps gpa
+/// @param gpa the guest physical address to change the rights of
+/// @param rights the new access rights (see epte::access_rights)
+///
+void set_access_rights(memory_map &mem_map, gpa_t gpa, epte_value_t rights);
+
+/// Invalidate the translations derived from the given memory map on the
+/// current CPU, if the memory map has been modified since its last flush
+///
+/// @expects
+/// @ensures
+///
+/// @param mem_map the memory map to flush
+///
+void flush(memory_map &mem_map);
+
+//--------------------------------------------------------------------------
+// INVEPT
+//--------------------------------------------------------------------------
+
+/// Invalidate the translations derived from the given memory map on the
+/// current CPU (single-context INVEPT)
+///
+/// @expects
+/// @ensures
+///
+/// @param mem_map the memory map to invalidate
+///
+void invept_single_context(memory_map &mem_map);
+
+/// Invalidate the translations derived from every memory map on the
+/// current CPU (all-context INVEPT)
+///
+/// @expects
+/// @ensures
+///
+void invept_all_contexts();
+
 /// Unmap the given guest physical address
 ///
 /// @expects
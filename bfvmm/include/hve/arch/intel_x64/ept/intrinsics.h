@@ -300,6 +300,26 @@ namespace epte
         { entry = set_bits(entry, mask, val << from); }
     }
 
+    namespace access_rights
+    {
+        constexpr const auto mask = 0x0000000000000007ULL;
+        constexpr const auto from = 0ULL;
+        constexpr const auto name = "access_rights";
+
+        constexpr const auto tp = 0x00;
+        constexpr const auto ro = 0x01;
+        constexpr const auto rw = 0x03;
+        constexpr const auto eo = 0x04;
+        constexpr const auto re = 0x05;
+        constexpr const auto pt = 0x07;
+
+        inline auto get(epte_t &entry) noexcept
+        { return get_bits(entry, mask) >> from; }
+
+        inline void set(epte_t &entry, epte_value_t val) noexcept
+        { entry = set_bits(entry, mask, val << from); }
+    }
+
     inline void trap_on_access(epte_t &entry) noexcept
     {
         read_access::disable(entry);
@@ -20,9 +20,11 @@
 #ifndef MEMORY_MAP_EPT_INTEL_X64_H
 #define MEMORY_MAP_EPT_INTEL_X64_H
 
+#include <bfgsl.h>
 #include <bfmemory.h>
 
 #include "intrinsics.h"
+#include "page_table_pool.h"
 #include "types.h"
 
 // -----------------------------------------------------------------------------
@@ -101,6 +103,41 @@ public:
     ///
     void unmap(gpa_t gpa);
 
+    /// Split the large page that maps the given guest physical address
+    /// into smaller pages, until gpa is mapped by a page no larger than the
+    /// given size (a 1GB page is split into 2MB pages, which are split into
+    /// 4KB pages). Each new page inherits the attributes of the page it was
+    /// split from, so the guest sees the same memory before and after the
+    /// split.
+    ///
+    /// @expects size is 2MB or 4KB
+    /// @ensures flush_pending() if a page was split
+    ///
+    /// @return Returns the leaf extended page table entry that maps gpa
+    ///
+    /// @param gpa the guest physical address to split at
+    /// @param size the largest page size that may map gpa after the split
+    ///
+    epte_t &split(gpa_t gpa, uint64_t size);
+
+    /// Merge the page table that covers the given guest physical address at
+    /// the given page size back into a single large page. Merging succeeds
+    /// if all 512 entries of the table are leaves that map contiguous,
+    /// suitably aligned host memory with identical attributes (the accessed
+    /// and dirty flags are ignored and combined). When merging into a 1GB
+    /// page, the 2MB regions of the table are merged first.
+    ///
+    /// @expects size is 1GB or 2MB
+    /// @ensures flush_pending() if a table was merged
+    ///
+    /// @return Returns true if gpa is mapped by a page of the given size
+    ///     (or larger) on return, false otherwise
+    ///
+    /// @param gpa the guest physical address to merge at
+    /// @param size the page size to merge into
+    ///
+    bool merge(gpa_t gpa, uint64_t size);
+
     /// Guest physical address to leaf extended page table entry
     ///
     /// @expects
@@ -145,14 +182,126 @@ public:
     ///
     hpa_t hpa() const;
 
+    /// Set the access rights (bits 2:0) of the leaf extended page table
+    /// entry that maps the given guest physical address. The change is not
+    /// guaranteed to be visible to the guest until flush() is called, which
+    /// allows any number of changes to share a single INVEPT.
+    ///
+    /// @expects
+    /// @ensures flush_pending()
+    ///
+    /// @param gpa the guest physical address to change the rights of
+    /// @param rights the new access rights (see epte::access_rights)
+    ///
+    void set_access_rights(gpa_t gpa, epte_value_t rights);
+
+    /// Mark this memory map as modified. Call this after changing extended
+    /// page table entries directly (e.g. through gpa_to_epte) so that the
+    /// next flush() invalidates the stale translations.
+    ///
+    /// @expects
+    /// @ensures flush_pending()
+    ///
+    void mark_flush_pending() noexcept;
+
+    /// @expects
+    /// @ensures
+    ///
+    /// @return Returns true if this memory map has been modified since the
+    ///     last flush
+    ///
+    bool flush_pending() const noexcept;
+
+    /// Invalidate the cached translations derived from this memory map on
+    /// the current CPU using a single-context INVEPT, if the memory map has
+    /// been modified since the last flush. Other CPUs that use this memory
+    /// map must flush as well.
+    ///
+    /// @expects
+    /// @ensures !flush_pending()
+    ///
+    void flush();
+
+    /// Enable the EPT accessed and dirty flags for this memory map. Once
+    /// enabled, eptp() returns an EPTP with the A/D enable bit set, and the
+    /// CPU sets the accessed and dirty flags of the leaf entries the guest
+    /// touches. The EPTP must be reloaded into the VMCS for this to take
+    /// effect.
+    ///
+    /// @expects the CPU supports EPT accessed and dirty flags
+    /// @ensures accessed_dirty_flags_enabled()
+    ///
+    void enable_accessed_dirty_flags();
+
+    /// @expects
+    /// @ensures
+    ///
+    /// @return Returns true if the EPT accessed and dirty flags are enabled
+    ///     for this memory map
+    ///
+    bool accessed_dirty_flags_enabled() const noexcept;
+
+    /// Harvest the dirty flags of the guest physical range
+    /// [gpa, gpa + size). Bit n of the bitmap is set if the 4KB page at
+    /// gpa + (n * 4KB) has been written since the last harvest (a dirty
+    /// large page sets the bits of every 4KB page it covers). The dirty
+    /// flags are cleared atomically as they are harvested, only present
+    /// tables are walked, and a single INVEPT is issued if any flag was
+    /// cleared. The flag of a large page that the range only partly covers
+    /// is reported but not cleared, so that the pages outside of the range
+    /// are not lost; harvest whole large pages (or split them) to avoid
+    /// reporting them again.
+    ///
+    /// @expects gpa and size are 4KB aligned
+    /// @expects bitmap has at least one bit per 4KB page in the range
+    /// @ensures
+    ///
+    /// @param gpa the first guest physical address to harvest
+    /// @param size the number of bytes to harvest
+    /// @param bitmap the bitmap to fill in (it is cleared first)
+    /// @return Returns the number of bits set in the bitmap
+    ///
+    uint64_t harvest_dirty(
+        gpa_t gpa, uint64_t size, gsl::span<uint64_t> bitmap);
+
+    /// Harvest the accessed flags of the guest physical range
+    /// [gpa, gpa + size). Behaves like harvest_dirty(), but reports (and
+    /// clears) the accessed flags instead, which are set on reads, writes
+    /// and instruction fetches.
+    ///
+    /// @expects gpa and size are 4KB aligned
+    /// @expects bitmap has at least one bit per 4KB page in the range
+    /// @ensures
+    ///
+    /// @param gpa the first guest physical address to harvest
+    /// @param size the number of bytes to harvest
+    /// @param bitmap the bitmap to fill in (it is cleared first)
+    /// @return Returns the number of bits set in the bitmap
+    ///
+    uint64_t harvest_accessed(
+        gpa_t gpa, uint64_t size, gsl::span<uint64_t> bitmap);
+
 #ifndef ENABLE_BUILD_TEST
 private:
 #endif
 
     /// @cond
 
+    page_table_pool m_pool;
+
     hva_t m_pml4_hva{0};
     hpa_t m_pml4_hpa{0};
+    bool m_flush_pending{false};
+    bool m_accessed_dirty_enabled{false};
+
+    struct harvest_t {
+        gpa_t start;
+        gpa_t end;
+        epte_value_t flag;
+        gsl::span<uint64_t> bitmap;
+        uint64_t count;
+        bool cleared;
+    };
 
     hpa_t allocate_page_table();
     void allocate_page_table(epte_t &entry);
@@ -168,6 +317,13 @@ private:
     epte_t &map_pde_to_page(gpa_t gpa, hpa_t hpa);
     epte_t &map_pte_to_page(gpa_t gpa, hpa_t hpa);
 
+    uint64_t harvest(
+        gpa_t gpa, uint64_t size, gsl::span<uint64_t> bitmap, epte_value_t flag);
+    void harvest_table(epte_t *table, gpa_t table_gpa, uint64_t page_size, harvest_t &h);
+
+    void split_entry(epte_t &entry, uint64_t child_size);
+    bool merge_entry(epte_t &entry, uint64_t child_size);
+
     void to_mdl(std::vector<memory_descriptor> &mdl, epte_t * page_table) const;
 
     /// @endcond
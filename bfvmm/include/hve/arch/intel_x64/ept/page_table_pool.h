@@ -0,0 +1,198 @@
+//
+// Bareflank Extended APIs
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef PAGE_TABLE_POOL_EPT_INTEL_X64_H
+#define PAGE_TABLE_POOL_EPT_INTEL_X64_H
+
+#include <memory>
+#include <vector>
+
+#include "intrinsics.h"
+#include "types.h"
+
+// -----------------------------------------------------------------------------
+// Exports
+// -----------------------------------------------------------------------------
+
+#include <bfexports.h>
+
+#ifndef STATIC_EAPIS_HVE
+#ifdef SHARED_EAPIS_HVE
+#define EXPORT_EAPIS_HVE EXPORT_SYM
+#else
+#define EXPORT_EAPIS_HVE IMPORT_SYM
+#endif
+#else
+#define EXPORT_EAPIS_HVE
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4251)
+#endif
+
+// *INDENT-OFF*
+
+namespace eapis
+{
+namespace intel_x64
+{
+namespace ept
+{
+
+/// EPT Page Table Pool
+///
+/// Hands out zeroed, page-sized extended page tables from slabs that are
+/// reserved up front. The host physical address of every page is resolved
+/// once when its slab is reserved, so allocating, freeing and walking page
+/// tables never goes through the VMM heap or the memory manager.
+///
+class EXPORT_EAPIS_HVE page_table_pool
+{
+public:
+
+    /// Default number of page tables reserved per slab
+    ///
+    static constexpr const std::size_t default_pages_per_slab = 32;
+
+    /// Constructor
+    ///
+    /// @expects pages_per_slab != 0
+    /// @ensures
+    ///
+    /// @param pages_per_slab the number of page tables to reserve each time
+    ///     the pool runs out of free page tables
+    ///
+    page_table_pool(std::size_t pages_per_slab = default_pages_per_slab);
+
+    /// Destructor
+    ///
+    /// Releases every slab. Page tables handed out by this pool are no
+    /// longer valid once the pool is destroyed.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    ~page_table_pool() = default;
+
+    /// Allocate
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return Returns the host physical address of a zeroed page table
+    ///
+    hpa_t allocate();
+
+    /// Free
+    ///
+    /// Zeroes the page table and returns it to the pool
+    ///
+    /// @expects hpa was returned by allocate()
+    /// @ensures
+    ///
+    /// @param hpa the host physical address of the page table to free
+    ///
+    void free(hpa_t hpa);
+
+    /// Reserve
+    ///
+    /// Reserves slabs until at least count page tables are free, so that
+    /// the next count allocations do not need to reserve memory.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param count the number of page tables that must be free
+    ///
+    void reserve(std::size_t count);
+
+    /// Host Physical Address to Host Virtual Address
+    ///
+    /// @expects hpa is owned by this pool
+    /// @ensures
+    ///
+    /// @param hpa the host physical address to convert
+    /// @return Returns the host virtual address of hpa
+    ///
+    epte_t *hpa_to_hva(hpa_t hpa) const;
+
+    /// @expects
+    /// @ensures
+    ///
+    /// @return Returns the number of page tables owned by this pool
+    ///
+    std::size_t size() const noexcept;
+
+    /// @expects
+    /// @ensures
+    ///
+    /// @return Returns the number of page tables that are free
+    ///
+    std::size_t free_count() const noexcept;
+
+#ifndef ENABLE_BUILD_TEST
+private:
+#endif
+
+    /// @cond
+
+    struct page_t {
+        epte_t *hva;
+        hpa_t hpa;
+    };
+
+    struct range_t {
+        hpa_t hpa;
+        epte_t *hva;
+        std::size_t num_pages;
+    };
+
+    void add_slab();
+    void add_range(const range_t &range);
+
+    std::size_t m_pages_per_slab;
+    std::vector<std::unique_ptr<uint8_t[]>> m_slabs;
+
+    std::vector<page_t> m_free;
+    std::vector<range_t> m_ranges;
+
+    /// @endcond
+
+public:
+
+    /// @cond
+
+    page_table_pool(page_table_pool &&) = default;
+    page_table_pool &operator=(page_table_pool &&) = default;
+
+    page_table_pool(const page_table_pool &) = delete;
+    page_table_pool &operator=(const page_table_pool &) = delete;
+
+    /// @endcond
+};
+
+}
+}
+}
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#endif
@@ -20,6 +20,9 @@
 #define EPT_MISCONFIGURATION_INTEL_X64_H
 
 #include "base.h"
+#include "exit_context.h"
+#include "exit_profile.h"
+#include "trace_ring.h"
 
 // -----------------------------------------------------------------------------
 // Definitions
@@ -125,17 +128,10 @@ private:
 
 private:
 
-    gsl::not_null<exit_handler_t *> m_exit_handler;
-    std::list<handler_delegate_t> m_handlers;
-
-private:
-
-    struct record_t {
-        uint64_t gva;
-        uint64_t gpa;
-    };
-
-    std::list<record_t> m_log;
+    gsl::not_null<exit_profile *> m_exit_profile;
+    gsl::not_null<trace_ring *> m_trace_ring;
+    gsl::not_null<exit_context *> m_exit_context;
+    handler_chain<handler_delegate_t> m_handlers;
 
 public:
 
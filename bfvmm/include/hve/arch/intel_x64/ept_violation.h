@@ -20,6 +20,9 @@
 #define EPT_VIOLATION_INTEL_X64_H
 
 #include "base.h"
+#include "exit_context.h"
+#include "exit_profile.h"
+#include "trace_ring.h"
 
 // -----------------------------------------------------------------------------
 // Definitions
@@ -157,21 +160,13 @@ private:
 
 private:
 
-    gsl::not_null<exit_handler_t *> m_exit_handler;
+    gsl::not_null<exit_profile *> m_exit_profile;
+    gsl::not_null<trace_ring *> m_trace_ring;
+    gsl::not_null<exit_context *> m_exit_context;
 
-    std::list<handler_delegate_t> m_read_handlers;
-    std::list<handler_delegate_t> m_write_handlers;
-    std::list<handler_delegate_t> m_execute_handlers;
-
-private:
-
-    struct record_t {
-        uint64_t gva;
-        uint64_t gpa;
-        uint64_t exit_qualification;
-    };
-
-    std::list<record_t> m_log;
+    handler_chain<handler_delegate_t> m_read_handlers;
+    handler_chain<handler_delegate_t> m_write_handlers;
+    handler_chain<handler_delegate_t> m_execute_handlers;
 
 public:
 
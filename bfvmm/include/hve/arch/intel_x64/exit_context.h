@@ -0,0 +1,261 @@
+//
+// Bareflank Extended APIs
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef EXIT_CONTEXT_INTEL_X64_EAPIS_H
+#define EXIT_CONTEXT_INTEL_X64_EAPIS_H
+
+#include <array>
+
+#include "base.h"
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+/// Exit Context
+///
+/// Caches the VM-exit information fields of the exit being handled. Each
+/// field is read from the VMCS the first time it is needed and served from
+/// the cache for the rest of the exit, so the exit qualification (and the
+/// fields that go with it) is read at most once per exit no matter how many
+/// handlers and delegates decode it. There is one exit context per vCPU
+/// (see hve::exit_context).
+///
+/// Only the read-only VM-exit information fields are cached. Nothing writes
+/// them while an exit is handled, so the cache cannot go stale. Guest-state
+/// fields (e.g. guest_cr3) can be written by handlers and are still read
+/// directly.
+///
+/// The context is invalidated (see begin()) at the start of every exit that
+/// is handled by a handler registered through hve::add_exit_handler, before
+/// that handler or any of its delegates run, so every handler of the exit
+/// sees the fields of the current exit.
+///
+class EXPORT_EAPIS_HVE exit_context : public base
+{
+public:
+
+    /// Stats
+    ///
+    struct stats_t {
+
+        /// Exits
+        ///
+        /// The number of times begin() was called
+        ///
+        uint64_t exits;
+
+        /// VMREADs
+        ///
+        /// The number of fields read from the VMCS
+        ///
+        uint64_t vmreads;
+
+        /// Hits
+        ///
+        /// The number of field reads served from the cache, i.e. the
+        /// VMREADs the cache saved
+        ///
+        uint64_t hits;
+    };
+
+    /// Default Constructor
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    exit_context() = default;
+
+    /// Destructor
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    ~exit_context() final;
+
+public:
+
+    /// Begin
+    ///
+    /// Invalidates every cached field. Called by hve once at the start of
+    /// each exit (see hve::add_exit_handler).
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    void begin() noexcept
+    {
+        m_valid = 0U;
+        m_stats.exits++;
+    }
+
+    /// Exit Qualification
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return the exit qualification of the current exit
+    ///
+    vmcs_n::value_type exit_qualification()
+    {
+        return this->read(field_t::exit_qualification, [] {
+            return vmcs_n::exit_qualification::get();
+        });
+    }
+
+    /// Guest Linear Address
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return the guest linear address of the current exit
+    ///
+    vmcs_n::value_type guest_linear_address()
+    {
+        return this->read(field_t::guest_linear_address, [] {
+            return vmcs_n::guest_linear_address::get();
+        });
+    }
+
+    /// Guest Physical Address
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return the guest physical address of the current exit
+    ///
+    vmcs_n::value_type guest_physical_address()
+    {
+        return this->read(field_t::guest_physical_address, [] {
+            return vmcs_n::guest_physical_address::get();
+        });
+    }
+
+    /// VM-Exit Interruption Information
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return the VM-exit interruption information of the current exit
+    ///
+    vmcs_n::value_type vm_exit_interruption_information()
+    {
+        return this->read(field_t::vm_exit_interruption_information, [] {
+            return vmcs_n::vm_exit_interruption_information::get();
+        });
+    }
+
+    /// VM-Exit Instruction Information
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return the VM-exit instruction information of the current exit
+    ///
+    vmcs_n::value_type vm_exit_instruction_information()
+    {
+        return this->read(field_t::vm_exit_instruction_information, [] {
+            return vmcs_n::vm_exit_instruction_information::get();
+        });
+    }
+
+    /// Stats
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return the VMREAD counters of this exit context
+    ///
+    const stats_t &stats() const noexcept
+    { return m_stats; }
+
+    /// Reset Stats
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    void reset_stats() noexcept
+    { m_stats = {}; }
+
+    /// Dump Log
+    ///
+    /// Prints the VMREAD counters
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    void dump_log() final;
+
+private:
+
+    enum class field_t : uint64_t {
+        exit_qualification = 0,
+        guest_linear_address = 1,
+        guest_physical_address = 2,
+        vm_exit_interruption_information = 3,
+        vm_exit_instruction_information = 4
+    };
+
+    static constexpr const std::size_t field_count = 5;
+
+    template<typename F>
+    vmcs_n::value_type read(field_t field, F f)
+    {
+        const auto index = static_cast<uint64_t>(field);
+        const auto bit = 1ULL << index;
+
+        if (GSL_LIKELY((m_valid & bit) != 0U)) {
+            m_stats.hits++;
+            return m_values[index];
+        }
+
+        m_stats.vmreads++;
+
+        m_values[index] = f();
+        m_valid |= bit;
+
+        return m_values[index];
+    }
+
+    uint64_t m_valid{0};
+    std::array<vmcs_n::value_type, field_count> m_values{};
+
+    stats_t m_stats{};
+
+public:
+
+    /// @cond
+
+    exit_context(exit_context &&) = default;
+    exit_context &operator=(exit_context &&) = default;
+
+    exit_context(const exit_context &) = delete;
+    exit_context &operator=(const exit_context &) = delete;
+
+    /// @endcond
+};
+
+}
+}
+
+#endif
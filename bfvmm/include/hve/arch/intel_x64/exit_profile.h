@@ -0,0 +1,317 @@
+//
+// Bareflank Extended APIs
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef EXIT_PROFILE_INTEL_X64_EAPIS_H
+#define EXIT_PROFILE_INTEL_X64_EAPIS_H
+
+#include <array>
+#include <unordered_map>
+
+#include <intrinsics.h>
+
+#include "base.h"
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+/// Exit Profile
+///
+/// Records how many TSC cycles each VM exit spends in its exit handler, as
+/// a log2 histogram per basic exit reason and, for the exits that have one,
+/// per key (the MSR of rdmsr/wrmsr, the port of io_instruction and the leaf
+/// of cpuid). There is one exit profile per vCPU (see hve::exit_profile),
+/// so recording does not need any synchronization.
+///
+/// Unlike the handler logs, the profile does not depend on the build type.
+/// It is disabled by default; while it is disabled a probe costs a branch.
+///
+class EXPORT_EAPIS_HVE exit_profile : public base
+{
+public:
+
+    /// Key type
+    ///
+    ///
+    using key_t = uint64_t;
+
+    /// Bucket count
+    ///
+    /// Bucket i counts the exits that took [2^i, 2^(i+1)) cycles (bucket 0
+    /// also counts exits that took 0 cycles)
+    ///
+    static constexpr const std::size_t bucket_count = 64;
+
+    /// Reason count
+    ///
+    /// The number of basic exit reasons that are profiled
+    ///
+    static constexpr const std::size_t reason_count = 65;
+
+    /// Histogram
+    ///
+    struct histogram_t {
+
+        /// Buckets
+        ///
+        /// The number of exits per log2 cycle bucket
+        ///
+        std::array<uint64_t, bucket_count> buckets;
+
+        /// Count
+        ///
+        /// The number of exits recorded
+        ///
+        uint64_t count;
+
+        /// Total
+        ///
+        /// The sum of the cycles of all exits recorded
+        ///
+        uint64_t total;
+
+        /// Max
+        ///
+        /// The cycles of the slowest exit recorded
+        ///
+        uint64_t max;
+
+        /// Add
+        ///
+        /// @expects
+        /// @ensures
+        ///
+        /// @param cycles the cycles the exit took
+        ///
+        void add(uint64_t cycles) noexcept
+        {
+            buckets[cycles != 0U ? bit_scan_reverse(cycles) : 0U]++;
+
+            count++;
+            total += cycles;
+
+            if (cycles > max) {
+                max = cycles;
+            }
+        }
+    };
+
+    /// Probe
+    ///
+    /// Reads the TSC when it is created and records the cycles elapsed
+    /// since then when it goes out of scope. A probe created while the
+    /// profile is disabled does nothing.
+    ///
+    class probe_t
+    {
+    public:
+
+        /// @cond
+
+        probe_t(histogram_t *reason, histogram_t *key) noexcept :
+            m_reason{reason},
+            m_key{key},
+            m_start{reason != nullptr ? ::x64::read_tsc::get() : 0U}
+        { }
+
+        ~probe_t()
+        {
+            if (m_reason == nullptr) {
+                return;
+            }
+
+            const auto cycles = ::x64::read_tsc::get() - m_start;
+
+            m_reason->add(cycles);
+
+            if (m_key != nullptr) {
+                m_key->add(cycles);
+            }
+        }
+
+        probe_t(probe_t &&) = delete;
+        probe_t &operator=(probe_t &&) = delete;
+
+        probe_t(const probe_t &) = delete;
+        probe_t &operator=(const probe_t &) = delete;
+
+        /// @endcond
+
+    private:
+
+        histogram_t *m_reason;
+        histogram_t *m_key;
+        uint64_t m_start;
+    };
+
+    /// Default Constructor
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    exit_profile() = default;
+
+    /// Destructor
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    ~exit_profile() final;
+
+public:
+
+    /// Enable
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    void enable() noexcept
+    { m_enabled = true; }
+
+    /// Disable
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    void disable() noexcept
+    { m_enabled = false; }
+
+    /// Enabled
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true iff the profile is recording
+    ///
+    bool enabled() const noexcept
+    { return m_enabled; }
+
+    /// Reset
+    ///
+    /// Clears every histogram
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    void reset();
+
+    /// Probe (Reason)
+    ///
+    /// Example:
+    /// @code
+    /// auto probe = m_exit_profile->probe(exit_reason::basic_exit_reason::cpuid);
+    /// @endcode
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param reason the basic exit reason of the exit being handled
+    /// @return a probe that records the exit in the histogram of reason
+    ///
+    probe_t probe(uint64_t reason)
+    {
+        if (GSL_LIKELY(!m_enabled) || reason >= reason_count) {
+            return {nullptr, nullptr};
+        }
+
+        return {&m_reasons[reason], nullptr};
+    }
+
+    /// Probe (Reason and Key)
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param reason the basic exit reason of the exit being handled
+    /// @param key the MSR, port or leaf of the exit being handled
+    /// @return a probe that records the exit in the histogram of reason
+    ///     and in the histogram of (reason, key)
+    ///
+    probe_t probe(uint64_t reason, key_t key)
+    {
+        if (GSL_LIKELY(!m_enabled) || reason >= reason_count) {
+            return {nullptr, nullptr};
+        }
+
+        return {&m_reasons[reason], &m_keys[make_key(reason, key)]};
+    }
+
+    /// Reason Histogram
+    ///
+    /// @expects reason < reason_count
+    /// @ensures
+    ///
+    /// @param reason the basic exit reason
+    /// @return the histogram of reason
+    ///
+    const histogram_t &reason_histogram(uint64_t reason) const;
+
+    /// Key Histogram
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param reason the basic exit reason
+    /// @param key the MSR, port or leaf
+    /// @return the histogram of (reason, key), or nullptr if no exit has
+    ///     been recorded for it
+    ///
+    const histogram_t *key_histogram(uint64_t reason, key_t key) const;
+
+    /// Dump Log
+    ///
+    /// Prints the histograms of every reason and key with at least one
+    /// recorded exit
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    void dump_log() final;
+
+private:
+
+    static uint64_t make_key(uint64_t reason, key_t key) noexcept
+    { return (reason << 32U) | (key & 0xFFFFFFFFULL); }
+
+    bool m_enabled{false};
+
+    std::array<histogram_t, reason_count> m_reasons{};
+    std::unordered_map<uint64_t, histogram_t> m_keys;
+
+public:
+
+    /// @cond
+
+    exit_profile(exit_profile &&) = default;
+    exit_profile &operator=(exit_profile &&) = default;
+
+    exit_profile(const exit_profile &) = delete;
+    exit_profile &operator=(const exit_profile &) = delete;
+
+    /// @endcond
+};
+
+}
+}
+
+#endif
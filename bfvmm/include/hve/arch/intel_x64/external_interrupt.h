@@ -20,6 +20,9 @@
 #define EXTERNAL_INTERRUPT_INTEL_X64_EAPIS_H
 
 #include "base.h"
+#include "exit_context.h"
+#include "exit_profile.h"
+#include "trace_ring.h"
 
 // -----------------------------------------------------------------------------
 // Definitions
@@ -141,9 +144,13 @@ public:
 
 private:
 
-    std::array<std::list<handler_delegate_t>, 256> m_handlers;
+    std::array<handler_chain<handler_delegate_t>, 256> m_handlers;
     std::array<uint64_t, 256> m_log;
 
+    exit_profile *m_exit_profile;
+    trace_ring *m_trace_ring;
+    exit_context *m_exit_context;
+
 public:
 
     /// @cond
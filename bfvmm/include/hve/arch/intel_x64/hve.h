@@ -23,12 +23,15 @@
 
 #include "control_register.h"
 #include "cpuid.h"
+#include "exit_context.h"
+#include "exit_profile.h"
 #include "external_interrupt.h"
 #include "interrupt_window.h"
 #include "io_instruction.h"
 #include "monitor_trap.h"
 #include "mov_dr.h"
 #include "rdmsr.h"
+#include "trace_ring.h"
 #include "vpid.h"
 #include "wrmsr.h"
 #include "ept.h"
@@ -89,6 +92,93 @@ public:
     ///
     gsl::not_null<vmcs_t *> vmcs();
 
+    /// Add Exit Handler
+    ///
+    /// Registers a handler for the given basic exit reason with the exit
+    /// handler, together with a delegate that invalidates the exit context
+    /// in front of it. The exit handler calls delegates in the reverse
+    /// order they are registered, so the exit context is invalidated once
+    /// at the start of every exit of this reason, before the handler (or
+    /// any of its delegates) reads it. Every exit reason should only be
+    /// registered once this way.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param reason the basic exit reason to handle
+    /// @param d the handler to call on exits of this reason
+    ///
+    void add_exit_handler(vmcs_n::value_type reason, ::handler_delegate_t &&d);
+
+    //--------------------------------------------------------------------------
+    // Exit Profile
+    //--------------------------------------------------------------------------
+
+    /// Get Exit Profile Object
+    ///
+    /// The exit profile always exists, but only records exits once it has
+    /// been enabled.
+    ///
+    /// Example:
+    /// @code
+    /// hve->exit_profile()->enable();
+    /// ...
+    /// auto &hist = hve->exit_profile()->reason_histogram(
+    ///     vmcs_n::exit_reason::basic_exit_reason::cpuid);
+    /// @endcode
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return Returns the exit profile of this vCPU
+    ///
+    gsl::not_null<eapis::intel_x64::exit_profile *> exit_profile();
+
+    //--------------------------------------------------------------------------
+    // Trace Ring
+    //--------------------------------------------------------------------------
+
+    /// Get Trace Ring Object
+    ///
+    /// The trace ring always exists. Handlers record into it once their
+    /// log has been enabled (see base::enable_log).
+    ///
+    /// Example:
+    /// @code
+    /// hve->rdmsr()->enable_log();
+    /// ...
+    /// auto region = hve->trace_ring()->region();
+    /// @endcode
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return Returns the trace ring of this vCPU
+    ///
+    gsl::not_null<eapis::intel_x64::trace_ring *> trace_ring();
+
+    //--------------------------------------------------------------------------
+    // Exit Context
+    //--------------------------------------------------------------------------
+
+    /// Get Exit Context Object
+    ///
+    /// The exit context always exists. Delegates can use it to read the
+    /// exit qualification (and related fields) of the exit being handled
+    /// without another VMREAD.
+    ///
+    /// Example:
+    /// @code
+    /// auto qual = hve->exit_context()->exit_qualification();
+    /// @endcode
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return Returns the exit context of this vCPU
+    ///
+    gsl::not_null<eapis::intel_x64::exit_context *> exit_context();
+
     //--------------------------------------------------------------------------
     // Control Register
     //--------------------------------------------------------------------------
@@ -179,6 +269,17 @@ public:
     ///
     void add_wrcr8_handler(control_register::handler_delegate_t &&d);
 
+    /// Disable CR8 Exiting
+    ///
+    /// Stop mov-to/from-cr8 from exiting, e.g. once CR8 is virtualized by
+    /// the TPR shadow. Registered CR8 handlers are kept, and exiting is
+    /// enabled again if another CR8 handler is added.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    void disable_cr8_exiting();
+
     //--------------------------------------------------------------------------
     // CPUID
     //--------------------------------------------------------------------------
@@ -206,6 +307,60 @@ public:
     void add_cpuid_handler(
         cpuid::leaf_t leaf, cpuid::subleaf_t subleaf, cpuid::handler_delegate_t &&d);
 
+    /// Add CPUID Handler (Any Subleaf)
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param leaf the leaf to call d on
+    /// @param d the delegate to call when the guest executes CPUID at the given
+    ///        leaf, regardless of the subleaf
+    ///
+    void add_cpuid_handler(
+        cpuid::leaf_t leaf, cpuid::handler_delegate_t &&d);
+
+    /// Force CPUID Set Bits
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param leaf the leaf to apply the policy to
+    /// @param subleaf the subleaf to apply the policy to
+    /// @param reg the register to apply the policy to
+    /// @param bits the bits that are always reported as 1
+    ///
+    void force_cpuid_set_bits(
+        cpuid::leaf_t leaf, cpuid::subleaf_t subleaf, cpuid::reg_t reg, uint64_t bits);
+
+    /// Force CPUID Clear Bits
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param leaf the leaf to apply the policy to
+    /// @param subleaf the subleaf to apply the policy to
+    /// @param reg the register to apply the policy to
+    /// @param bits the bits that are always reported as 0
+    ///
+    void force_cpuid_clear_bits(
+        cpuid::leaf_t leaf, cpuid::subleaf_t subleaf, cpuid::reg_t reg, uint64_t bits);
+
+    /// Force CPUID Value
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param leaf the leaf to apply the policy to
+    /// @param subleaf the subleaf to apply the policy to
+    /// @param rax the value of rax reported to the guest
+    /// @param rbx the value of rbx reported to the guest
+    /// @param rcx the value of rcx reported to the guest
+    /// @param rdx the value of rdx reported to the guest
+    ///
+    void force_cpuid_value(
+        cpuid::leaf_t leaf, cpuid::subleaf_t subleaf,
+        uint64_t rax, uint64_t rbx, uint64_t rcx, uint64_t rdx);
+
     //--------------------------------------------------------------------------
     // External Interrupt
     //--------------------------------------------------------------------------
@@ -283,6 +438,22 @@ public:
         io_instruction::handler_delegate_t &&in_d,
         io_instruction::handler_delegate_t &&out_d);
 
+    /// Add IO Instruction String Handler
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param port the port to call
+    /// @param in_d the delegate to call when the guest executes ins on the
+    ///        given port
+    /// @param out_d the delegate to call when the guest executes outs on the
+    ///        given port
+    ///
+    void add_io_instruction_string_handler(
+        vmcs_n::value_type port,
+        io_instruction::string_handler_delegate_t &&in_d,
+        io_instruction::string_handler_delegate_t &&out_d);
+
     //--------------------------------------------------------------------------
     // Monitor Trap
     //--------------------------------------------------------------------------
@@ -510,11 +681,14 @@ public:
 
 private:
 
+    bool handle_exit_begin(gsl::not_null<vmcs_t *> vmcs);
+
     void check_crall();
     void check_rdcr3();
     void check_wrcr3();
     void check_rdcr8();
     void check_wrcr8();
+    void check_cpuid();
     void check_io_bitmaps();
     void check_monitor_trap();
     void check_msr_bitmap();
@@ -531,6 +705,10 @@ private:
     std::unique_ptr<uint8_t[]> m_msr_bitmap;
     std::unique_ptr<uint8_t[]> m_io_bitmaps;
 
+    std::unique_ptr<eapis::intel_x64::exit_profile> m_exit_profile;
+    std::unique_ptr<eapis::intel_x64::trace_ring> m_trace_ring;
+    std::unique_ptr<eapis::intel_x64::exit_context> m_exit_context;
+
     std::unique_ptr<eapis::intel_x64::control_register> m_control_register;
     std::unique_ptr<eapis::intel_x64::cpuid> m_cpuid;
     std::unique_ptr<eapis::intel_x64::external_interrupt> m_external_interrupt;
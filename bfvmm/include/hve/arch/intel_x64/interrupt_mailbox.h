@@ -0,0 +1,148 @@
+//
+// Bareflank Hypervisor
+// Copyright (C) 2017 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef INTERRUPT_MAILBOX_INTEL_X64_EAPIS_H
+#define INTERRUPT_MAILBOX_INTEL_X64_EAPIS_H
+
+#include <array>
+#include <atomic>
+
+#include <bfgsl.h>
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+/// Interrupt Mailbox
+///
+/// A lock-free, multi-producer single-consumer set of pending interrupt
+/// vectors. Any core may post a vector; only the owning vCPU takes them.
+/// Like an IRR, a vector posted several times before it is taken is
+/// delivered once.
+///
+/// The pending flag tells producers whether the consumer has already been
+/// notified: post() returns true only for the post that found the mailbox
+/// empty, so at most one notification is outstanding no matter how many
+/// producers race. The consumer clears the flag before it takes the
+/// vectors, so a vector posted concurrently with take() is either taken or
+/// causes a new notification (all accesses are sequentially consistent,
+/// which this argument relies on).
+///
+class interrupt_mailbox
+{
+public:
+
+    /// Vector words
+    ///
+    /// The vectors taken from the mailbox, one bit per vector
+    ///
+    using vectors_t = std::array<uint64_t, 4>;
+
+    /// Default Constructor
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    interrupt_mailbox() = default;
+
+    /// Destructor
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    ~interrupt_mailbox() = default;
+
+    /// Post
+    ///
+    /// May be called from any core
+    ///
+    /// @expects vector < 256
+    /// @ensures
+    ///
+    /// @param vector the vector to post
+    /// @return true if the mailbox was empty, in which case the caller
+    ///     must notify the consumer
+    ///
+    bool post(uint64_t vector) noexcept
+    {
+        m_vectors[(vector >> 6U) & 0x3U].fetch_or(1ULL << (vector & 0x3FU));
+        return !m_pending.exchange(true);
+    }
+
+    /// Take
+    ///
+    /// Must only be called by the consumer
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param vectors the vectors posted since the last take (out)
+    /// @return true if at least one vector was taken
+    ///
+    bool take(vectors_t &vectors) noexcept
+    {
+        auto any = 0ULL;
+
+        m_pending.store(false);
+
+        for (auto i = 0U; i < vectors.size(); ++i) {
+            vectors[i] = m_vectors[i].exchange(0U);
+            any |= vectors[i];
+        }
+
+        return any != 0U;
+    }
+
+    /// Pending
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true if the consumer has been notified and has not taken
+    ///     the vectors yet
+    ///
+    bool pending() const noexcept
+    { return m_pending.load(); }
+
+private:
+
+    std::array<std::atomic<uint64_t>, 4> m_vectors{};
+    std::atomic<bool> m_pending{false};
+
+public:
+
+    /// @cond
+
+    interrupt_mailbox(interrupt_mailbox &&) = delete;
+    interrupt_mailbox &operator=(interrupt_mailbox &&) = delete;
+
+    interrupt_mailbox(const interrupt_mailbox &) = delete;
+    interrupt_mailbox &operator=(const interrupt_mailbox &) = delete;
+
+    /// @endcond
+};
+
+}
+}
+
+#endif
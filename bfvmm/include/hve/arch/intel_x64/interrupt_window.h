@@ -20,6 +20,7 @@
 #define INTERRUPT_WINDOW_INTEL_X64_EAPIS_H
 
 #include "base.h"
+#include "exit_profile.h"
 
 // -----------------------------------------------------------------------------
 // Definitions
@@ -133,7 +134,8 @@ private:
 
     /// @cond
 
-    std::list<handler_delegate_t> m_handlers;
+    handler_chain<handler_delegate_t> m_handlers;
+    exit_profile *m_exit_profile;
 
     /// @endcond
 
@@ -20,6 +20,9 @@
 #define IO_INSTRUCTION_INTEL_X64_EAPIS_H
 
 #include "base.h"
+#include "exit_context.h"
+#include "exit_profile.h"
+#include "trace_ring.h"
 
 // -----------------------------------------------------------------------------
 // Definitions
@@ -118,6 +121,80 @@ public:
     using handler_delegate_t =
         delegate<bool(gsl::not_null<vmcs_t *>, info_t &)>;
 
+    ///
+    /// String Info
+    ///
+    /// This struct is created by io_instruction::handle for string
+    /// instructions (ins/outs) before being passed to each registered
+    /// string handler. The guest's buffer is mapped one page at a time, so
+    /// a string handler is called once for each page the buffer touches,
+    /// with all of the elements that start in that page.
+    ///
+    struct string_info_t {
+
+        /// Port number
+        ///
+        /// The port number accessed by the guest.
+        ///
+        uint64_t port_number;
+
+        /// Size of access
+        ///
+        /// The size of each element.
+        ///
+        /// default: vmcs_n::exit_qualification::io_instruction::size_of_access
+        ///
+        uint64_t size_of_access;
+
+        /// Address
+        ///
+        /// The guest linear address of buffer (i.e. the element with the
+        /// lowest address).
+        ///
+        uint64_t address;
+
+        /// Buffer
+        ///
+        /// The guest's memory for the elements of this call, lowest address
+        /// first. For 'in' accesses the handler must fill the buffer. For
+        /// 'out' accesses the buffer holds the guest's data.
+        ///
+        gsl::span<uint8_t> buffer;
+
+        /// Count
+        ///
+        /// The number of elements in buffer
+        ///
+        uint64_t count;
+
+        /// Reverse
+        ///
+        /// If true, the guest's direction flag is set, and the elements are
+        /// transferred from the highest address in buffer to the lowest.
+        ///
+        bool reverse;
+
+        /// Ignore write (out)
+        ///
+        /// For 'out' accesses, do not write the elements in buffer to the
+        /// port info.port_number if this field is true. Set this to true if
+        /// your handler returns true and has consumed the buffer. This field
+        /// is not used for 'in' accesses.
+        ///
+        /// default: false
+        ///
+        bool ignore_write;
+    };
+
+    /// String handler delegate type
+    ///
+    /// The type of delegate clients must use when registering string
+    /// handlers. A string handler returns false to opt out, in which case
+    /// each element is passed to the handlers registered with add_handler.
+    ///
+    using string_handler_delegate_t =
+        delegate<bool(gsl::not_null<vmcs_t *>, string_info_t &)>;
+
     /// Constructor
     ///
     /// @expects
@@ -151,6 +228,25 @@ public:
         handler_delegate_t &&out_d
     );
 
+    /// Add String Handler
+    ///
+    /// @note handlers registered with add_handler are still required for
+    ///     the port, as they are used for non-string accesses and when the
+    ///     string handlers opt out.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param port the port to listen to
+    /// @param in_d the handler to call when an ins exit occurs
+    /// @param out_d the handler to call when an outs exit occurs
+    ///
+    void add_string_handler(
+        vmcs_n::value_type port,
+        string_handler_delegate_t &&in_d,
+        string_handler_delegate_t &&out_d
+    );
+
     /// Trap On Access
     ///
     /// Sets a '1' in the MSR bitmap corresponding with the provided port. All
@@ -241,34 +337,55 @@ public:
 
     /// @endcond
 
+#ifndef ENABLE_BUILD_TEST
 private:
+#endif
 
-    bool handle_in(gsl::not_null<vmcs_t *> vmcs, info_t &info);
-    bool handle_out(gsl::not_null<vmcs_t *> vmcs, info_t &info);
+    /// @cond
 
-    void emulate_in(info_t &info);
-    void emulate_out(info_t &info);
+    struct string_chunk_t {
+        uint64_t lowest;
+        uint64_t num;
+    };
 
-    void load_operand(gsl::not_null<vmcs_t *> vmcs, info_t &info);
-    void store_operand(gsl::not_null<vmcs_t *> vmcs, info_t &info);
+    static string_chunk_t string_chunk(
+        uint64_t address, uint64_t remaining, uint64_t bytes, bool reverse) noexcept;
 
-    gsl::span<uint8_t> m_io_bitmaps;
-    gsl::not_null<exit_handler_t *> m_exit_handler;
+    static uint64_t string_address_mask(uint64_t insn_info) noexcept;
 
-    std::unordered_map<vmcs_n::value_type, std::list<handler_delegate_t>> m_in_handlers;
-    std::unordered_map<vmcs_n::value_type, std::list<handler_delegate_t>> m_out_handlers;
+    static uint64_t string_index(
+        uint64_t reg, uint64_t delta, bool reverse, uint64_t mask) noexcept;
+
+    /// @endcond
 
 private:
 
-    struct port_record_t {
-        uint64_t port_number;
-        uint64_t size_of_access;
-        uint64_t direction_of_access;
-        uint64_t address;
-        uint64_t val;
-    };
+    using handlers_t = handler_chain<handler_delegate_t>;
+    using string_handlers_t = handler_chain<string_handler_delegate_t>;
 
-    std::list<port_record_t> m_log;
+    bool handle_string(
+        gsl::not_null<vmcs_t *> vmcs, const handlers_t &hdlrs, bool in, info_t &info);
+
+    bool handle_in(
+        gsl::not_null<vmcs_t *> vmcs, const handlers_t &hdlrs, info_t &info);
+    bool handle_out(
+        gsl::not_null<vmcs_t *> vmcs, const handlers_t &hdlrs, info_t &info);
+
+    void emulate_in(info_t &info);
+    void emulate_out(info_t &info);
+
+    void load_operand(gsl::not_null<vmcs_t *> vmcs, info_t &info);
+    void store_operand(gsl::not_null<vmcs_t *> vmcs, info_t &info);
+
+    gsl::span<uint8_t> m_io_bitmaps;
+    gsl::not_null<exit_profile *> m_exit_profile;
+    gsl::not_null<trace_ring *> m_trace_ring;
+    gsl::not_null<exit_context *> m_exit_context;
+
+    std::unordered_map<vmcs_n::value_type, handlers_t> m_in_handlers;
+    std::unordered_map<vmcs_n::value_type, handlers_t> m_out_handlers;
+    std::unordered_map<vmcs_n::value_type, string_handlers_t> m_in_string_handlers;
+    std::unordered_map<vmcs_n::value_type, string_handlers_t> m_out_string_handlers;
 
 public:
 
@@ -0,0 +1,230 @@
+//
+// Bareflank Hypervisor
+// Copyright (C) 2017 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef MMIO_DECODER_INTEL_X64_EAPIS_H
+#define MMIO_DECODER_INTEL_X64_EAPIS_H
+
+#include <bfvmm/memory_manager/arch/x64/map_ptr.h>
+
+#include "base.h"
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+/// MMIO decoder
+///
+/// A minimal decoder for the instructions guests use to access 32-bit
+/// MMIO registers such as the xAPIC's:
+///
+///     mov r/m32, r32      (89 /r)
+///     mov r32, r/m32      (8B /r)
+///     mov r/m32, imm32    (C7 /0 id)
+///
+/// with optional segment-override and (in 64-bit mode) REX prefixes.
+/// Anything else is rejected.
+///
+/// Decoded instructions are kept in a small direct-mapped cache keyed by
+/// the guest's linear RIP and CR3. A guest accesses its APIC from a
+/// handful of sites, so after warm-up a trapped access costs neither a
+/// guest page walk nor a decode. Each entry keeps the VMM mapping of the
+/// instruction it was decoded from, and a hit compares the bytes behind
+/// that mapping with the decoded ones, so code that is patched in place
+/// is decoded again. Code that is remapped to another page without a CR3
+/// change is not detected.
+///
+/// Only the bytes up to the end of RIP's page are mapped, unless the
+/// instruction continues on the next page, so that an access right before
+/// a page that is not present does not fault in the VMM.
+///
+class EXPORT_EAPIS_HVE mmio_decoder
+{
+public:
+
+    /// Instruction
+    ///
+    struct insn_t {
+
+        /// Length
+        ///
+        /// The length of the instruction in bytes
+        ///
+        uint64_t len;
+
+        /// Register
+        ///
+        /// The index (ModRM order: rax, rcx, rdx, rbx, rsp, ...) of the
+        /// general-purpose register read from or written to
+        ///
+        uint64_t reg;
+
+        /// Immediate
+        ///
+        /// The value written, if imm_src is true
+        ///
+        uint64_t imm;
+
+        /// Write
+        ///
+        /// True if the instruction writes to memory
+        ///
+        bool write;
+
+        /// Immediate source
+        ///
+        /// True if the value written is imm instead of reg
+        ///
+        bool imm_src;
+    };
+
+    /// Longest x86 instruction, in bytes
+    ///
+    static constexpr const auto max_insn_len = 15U;
+
+    /// Number of cached instructions
+    ///
+    static constexpr const auto cache_size = 32U;
+
+    /// Instruction bytes
+    ///
+    using insn_bytes_t = std::array<uint8_t, max_insn_len>;
+
+    /// Default Constructor
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    mmio_decoder() = default;
+
+    /// Destructor
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    ~mmio_decoder() = default;
+
+    /// Decode
+    ///
+    /// Decode the instruction at the guest's RIP, from the cache if it has
+    /// been decoded before
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param vmcs the vmcs of the guest that is executing the instruction
+    /// @param write true if the instruction is known to write to memory
+    ///     (e.g. from the exit qualification)
+    /// @return the decoded instruction. An exception is thrown if the
+    ///     instruction is not one of the supported forms
+    ///
+    const insn_t &decode(gsl::not_null<vmcs_t *> vmcs, bool write);
+
+    /// Decode bytes
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param bytes the bytes of the instruction, possibly followed by
+    ///     unrelated bytes
+    /// @param long_mode true if the instruction is executed in 64-bit mode
+    /// @param insn the decoded instruction (out)
+    /// @return true if bytes holds one of the supported forms
+    ///
+    static bool decode(
+        gsl::span<const uint8_t> bytes, bool long_mode, insn_t &insn);
+
+    /// Map Guest
+    ///
+    /// Map the bytes at a guest linear address into the VMM
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param rip the guest linear address of the instruction
+    /// @param cr3 the guest cr3 the instruction executes under
+    /// @param len the number of bytes to map
+    /// @param map the mapping (out)
+    /// @return the mapped bytes, valid for as long as map is
+    ///
+    static const uint8_t *map_guest(
+        uint64_t rip, uint64_t cr3, uint64_t len,
+        bfvmm::x64::unique_map<uint8_t> &map);
+
+    /// Hits
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return the number of decodes serviced from the cache
+    ///
+    uint64_t hits() const noexcept
+    { return m_hits; }
+
+    /// Misses
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return the number of decodes that were not serviced from the cache
+    ///
+    uint64_t misses() const noexcept
+    { return m_misses; }
+
+#ifndef ENABLE_BUILD_TEST
+private:
+#endif
+
+    /// @cond
+
+    struct entry_t {
+        uint64_t rip;
+        uint64_t cr3;
+        insn_t insn;
+        insn_bytes_t bytes;
+        bfvmm::x64::unique_map<uint8_t> map;
+        const uint8_t *code;
+        bool valid;
+    };
+
+    static uint64_t cache_index(uint64_t rip) noexcept;
+
+    std::array<entry_t, cache_size> m_cache{};
+
+    uint64_t m_hits{0};
+    uint64_t m_misses{0};
+
+    /// @endcond
+
+public:
+
+    /// @cond
+
+    mmio_decoder(mmio_decoder &&) = default;
+    mmio_decoder &operator=(mmio_decoder &&) = default;
+
+    mmio_decoder(const mmio_decoder &) = delete;
+    mmio_decoder &operator=(const mmio_decoder &) = delete;
+
+    /// @endcond
+};
+
+}
+}
+
+#endif
@@ -20,6 +20,7 @@
 #define MONITOR_TRAP_INTEL_X64_EAPIS_H
 
 #include "base.h"
+#include "exit_profile.h"
 
 // -----------------------------------------------------------------------------
 // Definitions
@@ -130,8 +131,8 @@ public:
 
 private:
 
-    exit_handler_t *m_exit_handler;
-    std::list<handler_delegate_t> m_handlers;
+    exit_profile *m_exit_profile;
+    handler_chain<handler_delegate_t> m_handlers;
 
 public:
 
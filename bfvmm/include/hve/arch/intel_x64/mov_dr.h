@@ -20,6 +20,9 @@
 #define MOV_DR_INTEL_X64_EAPIS_H
 
 #include "base.h"
+#include "exit_context.h"
+#include "exit_profile.h"
+#include "trace_ring.h"
 
 // -----------------------------------------------------------------------------
 // Definitions
@@ -137,16 +140,10 @@ public:
 
 private:
 
-    exit_handler_t *m_exit_handler;
-    std::list<handler_delegate_t> m_handlers;
-
-private:
-
-    struct dr_record_t {
-        uint64_t val;
-    };
-
-    std::list<dr_record_t> m_log;
+    exit_profile *m_exit_profile;
+    trace_ring *m_trace_ring;
+    exit_context *m_exit_context;
+    handler_chain<handler_delegate_t> m_handlers;
 
 public:
 
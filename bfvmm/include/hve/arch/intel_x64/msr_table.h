@@ -0,0 +1,162 @@
+//
+// Bareflank Extended APIs
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef MSR_TABLE_INTEL_X64_EAPIS_H
+#define MSR_TABLE_INTEL_X64_EAPIS_H
+
+#include <map>
+#include <array>
+#include <memory>
+
+#include <bfgsl.h>
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+/// MSR Table
+///
+/// Stores a T for each MSR. The table mirrors the ranges of the MSR bitmap
+/// (0x00000000 - 0x00001FFF and 0xC0000000 - 0xC0001FFF). MSRs in these
+/// ranges are stored in a two-level table that is indexed directly, with
+/// the second level allocated on first use. All other MSRs are stored in a
+/// sparse table.
+///
+template<typename T>
+class msr_table
+{
+public:
+
+    /// Default Constructor
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    msr_table() = default;
+
+    /// Destructor
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    ~msr_table() = default;
+
+    /// Find
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param msr the msr to look up
+    /// @return returns a pointer to the T for msr, or nullptr if get() has
+    ///     never been called for msr
+    ///
+    T *find(uint64_t msr) noexcept
+    {
+        const auto index = dense_index(msr);
+
+        if (GSL_LIKELY(index < dense_size)) {
+            const auto &page = m_dense[index >> page_shift];
+
+            if (page) {
+                return &(*page)[index & page_mask];
+            }
+
+            return nullptr;
+        }
+
+        const auto iter = m_sparse.find(msr);
+        if (iter != m_sparse.end()) {
+            return &iter->second;
+        }
+
+        return nullptr;
+    }
+
+    /// Get
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param msr the msr to look up
+    /// @return returns the T for msr, default constructing it if needed
+    ///
+    T &get(uint64_t msr)
+    {
+        const auto index = dense_index(msr);
+
+        if (GSL_LIKELY(index < dense_size)) {
+            auto &page = m_dense[index >> page_shift];
+
+            if (!page) {
+                page = std::make_unique<page_t>();
+            }
+
+            return (*page)[index & page_mask];
+        }
+
+        return m_sparse[msr];
+    }
+
+private:
+
+    static constexpr const uint64_t range_size = 0x2000;
+    static constexpr const uint64_t dense_size = range_size * 2;
+    static constexpr const uint64_t page_shift = 8;
+    static constexpr const uint64_t page_size = 1ULL << page_shift;
+    static constexpr const uint64_t page_mask = page_size - 1;
+
+    static uint64_t dense_index(uint64_t msr) noexcept
+    {
+        if (msr < range_size) {
+            return msr;
+        }
+
+        if (msr - 0xC0000000ULL < range_size) {
+            return (msr - 0xC0000000ULL) + range_size;
+        }
+
+        return dense_size;
+    }
+
+    using page_t = std::array<T, page_size>;
+
+    std::array<std::unique_ptr<page_t>, dense_size / page_size> m_dense;
+    std::map<uint64_t, T> m_sparse;
+
+public:
+
+    /// @cond
+
+    msr_table(msr_table &&) = default;
+    msr_table &operator=(msr_table &&) = default;
+
+    msr_table(const msr_table &) = delete;
+    msr_table &operator=(const msr_table &) = delete;
+
+    /// @endcond
+};
+
+}
+}
+
+#endif
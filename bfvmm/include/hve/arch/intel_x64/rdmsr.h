@@ -20,6 +20,9 @@
 #define RDMSR_INTEL_X64_EAPIS_H
 
 #include "base.h"
+#include "exit_profile.h"
+#include "trace_ring.h"
+#include "msr_table.h"
 
 // -----------------------------------------------------------------------------
 // Definitions
@@ -212,18 +215,10 @@ public:
 private:
 
     gsl::span<uint8_t> m_msr_bitmap;
-    gsl::not_null<exit_handler_t *> m_exit_handler;
+    gsl::not_null<exit_profile *> m_exit_profile;
+    gsl::not_null<trace_ring *> m_trace_ring;
 
-    std::unordered_map<vmcs_n::value_type, std::list<handler_delegate_t>> m_handlers;
-
-private:
-
-    struct msr_record_t {
-        uint64_t msr;
-        uint64_t val;
-    };
-
-    std::list<msr_record_t> m_log;
+    msr_table<handler_chain<handler_delegate_t>> m_handlers;
 
 public:
 
@@ -0,0 +1,316 @@
+//
+// Bareflank Extended APIs
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef TRACE_RING_INTEL_X64_EAPIS_H
+#define TRACE_RING_INTEL_X64_EAPIS_H
+
+#include <array>
+#include <atomic>
+#include <memory>
+
+#include <intrinsics.h>
+
+#include "base.h"
+
+// -----------------------------------------------------------------------------
+// Definitions
+// -----------------------------------------------------------------------------
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+/// Trace Ring
+///
+/// A fixed-size ring of exit records, shared by all of the handlers of a
+/// vCPU (see hve::trace_ring). Once the ring is full the oldest record is
+/// overwritten. Recording does not allocate.
+///
+/// The ring lives in a single region, made of whole pages, that holds a
+/// header followed by the record slots. The region can be shared with
+/// (e.g. mapped into) a host-side reader, which streams records with
+/// read() while the vCPU keeps recording. The region is page aligned but
+/// not physically contiguous; a reader outside of the VMM maps it page by
+/// page, from the addresses given by page_hpa(). Each slot is a seqlock: the
+/// writer invalidates the slot's sequence number, writes the record and
+/// then publishes the sequence number, so a reader that races with the
+/// writer sees a sequence number mismatch and skips the record. A reader
+/// that falls more than a ring behind skips ahead; the records it missed
+/// show up as a gap in the sequence numbers.
+///
+class EXPORT_EAPIS_HVE trace_ring
+{
+public:
+
+    /// Record type
+    ///
+    /// The handler that recorded an entry. The meaning of the data words
+    /// depends on the type (see the handler that records it).
+    ///
+    enum class type_t : uint64_t {
+        none = 0,
+        cpuid = 1,
+        rdmsr = 2,
+        wrmsr = 3,
+        io_instruction = 4,
+        ept_violation = 5,
+        ept_misconfiguration = 6,
+        cr0 = 7,
+        cr3 = 8,
+        cr4 = 9,
+        cr8 = 10,
+        mov_dr = 11,
+        external_interrupt = 12
+    };
+
+    /// Magic
+    ///
+    /// Identifies the region ("EAPISTRC")
+    ///
+    static constexpr const uint64_t magic = 0x4352545349504145ULL;
+
+    /// Default capacity
+    ///
+    /// The number of records a ring holds by default (64 KiB of slots)
+    ///
+    static constexpr const std::size_t default_capacity = 1024;
+
+    /// Data count
+    ///
+    /// The number of data words in a record
+    ///
+    static constexpr const std::size_t data_count = 5;
+
+    /// Header
+    ///
+    /// The start of the region
+    ///
+    struct header_t {
+        uint64_t magic;
+        uint64_t capacity;
+        std::atomic<uint64_t> head;
+        std::array<uint64_t, 5> reserved;
+    };
+
+    /// Slot
+    ///
+    /// A record as stored in the region
+    ///
+    struct slot_t {
+        std::atomic<uint64_t> seq;
+        std::atomic<uint64_t> tsc;
+        std::atomic<uint64_t> type;
+        std::array<std::atomic<uint64_t>, data_count> data;
+    };
+
+    /// Entry
+    ///
+    /// A record as read from the region
+    ///
+    struct entry_t {
+        uint64_t seq;
+        uint64_t tsc;
+        type_t type;
+        std::array<uint64_t, data_count> data;
+    };
+
+    /// Constructor
+    ///
+    /// @expects capacity is a power of two
+    /// @ensures
+    ///
+    /// @param capacity the number of records the ring holds
+    ///
+    explicit trace_ring(std::size_t capacity = default_capacity);
+
+    /// Destructor
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    ~trace_ring() = default;
+
+    /// Record
+    ///
+    /// Stamps a record with the next sequence number and the TSC and
+    /// stores it in the ring. Must only be called by the vCPU that owns
+    /// the ring.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param type the type of the record
+    /// @param d0 the first data word of the record
+    /// @param d1 the second data word of the record
+    /// @param d2 the third data word of the record
+    /// @param d3 the fourth data word of the record
+    /// @param d4 the fifth data word of the record
+    ///
+    void record(
+        type_t type, uint64_t d0 = 0, uint64_t d1 = 0, uint64_t d2 = 0,
+        uint64_t d3 = 0, uint64_t d4 = 0) noexcept
+    {
+        const auto seq = m_next++;
+        auto &slot = m_slots[seq & m_mask];
+
+        slot.seq.store(invalid_seq, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot.tsc.store(::x64::read_tsc::get(), std::memory_order_relaxed);
+        slot.type.store(static_cast<uint64_t>(type), std::memory_order_relaxed);
+        slot.data[0].store(d0, std::memory_order_relaxed);
+        slot.data[1].store(d1, std::memory_order_relaxed);
+        slot.data[2].store(d2, std::memory_order_relaxed);
+        slot.data[3].store(d3, std::memory_order_relaxed);
+        slot.data[4].store(d4, std::memory_order_relaxed);
+
+        slot.seq.store(seq, std::memory_order_release);
+        m_header->head.store(m_next, std::memory_order_release);
+    }
+
+    /// Head
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return the sequence number the next record will get (i.e. the
+    ///     number of records recorded so far)
+    ///
+    uint64_t head() const noexcept
+    { return m_next; }
+
+    /// Capacity
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return the number of records the ring holds
+    ///
+    std::size_t capacity() const noexcept
+    { return m_mask + 1U; }
+
+    /// Region
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return the memory the ring lives in, to be shared with a reader
+    ///
+    gsl::span<uint8_t> region() noexcept
+    { return gsl::make_span(m_base, m_region_size); }
+
+    /// Page Count
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return the number of pages in the region
+    ///
+    std::size_t page_count() const noexcept
+    { return m_region_size / ::x64::page_size; }
+
+    /// Page HPA
+    ///
+    /// @expects index < page_count()
+    /// @ensures
+    ///
+    /// @param index the index of a page of the region
+    /// @return the host physical address of the page, to be mapped by a
+    ///     reader outside of the VMM
+    ///
+    uintptr_t page_hpa(std::size_t index) const;
+
+    /// For Each
+    ///
+    /// Calls f with each record of the given type still in the ring, from
+    /// the oldest to the newest. Must only be called by the vCPU that owns
+    /// the ring.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param type the type of the records to visit
+    /// @param f the function to call with each record
+    ///
+    template<typename F>
+    void for_each(type_t type, F f) const
+    {
+        auto next = m_next > this->capacity() ? m_next - this->capacity() : 0U;
+        entry_t entry{};
+
+        for (; next != m_next; ++next) {
+            if (read_slot(m_slots, m_mask, next, entry) && entry.type == type) {
+                f(entry);
+            }
+        }
+    }
+
+    /// Read
+    ///
+    /// Reads records from a ring's region. May be called from any core
+    /// (or, through a mapping of the region, from the host) while the
+    /// owning vCPU records.
+    ///
+    /// @expects region is the start of a trace ring region
+    /// @ensures
+    ///
+    /// @param region the start of the region
+    /// @param next (in/out) the sequence number of the next record to
+    ///     read; 0 to start from the oldest record in the ring
+    /// @param out the entries to read the records into
+    /// @return the number of entries read
+    ///
+    static std::size_t read(
+        const uint8_t *region, uint64_t &next, gsl::span<entry_t> out) noexcept;
+
+private:
+
+    static constexpr const uint64_t invalid_seq = ~0ULL;
+
+    static bool read_slot(
+        const slot_t *slots, uint64_t mask, uint64_t seq, entry_t &entry) noexcept;
+
+    std::unique_ptr<uint8_t[]> m_region;
+    std::size_t m_region_size;
+
+    uint8_t *m_base;
+
+    header_t *m_header;
+    slot_t *m_slots;
+
+    uint64_t m_mask;
+    uint64_t m_next{0};
+
+public:
+
+    /// @cond
+
+    trace_ring(trace_ring &&) = default;
+    trace_ring &operator=(trace_ring &&) = default;
+
+    trace_ring(const trace_ring &) = delete;
+    trace_ring &operator=(const trace_ring &) = delete;
+
+    /// @endcond
+};
+
+}
+}
+
+#endif
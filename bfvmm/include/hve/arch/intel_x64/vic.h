@@ -20,9 +20,13 @@
 #define VIC_INTEL_X64_EAPIS_H
 
 #include "hve.h"
+#include "interrupt_mailbox.h"
 #include "lapic_register.h"
+#include "mmio_decoder.h"
 #include "phys_x2apic.h"
+#include "phys_xapic.h"
 #include "virt_x2apic.h"
+#include "virt_xapic.h"
 
 #ifndef VIC_LOG_LEVELS
 #define VIC_LOG_FATAL 0U
@@ -58,14 +62,33 @@ public:
     ///
     using handler_delegate_t = external_interrupt::handler_delegate_t;
 
+    /// EOI handler delegate type
+    ///
+    /// The delegate type clients must use when registering
+    /// handlers for virtualized EOIs
+    ///
+    using eoi_handler_delegate_t = virt_lapic::eoi_handler_delegate_t;
+
+    /// Number of virtual APIC IDs that can receive IPIs through mailboxes
+    ///
+    static constexpr const auto max_ipi_dests = 256U;
+
     /// Default Constructor
     ///
+    /// If the physical LAPIC is in x2APIC mode, guest accesses are trapped
+    /// through RDMSR/WRMSR exits. If it is in xAPIC mode and emm is
+    /// provided, the APIC MMIO page is made inaccessible in emm, and guest
+    /// accesses are trapped through EPT violations instead.
+    ///
     /// @expects
     /// @ensures
     ///
     /// @param hve the hve object for this vic.
+    /// @param emm the EPT memory map the guest runs on, or nullptr if the
+    ///     guest does not use EPT (x2APIC mode only)
     ///
-    vic(gsl::not_null<eapis::intel_x64::hve *> hve);
+    vic(gsl::not_null<eapis::intel_x64::hve *> hve,
+        ept::memory_map *emm = nullptr);
 
     /// Destructor
     ///
@@ -91,7 +114,8 @@ public:
     /// Virtual vector to physical vector
     ///
     /// Return the _highest_priority_ physical interrupt vector the provided
-    /// virtual vector maps to.
+    /// virtual vector maps to. This is a constant-time lookup in the
+    /// reverse map.
     ///
     /// @expects
     /// @ensures
@@ -105,7 +129,9 @@ public:
     /// Map
     ///
     /// Associate the virtual interrupt vector with the given
-    /// physical interrupt vector
+    /// physical interrupt vector, replacing the virtual vector it was
+    /// previously mapped to. Several physical vectors may map to the same
+    /// virtual vector.
     ///
     /// @expects
     /// @ensures
@@ -118,8 +144,9 @@ public:
     ///
     /// Unmap
     ///
-    /// Disassociate the virtual interrupt vector with
-    /// its highest-priority physical interrupt vector
+    /// Disassociate the virtual interrupt vector from every physical
+    /// interrupt vector that maps to it. Those physical vectors map to
+    /// virtual vector 0 afterwards.
     ///
     /// @expects
     /// @ensures
@@ -128,6 +155,214 @@ public:
     ///
     void unmap(uint64_t virt);
 
+    ///
+    /// Enable APIC-register virtualization
+    ///
+    /// Hand the virtual x2APIC's register page to the CPU (virtualize
+    /// x2APIC mode with APIC-register virtualization) and pass guest
+    /// RDMSRs of readable x2APIC registers through the MSR bitmap, so they
+    /// are serviced by the CPU without a VM exit. Writes with side effects
+    /// (EOI, ICR, self-IPI, TPR, ...) still trap to the vic. The TPR
+    /// shadow is enabled first (see enable_tpr_shadow).
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true if the CPU supports APIC-register virtualization and it
+    ///     has been enabled, false if register reads are still emulated
+    ///
+    bool enable_apic_register_virtualization();
+
+    ///
+    /// Enable TPR shadow
+    ///
+    /// Back the guest's TPR with the virtual-APIC page and stop mov
+    /// to/from CR8 from exiting. The physical TPR no longer mirrors the
+    /// guest's; instead, pending interrupts masked by the virtual TPR are
+    /// held back and the guest only exits (TPR below threshold) when it
+    /// lowers its TPR enough to unmask one.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true if the CPU supports the TPR shadow and it has been
+    ///     enabled, false if CR8 accesses still exit
+    ///
+    bool enable_tpr_shadow();
+
+    ///
+    /// Enable virtual-interrupt delivery
+    ///
+    /// Enable APIC-register virtualization and virtual-interrupt
+    /// delivery, and pass guest EOI and self-IPI writes through the MSR
+    /// bitmap. Interrupts queued for the guest are then posted to the
+    /// virtual IRR (RVI) and delivered by the CPU, and guest EOIs are
+    /// completed by the CPU, instead of costing an interrupt-window exit
+    /// and a WRMSR exit each. The TPR shadow is enabled first (see
+    /// enable_tpr_shadow).
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true if the CPU supports virtual-interrupt delivery and it
+    ///     has been enabled, false if interrupts are still injected in
+    ///     software
+    ///
+    bool enable_virtual_interrupt_delivery();
+
+    ///
+    /// Add EOI handler
+    ///
+    /// Set the EOI-exit bit of the given vector so that guest EOIs of it
+    /// cause a VM exit while virtual-interrupt delivery is enabled, and
+    /// call d on each such exit
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param vector the vector to trap EOIs of
+    /// @param d the delegate to call when the guest EOIs vector
+    ///
+    void add_eoi_handler(uint64_t vector, eoi_handler_delegate_t &&d);
+
+    ///
+    /// Enable posted interrupts
+    ///
+    /// Enable virtual-interrupt delivery and posted-interrupt processing
+    /// for this vCPU. Virtual vectors posted with post_interrupt() are
+    /// set in this vCPU's posted-interrupt descriptor and, if the vCPU
+    /// is in VMX non-root operation when the notification IPI arrives,
+    /// delivered to the guest by the CPU without a VM exit.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param notification_vector the physical vector this vCPU's core
+    ///     receives posted-interrupt notifications on
+    /// @return true if the CPU supports posted interrupts and they have
+    ///     been enabled, false otherwise
+    ///
+    bool enable_posted_interrupts(uint64_t notification_vector);
+
+    ///
+    /// Post interrupt
+    ///
+    /// Post the given virtual vector to this vCPU. Unlike send_virt_ipi,
+    /// this may be called from any core; the notification IPI is only
+    /// sent if the vCPU has no notification outstanding.
+    ///
+    /// @expects enable_posted_interrupts() returned true
+    /// @ensures
+    ///
+    /// @param vector the virtual vector to post
+    ///
+    void post_interrupt(uint64_t vector);
+
+    ///
+    /// Enable IPI mailbox
+    ///
+    /// Make this vCPU a destination for virtual IPIs sent by other vCPUs
+    /// through its lock-free mailbox. Guest ICR writes that target vCPUs
+    /// with a mailbox are then delivered to them directly (see
+    /// send_virt_icr) instead of as physical IPIs that each destination
+    /// has to take through its host IDT and remap. This is meant to be
+    /// enabled on every vCPU of a guest, or none: IPIs that can target
+    /// more than one vCPU are only delivered this way once all num_vcpus
+    /// vCPUs have a mailbox.
+    ///
+    /// @expects the virtual APIC ID of this vCPU is below max_ipi_dests
+    /// @expects num_vcpus is the same for every vCPU of the guest
+    /// @ensures
+    ///
+    /// @param kick_vector the physical vector this vCPU's core receives
+    ///     mailbox notifications on
+    /// @param num_vcpus the number of vCPUs in the guest, i.e. the number
+    ///     of vCPUs a broadcast IPI is delivered to
+    ///
+    void enable_ipi_mailbox(uint64_t kick_vector, uint64_t num_vcpus);
+
+    ///
+    /// Post virtual interrupt
+    ///
+    /// Deliver the given virtual vector to this vCPU. May be called from
+    /// any core. If posted interrupts are enabled they are used; otherwise
+    /// the vector is put in the mailbox, and this vCPU's core is only
+    /// kicked if the mailbox was empty, i.e. if no kick is outstanding.
+    ///
+    /// @expects enable_ipi_mailbox() has been called
+    /// @ensures
+    ///
+    /// @param vector the virtual vector to deliver
+    ///
+    void post_virt_interrupt(uint64_t vector);
+
+    ///
+    /// Send virtual ICR
+    ///
+    /// Decode the destination of the given IPI (shorthand, or physical or
+    /// logical destination mode) and deliver it to the vCPUs it targets.
+    /// Only fixed and lowest-priority IPIs are delivered this way; a
+    /// lowest-priority IPI goes to the first vCPU that accepts it.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param icr the ICR value, in x2APIC format
+    /// @return true if the IPI has been delivered, false if it has to be
+    ///     sent physically (mailboxes are not enabled, the delivery mode
+    ///     is not supported, the destination has no mailbox, the IPI
+    ///     can target more than one vCPU and not every vCPU of the guest
+    ///     has a mailbox yet, or no vCPU accepts it)
+    ///
+    bool send_virt_icr(uint64_t icr);
+
+    ///
+    /// Accepts logical destination
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param dest the destination field of a logical-mode IPI
+    /// @return true if dest is the logical broadcast, or if this vCPU's
+    ///     virtual LDR (and DFR in xAPIC mode) match dest
+    ///
+    bool accepts_logical_destination(uint64_t dest) const;
+
+    ///
+    /// Enable timer emulation
+    ///
+    /// Emulate the guest's LAPIC timer (one-shot, periodic and
+    /// TSC-deadline modes) on the VMX-preemption timer instead of passing
+    /// its registers through to the physical LAPIC. Writes to the LVT
+    /// timer, initial count, divide configuration and IA32_TSC_DEADLINE
+    /// still exit, but expirations are delivered from a preemption-timer
+    /// exit rather than as a physical interrupt that has to be taken
+    /// through the host IDT and remapped.
+    ///
+    /// The physical timer is masked and stopped, and the virtual timer
+    /// takes over its mode and remaining count (or TSC deadline). Counts
+    /// are converted to TSC ticks with the timer's clock rate, from CPUID
+    /// 0x15 or measured against the TSC.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true if the CPU supports the VMX-preemption timer and timer
+    ///     emulation has been enabled, false otherwise
+    ///
+    bool enable_timer_emulation();
+
+    ///
+    /// Injection statistics
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return the software-injection counters of this vCPU's virtual
+    ///     LAPIC
+    ///
+    const virt_lapic::injection_stats_t &injection_stats() const noexcept;
+
     ///
     /// Send physical IPI
     ///
@@ -274,6 +509,36 @@ public:
     bool handle_x2apic_self_ipi_write(
         gsl::not_null<vmcs_t *> vmcs, wrmsr::info_t &info);
 
+    /// Handle xAPIC read exit
+    ///
+    /// Handle guest attempts to read an xAPIC register through the
+    /// trapped MMIO page
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param vmcs the vmcs pointer for this vmexit
+    /// @param info the info structure for this vmexit
+    /// @return true iff the exit has been handled
+    ///
+    bool handle_xapic_read(
+        gsl::not_null<vmcs_t *> vmcs, ept_violation::info_t &info);
+
+    /// Handle xAPIC write exit
+    ///
+    /// Handle guest attempts to write an xAPIC register through the
+    /// trapped MMIO page
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param vmcs the vmcs pointer for this vmexit
+    /// @param info the info structure for this vmexit
+    /// @return true iff the exit has been handled
+    ///
+    bool handle_xapic_write(
+        gsl::not_null<vmcs_t *> vmcs, ept_violation::info_t &info);
+
     /// Handle cr8 read exit
     ///
     /// Handle guest attempts to read cr8
@@ -326,6 +591,30 @@ public:
     bool handle_wrmsr_apic_base(
         gsl::not_null<vmcs_t *> vmcs, wrmsr::info_t &info);
 
+    /// Handle read to IA32_TSC_DEADLINE MSR
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param vmcs the vmcs pointer for this vmexit
+    /// @param info the info structure for this vmexit
+    /// @return true iff the exit has been handled
+    ///
+    bool handle_rdmsr_tsc_deadline(
+        gsl::not_null<vmcs_t *> vmcs, rdmsr::info_t &info);
+
+    /// Handle write to IA32_TSC_DEADLINE MSR
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param vmcs the vmcs pointer for this vmexit
+    /// @param info the info structure for this vmexit
+    /// @return true iff the exit has been handled
+    ///
+    bool handle_wrmsr_tsc_deadline(
+        gsl::not_null<vmcs_t *> vmcs, wrmsr::info_t &info);
+
 private:
 
     void add_exit_handlers();
@@ -334,29 +623,59 @@ private:
     void add_external_interrupt_handlers();
 
     void add_x2apic_handlers();
+    void pass_through_x2apic_reads();
     void add_x2apic_read_handler(lapic_register::offset_t offset);
     void add_x2apic_write_handler(lapic_register::offset_t offset);
+    void add_xapic_handlers();
+
+    uint64_t read_xapic(lapic_register::offset_t offset);
+    void write_xapic(lapic_register::offset_t offset, uint64_t val);
+
+    uint64_t read_virt_register(lapic_register::offset_t offset);
+    bool write_virt_timer(lapic_register::offset_t offset, uint64_t val);
+    void take_over_phys_timer();
+    uint64_t timer_tsc_per_tick();
 
     void init_phys_idt();
     void init_phys_lapic();
     void init_phys_x2apic();
+    void init_phys_xapic();
     void init_virt_lapic();
     void init_save_state();
     void init_interrupt_map();
 
     bool handle_spurious_interrupt(
         gsl::not_null<vmcs_t *> vmcs, external_interrupt::info_t &info);
+    bool handle_posted_interrupt_notification(
+        gsl::not_null<vmcs_t *> vmcs, external_interrupt::info_t &info);
+    bool handle_ipi_mailbox_kick(
+        gsl::not_null<vmcs_t *> vmcs, external_interrupt::info_t &info);
+
+    void drain_ipi_mailbox();
+    void deliver_virt_interrupt(vic *dest, uint64_t vector);
 
     eapis::intel_x64::hve *m_hve;
+    ept::memory_map *m_emm;
 
     std::unique_ptr<gsl::byte[]> m_ist1;
     std::unique_ptr<eapis::intel_x64::virt_lapic> m_virt_lapic;
     std::unique_ptr<eapis::intel_x64::phys_lapic> m_phys_lapic;
 
-    std::array<std::list<handler_delegate_t>, 256> m_handlers;
+    std::array<handler_chain<handler_delegate_t>, 256> m_handlers;
     std::array<uint64_t, 256> m_interrupt_map;
+    std::array<std::array<uint64_t, 4>, 256> m_reverse_map;
     uint64_t m_virt_apic_base;
 
+    uintptr_t m_xapic_base{0};
+    mmio_decoder m_mmio_decoder;
+
+    uint64_t m_notification_vector{0};
+    uint64_t m_phys_apic_id{0};
+
+    std::unique_ptr<interrupt_mailbox> m_mailbox;
+    uint64_t m_kick_vector{0};
+    uint64_t m_virt_apic_id{0};
+
     friend class test::vcpu;
 
 public:
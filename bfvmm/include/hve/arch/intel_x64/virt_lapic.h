@@ -38,6 +38,83 @@ class EXPORT_EAPIS_HVE virt_lapic
 {
 public:
 
+    /// EOI handler delegate type
+    ///
+    /// The delegate type clients must use when registering handlers for
+    /// EOIs of a given vector. The second argument is the vector.
+    ///
+    using eoi_handler_delegate_t =
+        delegate<bool(gsl::not_null<vmcs_t *>, uint64_t)>;
+
+    /// Injection statistics
+    ///
+    /// Counters for interrupts injected in software (i.e. without
+    /// virtual-interrupt delivery). A burst lasts from the first vector
+    /// left pending in the IRR until the IRR drains again.
+    ///
+    struct injection_stats_t {
+
+        /// Injected
+        ///
+        /// The number of vectors injected through the VM-entry
+        /// interruption-information field
+        ///
+        uint64_t injected;
+
+        /// Window exits
+        ///
+        /// The number of interrupt-window exits taken
+        ///
+        uint64_t window_exits;
+
+        /// Bursts
+        ///
+        /// The number of bursts that have drained
+        ///
+        uint64_t bursts;
+
+        /// Exits saved
+        ///
+        /// Summed over all bursts, the number of vectors drained from the
+        /// IRR minus the interrupt-window exits taken to do so, i.e. the
+        /// window exits avoided compared to one exit per vector
+        ///
+        uint64_t exits_saved;
+
+        /// Last burst exits saved
+        ///
+        /// The exits saved by the most recently drained burst
+        ///
+        uint64_t last_burst_exits_saved;
+    };
+
+    /// Timer statistics
+    ///
+    /// Counters for the emulated APIC timer
+    ///
+    struct timer_stats_t {
+
+        /// Expirations
+        ///
+        /// The number of timer interrupts delivered to the guest
+        ///
+        uint64_t expirations;
+
+        /// Coalesced
+        ///
+        /// The number of periods of a periodic timer that elapsed before
+        /// an expiration could be delivered, and were merged into it
+        ///
+        uint64_t coalesced;
+
+        /// Immediate
+        ///
+        /// The number of deadlines that were already due when armed, and
+        /// were delivered without a VMX-preemption timer exit
+        ///
+        uint64_t immediate;
+    };
+
     /// Default Constructor
     ///
     /// @expects
@@ -101,6 +178,285 @@ public:
     ///
     virtual void inject_spurious(uint64_t vector) = 0;
 
+    /// Handle EOI
+    ///
+    /// Emulate a guest EOI: retire the highest-priority in-service vector
+    /// and, if the guest can take it, inject the next pending vector on
+    /// this VM entry instead of waiting for an interrupt-window exit.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    virtual void handle_eoi() = 0;
+
+    /// Injection statistics
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return the software-injection counters of this virtual LAPIC
+    ///
+    virtual const injection_stats_t &injection_stats() const noexcept = 0;
+
+    /// Enable TPR shadow
+    ///
+    /// Back the TPR with the CPU's virtual-APIC page so that guest CR8
+    /// accesses can be serviced without a VM exit. Pending interrupts
+    /// masked by the virtual TPR are held back, and the TPR threshold is
+    /// programmed so that the guest exits once it lowers its TPR enough
+    /// to unmask them.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true if the CPU supports the TPR shadow and it has been
+    ///     enabled, false otherwise
+    ///
+    virtual bool enable_tpr_shadow() = 0;
+
+    /// TPR shadow enabled
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true iff the TPR shadow is enabled
+    ///
+    virtual bool tpr_shadow_enabled() const noexcept = 0;
+
+    /// Enable register virtualization
+    ///
+    /// Back this virtual LAPIC with the CPU's virtual-APIC page so that
+    /// guest reads of APIC registers can be serviced by the CPU without
+    /// a VM exit.
+    ///
+    /// @expects tpr_shadow_enabled()
+    /// @ensures
+    ///
+    /// @return true if the CPU supports register virtualization and it has
+    ///     been enabled, false if the registers remain emulated in software
+    ///
+    virtual bool enable_register_virtualization() = 0;
+
+    /// Register virtualization enabled
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true iff register virtualization is enabled
+    ///
+    virtual bool register_virtualization_enabled() const noexcept = 0;
+
+    /// Enable interrupt delivery
+    ///
+    /// Let the CPU evaluate and deliver pending virtual interrupts and
+    /// virtualize guest EOIs (virtual-interrupt delivery), instead of
+    /// injecting one interrupt per interrupt-window exit.
+    ///
+    /// @expects tpr_shadow_enabled()
+    /// @ensures
+    ///
+    /// @return true if the CPU supports virtual-interrupt delivery and it
+    ///     has been enabled, false if interrupts are still injected in
+    ///     software
+    ///
+    virtual bool enable_interrupt_delivery() = 0;
+
+    /// Interrupt delivery enabled
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true iff virtual-interrupt delivery is enabled
+    ///
+    virtual bool interrupt_delivery_enabled() const noexcept = 0;
+
+    /// Add EOI handler
+    ///
+    /// Request a VM exit when the guest EOIs the given vector while
+    /// virtual-interrupt delivery is enabled, and call d when it does.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param vector the vector to trap EOIs of
+    /// @param d the delegate to call when the vector is EOI'd
+    ///
+    virtual void add_eoi_handler(
+        uint64_t vector, eoi_handler_delegate_t &&d) = 0;
+
+    /// Enable posted interrupts
+    ///
+    /// Enable virtual-interrupt delivery and posted-interrupt processing
+    /// with the given notification vector, so vectors posted with
+    /// post_interrupt() from any core are delivered without a VM exit on
+    /// this vCPU's core.
+    ///
+    /// @expects tpr_shadow_enabled()
+    /// @ensures
+    ///
+    /// @param notification_vector the physical vector of the
+    ///     posted-interrupt notification IPI
+    /// @return true if the CPU supports posted interrupts and they have
+    ///     been enabled, false otherwise
+    ///
+    virtual bool enable_posted_interrupts(uint64_t notification_vector) = 0;
+
+    /// Posted interrupts enabled
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true iff posted interrupts are enabled
+    ///
+    virtual bool posted_interrupts_enabled() const noexcept = 0;
+
+    /// Post interrupt
+    ///
+    /// Atomically set the vector in the posted-interrupt descriptor. This
+    /// may be called from any core.
+    ///
+    /// @expects posted_interrupts_enabled()
+    /// @ensures
+    ///
+    /// @param vector the virtual vector to post
+    /// @return true if the descriptor had no outstanding notification, in
+    ///     which case the caller must send the notification IPI
+    ///
+    virtual bool post_interrupt(uint64_t vector) = 0;
+
+    /// Sync posted interrupts
+    ///
+    /// Move the vectors pending in the posted-interrupt descriptor into
+    /// the virtual IRR. This must be called on this vCPU's core.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    virtual void sync_posted_interrupts() = 0;
+
+    /// Enable timer emulation
+    ///
+    /// Emulate the APIC timer (one-shot, periodic and TSC-deadline modes)
+    /// on the VMX-preemption timer. From then on the timer registers are
+    /// written with the write_timer_* functions below instead of being
+    /// passed to the physical LAPIC, and expirations are delivered through
+    /// queue_injection().
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true if the CPU supports the VMX-preemption timer and timer
+    ///     emulation has been enabled, false otherwise
+    ///
+    virtual bool enable_timer_emulation() = 0;
+
+    /// Timer emulation enabled
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true iff timer emulation is enabled
+    ///
+    virtual bool timer_emulation_enabled() const noexcept = 0;
+
+    /// Timer statistics
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return the counters of the emulated timer
+    ///
+    virtual const timer_stats_t &timer_stats() const noexcept = 0;
+
+    /// Write LVT timer
+    ///
+    /// @expects timer_emulation_enabled()
+    /// @ensures
+    ///
+    /// @param val the value of the LVT timer register to write
+    ///
+    virtual void write_lvt_timer(uint64_t val) = 0;
+
+    /// Write timer initial count
+    ///
+    /// Arms (or, if val is 0, disarms) the timer in one-shot and periodic
+    /// modes
+    ///
+    /// @expects timer_emulation_enabled()
+    /// @ensures
+    ///
+    /// @param val the value of the initial-count register to write
+    ///
+    virtual void write_timer_initial_count(uint64_t val) = 0;
+
+    /// Write timer divide configuration
+    ///
+    /// @expects timer_emulation_enabled()
+    /// @ensures
+    ///
+    /// @param val the value of the divide-configuration register to write
+    ///
+    virtual void write_timer_divide_config(uint64_t val) = 0;
+
+    /// Read timer current count
+    ///
+    /// @expects timer_emulation_enabled()
+    /// @ensures
+    ///
+    /// @return the value of the current-count register
+    ///
+    virtual uint64_t read_timer_current_count() const = 0;
+
+    /// Write TSC deadline
+    ///
+    /// Arms (or, if val is 0, disarms) the timer in TSC-deadline mode.
+    /// Ignored in the other modes.
+    ///
+    /// @expects timer_emulation_enabled()
+    /// @ensures
+    ///
+    /// @param val the value of IA32_TSC_DEADLINE to write
+    ///
+    virtual void write_tsc_deadline(uint64_t val) = 0;
+
+    /// Read TSC deadline
+    ///
+    /// @expects timer_emulation_enabled()
+    /// @ensures
+    ///
+    /// @return the value of IA32_TSC_DEADLINE (0 once it has expired)
+    ///
+    virtual uint64_t read_tsc_deadline() const = 0;
+
+    /// Set timer clock
+    ///
+    /// Sets the rate of the timer's input clock (the core crystal or bus
+    /// clock, before the divide configuration) relative to the TSC. The
+    /// one-shot and periodic counts are converted with it; TSC-deadline
+    /// mode counts in TSC ticks.
+    ///
+    /// @expects timer_emulation_enabled() && tsc_per_tick != 0
+    /// @ensures
+    ///
+    /// @param tsc_per_tick the number of TSC ticks per tick of the input
+    ///     clock, in 48.16 fixed point
+    ///
+    virtual void set_timer_clock(uint64_t tsc_per_tick) = 0;
+
+    /// Resume timer
+    ///
+    /// Arms the timer in one-shot and periodic modes as if it had been
+    /// armed with initial_count earlier, and current_count was left of
+    /// it. Used to take over a timer that was armed on the physical LAPIC.
+    ///
+    /// @expects timer_emulation_enabled()
+    /// @ensures
+    ///
+    /// @param initial_count the value of the initial-count register
+    /// @param current_count the count left before the next expiration
+    ///
+    virtual void resume_timer(uint64_t initial_count, uint64_t current_count) = 0;
+
     /// Read ID
     ///
     /// @expects
@@ -128,6 +484,15 @@ public:
     ///
     virtual uint64_t read_tpr() const = 0;
 
+    /// Read PPR
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return the value of the PPR
+    ///
+    virtual uint64_t read_ppr() const = 0;
+
     /// Read SVR
     ///
     /// @expects
@@ -21,6 +21,8 @@
 
 #include <array>
 #include <list>
+#include <map>
+#include <memory>
 
 #include "phys_x2apic.h"
 #include "virt_lapic.h"
@@ -34,7 +36,16 @@ namespace intel_x64
 ///
 /// Virtual x2APIC
 ///
-class EXPORT_EAPIS_HVE virt_x2apic final : public virt_lapic
+/// The registers are stored in a virtual-APIC page, laid out as the
+/// 4KB x2APIC register space (register n at byte offset n << 4). The same
+/// page can be handed to the CPU with enable_register_virtualization(),
+/// in which case guest RDMSRs of x2APIC registers are serviced from it
+/// without a VM exit.
+///
+/// virt_xapic reuses this class for guests that keep the LAPIC in xAPIC
+/// mode; the canonical offsets are the same in both modes.
+///
+class EXPORT_EAPIS_HVE virt_x2apic : public virt_lapic
 {
 public:
 
@@ -114,6 +125,213 @@ public:
     ///
     void inject_spurious(uint64_t vector) override;
 
+    /// Handle EOI
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    void handle_eoi() override;
+
+    /// Injection statistics
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return the software-injection counters of this virtual x2APIC
+    ///
+    const injection_stats_t &injection_stats() const noexcept override;
+
+    /// Enable TPR shadow
+    ///
+    /// Enables "use TPR shadow" with this virtual x2APIC's page as the
+    /// virtual-APIC page and handles TPR-below-threshold exits. CR8
+    /// exiting is left untouched (see vic::enable_tpr_shadow).
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true if the CPU supports the TPR shadow and it has been
+    ///     enabled, false otherwise
+    ///
+    bool enable_tpr_shadow() override;
+
+    /// TPR shadow enabled
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true iff the TPR shadow is enabled
+    ///
+    bool tpr_shadow_enabled() const noexcept override;
+
+    /// Enable register virtualization
+    ///
+    /// Enables "virtualize x2APIC mode" and "APIC-register virtualization"
+    /// on top of the TPR shadow, which the vic enables first so that CR8
+    /// exiting and the physical TPR follow (see vic::enable_tpr_shadow).
+    /// The MSR bitmap is left untouched; RDMSRs of x2APIC registers only
+    /// skip the VM exit once their read bits are cleared (see
+    /// vic::enable_apic_register_virtualization).
+    ///
+    /// @expects tpr_shadow_enabled()
+    /// @ensures
+    ///
+    /// @return true if the CPU supports the required controls and they
+    ///     have been enabled, false otherwise
+    ///
+    bool enable_register_virtualization() override;
+
+    /// Register virtualization enabled
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true iff register virtualization is enabled
+    ///
+    bool register_virtualization_enabled() const noexcept override;
+
+    /// Enable interrupt delivery
+    ///
+    /// Enables register virtualization and "virtual-interrupt delivery".
+    /// From then on, queued vectors are posted to the virtual IRR and RVI
+    /// and the CPU delivers them at VM entry or when the guest becomes
+    /// interruptible; guest EOIs update the virtual ISR and SVI without a
+    /// VM exit unless the vector's EOI-exit bit is set.
+    ///
+    /// @expects tpr_shadow_enabled()
+    /// @ensures
+    ///
+    /// @return true if the CPU supports the required controls and they
+    ///     have been enabled, false otherwise
+    ///
+    bool enable_interrupt_delivery() override;
+
+    /// Interrupt delivery enabled
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true iff virtual-interrupt delivery is enabled
+    ///
+    bool interrupt_delivery_enabled() const noexcept override;
+
+    /// Add EOI handler
+    ///
+    /// Sets the vector's bit in the EOI-exit bitmap and calls d on each
+    /// resulting virtualized-EOI exit
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param vector the vector to trap EOIs of
+    /// @param d the delegate to call when the vector is EOI'd
+    ///
+    void add_eoi_handler(uint64_t vector, eoi_handler_delegate_t &&d) override;
+
+    /// Enable posted interrupts
+    ///
+    /// Enables virtual-interrupt delivery and "process posted interrupts"
+    /// with a 64-byte aligned posted-interrupt descriptor owned by this
+    /// virtual x2APIC.
+    ///
+    /// @expects tpr_shadow_enabled()
+    /// @ensures
+    ///
+    /// @param notification_vector the physical vector of the
+    ///     posted-interrupt notification IPI
+    /// @return true if the CPU supports the required controls and they
+    ///     have been enabled, false otherwise
+    ///
+    bool enable_posted_interrupts(uint64_t notification_vector) override;
+
+    /// Posted interrupts enabled
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true iff posted interrupts are enabled
+    ///
+    bool posted_interrupts_enabled() const noexcept override;
+
+    /// Post interrupt
+    ///
+    /// @expects posted_interrupts_enabled()
+    /// @ensures
+    ///
+    /// @param vector the virtual vector to post
+    /// @return true if the caller must send the notification IPI
+    ///
+    bool post_interrupt(uint64_t vector) override;
+
+    /// Sync posted interrupts
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    void sync_posted_interrupts() override;
+
+    /// Enable timer emulation
+    ///
+    /// Handles VMX-preemption timer exits and saves the timer value on
+    /// exit, so the countdown only runs while the guest does. The timer is
+    /// only activated while the virtual timer is armed.
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true if the CPU supports the VMX-preemption timer and timer
+    ///     emulation has been enabled, false otherwise
+    ///
+    bool enable_timer_emulation() override;
+
+    /// Timer emulation enabled
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return true iff timer emulation is enabled
+    ///
+    bool timer_emulation_enabled() const noexcept override;
+
+    /// Timer statistics
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return the counters of the emulated timer
+    ///
+    const timer_stats_t &timer_stats() const noexcept override;
+
+    /// Handle VMX-preemption timer exit
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param vmcs the vmcs pointer for this exit
+    /// @return true iff the exit is handled
+    ///
+    bool handle_preemption_timer_exit(gsl::not_null<vmcs_t *> vmcs);
+
+    /// Handle virtualized EOI exit
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param vmcs the vmcs pointer for this exit
+    /// @return true iff the exit is handled
+    ///
+    bool handle_virtualized_eoi_exit(gsl::not_null<vmcs_t *> vmcs);
+
+    /// Handle TPR below threshold exit
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param vmcs the vmcs pointer for this exit
+    /// @return true iff the exit is handled
+    ///
+    bool handle_tpr_below_threshold_exit(gsl::not_null<vmcs_t *> vmcs);
+
     /// @cond
 
     ///
@@ -122,6 +340,7 @@ public:
     uint64_t read_id() const override;
     uint64_t read_version() const override;
     uint64_t read_tpr() const override;
+    uint64_t read_ppr() const override;
     uint64_t read_icr() const override;
     uint64_t read_svr() const override;
 
@@ -134,6 +353,18 @@ public:
     void write_self_ipi(uint64_t vector) override;
     void write_svr(uint64_t svr) override;
 
+    ///
+    /// Timer
+    ///
+    void write_lvt_timer(uint64_t val) override;
+    void write_timer_initial_count(uint64_t val) override;
+    void write_timer_divide_config(uint64_t val) override;
+    uint64_t read_timer_current_count() const override;
+    void write_tsc_deadline(uint64_t val) override;
+    uint64_t read_tsc_deadline() const override;
+    void set_timer_clock(uint64_t tsc_per_tick) override;
+    void resume_timer(uint64_t initial_count, uint64_t current_count) override;
+
     /// @endcond
 
 #ifndef ENABLE_BUILD_TEST
@@ -144,6 +375,13 @@ private:
 
     void queue_interrupt(uint64_t vector);
     void inject_interrupt(uint64_t vector);
+    void queue_virtual_interrupt(uint64_t vector);
+
+    void trap_eoi(uint64_t vector);
+
+    bool masked_by_isr(uint64_t vector) const;
+    bool masked_by_tpr(uint64_t vector) const;
+    void inject_pending(bool window_open);
 
     void init_virt_from_phys_x2apic(
         eapis::intel_x64::phys_lapic *phys,
@@ -160,20 +398,56 @@ private:
     void reset_lvt_register(lapic_register::offset_t offset);
     void clear_register(lapic_register::offset_t offset);
 
-    bool irr_is_empty();
-    bool isr_is_empty();
-    bool is_empty_256bit(uint64_t last);
+    bool irr_is_empty() const;
+    bool isr_is_empty() const;
+    bool is_empty_256bit(lapic_register::offset_t base) const;
 
     void pop_irr();
     void pop_isr();
-    void pop_256bit(uint64_t last);
+    void pop_256bit(lapic_register::offset_t base);
 
-    uint64_t top_irr();
-    uint64_t top_isr();
-    uint64_t top_256bit(uint64_t last);
+    uint64_t top_irr() const;
+    uint64_t top_isr() const;
+    uint64_t top_256bit(lapic_register::offset_t base) const;
+    uint64_t summary_256bit(lapic_register::offset_t base) const;
+
+    void update_ppr();
+
+    uint64_t timer_mode() const;
+    uint64_t timer_divisor() const;
+    uint64_t ticks_to_tsc(uint64_t ticks) const noexcept;
+    uint64_t tsc_to_ticks(uint64_t tsc) const noexcept;
+    void arm_timer(uint64_t deadline);
+    void disarm_timer();
+    void expire_timer(uint64_t now);
 
     eapis::intel_x64::hve *m_hve;
-    std::array<uint32_t, lapic_register::count> m_registers;
+
+    std::unique_ptr<uint32_t[]> m_virt_apic_page;
+    uint64_t m_irr_summary{0};
+    uint64_t m_isr_summary{0};
+
+    injection_stats_t m_injection_stats{};
+    uint64_t m_burst_injected{0};
+    uint64_t m_burst_window_exits{0};
+
+    timer_stats_t m_timer_stats{};
+    uint64_t m_timer_deadline{0};
+    uint64_t m_timer_period{0};
+    uint64_t m_tsc_deadline{0};
+    uint64_t m_preemption_timer_shift{0};
+    uint64_t m_timer_tsc_per_tick{1ULL << 16U};
+    bool m_timer_emulation{false};
+    bool m_timer_armed{false};
+
+    bool m_tpr_shadow{false};
+    bool m_register_virtualization{false};
+    bool m_interrupt_delivery{false};
+
+    std::unique_ptr<uint64_t[]> m_pi_desc_storage;
+    uint64_t *m_pi_desc{nullptr};
+
+    std::map<uint64_t, handler_chain<eoi_handler_delegate_t>> m_eoi_handlers;
 
     /// @endcond
 
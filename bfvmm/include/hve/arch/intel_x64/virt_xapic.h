@@ -0,0 +1,107 @@
+//
+// Bareflank Hypervisor
+// Copyright (C) 2017 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#ifndef VIRT_XAPIC_INTEL_X64_EAPIS_H
+#define VIRT_XAPIC_INTEL_X64_EAPIS_H
+
+#include "virt_x2apic.h"
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+///
+/// Virtual xAPIC
+///
+/// A virtual x2APIC whose registers are presented in xAPIC format: the
+/// ID is held in bits 31:24, and the xAPIC-only DFR and ICR-high registers
+/// are kept. Guest accesses reach it through the vic's EPT traps on the
+/// APIC MMIO page instead of through RDMSR/WRMSR exits.
+///
+/// The CPU's x2APIC virtualization only covers MSR accesses, so register
+/// virtualization (and with it virtual-interrupt delivery and posted
+/// interrupts) is not available in this mode; interrupts are injected in
+/// software. The TPR shadow is, as it only concerns CR8.
+///
+class EXPORT_EAPIS_HVE virt_xapic final : public virt_x2apic
+{
+public:
+
+    /// Default Constructor
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param hve the hve object of this virt_xapic
+    ///
+    virt_xapic(gsl::not_null<eapis::intel_x64::hve *> hve);
+
+    /// Constructor
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @param hve the hve object of this virt_xapic
+    /// @param phys the phys_xapic object of the physical core
+    ///
+    virt_xapic(
+        gsl::not_null<eapis::intel_x64::hve *> hve,
+        gsl::not_null<eapis::intel_x64::phys_lapic *> phys);
+
+    /// Destructor
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    ~virt_xapic() override = default;
+
+    /// Enable register virtualization
+    ///
+    /// Not supported in xAPIC mode (see the class description)
+    ///
+    /// @expects
+    /// @ensures
+    ///
+    /// @return false
+    ///
+    bool enable_register_virtualization() override;
+
+    /// @cond
+
+    uint64_t read_id() const override;
+
+    /// @endcond
+
+public:
+
+    /// @cond
+
+    virt_xapic(virt_xapic &&) = default;
+    virt_xapic &operator=(virt_xapic &&) = default;
+
+    virt_xapic(const virt_xapic &) = delete;
+    virt_xapic &operator=(const virt_xapic &) = delete;
+
+    /// @endcond
+};
+
+}
+}
+
+#endif
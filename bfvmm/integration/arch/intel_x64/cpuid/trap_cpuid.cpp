@@ -62,6 +62,10 @@ public:
             42, 0, cpuid::handler_delegate_t::create<test_handler>()
         );
 
+        hve()->force_cpuid_value(
+            43, 0, 43, 43, 43, 43
+        );
+
         hve()->cpuid()->enable_log();
     }
 
@@ -81,6 +85,16 @@ public:
         bfdebug_nhex(0, "ret.rbx", ret.rbx);
         bfdebug_nhex(0, "ret.rcx", ret.rcx);
         bfdebug_nhex(0, "ret.rdx", ret.rdx);
+
+        ret =
+            ::x64::cpuid::get(
+                43, 0, 0, 0
+            );
+
+        bfdebug_nhex(0, "ret.rax", ret.rax);
+        bfdebug_nhex(0, "ret.rbx", ret.rbx);
+        bfdebug_nhex(0, "ret.rcx", ret.rcx);
+        bfdebug_nhex(0, "ret.rdx", ret.rdx);
     }
 };
 
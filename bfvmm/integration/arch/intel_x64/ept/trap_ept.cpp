@@ -93,9 +93,10 @@ private:
     {
         m_mem_map = std::make_unique<ept::memory_map>();
 
+        ept::identity_map_range(*m_mem_map, 0, page_count * page_size_bytes);
+
         for (auto i = 0ULL; i < page_count; i++) {
             auto addr = i * page_size_bytes;
-            ept::identity_map_1g(*m_mem_map, addr);
             auto &entry = m_mem_map->gpa_to_epte(addr);
 
             ept::epte::read_access::disable(entry);
@@ -116,18 +117,13 @@ private:
         bfignored(info);
 
         info.ignore_advance = true;
-        vmcs::secondary_processor_based_vm_execution_controls::enable_ept::disable();
 
         for (auto i = 0ULL; i < page_count; i++) {
             auto addr = i * page_size_bytes;
-            auto &entry = m_mem_map->gpa_to_epte(addr);
-
-            ept::epte::read_access::enable(entry);
-            ept::epte::write_access::enable(entry);
-            ept::epte::execute_access::disable(entry);
+            ept::set_access_rights(*m_mem_map, addr, ept::epte::access_rights::rw);
         }
 
-        vmcs::secondary_processor_based_vm_execution_controls::enable_ept::enable();
+        ept::flush(*m_mem_map);
 
         return true;
     }
@@ -158,18 +154,13 @@ private:
 
         m_have_trapped_write_violation = true;
         info.ignore_advance = true;
-        vmcs::secondary_processor_based_vm_execution_controls::enable_ept::disable();
 
         for (auto i = 0ULL; i < page_count; i++) {
             auto addr = i * page_size_bytes;
-            auto &entry = m_mem_map->gpa_to_epte(addr);
-
-            ept::epte::read_access::disable(entry);
-            ept::epte::write_access::disable(entry);
-            ept::epte::execute_access::enable(entry);
+            ept::set_access_rights(*m_mem_map, addr, ept::epte::access_rights::eo);
         }
 
-        vmcs::secondary_processor_based_vm_execution_controls::enable_ept::enable();
+        ept::flush(*m_mem_map);
 
         return true;
     }
@@ -182,18 +173,13 @@ private:
         bfignored(info);
 
         info.ignore_advance = true;
-        vmcs::secondary_processor_based_vm_execution_controls::enable_ept::disable();
 
         for (auto i = 0ULL; i < page_count; i++) {
             auto addr = i * page_size_bytes;
-            auto &entry = m_mem_map->gpa_to_epte(addr);
-
-            ept::epte::read_access::enable(entry);
-            ept::epte::write_access::disable(entry);
-            ept::epte::execute_access::enable(entry);
+            ept::set_access_rights(*m_mem_map, addr, ept::epte::access_rights::re);
         }
 
-        vmcs::secondary_processor_based_vm_execution_controls::enable_ept::enable();
+        ept::flush(*m_mem_map);
 
         return true;
     }
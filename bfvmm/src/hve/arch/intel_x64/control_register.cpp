@@ -32,11 +32,13 @@ default_handler(
 control_register::control_register(
     gsl::not_null<eapis::intel_x64::hve *> hve
 ) :
-    m_exit_handler{hve->exit_handler()}
+    m_exit_profile{hve->exit_profile()},
+    m_trace_ring{hve->trace_ring()},
+    m_exit_context{hve->exit_context()}
 {
     using namespace vmcs_n;
 
-    m_exit_handler->add_handler(
+    hve->add_exit_handler(
         exit_reason::basic_exit_reason::control_register_accesses,
         ::handler_delegate_t::create<control_register, &control_register::handle>(this)
     );
@@ -149,6 +151,20 @@ control_register::enable_wrcr8_exiting()
     primary_processor_based_vm_execution_controls::cr8_load_exiting::enable();
 }
 
+void
+control_register::disable_rdcr8_exiting()
+{
+    using namespace vmcs_n;
+    primary_processor_based_vm_execution_controls::cr8_store_exiting::disable();
+}
+
+void
+control_register::disable_wrcr8_exiting()
+{
+    using namespace vmcs_n;
+    primary_processor_based_vm_execution_controls::cr8_load_exiting::disable();
+}
+
 // -----------------------------------------------------------------------------
 // Debug
 // -----------------------------------------------------------------------------
@@ -156,65 +172,33 @@ control_register::enable_wrcr8_exiting()
 void
 control_register::dump_log()
 {
-    if (!m_cr0_log.empty()) {
-        bfdebug_transaction(0, [&](std::string * msg) {
-            bfdebug_lnbr(0, msg);
-            bfdebug_info(0, "cr0 log", msg);
-            bfdebug_brk2(0, msg);
-
-            for (const auto &record : m_cr0_log) {
-                bfdebug_info(0, "record", msg);
-                bfdebug_subnhex(0, "val", record.val, msg);
-                bfdebug_subnhex(0, "shadow", record.shadow, msg);
-            }
-
-            bfdebug_lnbr(0, msg);
-        });
-    }
-
-    if (!m_cr3_log.empty()) {
-        bfdebug_transaction(0, [&](std::string * msg) {
-            bfdebug_lnbr(0, msg);
-            bfdebug_info(0, "cr3 log", msg);
-            bfdebug_brk2(0, msg);
-
-            for (const auto &record : m_cr3_log) {
-                bfdebug_info(0, "record", msg);
-                bfdebug_subnhex(0, "val", record.val, msg);
-                bfdebug_subnhex(0, "shadow", record.shadow, msg);
-            }
-
-            bfdebug_lnbr(0, msg);
+    const std::array<std::pair<trace_ring::type_t, const char *>, 4> logs = {{
+        {trace_ring::type_t::cr0, "cr0 log"},
+        {trace_ring::type_t::cr3, "cr3 log"},
+        {trace_ring::type_t::cr4, "cr4 log"},
+        {trace_ring::type_t::cr8, "cr8 log"}
+    }};
+
+    for (const auto &log : logs) {
+        auto empty = true;
+        m_trace_ring->for_each(log.first, [&](const trace_ring::entry_t &) {
+            empty = false;
         });
-    }
-
-    if (!m_cr4_log.empty()) {
-        bfdebug_transaction(0, [&](std::string * msg) {
-            bfdebug_lnbr(0, msg);
-            bfdebug_info(0, "cr4 log", msg);
-            bfdebug_brk2(0, msg);
 
-            for (const auto &record : m_cr4_log) {
-                bfdebug_info(0, "record", msg);
-                bfdebug_subnhex(0, "val", record.val, msg);
-                bfdebug_subnhex(0, "shadow", record.shadow, msg);
-            }
-
-            bfdebug_lnbr(0, msg);
-        });
-    }
+        if (empty) {
+            continue;
+        }
 
-    if (!m_cr8_log.empty()) {
         bfdebug_transaction(0, [&](std::string * msg) {
             bfdebug_lnbr(0, msg);
-            bfdebug_info(0, "cr8 log", msg);
+            bfdebug_info(0, log.second, msg);
             bfdebug_brk2(0, msg);
 
-            for (const auto &record : m_cr8_log) {
+            m_trace_ring->for_each(log.first, [&](const trace_ring::entry_t & record) {
                 bfdebug_info(0, "record", msg);
-                bfdebug_subnhex(0, "val", record.val, msg);
-                bfdebug_subnhex(0, "shadow", record.shadow, msg);
-            }
+                bfdebug_subnhex(0, "val", record.data[0], msg);
+                bfdebug_subnhex(0, "shadow", record.data[1], msg);
+            });
 
             bfdebug_lnbr(0, msg);
         });
@@ -229,8 +213,9 @@ bool
 control_register::handle(gsl::not_null<vmcs_t *> vmcs)
 {
     using namespace vmcs_n::exit_qualification::control_register_access;
+    auto probe = m_exit_profile->probe(vmcs_n::exit_reason::basic_exit_reason::control_register_accesses);
 
-    switch (control_register_number::get()) {
+    switch (control_register_number::get(m_exit_context->exit_qualification())) {
         case 0:
             return handle_wrcr0(vmcs);
 
@@ -253,7 +238,7 @@ control_register::handle_cr3(gsl::not_null<vmcs_t *> vmcs)
 {
     using namespace vmcs_n::exit_qualification::control_register_access;
 
-    switch (access_type::get()) {
+    switch (access_type::get(m_exit_context->exit_qualification())) {
         case access_type::mov_from_cr:
             return handle_rdcr3(vmcs);
 
@@ -270,7 +255,7 @@ control_register::handle_cr8(gsl::not_null<vmcs_t *> vmcs)
 {
     using namespace vmcs_n::exit_qualification::control_register_access;
 
-    switch (access_type::get()) {
+    switch (access_type::get(m_exit_context->exit_qualification())) {
         case access_type::mov_from_cr:
             return handle_rdcr8(vmcs);
 
@@ -286,16 +271,14 @@ bool
 control_register::handle_wrcr0(gsl::not_null<vmcs_t *> vmcs)
 {
     struct info_t info = {
-        this->emulate_rdgpr(vmcs),
+        this->emulate_rdgpr(vmcs, m_exit_context->exit_qualification()),
         vmcs_n::cr0_read_shadow::get(),
         false,
         false
     };
 
-    if (!ndebug && m_log_enabled) {
-        add_record(m_cr0_log, {
-            info.val, info.shadow
-        });
+    if (m_log_enabled) {
+        m_trace_ring->record(trace_ring::type_t::cr0, info.val, info.shadow);
     }
 
     for (const auto &d : m_wrcr0_handlers) {
@@ -328,17 +311,15 @@ control_register::handle_rdcr3(gsl::not_null<vmcs_t *> vmcs)
         false
     };
 
-    if (!ndebug && m_log_enabled) {
-        add_record(m_cr3_log, {
-            info.val, info.shadow
-        });
+    if (m_log_enabled) {
+        m_trace_ring->record(trace_ring::type_t::cr3, info.val, info.shadow);
     }
 
     for (const auto &d : m_rdcr3_handlers) {
         if (d(vmcs, info)) {
 
             if (!info.ignore_write) {
-                this->emulate_wrgpr(vmcs, info.val);
+                this->emulate_wrgpr(vmcs, info.val, m_exit_context->exit_qualification());
             }
 
             if (!info.ignore_advance) {
@@ -357,16 +338,14 @@ bool
 control_register::handle_wrcr3(gsl::not_null<vmcs_t *> vmcs)
 {
     struct info_t info = {
-        this->emulate_rdgpr(vmcs),
+        this->emulate_rdgpr(vmcs, m_exit_context->exit_qualification()),
         0,
         false,
         false
     };
 
-    if (!ndebug && m_log_enabled) {
-        add_record(m_cr3_log, {
-            info.val, info.shadow
-        });
+    if (m_log_enabled) {
+        m_trace_ring->record(trace_ring::type_t::cr3, info.val, info.shadow);
     }
 
     for (const auto &d : m_wrcr3_handlers) {
@@ -392,16 +371,14 @@ bool
 control_register::handle_wrcr4(gsl::not_null<vmcs_t *> vmcs)
 {
     struct info_t info = {
-        this->emulate_rdgpr(vmcs),
+        this->emulate_rdgpr(vmcs, m_exit_context->exit_qualification()),
         vmcs_n::cr4_read_shadow::get(),
         false,
         false
     };
 
-    if (!ndebug && m_log_enabled) {
-        add_record(m_cr4_log, {
-            info.val, info.shadow
-        });
+    if (m_log_enabled) {
+        m_trace_ring->record(trace_ring::type_t::cr4, info.val, info.shadow);
     }
 
     for (const auto &d : m_wrcr4_handlers) {
@@ -434,17 +411,15 @@ control_register::handle_rdcr8(gsl::not_null<vmcs_t *> vmcs)
         false
     };
 
-    if (!ndebug && m_log_enabled) {
-        add_record(m_cr8_log, {
-            info.val, info.shadow
-        });
+    if (m_log_enabled) {
+        m_trace_ring->record(trace_ring::type_t::cr8, info.val, info.shadow);
     }
 
     for (const auto &d : m_rdcr8_handlers) {
         if (d(vmcs, info)) {
 
             if (!info.ignore_write) {
-                this->emulate_wrgpr(vmcs, info.val);
+                this->emulate_wrgpr(vmcs, info.val, m_exit_context->exit_qualification());
             }
 
             if (!info.ignore_advance) {
@@ -463,16 +438,14 @@ bool
 control_register::handle_wrcr8(gsl::not_null<vmcs_t *> vmcs)
 {
     struct info_t info = {
-        this->emulate_rdgpr(vmcs),
+        this->emulate_rdgpr(vmcs, m_exit_context->exit_qualification()),
         0,
         false,
         false
     };
 
-    if (!ndebug && m_log_enabled) {
-        add_record(m_cr8_log, {
-            info.val, info.shadow
-        });
+    if (m_log_enabled) {
+        m_trace_ring->record(trace_ring::type_t::cr8, info.val, info.shadow);
     }
 
     for (const auto &d : m_wrcr8_handlers) {
@@ -25,11 +25,12 @@ namespace intel_x64
 {
 
 cpuid::cpuid(gsl::not_null<eapis::intel_x64::hve *> hve) :
-    m_exit_handler{hve->exit_handler()}
+    m_exit_profile{hve->exit_profile()},
+    m_trace_ring{hve->trace_ring()}
 {
     using namespace vmcs_n;
 
-    m_exit_handler->add_handler(
+    hve->add_exit_handler(
         exit_reason::basic_exit_reason::cpuid,
         ::handler_delegate_t::create<cpuid, &cpuid::handle>(this)
     );
@@ -43,12 +44,206 @@ cpuid::~cpuid()
 }
 
 // -----------------------------------------------------------------------------
-// CR0
+// Add Handler
 // -----------------------------------------------------------------------------
 
 void cpuid::add_handler(
     leaf_t leaf, subleaf_t subleaf, handler_delegate_t &&d)
-{ m_handlers[ {leaf, subleaf}].push_front(std::move(d)); }
+{ this->get_subleaf(leaf, subleaf).handlers.push_front(std::move(d)); }
+
+void cpuid::add_handler(
+    leaf_t leaf, handler_delegate_t &&d)
+{ this->get_leaf(leaf).any_subleaf.push_front(std::move(d)); }
+
+// -----------------------------------------------------------------------------
+// Policies
+// -----------------------------------------------------------------------------
+
+// Policies are kept as masks (and an optional value) so that they can be
+// applied to a live result as well as to the cached one. Like applying
+// them in the order they were registered, a later set/clear of a bit
+// overrides an earlier one, and a value replaces all earlier policies.
+
+void cpuid::force_set_bits(
+    leaf_t leaf, subleaf_t subleaf, reg_t reg, uint64_t bits)
+{
+    auto &entry = this->get_subleaf(leaf, subleaf);
+    const auto index = static_cast<std::size_t>(reg);
+
+    bits &= 0x00000000FFFFFFFFULL;
+
+    entry.set_bits.at(index) |= bits;
+    entry.clear_bits.at(index) &= ~bits;
+    entry.has_policy = true;
+
+    this->apply_policy(entry, entry.hardware, entry.result);
+}
+
+void cpuid::force_clear_bits(
+    leaf_t leaf, subleaf_t subleaf, reg_t reg, uint64_t bits)
+{
+    auto &entry = this->get_subleaf(leaf, subleaf);
+    const auto index = static_cast<std::size_t>(reg);
+
+    bits &= 0x00000000FFFFFFFFULL;
+
+    entry.clear_bits.at(index) |= bits;
+    entry.set_bits.at(index) &= ~bits;
+    entry.has_policy = true;
+
+    this->apply_policy(entry, entry.hardware, entry.result);
+}
+
+void cpuid::force_value(
+    leaf_t leaf, subleaf_t subleaf,
+    uint64_t rax, uint64_t rbx, uint64_t rcx, uint64_t rdx)
+{
+    auto &entry = this->get_subleaf(leaf, subleaf);
+
+    entry.value = {
+        rax & 0x00000000FFFFFFFFULL,
+        rbx & 0x00000000FFFFFFFFULL,
+        rcx & 0x00000000FFFFFFFFULL,
+        rdx & 0x00000000FFFFFFFFULL
+    };
+
+    entry.set_bits = {};
+    entry.clear_bits = {};
+    entry.has_value = true;
+    entry.has_policy = true;
+
+    this->apply_policy(entry, entry.hardware, entry.result);
+}
+
+void cpuid::disable_result_cache(
+    leaf_t leaf, subleaf_t subleaf)
+{ this->get_subleaf(leaf, subleaf).cached = false; }
+
+void
+cpuid::apply_policy(
+    const subleaf_entry_t &entry, const std::array<uint64_t, 4> &in,
+    std::array<uint64_t, 4> &out)
+{
+    const auto &base = entry.has_value ? entry.value : in;
+
+    for (auto i = 0U; i < out.size(); ++i) {
+        out.at(i) = (base.at(i) | entry.set_bits.at(i)) & ~entry.clear_bits.at(i);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Dispatch Table
+// -----------------------------------------------------------------------------
+
+constexpr const auto basic_leaf_first = 0x00000000ULL;
+constexpr const auto extended_leaf_first = 0x80000000ULL;
+constexpr const auto dense_leaf_count = 0x40ULL;
+
+// Leaves whose output depends on guest state (CR4.OSXSAVE, CR4.PKE, XCR0)
+// or on the core the guest is running on (APIC IDs)
+
+static bool
+is_dynamic_leaf(cpuid::leaf_t leaf) noexcept
+{
+    switch (leaf) {
+        case 0x1U:
+        case 0x7U:
+        case 0xBU:
+        case 0xDU:
+        case 0x1FU:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+cpuid::leaf_entry_t *
+cpuid::find_leaf(leaf_t leaf)
+{
+    if (leaf - basic_leaf_first < dense_leaf_count) {
+        return &m_basic_leaves[leaf - basic_leaf_first];
+    }
+
+    if (leaf - extended_leaf_first < dense_leaf_count) {
+        return &m_extended_leaves[leaf - extended_leaf_first];
+    }
+
+    const auto iter = m_other_leaves.find(leaf);
+    if (iter != m_other_leaves.end()) {
+        return &iter->second;
+    }
+
+    return nullptr;
+}
+
+cpuid::leaf_entry_t &
+cpuid::get_leaf(leaf_t leaf)
+{
+    leaf &= 0x00000000FFFFFFFFULL;
+
+    if (auto entry = this->find_leaf(leaf)) {
+        return *entry;
+    }
+
+    return m_other_leaves[leaf];
+}
+
+cpuid::subleaf_entry_t *
+cpuid::find_subleaf(leaf_entry_t &entry, subleaf_t subleaf)
+{
+    for (auto &subleaf_entry : entry.subleaves) {
+        if (subleaf_entry.subleaf == subleaf) {
+            return &subleaf_entry;
+        }
+    }
+
+    return nullptr;
+}
+
+cpuid::subleaf_entry_t &
+cpuid::get_subleaf(leaf_t leaf, subleaf_t subleaf)
+{
+    leaf &= 0x00000000FFFFFFFFULL;
+    subleaf &= 0x00000000FFFFFFFFULL;
+
+    auto &entry = this->get_leaf(leaf);
+
+    if (auto subleaf_entry = this->find_subleaf(entry, subleaf)) {
+        return *subleaf_entry;
+    }
+
+    // Note:
+    //
+    // The result is read from hardware here, and not on each exit, unless
+    // the leaf is dynamic (see is_dynamic_leaf) or its cache is disabled.
+    // Since handlers and policies are registered while the vCPU is being
+    // constructed, this runs on the physical core the vCPU executes on.
+    //
+
+    auto ret =
+        ::x64::cpuid::get(
+            gsl::narrow_cast<::x64::cpuid::field_type>(leaf),
+            0,
+            gsl::narrow_cast<::x64::cpuid::field_type>(subleaf),
+            0
+        );
+
+    subleaf_entry_t subleaf_entry{};
+
+    subleaf_entry.subleaf = subleaf;
+    subleaf_entry.cached = !is_dynamic_leaf(leaf);
+    subleaf_entry.hardware = {
+        ret.rax & 0x00000000FFFFFFFFULL,
+        ret.rbx & 0x00000000FFFFFFFFULL,
+        ret.rcx & 0x00000000FFFFFFFFULL,
+        ret.rdx & 0x00000000FFFFFFFFULL
+    };
+    subleaf_entry.result = subleaf_entry.hardware;
+
+    entry.subleaves.push_back(std::move(subleaf_entry));
+    return entry.subleaves.back();
+}
 
 // -----------------------------------------------------------------------------
 // Debug
@@ -62,15 +257,15 @@ cpuid::dump_log()
         bfdebug_info(0, "cpuid log", msg);
         bfdebug_brk2(0, msg);
 
-        for (const auto &record : m_log) {
+        m_trace_ring->for_each(trace_ring::type_t::cpuid, [&](const trace_ring::entry_t & record) {
             bfdebug_info(0, "record", msg);
-            bfdebug_subnhex(0, "leaf", record.leaf, msg);
-            bfdebug_subnhex(0, "subleaf", record.subleaf, msg);
-            bfdebug_subnhex(0, "rax", record.rax, msg);
-            bfdebug_subnhex(0, "rbx", record.rbx, msg);
-            bfdebug_subnhex(0, "rcx", record.rcx, msg);
-            bfdebug_subnhex(0, "rdx", record.rdx, msg);
-        }
+            bfdebug_subnhex(0, "leaf", record.data[0] & 0x00000000FFFFFFFFULL, msg);
+            bfdebug_subnhex(0, "subleaf", record.data[0] >> 32U, msg);
+            bfdebug_subnhex(0, "rax", record.data[1], msg);
+            bfdebug_subnhex(0, "rbx", record.data[2], msg);
+            bfdebug_subnhex(0, "rcx", record.data[3], msg);
+            bfdebug_subnhex(0, "rdx", record.data[4], msg);
+        });
 
         bfdebug_lnbr(0, msg);
     });
@@ -83,39 +278,100 @@ cpuid::dump_log()
 bool
 cpuid::handle(gsl::not_null<vmcs_t *> vmcs)
 {
-    const auto &hdlrs = m_handlers.find({
-        vmcs->save_state()->rax, vmcs->save_state()->rcx
-    });
+    const auto leaf = vmcs->save_state()->rax & 0x00000000FFFFFFFFULL;
+    const auto subleaf = vmcs->save_state()->rcx & 0x00000000FFFFFFFFULL;
 
-    if (GSL_LIKELY(hdlrs != m_handlers.end())) {
-
-        auto ret =
-            ::x64::cpuid::get(
-                gsl::narrow_cast<::x64::cpuid::field_type>(vmcs->save_state()->rax),
-                gsl::narrow_cast<::x64::cpuid::field_type>(vmcs->save_state()->rbx),
-                gsl::narrow_cast<::x64::cpuid::field_type>(vmcs->save_state()->rcx),
-                gsl::narrow_cast<::x64::cpuid::field_type>(vmcs->save_state()->rdx)
-            );
-
-        struct info_t info = {
-            ret.rax,
-            ret.rbx,
-            ret.rcx,
-            ret.rdx,
-            false,
-            false
-        };
-
-        if (!ndebug && m_log_enabled) {
-            add_record(m_log, {
-                vmcs->save_state()->rax,
-                vmcs->save_state()->rcx,
-                info.rax, info.rbx, info.rcx, info.rdx
-            });
-        }
+    auto probe = m_exit_profile->probe(vmcs_n::exit_reason::basic_exit_reason::cpuid, leaf);
+
+    if (auto entry = this->find_leaf(leaf)) {
+        auto subleaf_entry = this->find_subleaf(*entry, subleaf);
+
+        if (GSL_LIKELY(subleaf_entry != nullptr || !entry->any_subleaf.empty())) {
+
+            struct info_t info = {
+                0, 0, 0, 0, false, false
+            };
+
+            if (subleaf_entry != nullptr && subleaf_entry->cached) {
+                info.rax = subleaf_entry->result[0];
+                info.rbx = subleaf_entry->result[1];
+                info.rcx = subleaf_entry->result[2];
+                info.rdx = subleaf_entry->result[3];
+            }
+            else if (subleaf_entry != nullptr) {
+                auto ret =
+                    ::x64::cpuid::get(
+                        gsl::narrow_cast<::x64::cpuid::field_type>(leaf),
+                        0,
+                        gsl::narrow_cast<::x64::cpuid::field_type>(subleaf),
+                        0
+                    );
+
+                std::array<uint64_t, 4> result{};
+
+                this->apply_policy(*subleaf_entry, {
+                    ret.rax & 0x00000000FFFFFFFFULL,
+                    ret.rbx & 0x00000000FFFFFFFFULL,
+                    ret.rcx & 0x00000000FFFFFFFFULL,
+                    ret.rdx & 0x00000000FFFFFFFFULL
+                }, result);
+
+                info.rax = result[0];
+                info.rbx = result[1];
+                info.rcx = result[2];
+                info.rdx = result[3];
+            }
+            else {
+                auto ret =
+                    ::x64::cpuid::get(
+                        gsl::narrow_cast<::x64::cpuid::field_type>(vmcs->save_state()->rax),
+                        gsl::narrow_cast<::x64::cpuid::field_type>(vmcs->save_state()->rbx),
+                        gsl::narrow_cast<::x64::cpuid::field_type>(vmcs->save_state()->rcx),
+                        gsl::narrow_cast<::x64::cpuid::field_type>(vmcs->save_state()->rdx)
+                    );
+
+                info.rax = ret.rax;
+                info.rbx = ret.rbx;
+                info.rcx = ret.rcx;
+                info.rdx = ret.rdx;
+            }
+
+            if (m_log_enabled) {
+
+                // The leaf and subleaf are both 32 bits, so they share the
+                // first data word to leave room for the four registers
+
+                m_trace_ring->record(
+                    trace_ring::type_t::cpuid, (subleaf << 32U) | leaf,
+                    info.rax, info.rbx, info.rcx, info.rdx
+                );
+            }
+
+            const std::array<handler_chain<handler_delegate_t> *, 2> chains = {
+                subleaf_entry != nullptr ? &subleaf_entry->handlers : nullptr,
+                &entry->any_subleaf
+            };
+
+            auto handled = false;
+
+            for (const auto chain : chains) {
+                if (handled || chain == nullptr) {
+                    continue;
+                }
+
+                for (const auto &d : *chain) {
+                    if (d(vmcs, info)) {
+                        handled = true;
+                        break;
+                    }
+                }
+            }
+
+            if (!handled && subleaf_entry != nullptr) {
+                handled = subleaf_entry->has_policy;
+            }
 
-        for (const auto &d : hdlrs->second) {
-            if (d(vmcs, info)) {
+            if (handled) {
 
                 if (!info.ignore_write) {
                     vmcs->save_state()->rax = set_bits(vmcs->save_state()->rax, 0x00000000FFFFFFFFULL, info.rax);
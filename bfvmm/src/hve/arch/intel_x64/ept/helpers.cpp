@@ -38,7 +38,14 @@ eptp(memory_map &map)
 
     val = eptp::memory_type::set(val, eptp::memory_type::write_back);
     val = eptp::page_walk_length_minus_one::set(val, max_page_walk_length - 1U);
-    val = eptp::accessed_and_dirty_flags::disable(val);
+
+    if (map.accessed_dirty_flags_enabled()) {
+        val = eptp::accessed_and_dirty_flags::enable(val);
+    }
+    else {
+        val = eptp::accessed_and_dirty_flags::disable(val);
+    }
+
     val = eptp::phys_addr::set(val, pml4_hpa);
 
     return val;
@@ -51,7 +58,7 @@ map_1g(memory_map &mem_map, gpa_t gpa, hpa_t hpa)
 void
 map_1g(memory_map &mem_map, gpa_t gpa, hpa_t hpa, memory_attr_t mattr)
 {
-    auto entry = mem_map.map(gpa, hpa, pdpte::page_size_bytes);
+    auto &entry = mem_map.map(gpa, hpa, pdpte::page_size_bytes);
     epte::memory_attr::set(entry, mattr);
 }
 
@@ -70,7 +77,7 @@ map_2m(memory_map &mem_map, gpa_t gpa, hpa_t hpa)
 void
 map_2m(memory_map &mem_map, gpa_t gpa, hpa_t hpa, memory_attr_t mattr)
 {
-    auto entry = mem_map.map(gpa, hpa, pde::page_size_bytes);
+    auto &entry = mem_map.map(gpa, hpa, pde::page_size_bytes);
     epte::memory_attr::set(entry, mattr);
 }
 
@@ -89,7 +96,7 @@ map_4k(memory_map &mem_map, gpa_t gpa, hpa_t hpa)
 void
 map_4k(memory_map &mem_map, gpa_t gpa, hpa_t hpa, memory_attr_t mattr)
 {
-    auto entry = mem_map.map(gpa, hpa, pte::page_size_bytes);
+    auto &entry = mem_map.map(gpa, hpa, pte::page_size_bytes);
     epte::memory_attr::set(entry, mattr);
 }
 
@@ -101,6 +108,113 @@ void
 identity_map_4k(memory_map &mem_map, gpa_t gpa, memory_attr_t mattr)
 { map_4k(mem_map, gpa, gpa, mattr); }
 
+// 1g leaves are an optional EPT feature; on a CPU without them a PDPTE
+// with bit 7 set is an EPT misconfiguration
+
+static uint64_t
+largest_page_size(gpa_t gpa, hpa_t hpa, uint64_t size, bool large_1g) noexcept
+{
+    if (large_1g && size >= pdpte::page_size_bytes &&
+        ((gpa | hpa) & (pdpte::page_size_bytes - 1U)) == 0) {
+        return pdpte::page_size_bytes;
+    }
+
+    if (size >= pde::page_size_bytes && ((gpa | hpa) & (pde::page_size_bytes - 1U)) == 0) {
+        return pde::page_size_bytes;
+    }
+
+    return pte::page_size_bytes;
+}
+
+static uint64_t
+map_range_pages(
+    memory_map &mem_map, gpa_t gpa, hpa_t hpa, uint64_t size,
+    const memory_attr_t *mattr)
+{
+    expects(((gpa | hpa | size) & (pte::page_size_bytes - 1U)) == 0);
+
+    using namespace ::intel_x64::msrs::ia32_vmx_ept_vpid_cap;
+
+    auto num_pages = 0ULL;
+    auto large_1g = pdpte_1gb_support::is_enabled();
+
+    while (size != 0) {
+        auto page_size = largest_page_size(gpa, hpa, size, large_1g);
+        auto &entry = mem_map.map(gpa, hpa, page_size);
+
+        if (mattr != nullptr) {
+            epte::memory_attr::set(entry, *mattr);
+        }
+
+        gpa += page_size;
+        hpa += page_size;
+        size -= page_size;
+
+        num_pages++;
+    }
+
+    return num_pages;
+}
+
+uint64_t
+map_range(memory_map &mem_map, gpa_t gpa, hpa_t hpa, uint64_t size)
+{ return map_range_pages(mem_map, gpa, hpa, size, nullptr); }
+
+uint64_t
+map_range(
+    memory_map &mem_map, gpa_t gpa, hpa_t hpa, uint64_t size, memory_attr_t mattr)
+{ return map_range_pages(mem_map, gpa, hpa, size, &mattr); }
+
+uint64_t
+identity_map_range(memory_map &mem_map, gpa_t gpa, uint64_t size)
+{ return map_range_pages(mem_map, gpa, gpa, size, nullptr); }
+
+uint64_t
+identity_map_range(
+    memory_map &mem_map, gpa_t gpa, uint64_t size, memory_attr_t mattr)
+{ return map_range_pages(mem_map, gpa, gpa, size, &mattr); }
+
+epte_t &
+split(memory_map &mem_map, gpa_t gpa, uint64_t size)
+{ return mem_map.split(gpa, size); }
+
+epte_t &
+split_4k(memory_map &mem_map, gpa_t gpa)
+{ return mem_map.split(gpa, pte::page_size_bytes); }
+
+bool
+merge(memory_map &mem_map, gpa_t gpa, uint64_t size)
+{ return mem_map.merge(gpa, size); }
+
+uint64_t
+harvest_dirty(
+    memory_map &mem_map, gpa_t gpa, uint64_t size, gsl::span<uint64_t> bitmap)
+{ return mem_map.harvest_dirty(gpa, size, bitmap); }
+
+uint64_t
+harvest_accessed(
+    memory_map &mem_map, gpa_t gpa, uint64_t size, gsl::span<uint64_t> bitmap)
+{ return mem_map.harvest_accessed(gpa, size, bitmap); }
+
+void
+set_access_rights(memory_map &mem_map, gpa_t gpa, epte_value_t rights)
+{ mem_map.set_access_rights(gpa, rights); }
+
+void
+flush(memory_map &mem_map)
+{ mem_map.flush(); }
+
+void
+invept_single_context(memory_map &mem_map)
+{
+    mem_map.mark_flush_pending();
+    mem_map.flush();
+}
+
+void
+invept_all_contexts()
+{ ::intel_x64::vmx::invept_global(); }
+
 void
 unmap(memory_map &mem_map, gpa_t gpa)
 { mem_map.unmap(gpa); }
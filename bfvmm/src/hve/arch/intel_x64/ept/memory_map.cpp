@@ -17,9 +17,14 @@
 // License along with this library; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
+#include <atomic>
+#include <algorithm>
+
+#include <intrinsics.h>
 #include <bfvmm/memory_manager/memory_manager.h>
 #include "hve/arch/intel_x64/ept/memory_map.h"
 #include "hve/arch/intel_x64/ept/intrinsics.h"
+#include "hve/arch/intel_x64/ept/helpers.h"
 
 namespace eapis
 {
@@ -28,28 +33,31 @@ namespace intel_x64
 namespace ept
 {
 
-memory_map::memory_map()
-{
-    auto pml4 = new epte_t[page_table::num_entries]();
-    m_pml4_hva = reinterpret_cast<hva_t>(pml4);
-    m_pml4_hpa = g_mm->virtint_to_physint(m_pml4_hva);
-}
-
-memory_map::~memory_map()
+static void
+mark_pages(gsl::span<uint64_t> bitmap, uint64_t bit, uint64_t num_bits)
 {
-    auto pml4 = reinterpret_cast<epte_t *>(m_pml4_hva);
-    auto pml4_view = gsl::make_span(pml4, page_table::num_entries);
+    auto word = [&](uint64_t b) -> uint64_t &
+    { return bitmap[gsl::narrow_cast<std::ptrdiff_t>(b / 64U)]; };
 
-    for (auto pml4e : pml4_view) {
-        if (epte::is_present(pml4e) && !epte::is_leaf_entry(pml4e)) {
-            free_page_table(pml4e);
-        }
-        epte::clear(pml4e);
+    for (; num_bits != 0 && (bit % 64U) != 0; bit++, num_bits--) {
+        word(bit) |= 1ULL << (bit % 64U);
+    }
+    for (; num_bits >= 64U; bit += 64U, num_bits -= 64U) {
+        word(bit) = ~0ULL;
     }
+    for (; num_bits != 0; bit++, num_bits--) {
+        word(bit) |= 1ULL << (bit % 64U);
+    }
+}
 
-    delete[] pml4;
+memory_map::memory_map()
+{
+    m_pml4_hpa = m_pool.allocate();
+    m_pml4_hva = reinterpret_cast<hva_t>(m_pool.hpa_to_hva(m_pml4_hpa));
 }
 
+memory_map::~memory_map() = default;
+
 epte_t &
 memory_map::map(gpa_t gpa, hpa_t hpa, uint64_t size)
 {
@@ -76,6 +84,86 @@ memory_map::unmap(gpa_t gpa)
 {
     auto &leaf = gpa_to_epte(gpa);
     epte::clear(leaf);
+
+    m_flush_pending = true;
+}
+
+epte_t &
+memory_map::split(gpa_t gpa, uint64_t size)
+{
+    if (size != pde::page_size_bytes && size != pte::page_size_bytes) {
+        throw std::logic_error("split: invalid ept page size specified");
+    }
+
+    auto &pml4e = this->gpa_to_pml4e(gpa);
+    if (!epte::is_present(pml4e)) {
+        throw std::runtime_error("split: failed to split gpa, gpa is not "
+                                 "mapped at the 512GB level");
+    }
+
+    auto &pdpte = this->gpa_to_pdpte(gpa, pml4e);
+    if (!epte::is_present(pdpte)) {
+        throw std::runtime_error("split: failed to split gpa, gpa is not "
+                                 "mapped at the 1GB level");
+    }
+    if (epte::is_leaf_entry(pdpte)) {
+        this->split_entry(pdpte, pde::page_size_bytes);
+    }
+
+    auto &pde = this->gpa_to_pde(gpa, pdpte);
+    if (!epte::is_present(pde)) {
+        throw std::runtime_error("split: failed to split gpa, gpa is not "
+                                 "mapped at the 2MB level");
+    }
+    if (size == pte::page_size_bytes && epte::is_leaf_entry(pde)) {
+        this->split_entry(pde, pte::page_size_bytes);
+    }
+
+    return this->gpa_to_epte(gpa);
+}
+
+bool
+memory_map::merge(gpa_t gpa, uint64_t size)
+{
+    if (size != pdpte::page_size_bytes && size != pde::page_size_bytes) {
+        throw std::logic_error("merge: invalid ept page size specified");
+    }
+
+    auto &pml4e = this->gpa_to_pml4e(gpa);
+    if (!epte::is_present(pml4e)) {
+        return false;
+    }
+
+    auto &pdpte = this->gpa_to_pdpte(gpa, pml4e);
+    if (!epte::is_present(pdpte)) {
+        return false;
+    }
+    if (epte::is_leaf_entry(pdpte)) {
+        return true;
+    }
+
+    if (size == pdpte::page_size_bytes) {
+        auto pd = m_pool.hpa_to_hva(epte::hpa(pdpte));
+        auto pd_view = gsl::make_span(pd, page_table::num_entries);
+
+        for (auto &pde : pd_view) {
+            if (epte::is_present(pde) && !epte::is_leaf_entry(pde)) {
+                this->merge_entry(pde, pte::page_size_bytes);
+            }
+        }
+
+        return this->merge_entry(pdpte, pde::page_size_bytes);
+    }
+
+    auto &pde = this->gpa_to_pde(gpa, pdpte);
+    if (!epte::is_present(pde)) {
+        return false;
+    }
+    if (epte::is_leaf_entry(pde)) {
+        return true;
+    }
+
+    return this->merge_entry(pde, pte::page_size_bytes);
 }
 
 epte_t &
@@ -171,15 +259,147 @@ hpa_t
 memory_map::hpa() const
 { return m_pml4_hpa; }
 
-hpa_t
-memory_map::allocate_page_table()
+void
+memory_map::set_access_rights(gpa_t gpa, epte_value_t rights)
 {
-    auto pt_hva = new epte_t [page_table::num_entries]();
-    auto pt_hpa = g_mm->virtptr_to_physint(pt_hva);
+    auto &entry = this->gpa_to_epte(gpa);
 
-    return pt_hpa;
+    epte::access_rights::set(entry, rights);
+    m_flush_pending = true;
 }
 
+void
+memory_map::mark_flush_pending() noexcept
+{ m_flush_pending = true; }
+
+bool
+memory_map::flush_pending() const noexcept
+{ return m_flush_pending; }
+
+void
+memory_map::flush()
+{
+    if (m_flush_pending) {
+        ::intel_x64::vmx::invept_single_context(ept::eptp(*this));
+        m_flush_pending = false;
+    }
+}
+
+void
+memory_map::enable_accessed_dirty_flags()
+{
+    using namespace ::intel_x64::msrs::ia32_vmx_ept_vpid_cap;
+
+    if (!accessed_dirty_support::is_enabled()) {
+        throw std::runtime_error("enable_accessed_dirty_flags: EPT accessed "
+                                 "and dirty flags are not supported");
+    }
+
+    m_accessed_dirty_enabled = true;
+}
+
+bool
+memory_map::accessed_dirty_flags_enabled() const noexcept
+{ return m_accessed_dirty_enabled; }
+
+uint64_t
+memory_map::harvest_dirty(gpa_t gpa, uint64_t size, gsl::span<uint64_t> bitmap)
+{ return this->harvest(gpa, size, bitmap, epte::dirty::mask); }
+
+uint64_t
+memory_map::harvest_accessed(gpa_t gpa, uint64_t size, gsl::span<uint64_t> bitmap)
+{ return this->harvest(gpa, size, bitmap, epte::accessed_flag::mask); }
+
+uint64_t
+memory_map::harvest(
+    gpa_t gpa, uint64_t size, gsl::span<uint64_t> bitmap, epte_value_t flag)
+{
+    expects(((gpa | size) & (pte::page_size_bytes - 1U)) == 0);
+    expects(static_cast<uint64_t>(bitmap.size()) * 64U >= size / pte::page_size_bytes);
+
+    std::fill(bitmap.begin(), bitmap.end(), 0ULL);
+
+    if (size == 0) {
+        return 0;
+    }
+
+    harvest_t h{gpa, gpa + size, flag, bitmap, 0, false};
+
+    auto pml4 = reinterpret_cast<epte_t *>(m_pml4_hva);
+    auto pml4e_size = pdpte::page_size_bytes * page_table::num_entries;
+
+    this->harvest_table(pml4, 0, pml4e_size, h);
+
+    if (h.cleared) {
+        m_flush_pending = true;
+        this->flush();
+    }
+
+    return h.count;
+}
+
+void
+memory_map::harvest_table(
+    epte_t *table, gpa_t table_gpa, uint64_t page_size, harvest_t &h)
+{
+    static_assert(sizeof(std::atomic<epte_t>) == sizeof(epte_t),
+                  "std::atomic<epte_t> must have the layout of epte_t");
+
+    auto first = h.start > table_gpa ? (h.start - table_gpa) / page_size : 0;
+    auto last = std::min<uint64_t>(
+        (h.end - 1U - table_gpa) / page_size, page_table::num_entries - 1U);
+
+    for (auto i = first; i <= last; i++) {
+        auto &entry = table[i];
+        auto entry_gpa = table_gpa + (i * page_size);
+
+        if (!epte::is_present(entry)) {
+            continue;
+        }
+
+        if (page_size != pte::page_size_bytes && !epte::is_leaf_entry(entry)) {
+            auto child = m_pool.hpa_to_hva(epte::hpa(entry));
+            this->harvest_table(child, entry_gpa, page_size / page_table::num_entries, h);
+
+            continue;
+        }
+
+        // The CPU sets the A/D flags with locked operations, so the flag
+        // must be cleared atomically to avoid losing an update. The plain
+        // read first keeps clean entries off the locked path.
+
+        if ((entry & h.flag) == 0) {
+            continue;
+        }
+
+        auto start = std::max(entry_gpa, h.start);
+        auto end = std::min(entry_gpa + page_size, h.end);
+
+        // A large page that the range only partly covers also tracks pages
+        // outside of the range, so its flag is reported but left set for
+        // the harvest that covers the rest of it.
+
+        if (start == entry_gpa && end == entry_gpa + page_size) {
+            auto atomic_entry = reinterpret_cast<std::atomic<epte_t> *>(&entry);
+            if ((atomic_entry->fetch_and(~h.flag) & h.flag) == 0) {
+                continue;
+            }
+
+            h.cleared = true;
+        }
+
+        auto bit = (start - h.start) / pte::page_size_bytes;
+        auto num_bits = (end - start) / pte::page_size_bytes;
+
+        h.count += num_bits;
+        mark_pages(h.bitmap, bit, num_bits);
+    }
+}
+
+hpa_t
+memory_map::allocate_page_table()
+{ return m_pool.allocate(); }
+
 void
 memory_map::allocate_page_table(epte_t &entry)
 {
@@ -196,19 +416,92 @@ void
 memory_map::free_page_table(epte_t &entry)
 {
     auto pt_hpa = epte::hpa(entry);
-    auto pt_hva = g_mm->physint_to_virtptr(pt_hpa);
-    auto page_table = static_cast<epte_t *>(pt_hva);
+    auto page_table = m_pool.hpa_to_hva(pt_hpa);
 
     auto pt_view = gsl::make_span(page_table, page_table::num_entries);
 
-    for (auto pte : pt_view) {
+    for (auto &pte : pt_view) {
         if (epte::is_present(pte) && !epte::is_leaf_entry(pte)) {
             this->free_page_table(pte);
         }
     }
 
     epte::clear(entry);
-    delete[] page_table;
+    m_pool.free(pt_hpa);
+}
+
+void
+memory_map::split_entry(epte_t &entry, uint64_t child_size)
+{
+    auto pt_hpa = this->allocate_page_table();
+    auto page_table = m_pool.hpa_to_hva(pt_hpa);
+    auto pt_view = gsl::make_span(page_table, page_table::num_entries);
+
+    auto child_hpa = epte::hpa(entry);
+
+    for (auto &pte : pt_view) {
+        pte = entry;
+        epte::set_hpa(pte, child_hpa);
+
+        child_hpa += child_size;
+    }
+
+    // The table is fully populated before it is linked, so the guest never
+    // observes a partially split region
+
+    epte_t table_entry{0};
+
+    epte::read_access::enable(table_entry);
+    epte::write_access::enable(table_entry);
+    epte::execute_access::enable(table_entry);
+    epte::set_hpa(table_entry, pt_hpa);
+
+    entry = table_entry;
+    m_flush_pending = true;
+}
+
+bool
+memory_map::merge_entry(epte_t &entry, uint64_t child_size)
+{
+    constexpr const auto ad_mask =
+        epte::accessed_flag::mask | epte::dirty::mask;
+    constexpr const auto attr_mask =
+        ~(epte::phys_addr_bits::mask | ad_mask);
+
+    auto pt_hpa = epte::hpa(entry);
+    auto page_table = m_pool.hpa_to_hva(pt_hpa);
+    auto pt_view = gsl::make_span(page_table, page_table::num_entries);
+
+    auto first = pt_view[0];
+    auto base_hpa = epte::hpa(first);
+
+    if ((base_hpa & ((child_size * page_table::num_entries) - 1U)) != 0) {
+        return false;
+    }
+
+    auto ad_bits = 0ULL;
+    auto child_hpa = base_hpa;
+
+    for (auto &pte : pt_view) {
+        if (!epte::is_present(pte) || !epte::is_leaf_entry(pte)) {
+            return false;
+        }
+        if ((pte & attr_mask) != (first & attr_mask)) {
+            return false;
+        }
+        if (epte::hpa(pte) != child_hpa) {
+            return false;
+        }
+
+        ad_bits |= pte & ad_mask;
+        child_hpa += child_size;
+    }
+
+    entry = (first & ~ad_mask) | ad_bits;
+    m_pool.free(pt_hpa);
+
+    m_flush_pending = true;
+    return true;
 }
 
 void
@@ -225,8 +518,7 @@ epte_t &
 memory_map::gpa_to_pml4e(gpa_t gpa)
 {
     auto pml4e_offset = gpa::pml4_index::get_offset(gpa);
-    auto pml4_hva = g_mm->physint_to_virtint(m_pml4_hpa);
-    auto pml4e_hva = pml4_hva + pml4e_offset;
+    auto pml4e_hva = m_pml4_hva + pml4e_offset;
 
     return *reinterpret_cast<epte_t *>(pml4e_hva);
 }
@@ -236,7 +528,7 @@ memory_map::gpa_to_pdpte(gpa_t gpa, epte_t &pml4e)
 {
     auto pdpte_offset = gpa::pdpt_index::get_offset(gpa);
     auto pdpt_hpa = epte::hpa(pml4e);
-    auto pdpt_hva = g_mm->physint_to_virtint(pdpt_hpa);
+    auto pdpt_hva = reinterpret_cast<hva_t>(m_pool.hpa_to_hva(pdpt_hpa));
     auto pdpte_hva = pdpt_hva + pdpte_offset;
 
     return *reinterpret_cast<epte_t *>(pdpte_hva);
@@ -247,7 +539,7 @@ memory_map::gpa_to_pde(gpa_t gpa, epte_t &pdpte)
 {
     auto pde_offset = gpa::pd_index::get_offset(gpa);
     auto pd_hpa = epte::hpa(pdpte);
-    auto pd_hva = g_mm->physint_to_virtint(pd_hpa);
+    auto pd_hva = reinterpret_cast<hva_t>(m_pool.hpa_to_hva(pd_hpa));
     auto pde_hva = pd_hva + pde_offset;
 
     return *reinterpret_cast<epte_t *>(pde_hva);
@@ -258,7 +550,7 @@ memory_map::gpa_to_pte(gpa_t gpa, epte_t &pde)
 {
     auto pte_offset = gpa::pt_index::get_offset(gpa);
     auto pt_hpa = epte::hpa(pde);
-    auto pt_hva = g_mm->physint_to_virtint(pt_hpa);
+    auto pt_hva = reinterpret_cast<hva_t>(m_pool.hpa_to_hva(pt_hpa));
     auto pte_hva = pt_hva + pte_offset;
 
     return *reinterpret_cast<epte_t *>(pte_hva);
@@ -369,10 +661,11 @@ memory_map::to_mdl(std::vector<memory_descriptor> &mdl, epte_t *page_table) cons
     for (auto pte : pt_view) {
         if (epte::is_present(pte) && !epte::is_leaf_entry(pte)) {
             auto phys = epte::hpa(pte);
-            auto virt = g_mm->physint_to_virtint(phys);
-            mdl.push_back({phys, virt, MEMORY_TYPE_R | MEMORY_TYPE_W});
+            auto virt = m_pool.hpa_to_hva(phys);
+            auto addr = reinterpret_cast<uintptr_t>(virt);
+            mdl.push_back({phys, addr, MEMORY_TYPE_R | MEMORY_TYPE_W});
 
-            this->to_mdl(mdl, reinterpret_cast<epte_t *>(virt));
+            this->to_mdl(mdl, virt);
         }
     }
 }
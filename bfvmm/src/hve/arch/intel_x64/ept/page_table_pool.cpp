@@ -0,0 +1,145 @@
+//
+// Bareflank Extended APIs
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+#include <bfvmm/memory_manager/memory_manager.h>
+#include "hve/arch/intel_x64/ept/page_table_pool.h"
+
+namespace eapis
+{
+namespace intel_x64
+{
+namespace ept
+{
+
+page_table_pool::page_table_pool(std::size_t pages_per_slab) :
+    m_pages_per_slab(pages_per_slab)
+{ expects(pages_per_slab != 0); }
+
+hpa_t
+page_table_pool::allocate()
+{
+    if (m_free.empty()) {
+        this->add_slab();
+    }
+
+    auto page = m_free.back();
+    m_free.pop_back();
+
+    return page.hpa;
+}
+
+void
+page_table_pool::free(hpa_t hpa)
+{
+    auto hva = this->hpa_to_hva(hpa);
+    std::fill_n(hva, page_table::num_entries, 0ULL);
+
+    m_free.push_back({hva, hpa});
+}
+
+void
+page_table_pool::reserve(std::size_t count)
+{
+    while (m_free.size() < count) {
+        this->add_slab();
+    }
+}
+
+epte_t *
+page_table_pool::hpa_to_hva(hpa_t hpa) const
+{
+    auto iter = std::upper_bound(m_ranges.begin(), m_ranges.end(), hpa,
+    [](hpa_t val, const range_t &range) { return val < range.hpa; });
+
+    if (iter != m_ranges.begin()) {
+        auto &range = *std::prev(iter);
+        auto offset = hpa - range.hpa;
+
+        if (offset < range.num_pages * page_size_4k) {
+            return range.hva + (offset / epte_size_bytes);
+        }
+    }
+
+    throw std::runtime_error("hpa_to_hva: hpa is not owned by this pool");
+}
+
+std::size_t
+page_table_pool::size() const noexcept
+{ return m_slabs.size() * m_pages_per_slab; }
+
+std::size_t
+page_table_pool::free_count() const noexcept
+{ return m_free.size(); }
+
+void
+page_table_pool::add_slab()
+{
+    // Page tables must be 4k aligned, which new[] does not guarantee (on
+    // the host it is only 16 byte aligned), so the slab is over-allocated
+    // by a page and the tables start at the first page boundary in it.
+
+    auto bytes = m_pages_per_slab * page_size_4k;
+    m_slabs.push_back(std::make_unique<uint8_t[]>(bytes + page_size_4k - 1U));
+
+    auto addr = reinterpret_cast<uintptr_t>(m_slabs.back().get());
+    auto slab = reinterpret_cast<epte_t *>((addr + page_size_4k - 1U) & ~(page_size_4k - 1U));
+
+    m_free.reserve(m_free.size() + m_pages_per_slab);
+
+    // The slab is virtually contiguous but not necessarily physically
+    // contiguous, so one range is recorded per physically contiguous run.
+
+    range_t run{0, nullptr, 0};
+
+    for (auto i = 0ULL; i < m_pages_per_slab; i++) {
+        auto hva = &slab[i * page_table::num_entries];
+        auto hpa = g_mm->virtptr_to_physint(hva);
+
+        m_free.push_back({hva, hpa});
+
+        if (run.num_pages != 0 && run.hpa + (run.num_pages * page_size_4k) == hpa) {
+            run.num_pages++;
+            continue;
+        }
+
+        if (run.num_pages != 0) {
+            this->add_range(run);
+        }
+
+        run = {hpa, hva, 1};
+    }
+
+    this->add_range(run);
+}
+
+void
+page_table_pool::add_range(const range_t &range)
+{
+    auto iter = std::upper_bound(m_ranges.begin(), m_ranges.end(), range.hpa,
+    [](hpa_t val, const range_t &r) { return val < r.hpa; });
+
+    m_ranges.insert(iter, range);
+}
+
+}
+}
+}
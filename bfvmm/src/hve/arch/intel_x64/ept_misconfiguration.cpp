@@ -27,11 +27,13 @@ namespace intel_x64
 ept_misconfiguration::ept_misconfiguration(
     gsl::not_null<eapis::intel_x64::hve *> hve
 ) :
-    m_exit_handler{hve->exit_handler()}
+    m_exit_profile{hve->exit_profile()},
+    m_trace_ring{hve->trace_ring()},
+    m_exit_context{hve->exit_context()}
 {
     using namespace vmcs_n;
 
-    m_exit_handler->add_handler(
+    hve->add_exit_handler(
         exit_reason::basic_exit_reason::ept_misconfiguration,
         ::handler_delegate_t::create<ept_misconfiguration, &ept_misconfiguration::handle>(this)
     );
@@ -51,34 +53,34 @@ ept_misconfiguration::add_handler(handler_delegate_t &&d)
 void
 ept_misconfiguration::dump_log()
 {
-    if (!m_log.empty()) {
-        bfdebug_transaction(0, [&](std::string * msg) {
-            bfdebug_lnbr(0, msg);
-            bfdebug_info(0, "ept misconfiguration log", msg);
-            bfdebug_brk2(0, msg);
-
-            for (const auto &record : m_log) {
-                bfdebug_info(0, "record", msg);
-                bfdebug_subnhex(0, "guest virtual address", record.gva, msg);
-                bfdebug_subnhex(0, "guest physical address", record.gpa, msg);
-            }
-
-            bfdebug_lnbr(0, msg);
+    bfdebug_transaction(0, [&](std::string * msg) {
+        bfdebug_lnbr(0, msg);
+        bfdebug_info(0, "ept misconfiguration log", msg);
+        bfdebug_brk2(0, msg);
+
+        m_trace_ring->for_each(trace_ring::type_t::ept_misconfiguration, [&](const trace_ring::entry_t & record) {
+            bfdebug_info(0, "record", msg);
+            bfdebug_subnhex(0, "guest virtual address", record.data[0], msg);
+            bfdebug_subnhex(0, "guest physical address", record.data[1], msg);
         });
-    }
+
+        bfdebug_lnbr(0, msg);
+    });
 }
 
 bool
 ept_misconfiguration::handle(gsl::not_null<vmcs_t *> vmcs)
 {
+    auto probe = m_exit_profile->probe(vmcs_n::exit_reason::basic_exit_reason::ept_misconfiguration);
+
     struct info_t info = {
-        vmcs_n::guest_linear_address::get(),
-        vmcs_n::guest_physical_address::get(),
+        m_exit_context->guest_linear_address(),
+        m_exit_context->guest_physical_address(),
         false
     };
 
-    if (!ndebug && m_log_enabled) {
-        add_record(m_log, {info.gva, info.gpa});
+    if (m_log_enabled) {
+        m_trace_ring->record(trace_ring::type_t::ept_misconfiguration, info.gva, info.gpa);
     }
 
     for (const auto &d : m_handlers) {
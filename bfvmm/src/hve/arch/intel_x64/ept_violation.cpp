@@ -27,11 +27,13 @@ namespace intel_x64
 ept_violation::ept_violation(
     gsl::not_null<eapis::intel_x64::hve *> hve
 ) :
-    m_exit_handler{hve->exit_handler()}
+    m_exit_profile{hve->exit_profile()},
+    m_trace_ring{hve->trace_ring()},
+    m_exit_context{hve->exit_context()}
 {
     using namespace vmcs_n;
 
-    m_exit_handler->add_handler(
+    hve->add_exit_handler(
         exit_reason::basic_exit_reason::ept_violation,
         ::handler_delegate_t::create<ept_violation, &ept_violation::handle>(this)
     );
@@ -59,47 +61,49 @@ ept_violation::add_execute_handler(handler_delegate_t &&d)
 void
 ept_violation::dump_log()
 {
-    if (!m_log.empty()) {
-        bfdebug_transaction(0, [&](std::string * msg) {
-            bfdebug_lnbr(0, msg);
-            bfdebug_info(0, "ept violation log", msg);
-            bfdebug_brk2(0, msg);
+    namespace qual_n = vmcs_n::exit_qualification::ept_violation;
 
-            for (const auto &record : m_log) {
+    bfdebug_transaction(0, [&](std::string * msg) {
+        bfdebug_lnbr(0, msg);
+        bfdebug_info(0, "ept violation log", msg);
+        bfdebug_brk2(0, msg);
 
-                if (vmcs_n::exit_qualification::ept_violation::data_read::is_enabled(record.exit_qualification)) {
-                    bfdebug_info(0, "data read record", msg);
-                }
+        m_trace_ring->for_each(trace_ring::type_t::ept_violation, [&](const trace_ring::entry_t & record) {
 
-                if (vmcs_n::exit_qualification::ept_violation::data_write::is_enabled(record.exit_qualification)) {
-                    bfdebug_info(0, "data write record", msg);
-                }
+            if (qual_n::data_read::is_enabled(record.data[2])) {
+                bfdebug_info(0, "data read record", msg);
+            }
 
-                if (vmcs_n::exit_qualification::ept_violation::instruction_fetch::is_enabled(record.exit_qualification)) {
-                    bfdebug_info(0, "instruction fetch record", msg);
-                }
+            if (qual_n::data_write::is_enabled(record.data[2])) {
+                bfdebug_info(0, "data write record", msg);
+            }
 
-                bfdebug_subnhex(0, "guest virtual address", record.gva, msg);
-                bfdebug_subnhex(0, "guest physical address", record.gpa, msg);
+            if (qual_n::instruction_fetch::is_enabled(record.data[2])) {
+                bfdebug_info(0, "instruction fetch record", msg);
             }
 
-            bfdebug_lnbr(0, msg);
+            bfdebug_subnhex(0, "guest virtual address", record.data[0], msg);
+            bfdebug_subnhex(0, "guest physical address", record.data[1], msg);
         });
-    }
+
+        bfdebug_lnbr(0, msg);
+    });
 }
 
 bool
 ept_violation::handle(gsl::not_null<vmcs_t *> vmcs)
 {
     using namespace vmcs_n;
-    auto qual = exit_qualification::ept_violation::get();
+    auto probe = m_exit_profile->probe(exit_reason::basic_exit_reason::ept_violation);
+
+    auto qual = m_exit_context->exit_qualification();
     auto read_access = exit_qualification::ept_violation::data_read::is_enabled(qual);
     auto write_access = exit_qualification::ept_violation::data_write::is_enabled(qual);
     auto execute_access = exit_qualification::ept_violation::instruction_fetch::is_enabled(qual);
 
     struct info_t info = {
-        guest_linear_address::get(),
-        guest_physical_address::get(),
+        m_exit_context->guest_linear_address(),
+        m_exit_context->guest_physical_address(),
         qual,
         false
     };
@@ -137,8 +141,10 @@ ept_violation::handle(gsl::not_null<vmcs_t *> vmcs)
 bool
 ept_violation::handle_read(gsl::not_null<vmcs_t *> vmcs, info_t &info)
 {
-    if (!ndebug && m_log_enabled) {
-        add_record(m_log, {info.gva, info.gpa, info.exit_qualification});
+    if (m_log_enabled) {
+        m_trace_ring->record(
+            trace_ring::type_t::ept_violation, info.gva, info.gpa, info.exit_qualification
+        );
     }
 
     for (const auto &d : m_read_handlers) {
@@ -159,8 +165,10 @@ ept_violation::handle_read(gsl::not_null<vmcs_t *> vmcs, info_t &info)
 bool
 ept_violation::handle_write(gsl::not_null<vmcs_t *> vmcs, info_t &info)
 {
-    if (!ndebug && m_log_enabled) {
-        add_record(m_log, {info.gva, info.gpa, info.exit_qualification});
+    if (m_log_enabled) {
+        m_trace_ring->record(
+            trace_ring::type_t::ept_violation, info.gva, info.gpa, info.exit_qualification
+        );
     }
 
     for (const auto &d : m_write_handlers) {
@@ -181,8 +189,10 @@ ept_violation::handle_write(gsl::not_null<vmcs_t *> vmcs, info_t &info)
 bool
 ept_violation::handle_execute(gsl::not_null<vmcs_t *> vmcs, info_t &info)
 {
-    if (!ndebug && m_log_enabled) {
-        add_record(m_log, {info.gva, info.gpa, info.exit_qualification});
+    if (m_log_enabled) {
+        m_trace_ring->record(
+            trace_ring::type_t::ept_violation, info.gva, info.gpa, info.exit_qualification
+        );
     }
 
     for (const auto &d : m_execute_handlers) {
@@ -0,0 +1,55 @@
+//
+// Bareflank Extended APIs
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <bfdebug.h>
+#include <hve/arch/intel_x64/exit_context.h>
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+exit_context::~exit_context()
+{
+    if (!ndebug && m_log_enabled) {
+        dump_log();
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Debug
+// -----------------------------------------------------------------------------
+
+void
+exit_context::dump_log()
+{
+    bfdebug_transaction(0, [&](std::string * msg) {
+        bfdebug_lnbr(0, msg);
+        bfdebug_info(0, "exit context", msg);
+        bfdebug_brk2(0, msg);
+
+        bfdebug_subndec(0, "exits", m_stats.exits, msg);
+        bfdebug_subndec(0, "vmreads", m_stats.vmreads, msg);
+        bfdebug_subndec(0, "vmreads saved", m_stats.hits, msg);
+
+        bfdebug_lnbr(0, msg);
+    });
+}
+
+}
+}
@@ -0,0 +1,112 @@
+//
+// Bareflank Extended APIs
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <bfdebug.h>
+#include <hve/arch/intel_x64/exit_profile.h>
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+exit_profile::~exit_profile()
+{
+    if (!ndebug && m_log_enabled) {
+        dump_log();
+    }
+}
+
+void
+exit_profile::reset()
+{
+    m_reasons.fill({});
+    m_keys.clear();
+}
+
+const exit_profile::histogram_t &
+exit_profile::reason_histogram(uint64_t reason) const
+{
+    expects(reason < reason_count);
+    return m_reasons.at(reason);
+}
+
+const exit_profile::histogram_t *
+exit_profile::key_histogram(uint64_t reason, key_t key) const
+{
+    const auto iter = m_keys.find(make_key(reason, key));
+    if (iter != m_keys.end()) {
+        return &iter->second;
+    }
+
+    return nullptr;
+}
+
+// -----------------------------------------------------------------------------
+// Debug
+// -----------------------------------------------------------------------------
+
+static void
+dump_histogram(const exit_profile::histogram_t &hist, std::string *msg)
+{
+    bfdebug_subndec(0, "count", hist.count, msg);
+    bfdebug_subndec(0, "mean", hist.total / hist.count, msg);
+    bfdebug_subndec(0, "max", hist.max, msg);
+
+    for (auto i = 0U; i < exit_profile::bucket_count; ++i) {
+        if (hist.buckets.at(i) != 0U) {
+            const auto bucket = "< 2^" + std::to_string(i + 1U);
+            bfdebug_subndec(0, bucket.c_str(), hist.buckets.at(i), msg);
+        }
+    }
+}
+
+void
+exit_profile::dump_log()
+{
+    bfdebug_transaction(0, [&](std::string * msg) {
+        bfdebug_lnbr(0, msg);
+        bfdebug_info(0, "exit profile", msg);
+        bfdebug_brk2(0, msg);
+
+        for (auto reason = 0ULL; reason < reason_count; ++reason) {
+            if (m_reasons.at(reason).count == 0U) {
+                continue;
+            }
+
+            bfdebug_info(0, "reason", msg);
+            bfdebug_subnhex(0, "reason", reason, msg);
+            dump_histogram(m_reasons.at(reason), msg);
+
+            for (const auto &key : m_keys) {
+                if ((key.first >> 32U) != reason) {
+                    continue;
+                }
+
+                bfdebug_info(0, "key", msg);
+                bfdebug_subnhex(0, "reason", reason, msg);
+                bfdebug_subnhex(0, "key", key.first & 0xFFFFFFFFULL, msg);
+                dump_histogram(key.second, msg);
+            }
+        }
+
+        bfdebug_lnbr(0, msg);
+    });
+}
+
+}
+}
@@ -24,11 +24,14 @@ namespace eapis
 namespace intel_x64
 {
 
-external_interrupt::external_interrupt(gsl::not_null<eapis::intel_x64::hve *> hve)
+external_interrupt::external_interrupt(gsl::not_null<eapis::intel_x64::hve *> hve) :
+    m_exit_profile{hve->exit_profile()},
+    m_trace_ring{hve->trace_ring()},
+    m_exit_context{hve->exit_context()}
 {
     using namespace vmcs_n;
 
-    hve->exit_handler()->add_handler(
+    hve->add_exit_handler(
         exit_reason::basic_exit_reason::external_interrupt,
         ::handler_delegate_t::create<external_interrupt, &external_interrupt::handle>(this)
     );
@@ -90,11 +93,16 @@ bool
 external_interrupt::handle(gsl::not_null<vmcs_t *> vmcs)
 {
     struct info_t info = {
-        vmcs_n::vm_exit_interruption_information::vector::get()
+        vmcs_n::vm_exit_interruption_information::vector::get(
+            m_exit_context->vm_exit_interruption_information()
+        )
     };
 
-    if (!ndebug && m_log_enabled) {
+    auto probe = m_exit_profile->probe(vmcs_n::exit_reason::basic_exit_reason::external_interrupt, info.vector);
+
+    if (m_log_enabled) {
         m_log.at(info.vector)++;
+        m_trace_ring->record(trace_ring::type_t::external_interrupt, info.vector);
     }
 
     for (const auto &d : m_handlers.at(info.vector)) {
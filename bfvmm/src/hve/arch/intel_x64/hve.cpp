@@ -29,6 +29,9 @@ hve::hve(
     gsl::not_null<exit_handler_t *> exit_handler,
     gsl::not_null<vmcs_t *> vmcs
 ) :
+    m_exit_profile{std::make_unique<eapis::intel_x64::exit_profile>()},
+    m_trace_ring{std::make_unique<eapis::intel_x64::trace_ring>()},
+    m_exit_context{std::make_unique<eapis::intel_x64::exit_context>()},
     m_exit_handler{exit_handler},
     m_vmcs{vmcs}
 { }
@@ -41,6 +44,47 @@ gsl::not_null<vmcs_t *>
 hve::vmcs()
 { return m_vmcs; }
 
+void
+hve::add_exit_handler(vmcs_n::value_type reason, ::handler_delegate_t &&d)
+{
+    m_exit_handler->add_handler(reason, std::move(d));
+
+    m_exit_handler->add_handler(
+        reason,
+        ::handler_delegate_t::create<hve, &hve::handle_exit_begin>(this)
+    );
+}
+
+bool
+hve::handle_exit_begin(gsl::not_null<vmcs_t *> vmcs)
+{
+    bfignored(vmcs);
+
+    m_exit_context->begin();
+    return false;
+}
+
+//--------------------------------------------------------------------------
+// Exit Profile
+//--------------------------------------------------------------------------
+
+gsl::not_null<eapis::intel_x64::exit_profile *> hve::exit_profile()
+{ return m_exit_profile.get(); }
+
+//--------------------------------------------------------------------------
+// Trace Ring
+//--------------------------------------------------------------------------
+
+gsl::not_null<eapis::intel_x64::trace_ring *> hve::trace_ring()
+{ return m_trace_ring.get(); }
+
+//--------------------------------------------------------------------------
+// Exit Context
+//--------------------------------------------------------------------------
+
+gsl::not_null<eapis::intel_x64::exit_context *> hve::exit_context()
+{ return m_exit_context.get(); }
+
 //--------------------------------------------------------------------------
 // Control Register
 //--------------------------------------------------------------------------
@@ -98,6 +142,19 @@ void hve::add_wrcr8_handler(control_register::handler_delegate_t &&d)
     m_control_register->add_wrcr8_handler(std::move(d));
 }
 
+void hve::disable_cr8_exiting()
+{
+    if (m_is_rdcr8_enabled) {
+        m_is_rdcr8_enabled = false;
+        m_control_register->disable_rdcr8_exiting();
+    }
+
+    if (m_is_wrcr8_enabled) {
+        m_is_wrcr8_enabled = false;
+        m_control_register->disable_wrcr8_exiting();
+    }
+}
+
 //--------------------------------------------------------------------------
 // CPUID
 //--------------------------------------------------------------------------
@@ -108,13 +165,39 @@ gsl::not_null<cpuid *> hve::cpuid()
 void hve::add_cpuid_handler(
     cpuid::leaf_t leaf, cpuid::subleaf_t subleaf, cpuid::handler_delegate_t &&d)
 {
-    if (!m_cpuid) {
-        m_cpuid = std::make_unique<eapis::intel_x64::cpuid>(this);
-    }
-
+    check_cpuid();
     m_cpuid->add_handler(leaf, subleaf, std::move(d));
 }
 
+void hve::add_cpuid_handler(
+    cpuid::leaf_t leaf, cpuid::handler_delegate_t &&d)
+{
+    check_cpuid();
+    m_cpuid->add_handler(leaf, std::move(d));
+}
+
+void hve::force_cpuid_set_bits(
+    cpuid::leaf_t leaf, cpuid::subleaf_t subleaf, cpuid::reg_t reg, uint64_t bits)
+{
+    check_cpuid();
+    m_cpuid->force_set_bits(leaf, subleaf, reg, bits);
+}
+
+void hve::force_cpuid_clear_bits(
+    cpuid::leaf_t leaf, cpuid::subleaf_t subleaf, cpuid::reg_t reg, uint64_t bits)
+{
+    check_cpuid();
+    m_cpuid->force_clear_bits(leaf, subleaf, reg, bits);
+}
+
+void hve::force_cpuid_value(
+    cpuid::leaf_t leaf, cpuid::subleaf_t subleaf,
+    uint64_t rax, uint64_t rbx, uint64_t rcx, uint64_t rdx)
+{
+    check_cpuid();
+    m_cpuid->force_value(leaf, subleaf, rax, rbx, rcx, rdx);
+}
+
 //--------------------------------------------------------------------------
 // External Interrupt
 //--------------------------------------------------------------------------
@@ -171,6 +254,20 @@ void hve::add_io_instruction_handler(
     m_io_instruction->add_handler(port, std::move(in_d), std::move(out_d));
 }
 
+void hve::add_io_instruction_string_handler(
+    vmcs_n::value_type port,
+    io_instruction::string_handler_delegate_t &&in_d,
+    io_instruction::string_handler_delegate_t &&out_d)
+{
+    check_io_bitmaps();
+
+    if (!m_io_instruction) {
+        m_io_instruction = std::make_unique<eapis::intel_x64::io_instruction>(this);
+    }
+
+    m_io_instruction->add_string_handler(port, std::move(in_d), std::move(out_d));
+}
+
 //--------------------------------------------------------------------------
 // Monitor Trap
 //--------------------------------------------------------------------------
@@ -359,6 +456,13 @@ void hve::check_wrcr8()
     }
 }
 
+void hve::check_cpuid()
+{
+    if (!m_cpuid) {
+        m_cpuid = std::make_unique<eapis::intel_x64::cpuid>(this);
+    }
+}
+
 void hve::check_io_bitmaps()
 {
     using namespace vmcs_n;
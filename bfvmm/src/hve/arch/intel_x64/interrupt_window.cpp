@@ -24,11 +24,12 @@ namespace eapis
 namespace intel_x64
 {
 
-interrupt_window::interrupt_window(gsl::not_null<eapis::intel_x64::hve *> hve)
+interrupt_window::interrupt_window(gsl::not_null<eapis::intel_x64::hve *> hve) :
+    m_exit_profile{hve->exit_profile()}
 {
     using namespace vmcs_n;
 
-    hve->exit_handler()->add_handler(
+    hve->add_exit_handler(
         exit_reason::basic_exit_reason::interrupt_window,
         ::handler_delegate_t::create<interrupt_window, &interrupt_window::handle>(this)
     );
@@ -116,6 +117,8 @@ interrupt_window::dump_log()
 bool
 interrupt_window::handle(gsl::not_null<vmcs_t *> vmcs)
 {
+    auto probe = m_exit_profile->probe(vmcs_n::exit_reason::basic_exit_reason::interrupt_window);
+
     for (const auto &d : m_handlers) {
         if (d(vmcs)) {
             return true;
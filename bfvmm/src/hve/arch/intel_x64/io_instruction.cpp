@@ -16,6 +16,8 @@
 // License along with this library; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
+#include <cstring>
+
 #include <bfdebug.h>
 #include <hve/arch/intel_x64/hve.h>
 
@@ -28,11 +30,13 @@ namespace intel_x64
 
 io_instruction::io_instruction(gsl::not_null<eapis::intel_x64::hve *> hve) :
     m_io_bitmaps{hve->io_bitmaps()},
-    m_exit_handler{hve->exit_handler()}
+    m_exit_profile{hve->exit_profile()},
+    m_trace_ring{hve->trace_ring()},
+    m_exit_context{hve->exit_context()}
 {
     using namespace vmcs_n;
 
-    m_exit_handler->add_handler(
+    hve->add_exit_handler(
         exit_reason::basic_exit_reason::io_instruction,
         ::handler_delegate_t::create<io_instruction, &io_instruction::handle>(this)
     );
@@ -59,6 +63,16 @@ io_instruction::add_handler(
     m_out_handlers[port].push_front(std::move(out_d));
 }
 
+void
+io_instruction::add_string_handler(
+    vmcs_n::value_type port, string_handler_delegate_t &&in_d, string_handler_delegate_t &&out_d)
+{
+    trap_on_access(port);
+
+    m_in_string_handlers[port].push_front(std::move(in_d));
+    m_out_string_handlers[port].push_front(std::move(out_d));
+}
+
 void
 io_instruction::trap_on_access(vmcs_n::value_type port)
 {
@@ -101,14 +115,14 @@ io_instruction::dump_log()
         bfdebug_info(0, "io instruction log", msg);
         bfdebug_brk2(0, msg);
 
-        for (const auto &record : m_log) {
+        m_trace_ring->for_each(trace_ring::type_t::io_instruction, [&](const trace_ring::entry_t & record) {
             bfdebug_info(0, "record", msg);
-            bfdebug_subnhex(0, "port_number", record.port_number, msg);
-            bfdebug_subnhex(0, "size_of_access", record.size_of_access, msg);
-            bfdebug_subnhex(0, "direction_of_access", record.direction_of_access, msg);
-            bfdebug_subnhex(0, "address", record.address, msg);
-            bfdebug_subnhex(0, "val", record.val, msg);
-        }
+            bfdebug_subnhex(0, "port_number", record.data[0], msg);
+            bfdebug_subnhex(0, "size_of_access", record.data[1], msg);
+            bfdebug_subnhex(0, "direction_of_access", record.data[2], msg);
+            bfdebug_subnhex(0, "address", record.data[3], msg);
+            bfdebug_subnhex(0, "val", record.data[4], msg);
+        });
 
         bfdebug_lnbr(0, msg);
     });
@@ -122,12 +136,8 @@ bool
 io_instruction::handle(gsl::not_null<vmcs_t *> vmcs)
 {
     namespace io_instruction = vmcs_n::exit_qualification::io_instruction;
-    auto eq = io_instruction::get();
 
-    auto reps = 1ULL;
-    if (io_instruction::rep_prefixed::is_enabled(eq)) {
-        reps = vmcs->save_state()->rcx & 0x00000000FFFFFFFFULL;
-    }
+    auto eq = m_exit_context->exit_qualification();
 
     struct info_t info = {
         0ULL,
@@ -148,102 +158,256 @@ io_instruction::handle(gsl::not_null<vmcs_t *> vmcs)
             break;
     }
 
+    auto probe = m_exit_profile->probe(vmcs_n::exit_reason::basic_exit_reason::io_instruction, info.port_number);
+
+    const auto in =
+        io_instruction::direction_of_access::get(eq) ==
+        io_instruction::direction_of_access::in;
+
+    auto &handlers = in ? m_in_handlers : m_out_handlers;
+
+    const auto &hdlrs = handlers.find(info.port_number);
+    if (GSL_UNLIKELY(hdlrs == handlers.end())) {
+        throw std::runtime_error(
+            "io_instruction::handle: unhandled io instruction #" + std::to_string(info.port_number));
+    }
+
     if (io_instruction::string_instruction::is_enabled(eq)) {
-        info.address = vmcs_n::guest_linear_address::get();
+        return handle_string(vmcs, hdlrs->second, in, info);
     }
 
-    for (auto i = 0ULL; i < reps; i++) {
-        switch (io_instruction::direction_of_access::get(eq)) {
-            case io_instruction::direction_of_access::in:
-                handle_in(vmcs, info);
-                break;
+    if (in) {
+        if (handle_in(vmcs, hdlrs->second, info) && !info.ignore_write) {
+            store_operand(vmcs, info);
+        }
+    }
+    else {
+        load_operand(vmcs, info);
 
-            default:
-                handle_out(vmcs, info);
-                break;
+        if (handle_out(vmcs, hdlrs->second, info) && !info.ignore_write) {
+            emulate_out(info);
         }
+    }
 
-        info.address += info.size_of_access + 1ULL;
+    if (!info.ignore_advance) {
+        return advance(vmcs);
     }
 
     return true;
 }
 
 bool
-io_instruction::handle_in(gsl::not_null<vmcs_t *> vmcs, info_t &info)
+io_instruction::handle_string(
+    gsl::not_null<vmcs_t *> vmcs, const handlers_t &hdlrs, bool in, info_t &info)
 {
     namespace io_instruction = vmcs_n::exit_qualification::io_instruction;
+    auto eq = m_exit_context->exit_qualification();
+
+    // The count and index registers are CX/SI/DI, ECX/ESI/EDI or
+    // RCX/RSI/RDI depending on the address size of the instruction
+
+    const auto mask = string_address_mask(m_exit_context->vm_exit_instruction_information());
+
+    auto count = 1ULL;
+    if (io_instruction::rep_prefixed::is_enabled(eq)) {
+        count = vmcs->save_state()->rcx & mask;
+    }
+
+    const auto bytes = info.size_of_access + 1ULL;
+    const auto reverse = vmcs_n::guest_rflags::direction_flag::is_enabled();
+
+    auto &string_handlers = in ? m_in_string_handlers : m_out_string_handlers;
+    const auto &string_hdlrs = string_handlers.find(info.port_number);
+
+    auto ignore_advance = false;
+    auto address = m_exit_context->guest_linear_address();
+
+    for (auto remaining = count; remaining > 0;) {
+
+        // Note:
+        //
+        // Each iteration handles every element that starts in the page
+        // containing address, so the guest's buffer is mapped once per
+        // page. The last element might straddle the page boundary, which
+        // is why the mapping is sized by element and not by page.
+        //
+
+        const auto chunk = string_chunk(address, remaining, bytes, reverse);
+        const auto lowest = chunk.lowest;
+        const auto num = chunk.num;
+        const auto size = num * bytes;
 
-    const auto &hdlrs =
-        m_in_handlers.find(info.port_number);
+        auto map = bfvmm::x64::make_unique_map<uint8_t>(
+                       lowest, vmcs_n::guest_cr3::get(), size, vmcs_n::guest_ia32_pat::get()
+                   );
 
-    if (GSL_LIKELY(hdlrs != m_in_handlers.end())) {
-        emulate_in(info);
+        auto buffer = gsl::make_span(map.get(), gsl::narrow_cast<std::ptrdiff_t>(size));
+        auto handled = false;
 
-        if (!ndebug && m_log_enabled) {
-            add_record(m_log, {
+        if (string_hdlrs != string_handlers.end()) {
+            struct string_info_t string_info = {
                 info.port_number,
                 info.size_of_access,
-                io_instruction::direction_of_access::in,
-                info.address,
-                info.val
-            });
-        }
+                lowest,
+                buffer,
+                num,
+                reverse,
+                false
+            };
+
+            for (const auto &d : string_hdlrs->second) {
+                if (d(vmcs, string_info)) {
+                    handled = true;
+                    break;
+                }
+            }
+
+            if (handled && !in && !string_info.ignore_write) {
+                for (auto i = 0ULL; i < num; i++) {
+                    const auto index = reverse ? (num - i - 1) * bytes : i * bytes;
 
-        for (const auto &d : hdlrs->second) {
-            if (d(vmcs, info)) {
+                    info.val = 0;
+                    std::memcpy(&info.val, &buffer.at(gsl::narrow_cast<std::ptrdiff_t>(index)), bytes);
 
-                if (!info.ignore_write) {
-                    store_operand(vmcs, info);
+                    emulate_out(info);
                 }
+            }
+        }
+
+        for (auto i = 0ULL; !handled && i < num; i++) {
+            const auto index = reverse ? (num - i - 1) * bytes : i * bytes;
+            auto element = &buffer.at(gsl::narrow_cast<std::ptrdiff_t>(index));
 
-                if (!info.ignore_advance) {
-                    return advance(vmcs);
+            info.address = lowest + index;
+            info.val = 0;
+            info.ignore_write = false;
+
+            if (in) {
+                if (handle_in(vmcs, hdlrs, info) && !info.ignore_write) {
+                    std::memcpy(element, &info.val, bytes);
                 }
+            }
+            else {
+                std::memcpy(&info.val, element, bytes);
 
-                return true;
+                if (handle_out(vmcs, hdlrs, info) && !info.ignore_write) {
+                    emulate_out(info);
+                }
             }
+
+            ignore_advance = ignore_advance || info.ignore_advance;
         }
+
+        address = reverse ? address - size : address + size;
+        remaining -= num;
     }
 
-    throw std::runtime_error(
-        "io_instruction::handle_in: unhandled io instruction #" + std::to_string(info.port_number));
+    auto &index_reg = in ? vmcs->save_state()->rdi : vmcs->save_state()->rsi;
+    index_reg = string_index(index_reg, count * bytes, reverse, mask);
+
+    if (io_instruction::rep_prefixed::is_enabled(eq)) {
+        vmcs->save_state()->rcx = set_bits(vmcs->save_state()->rcx, mask, 0ULL);
+    }
+
+    if (!ignore_advance) {
+        return advance(vmcs);
+    }
+
+    return true;
 }
 
+// Each chunk is every element that starts in the page containing address
+// (walking down from address when reverse is set), limited to remaining
+
+io_instruction::string_chunk_t
+io_instruction::string_chunk(
+    uint64_t address, uint64_t remaining, uint64_t bytes, bool reverse) noexcept
+{
+    const auto offset = address & (::x64::page_size - 1);
+    auto num = reverse ?
+               (offset / bytes) + 1 :
+               (::x64::page_size - offset + bytes - 1) / bytes;
+
+    num = num < remaining ? num : remaining;
+
+    return {reverse ? address - ((num - 1) * bytes) : address, num};
+}
+
+// Address size of INS/OUTS (bits 9:7 of the VM-exit instruction
+// information): 0 is 16 bit, 1 is 32 bit and 2 is 64 bit
+
+uint64_t
+io_instruction::string_address_mask(uint64_t insn_info) noexcept
+{
+    switch ((insn_info >> 7U) & 0x7U) {
+        case 0U:
+            return 0x000000000000FFFFULL;
+
+        case 1U:
+            return 0x00000000FFFFFFFFULL;
+
+        default:
+            return 0xFFFFFFFFFFFFFFFFULL;
+    }
+}
+
+// Only the address-size part of an index register moves (and wraps); the
+// bits above it are kept
+
+uint64_t
+io_instruction::string_index(
+    uint64_t reg, uint64_t delta, bool reverse, uint64_t mask) noexcept
+{ return set_bits(reg, mask, reverse ? reg - delta : reg + delta); }
+
 bool
-io_instruction::handle_out(gsl::not_null<vmcs_t *> vmcs, info_t &info)
+io_instruction::handle_in(
+    gsl::not_null<vmcs_t *> vmcs, const handlers_t &hdlrs, info_t &info)
 {
     namespace io_instruction = vmcs_n::exit_qualification::io_instruction;
 
-    const auto &hdlrs =
-        m_in_handlers.find(info.port_number);
-
-    if (GSL_LIKELY(hdlrs != m_in_handlers.end())) {
-        load_operand(vmcs, info);
+    emulate_in(info);
+
+    if (m_log_enabled) {
+        m_trace_ring->record(
+            trace_ring::type_t::io_instruction,
+            info.port_number,
+            info.size_of_access,
+            io_instruction::direction_of_access::in,
+            info.address,
+            info.val
+        );
+    }
 
-        if (!ndebug && m_log_enabled) {
-            add_record(m_log, {
-                info.port_number,
-                info.size_of_access,
-                io_instruction::direction_of_access::out,
-                info.address,
-                info.val
-            });
+    for (const auto &d : hdlrs) {
+        if (d(vmcs, info)) {
+            return true;
         }
+    }
 
-        for (const auto &d : hdlrs->second) {
-            if (d(vmcs, info)) {
+    throw std::runtime_error(
+        "io_instruction::handle_in: unhandled io instruction #" + std::to_string(info.port_number));
+}
 
-                if (!info.ignore_write) {
-                    emulate_out(info);
-                }
+bool
+io_instruction::handle_out(
+    gsl::not_null<vmcs_t *> vmcs, const handlers_t &hdlrs, info_t &info)
+{
+    namespace io_instruction = vmcs_n::exit_qualification::io_instruction;
 
-                if (!info.ignore_advance) {
-                    return advance(vmcs);
-                }
+    if (m_log_enabled) {
+        m_trace_ring->record(
+            trace_ring::type_t::io_instruction,
+            info.port_number,
+            info.size_of_access,
+            io_instruction::direction_of_access::out,
+            info.address,
+            info.val
+        );
+    }
 
-                return true;
-            }
+    for (const auto &d : hdlrs) {
+        if (d(vmcs, info)) {
+            return true;
         }
     }
 
@@ -306,53 +470,18 @@ io_instruction::load_operand(
 {
     namespace io_instruction = vmcs_n::exit_qualification::io_instruction;
 
-    if (info.address != 0ULL) {
-        switch (info.size_of_access) {
-            case io_instruction::size_of_access::one_byte: {
-                auto map = bfvmm::x64::make_unique_map<uint8_t>(
-                               info.address, vmcs_n::guest_cr3::get(),
-                               info.size_of_access, vmcs_n::guest_ia32_pat::get()
-                           );
-
-                info.val = map.get()[0] & 0x00000000000000FFULL;
-                break;
-            }
-
-            case io_instruction::size_of_access::two_byte: {
-                auto map = bfvmm::x64::make_unique_map<uint16_t>(
-                               info.address, vmcs_n::guest_cr3::get(),
-                               info.size_of_access, vmcs_n::guest_ia32_pat::get()
-                           );
-
-                info.val = map.get()[0] & 0x000000000000FFFFULL;
-                break;
-            }
+    switch (info.size_of_access) {
+        case io_instruction::size_of_access::one_byte:
+            info.val = vmcs->save_state()->rax & 0x00000000000000FFULL;
+            break;
 
-            default: {
-                auto map = bfvmm::x64::make_unique_map<uint32_t>(
-                               info.address, vmcs_n::guest_cr3::get(),
-                               info.size_of_access, vmcs_n::guest_ia32_pat::get()
-                           );
+        case io_instruction::size_of_access::two_byte:
+            info.val = vmcs->save_state()->rax & 0x000000000000FFFFULL;
+            break;
 
-                info.val = map.get()[0] & 0x00000000FFFFFFFFULL;
-                break;
-            }
-        }
-    }
-    else {
-        switch (info.size_of_access) {
-            case io_instruction::size_of_access::one_byte:
-                info.val = vmcs->save_state()->rax & 0x00000000000000FFULL;
-                break;
-
-            case io_instruction::size_of_access::two_byte:
-                info.val = vmcs->save_state()->rax & 0x000000000000FFFFULL;
-                break;
-
-            default:
-                info.val = vmcs->save_state()->rax & 0x00000000FFFFFFFFULL;
-                break;
-        }
+        default:
+            info.val = vmcs->save_state()->rax & 0x00000000FFFFFFFFULL;
+            break;
     }
 }
 
@@ -362,56 +491,21 @@ io_instruction::store_operand(
 {
     namespace io_instruction = vmcs_n::exit_qualification::io_instruction;
 
-    if (info.address != 0ULL) {
-        switch (info.size_of_access) {
-            case io_instruction::size_of_access::one_byte: {
-                auto map = bfvmm::x64::make_unique_map<uint8_t>(
-                               info.address, vmcs_n::guest_cr3::get(),
-                               info.size_of_access, vmcs_n::guest_ia32_pat::get()
-                           );
-
-                map.get()[0] = gsl::narrow_cast<uint8_t>(info.val);
-                break;
-            }
-
-            case io_instruction::size_of_access::two_byte: {
-                auto map = bfvmm::x64::make_unique_map<uint16_t>(
-                               info.address, vmcs_n::guest_cr3::get(),
-                               info.size_of_access, vmcs_n::guest_ia32_pat::get()
-                           );
-
-                map.get()[0] = gsl::narrow_cast<uint16_t>(info.val);
-                break;
-            }
+    switch (info.size_of_access) {
+        case io_instruction::size_of_access::one_byte:
+            vmcs->save_state()->rax = set_bits(
+                                          vmcs->save_state()->rax, 0x00000000000000FFULL, info.val);
+            break;
 
-            default: {
-                auto map = bfvmm::x64::make_unique_map<uint32_t>(
-                               info.address, vmcs_n::guest_cr3::get(),
-                               info.size_of_access, vmcs_n::guest_ia32_pat::get()
-                           );
+        case io_instruction::size_of_access::two_byte:
+            vmcs->save_state()->rax = set_bits(
+                                          vmcs->save_state()->rax, 0x000000000000FFFFULL, info.val);
+            break;
 
-                map.get()[0] = gsl::narrow_cast<uint32_t>(info.val);
-                break;
-            }
-        }
-    }
-    else {
-        switch (info.size_of_access) {
-            case io_instruction::size_of_access::one_byte:
-                vmcs->save_state()->rax = set_bits(
-                                              vmcs->save_state()->rax, 0x00000000000000FFULL, info.val);
-                break;
-
-            case io_instruction::size_of_access::two_byte:
-                vmcs->save_state()->rax = set_bits(
-                                              vmcs->save_state()->rax, 0x000000000000FFFFULL, info.val);
-                break;
-
-            default:
-                vmcs->save_state()->rax = set_bits(
-                                              vmcs->save_state()->rax, 0x00000000FFFFFFFFULL, info.val);
-                break;
-        }
+        default:
+            vmcs->save_state()->rax = set_bits(
+                                          vmcs->save_state()->rax, 0x00000000FFFFFFFFULL, info.val);
+            break;
     }
 }
 
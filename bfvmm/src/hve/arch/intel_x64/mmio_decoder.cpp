@@ -0,0 +1,239 @@
+//
+// Bareflank Hypervisor
+// Copyright (C) 2017 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <algorithm>
+
+#include <hve/arch/intel_x64/mmio_decoder.h>
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+constexpr const auto opcode_mov_store = 0x89U;
+constexpr const auto opcode_mov_load = 0x8BU;
+constexpr const auto opcode_mov_imm = 0xC7U;
+
+constexpr const auto rex_w = 0x08U;
+constexpr const auto rex_r = 0x04U;
+
+static inline bool
+is_segment_override(uint8_t byte) noexcept
+{
+    switch (byte) {
+        case 0x26U:
+        case 0x2EU:
+        case 0x36U:
+        case 0x3EU:
+        case 0x64U:
+        case 0x65U:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static inline bool
+is_rex(uint8_t byte) noexcept
+{ return (byte & 0xF0U) == 0x40U; }
+
+uint64_t
+mmio_decoder::cache_index(uint64_t rip) noexcept
+{ return (rip ^ (rip >> 5U)) & (cache_size - 1U); }
+
+bool
+mmio_decoder::decode(
+    gsl::span<const uint8_t> bytes, bool long_mode, insn_t &insn)
+{
+    const auto data = bytes.data();
+    const auto size = static_cast<uint64_t>(bytes.size());
+
+    auto i = 0ULL;
+    auto rex = 0ULL;
+
+    while (i < size && is_segment_override(data[i])) {
+        ++i;
+    }
+
+    if (long_mode && i < size && is_rex(data[i])) {
+        rex = data[i++];
+    }
+
+    // REX.W makes the access 64 bits wide, which no 32-bit MMIO register
+    // supports; operand- and address-size prefixes are rejected as
+    // unknown opcodes
+
+    if ((rex & rex_w) != 0U || i + 2U > size) {
+        return false;
+    }
+
+    const uint64_t opcode = data[i++];
+    const uint64_t modrm = data[i++];
+
+    const auto mod = modrm >> 6U;
+    const auto reg = ((modrm >> 3U) & 0x7U) | (((rex & rex_r) != 0U) ? 0x8U : 0x0U);
+    const auto rm = modrm & 0x7U;
+
+    switch (opcode) {
+        case opcode_mov_store:
+            insn.write = true;
+            insn.imm_src = false;
+            break;
+
+        case opcode_mov_load:
+            insn.write = false;
+            insn.imm_src = false;
+            break;
+
+        case opcode_mov_imm:
+            if ((reg & 0x7U) != 0U) {
+                return false;
+            }
+
+            insn.write = true;
+            insn.imm_src = true;
+            break;
+
+        default:
+            return false;
+    }
+
+    // The address itself is not needed (the exit provides it), only the
+    // length of the memory operand: SIB byte and displacement
+
+    if (mod == 3U) {
+        return false;
+    }
+
+    auto disp = 0ULL;
+
+    if (rm == 4U) {
+        if (i >= size) {
+            return false;
+        }
+
+        if (mod == 0U && (data[i] & 0x7U) == 5U) {
+            disp = 4U;
+        }
+
+        ++i;
+    }
+
+    if (mod == 0U && rm == 5U) {
+        disp = 4U;
+    }
+
+    if (mod == 1U) {
+        disp = 1U;
+    }
+
+    if (mod == 2U) {
+        disp = 4U;
+    }
+
+    i += disp;
+    insn.imm = 0U;
+
+    if (insn.imm_src) {
+        if (i + 4U > size) {
+            return false;
+        }
+
+        for (auto b = 0U; b < 4U; ++b) {
+            insn.imm |= static_cast<uint64_t>(data[i + b]) << (b * 8U);
+        }
+
+        i += 4U;
+    }
+
+    if (i > size) {
+        return false;
+    }
+
+    insn.len = i;
+    insn.reg = insn.imm_src ? 0U : reg;
+
+    return true;
+}
+
+const mmio_decoder::insn_t &
+mmio_decoder::decode(gsl::not_null<vmcs_t *> vmcs, bool write)
+{
+    const auto rip = vmcs_n::guest_cs_base::get() + vmcs->save_state()->rip;
+    const auto cr3 = vmcs_n::guest_cr3::get();
+
+    // RIP and CR3 do not identify the code, as the guest can patch it.
+    // The entry's mapping still points at the bytes it was decoded from,
+    // so a hit only has to compare them, without a page walk.
+
+    auto &entry = m_cache.at(cache_index(rip));
+
+    if (entry.valid && entry.rip == rip && entry.cr3 == cr3 && entry.insn.write == write &&
+        std::equal(entry.code, entry.code + entry.insn.len, entry.bytes.begin())) {
+        ++m_hits;
+        return entry.insn;
+    }
+
+    ++m_misses;
+    entry.valid = false;
+
+    const auto long_mode = vmcs_n::guest_cs_access_rights::l::is_enabled();
+    const auto page_left = ::x64::page_size - (rip & (::x64::page_size - 1U));
+
+    insn_t insn{};
+
+    auto len = std::min<uint64_t>(max_insn_len, page_left);
+    auto code = map_guest(rip, cr3, len, entry.map);
+    auto decoded = decode(gsl::make_span(code, len), long_mode, insn);
+
+    if (!decoded && len < max_insn_len) {
+        len = max_insn_len;
+        code = map_guest(rip, cr3, len, entry.map);
+        decoded = decode(gsl::make_span(code, len), long_mode, insn);
+    }
+
+    if (!decoded || insn.write != write) {
+        throw std::runtime_error("mmio_decoder: unsupported instruction");
+    }
+
+    std::copy(code, code + insn.len, entry.bytes.begin());
+
+    entry.rip = rip;
+    entry.insn = insn;
+    entry.cr3 = cr3;
+    entry.code = code;
+    entry.valid = true;
+
+    return entry.insn;
+}
+
+const uint8_t *
+mmio_decoder::map_guest(
+    uint64_t rip, uint64_t cr3, uint64_t len,
+    bfvmm::x64::unique_map<uint8_t> &map)
+{
+    map = bfvmm::x64::make_unique_map<uint8_t>(
+              rip, cr3, len, vmcs_n::guest_ia32_pat::get()
+          );
+
+    return map.get();
+}
+
+}
+}
@@ -25,11 +25,11 @@ namespace intel_x64
 {
 
 monitor_trap::monitor_trap(gsl::not_null<eapis::intel_x64::hve *> hve) :
-    m_exit_handler{hve->exit_handler()}
+    m_exit_profile{hve->exit_profile()}
 {
     using namespace vmcs_n;
 
-    m_exit_handler->add_handler(
+    hve->add_exit_handler(
         exit_reason::basic_exit_reason::monitor_trap_flag,
         ::handler_delegate_t::create<monitor_trap, &monitor_trap::handle>(this)
     );
@@ -58,6 +58,7 @@ bool
 monitor_trap::handle(gsl::not_null<vmcs_t *> vmcs)
 {
     using namespace vmcs_n;
+    auto probe = m_exit_profile->probe(exit_reason::basic_exit_reason::monitor_trap_flag);
 
     struct info_t info = {
         false
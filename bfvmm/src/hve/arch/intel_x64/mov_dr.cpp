@@ -25,11 +25,13 @@ namespace intel_x64
 {
 
 mov_dr::mov_dr(gsl::not_null<eapis::intel_x64::hve *> hve) :
-    m_exit_handler{hve->exit_handler()}
+    m_exit_profile{hve->exit_profile()},
+    m_trace_ring{hve->trace_ring()},
+    m_exit_context{hve->exit_context()}
 {
     using namespace vmcs_n;
 
-    m_exit_handler->add_handler(
+    hve->add_exit_handler(
         exit_reason::basic_exit_reason::mov_dr,
         ::handler_delegate_t::create<mov_dr, &mov_dr::handle>(this)
     );
@@ -65,10 +67,10 @@ mov_dr::dump_log()
         bfdebug_info(0, "dr7 log", msg);
         bfdebug_brk2(0, msg);
 
-        for (const auto &record : m_log) {
+        m_trace_ring->for_each(trace_ring::type_t::mov_dr, [&](const trace_ring::entry_t & record) {
             bfdebug_info(0, "record", msg);
-            bfdebug_subnhex(0, "val", record.val, msg);
-        }
+            bfdebug_subnhex(0, "val", record.data[0], msg);
+        });
 
         bfdebug_lnbr(0, msg);
     });
@@ -81,16 +83,16 @@ mov_dr::dump_log()
 bool
 mov_dr::handle(gsl::not_null<vmcs_t *> vmcs)
 {
+    auto probe = m_exit_profile->probe(vmcs_n::exit_reason::basic_exit_reason::mov_dr);
+
     struct info_t info = {
-        this->emulate_rdgpr(vmcs),
+        this->emulate_rdgpr(vmcs, m_exit_context->exit_qualification()),
         false,
         false
     };
 
-    if (!ndebug && m_log_enabled) {
-        add_record(m_log, {
-            info.val
-        });
+    if (m_log_enabled) {
+        m_trace_ring->record(trace_ring::type_t::mov_dr, info.val);
     }
 
     for (const auto &d : m_handlers) {
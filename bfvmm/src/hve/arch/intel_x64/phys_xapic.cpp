@@ -0,0 +1,134 @@
+//
+// Bareflank Hypervisor
+// Copyright (C) 2017 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <intrinsics.h>
+
+#include <hve/arch/intel_x64/lapic_register.h>
+#include <hve/arch/intel_x64/phys_xapic.h>
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+using namespace ::intel_x64::msrs;
+using namespace lapic_register;
+
+// Registers are 16-byte aligned in the MMIO page, so the canonical offset
+// of a register is its index in 32-bit words divided by 4
+
+static inline auto
+reg_index(offset_t offset) noexcept
+{ return offset << 2U; }
+
+constexpr const auto xapic_id_from = 24U;
+constexpr const auto icr_dest_self = 0x40000ULL;
+
+constexpr const auto id_offset = msr_addr_to_offset(ia32_x2apic_apicid::addr);
+constexpr const auto version_offset = msr_addr_to_offset(ia32_x2apic_version::addr);
+constexpr const auto tpr_offset = msr_addr_to_offset(ia32_x2apic_tpr::addr);
+constexpr const auto eoi_offset = msr_addr_to_offset(ia32_x2apic_eoi::addr);
+constexpr const auto svr_offset = msr_addr_to_offset(ia32_x2apic_sivr::addr);
+constexpr const auto icr_lo_offset = msr_addr_to_offset(ia32_x2apic_icr::addr);
+constexpr const auto icr_hi_offset = icr_lo_offset + 1U;
+
+phys_xapic::phys_xapic(uintptr_t base) :
+    m_map{bfvmm::x64::make_unique_map<uint32_t>(base, ::x64::memory_attr::rw_uc)},
+    m_regs{m_map.get()}
+{ expects((base & (::x64::page_size - 1U)) == 0U); }
+
+phys_xapic::phys_xapic(gsl::not_null<uint32_t *> regs) :
+    m_regs{regs}
+{ }
+
+void
+phys_xapic::enable_interrupts()
+{ ::x64::rflags::interrupt_enable_flag::enable(); }
+
+void
+phys_xapic::disable_interrupts()
+{ ::x64::rflags::interrupt_enable_flag::disable(); }
+
+uint64_t
+phys_xapic::read_register(lapic_register::offset_t offset) const
+{
+    const volatile auto *reg = &m_regs[reg_index(offset)];
+    return *reg;
+}
+
+void
+phys_xapic::write_register(lapic_register::offset_t offset, uint64_t val)
+{
+    volatile auto *reg = &m_regs[reg_index(offset)];
+    *reg = gsl::narrow_cast<uint32_t>(val);
+}
+
+uint64_t
+phys_xapic::read_id() const
+{ return this->read_register(id_offset) >> xapic_id_from; }
+
+uint64_t
+phys_xapic::read_version() const
+{ return this->read_register(version_offset); }
+
+uint64_t
+phys_xapic::read_tpr() const
+{ return this->read_register(tpr_offset); }
+
+uint64_t
+phys_xapic::read_svr() const
+{ return this->read_register(svr_offset); }
+
+uint64_t
+phys_xapic::read_icr() const
+{
+    const auto dest = this->read_register(icr_hi_offset) >> xapic_id_from;
+    return (dest << 32U) | this->read_register(icr_lo_offset);
+}
+
+void
+phys_xapic::write_eoi()
+{ this->write_register(eoi_offset, 0x0ULL); }
+
+void
+phys_xapic::write_tpr(uint64_t tpr)
+{ this->write_register(tpr_offset, tpr); }
+
+void
+phys_xapic::write_svr(uint64_t svr)
+{ this->write_register(svr_offset, svr); }
+
+// The IPI is sent by the write to the low half, so the destination has to
+// be written first
+
+void
+phys_xapic::write_icr(uint64_t icr)
+{
+    this->write_register(icr_hi_offset, (icr >> 32U) << xapic_id_from);
+    this->write_register(icr_lo_offset, icr & 0xFFFFFFFFU);
+}
+
+// xAPIC mode has no self-IPI register; a fixed IPI with the "self"
+// destination shorthand is equivalent
+
+void
+phys_xapic::write_self_ipi(uint64_t vector)
+{ this->write_register(icr_lo_offset, icr_dest_self | (vector & 0xFFU)); }
+
+}
+}
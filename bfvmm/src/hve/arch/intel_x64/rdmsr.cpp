@@ -26,11 +26,12 @@ namespace intel_x64
 
 rdmsr::rdmsr(gsl::not_null<eapis::intel_x64::hve *> hve) :
     m_msr_bitmap{hve->msr_bitmap()},
-    m_exit_handler{hve->exit_handler()}
+    m_exit_profile{hve->exit_profile()},
+    m_trace_ring{hve->trace_ring()}
 {
     using namespace vmcs_n;
 
-    m_exit_handler->add_handler(
+    hve->add_exit_handler(
         exit_reason::basic_exit_reason::rdmsr,
         ::handler_delegate_t::create<rdmsr, &rdmsr::handle>(this)
     );
@@ -54,7 +55,7 @@ rdmsr::add_handler(
 #ifndef DISABLE_AUTO_TRAP_ON_ACCESS
     this->trap_on_access(msr);
 #endif
-    m_handlers[msr].push_front(std::move(d));
+    m_handlers.get(msr).push_front(std::move(d));
 }
 
 void
@@ -105,11 +106,11 @@ rdmsr::dump_log()
         bfdebug_info(0, "rdmsr log", msg);
         bfdebug_brk2(0, msg);
 
-        for (const auto &record : m_log) {
+        m_trace_ring->for_each(trace_ring::type_t::rdmsr, [&](const trace_ring::entry_t & record) {
             bfdebug_info(0, "record", msg);
-            bfdebug_subnhex(0, "msr", record.msr, msg);
-            bfdebug_subnhex(0, "val", record.val, msg);
-        }
+            bfdebug_subnhex(0, "msr", record.data[0], msg);
+            bfdebug_subnhex(0, "val", record.data[1], msg);
+        });
 
         bfdebug_lnbr(0, msg);
     });
@@ -136,12 +137,17 @@ rdmsr::handle(gsl::not_null<vmcs_t *> vmcs)
     // this case would be the interrupt code that would then inject a GP.
     //
 
-    const auto &hdlrs =
+    auto probe = m_exit_profile->probe(vmcs_n::exit_reason::basic_exit_reason::rdmsr, vmcs->save_state()->rcx);
+
+    const auto hdlrs =
         m_handlers.find(
             vmcs->save_state()->rcx
         );
 
-    if (GSL_LIKELY(hdlrs != m_handlers.end())) {
+    // The table allocates MSRs in groups, so an MSR without a handler can
+    // still have an (empty) chain
+
+    if (GSL_LIKELY(hdlrs != nullptr && !hdlrs->empty())) {
 
         struct info_t info = {
             vmcs->save_state()->rcx,
@@ -155,13 +161,11 @@ rdmsr::handle(gsl::not_null<vmcs_t *> vmcs)
                 gsl::narrow_cast<::x64::msrs::field_type>(vmcs->save_state()->rcx)
             );
 
-        if (!ndebug && m_log_enabled) {
-            add_record(m_log, {
-                info.msr, info.val
-            });
+        if (m_log_enabled) {
+            m_trace_ring->record(trace_ring::type_t::rdmsr, info.msr, info.val);
         }
 
-        for (const auto &d : hdlrs->second) {
+        for (const auto &d : *hdlrs) {
             if (d(vmcs, info)) {
 
                 if (!info.ignore_write) {
@@ -0,0 +1,129 @@
+//
+// Bareflank Extended APIs
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <new>
+
+#include <bfvmm/memory_manager/memory_manager.h>
+#include <hve/arch/intel_x64/trace_ring.h>
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+static_assert(sizeof(trace_ring::header_t) == 64, "trace_ring::header_t must fill one slot");
+static_assert(sizeof(trace_ring::slot_t) == 64, "trace_ring::slot_t must fill one cache line");
+
+trace_ring::trace_ring(std::size_t capacity) :
+    m_mask{capacity - 1U}
+{
+    expects(capacity != 0U && (capacity & (capacity - 1U)) == 0U);
+
+    const auto size = sizeof(header_t) + (capacity * sizeof(slot_t));
+
+    m_region_size = (size + ::x64::page_size - 1U) & ~(::x64::page_size - 1U);
+
+    // new[] is not page aligned, so the region is over-allocated by a page
+    // and starts at the first page boundary in it. Otherwise a reader
+    // mapping the pages would see the region at an offset, and the last
+    // page of the region would spill into one more page.
+
+    m_region = std::make_unique<uint8_t[]>(m_region_size + ::x64::page_size - 1U);
+
+    const auto addr = reinterpret_cast<uintptr_t>(m_region.get());
+    m_base = reinterpret_cast<uint8_t *>((addr + ::x64::page_size - 1U) & ~(::x64::page_size - 1U));
+
+    m_header = new (m_base) header_t{};
+    m_header->magic = magic;
+    m_header->capacity = capacity;
+
+    m_slots = reinterpret_cast<slot_t *>(m_base + sizeof(header_t));
+
+    for (auto i = 0ULL; i < capacity; ++i) {
+        auto slot = new (&m_slots[i]) slot_t{};
+        slot->seq.store(invalid_seq, std::memory_order_relaxed);
+    }
+}
+
+uintptr_t
+trace_ring::page_hpa(std::size_t index) const
+{
+    expects(index < this->page_count());
+    return g_mm->virtptr_to_physint(m_base + (index * ::x64::page_size));
+}
+
+bool
+trace_ring::read_slot(
+    const slot_t *slots, uint64_t mask, uint64_t seq, entry_t &entry) noexcept
+{
+    const auto &slot = slots[seq & mask];
+
+    if (slot.seq.load(std::memory_order_acquire) != seq) {
+        return false;
+    }
+
+    entry.seq = seq;
+    entry.tsc = slot.tsc.load(std::memory_order_relaxed);
+    entry.type = static_cast<type_t>(slot.type.load(std::memory_order_relaxed));
+
+    for (auto i = 0U; i < data_count; ++i) {
+        entry.data.at(i) = slot.data.at(i).load(std::memory_order_relaxed);
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.seq.load(std::memory_order_relaxed) == seq;
+}
+
+std::size_t
+trace_ring::read(
+    const uint8_t *region, uint64_t &next, gsl::span<entry_t> out) noexcept
+{
+    auto header = reinterpret_cast<const header_t *>(region);
+    auto slots = reinterpret_cast<const slot_t *>(region + sizeof(header_t));
+
+    const auto capacity = header->capacity;
+    const auto head = header->head.load(std::memory_order_acquire);
+
+    // Records older than one ring have been overwritten (or next is ahead
+    // of the writer, e.g. after the ring was recreated); restart from the
+    // oldest record that is still in the ring
+
+    if (head - next > capacity) {
+        next = head > capacity ? head - capacity : 0U;
+    }
+
+    std::size_t count = 0;
+
+    for (auto &entry : out) {
+        while (next != head && !read_slot(slots, capacity - 1U, next, entry)) {
+            ++next;
+        }
+
+        if (next == head) {
+            break;
+        }
+
+        ++next;
+        ++count;
+    }
+
+    return count;
+}
+
+}
+}
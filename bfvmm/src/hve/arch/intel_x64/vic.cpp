@@ -16,6 +16,8 @@
 // License along with this library; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
+#include <atomic>
+
 #include <bfthreadcontext.h>
 
 #include <hve/arch/intel_x64/isr.h>
@@ -26,8 +28,74 @@ namespace eapis
 namespace intel_x64
 {
 
-vic::vic(gsl::not_null<eapis::intel_x64::hve *> hve) :
+using namespace lapic_register;
+
+constexpr const auto xapic_base_mask = 0x000FFFFFFFFFF000ULL;
+constexpr const auto xapic_id_from = 24U;
+
+constexpr const auto eoi_offset = msr_addr_to_offset(::intel_x64::msrs::ia32_x2apic_eoi::addr);
+constexpr const auto tpr_offset = msr_addr_to_offset(::intel_x64::msrs::ia32_x2apic_tpr::addr);
+constexpr const auto icr_lo_offset = msr_addr_to_offset(::intel_x64::msrs::ia32_x2apic_icr::addr);
+constexpr const auto icr_hi_offset = icr_lo_offset + 1U;
+constexpr const auto ldr_offset = msr_addr_to_offset(::intel_x64::msrs::ia32_x2apic_ldr::addr);
+constexpr const auto dfr_offset = mem_addr_to_offset(0x0E0ULL);
+
+constexpr const auto lvt_timer_offset = msr_addr_to_offset(::intel_x64::msrs::ia32_x2apic_lvt_timer::addr);
+constexpr const auto init_count_offset = msr_addr_to_offset(::intel_x64::msrs::ia32_x2apic_init_count::addr);
+constexpr const auto cur_count_offset = msr_addr_to_offset(::intel_x64::msrs::ia32_x2apic_cur_count::addr);
+constexpr const auto div_conf_offset = msr_addr_to_offset(::intel_x64::msrs::ia32_x2apic_div_conf::addr);
+
+constexpr const auto ia32_tsc_deadline_addr = 0x6E0U;
+
+// LAPIC timer
+
+constexpr const auto lvt_masked = 0x10000ULL;
+constexpr const auto lvt_timer_mode_mask = 0x60000ULL;
+constexpr const auto lvt_timer_mode_tsc_deadline = 0x40000ULL;
+constexpr const auto div_conf_by_1 = 0xBULL;
+
+constexpr const auto tsc_info_leaf = 0x15U;
+constexpr const auto timer_calibration_count = 0xFFFFFFFFULL;
+constexpr const auto timer_calibration_tsc = 0x100000ULL;
+
+// ICR fields (x2APIC format: the destination is in bits 63:32)
+
+constexpr const auto icr_vector_mask = 0xFFULL;
+constexpr const auto icr_delivery_mode_mask = 0x700ULL;
+constexpr const auto icr_delivery_mode_from = 8U;
+constexpr const auto icr_dest_mode_logical = 0x800ULL;
+constexpr const auto icr_shorthand_mask = 0xC0000ULL;
+constexpr const auto icr_shorthand_from = 18U;
+
+constexpr const auto delivery_mode_fixed = 0U;
+constexpr const auto delivery_mode_lowest_priority = 1U;
+
+constexpr const auto shorthand_none = 0U;
+constexpr const auto shorthand_self = 1U;
+constexpr const auto shorthand_all = 2U;
+constexpr const auto shorthand_others = 3U;
+
+constexpr const auto x2apic_broadcast = 0xFFFFFFFFULL;
+constexpr const auto xapic_broadcast = 0xFFULL;
+
+// vCPUs that receive virtual IPIs through their mailboxes, by virtual APIC
+// ID. Entries are published once the mailbox is ready and cleared when the
+// vic is destroyed, which happens after the guest has stopped sending IPIs
+
+static std::array<std::atomic<vic *>, vic::max_ipi_dests> g_vics{};
+
+// The number of vCPUs in the guest, and how many of them are in g_vics. An
+// IPI that can target more than one vCPU is only delivered virtually once
+// every vCPU is registered, as an unregistered vCPU would miss it
+
+static std::atomic<uint64_t> g_num_ipi_dests{0};
+static std::atomic<uint64_t> g_num_registered_ipi_dests{0};
+
+vic::vic(
+    gsl::not_null<eapis::intel_x64::hve *> hve,
+    ept::memory_map *emm) :
     m_hve{hve},
+    m_emm{emm},
     m_virt_apic_base{0}
 {
     this->init_phys_idt();
@@ -41,18 +109,40 @@ vic::vic(gsl::not_null<eapis::intel_x64::hve *> hve) :
 }
 
 vic::~vic()
-{ ::intel_x64::cr8::set(0xFU); }
+{
+    if (m_kick_vector != 0U) {
+        auto self = this;
+        if (g_vics.at(m_virt_apic_id).compare_exchange_strong(self, nullptr)) {
+            if (--g_num_registered_ipi_dests == 0U) {
+                g_num_ipi_dests = 0U;
+            }
+        }
+    }
+
+    ::intel_x64::cr8::set(0xFU);
+}
 
 uint64_t
 vic::phys_to_virt(uint64_t phys)
 { return m_interrupt_map.at(phys); }
 
+// Exceptions (phys vectors 0-31) are never translated back from a
+// virtual vector, so reverse lookups mask them out of the first word
+
+static constexpr uint64_t
+reverse_mask(uint64_t word) noexcept
+{ return word == 0U ? 0xFFFFFFFF00000000ULL : 0xFFFFFFFFFFFFFFFFULL; }
+
 uint64_t
 vic::virt_to_phys(uint64_t virt)
 {
-    for (auto phys = 255U; phys >= 32U; --phys) {
-        if (m_interrupt_map.at(phys) == virt) {
-            return phys;
+    const auto &phys = m_reverse_map.at(virt);
+
+    for (auto i = phys.size(); i > 0U; --i) {
+        const auto word = phys[i - 1U] & reverse_mask(i - 1U);
+
+        if (word != 0U) {
+            return ((i - 1U) << 6U) | bit_scan_reverse(word);
         }
     }
 
@@ -61,18 +151,464 @@ vic::virt_to_phys(uint64_t virt)
 
 void
 vic::map(uint64_t phys, uint64_t virt)
-{ m_interrupt_map.at(phys) = virt; }
+{
+    auto &prev = m_reverse_map.at(m_interrupt_map.at(phys));
+    auto &next = m_reverse_map.at(virt);
+
+    prev[phys >> 6U] = clear_bit(prev[phys >> 6U], phys & 0x3FU);
+    next[phys >> 6U] = set_bit(next[phys >> 6U], phys & 0x3FU);
+
+    m_interrupt_map.at(phys) = virt;
+}
 
 void
 vic::unmap(uint64_t virt)
 {
-    for (auto phys = 255U; phys >= 32U; --phys) {
-        if (m_interrupt_map.at(phys) == virt) {
-            m_interrupt_map.at(phys) = 0U;
+    auto &phys = m_reverse_map.at(virt);
+    auto &none = m_reverse_map.at(0U);
+
+    for (auto i = 0U; i < phys.size(); ++i) {
+        auto word = phys[i] & reverse_mask(i);
+
+        phys[i] &= ~word;
+        none[i] |= word;
+
+        while (word != 0U) {
+            const auto bit = bit_scan_reverse(word);
+
+            m_interrupt_map.at((i << 6U) | bit) = 0U;
+            word = clear_bit(word, bit);
+        }
+    }
+}
+
+// Register virtualization and virtual-interrupt delivery run on top of the
+// TPR shadow, which is only ever enabled through vic::enable_tpr_shadow so
+// that CR8 exiting and the physical TPR always follow it
+
+bool
+vic::enable_apic_register_virtualization()
+{
+    if (!this->enable_tpr_shadow()) {
+        return false;
+    }
+
+    if (!m_virt_lapic->enable_register_virtualization()) {
+        return false;
+    }
+
+    this->pass_through_x2apic_reads();
+    return true;
+}
+
+bool
+vic::enable_tpr_shadow()
+{
+    if (!m_virt_lapic->enable_tpr_shadow()) {
+        return false;
+    }
+
+    m_hve->disable_cr8_exiting();
+    m_phys_lapic->write_tpr(0U);
+
+    return true;
+}
+
+bool
+vic::enable_virtual_interrupt_delivery()
+{
+    using namespace ::intel_x64::msrs;
+
+    if (!this->enable_tpr_shadow()) {
+        return false;
+    }
+
+    if (!m_virt_lapic->enable_interrupt_delivery()) {
+        return false;
+    }
+
+    this->pass_through_x2apic_reads();
+
+    m_hve->wrmsr()->pass_through_access(ia32_x2apic_eoi::addr);
+    m_hve->wrmsr()->pass_through_access(ia32_x2apic_self_ipi::addr);
+
+    return true;
+}
+
+void
+vic::add_eoi_handler(uint64_t vector, eoi_handler_delegate_t &&d)
+{ m_virt_lapic->add_eoi_handler(vector, std::move(d)); }
+
+bool
+vic::enable_timer_emulation()
+{
+    if (!m_virt_lapic->enable_timer_emulation()) {
+        return false;
+    }
+
+    this->take_over_phys_timer();
+
+    // The current count is computed from the TSC on each read, so it has
+    // to trap even if the other registers are read without an exit
+
+    m_hve->rdmsr()->trap_on_access(::intel_x64::msrs::ia32_x2apic_cur_count::addr);
+
+    m_hve->add_rdmsr_handler(
+        ia32_tsc_deadline_addr,
+        rdmsr::handler_delegate_t::create<vic,
+        &vic::handle_rdmsr_tsc_deadline>(this)
+    );
+
+    m_hve->add_wrmsr_handler(
+        ia32_tsc_deadline_addr,
+        wrmsr::handler_delegate_t::create<vic,
+        &vic::handle_wrmsr_tsc_deadline>(this)
+    );
+
+    return true;
+}
+
+// From here on the guest's timer writes only reach the virtual timer, so
+// the guest could no longer stop a physical timer it had armed, and each
+// of its expirations would arrive on top of the virtual ones. The
+// physical timer is stopped, and the virtual one continues where it was.
+
+void
+vic::take_over_phys_timer()
+{
+    const auto lvt = m_phys_lapic->read_register(lvt_timer_offset);
+    const auto dcr = m_phys_lapic->read_register(div_conf_offset);
+    const auto init = m_phys_lapic->read_register(init_count_offset);
+    const auto cur = m_phys_lapic->read_register(cur_count_offset);
+
+    const auto deadline_mode = (lvt & lvt_timer_mode_mask) == lvt_timer_mode_tsc_deadline;
+    const auto deadline = deadline_mode ? ::intel_x64::msrs::get(ia32_tsc_deadline_addr) : 0U;
+
+    if (deadline_mode) {
+        ::intel_x64::msrs::set(ia32_tsc_deadline_addr, 0U);
+    }
+
+    const auto tsc_per_tick = this->timer_tsc_per_tick();
+
+    m_phys_lapic->write_register(lvt_timer_offset, lvt | lvt_masked);
+    m_phys_lapic->write_register(init_count_offset, 0U);
+    m_phys_lapic->write_register(div_conf_offset, dcr);
+
+    m_virt_lapic->set_timer_clock(tsc_per_tick);
+    m_virt_lapic->write_lvt_timer(lvt);
+    m_virt_lapic->write_timer_divide_config(dcr);
+
+    if (!deadline_mode) {
+        m_virt_lapic->resume_timer(init, cur);
+        return;
+    }
+
+    if (deadline != 0U) {
+        m_virt_lapic->write_tsc_deadline(deadline);
+    }
+}
+
+// The timer counts the core crystal clock (the bus clock on older CPUs),
+// which is typically 20 to 100 times slower than the TSC. CPUID 0x15
+// gives the ratio of the two when it enumerates the crystal's frequency.
+// Otherwise the physical timer, which is about to be stopped anyway, is
+// timed against the TSC.
+
+uint64_t
+vic::timer_tsc_per_tick()
+{
+    const auto max_leaf = ::x64::cpuid::get(0, 0, 0, 0).rax & 0xFFFFFFFFULL;
+
+    if (max_leaf >= tsc_info_leaf) {
+        const auto info = ::x64::cpuid::get(tsc_info_leaf, 0, 0, 0);
+
+        const auto den = info.rax & 0xFFFFFFFFULL;
+        const auto num = info.rbx & 0xFFFFFFFFULL;
+        const auto hz = info.rcx & 0xFFFFFFFFULL;
+
+        if (den != 0U && num != 0U && hz != 0U) {
+            return (num << 16U) / den;
+        }
+    }
+
+    m_phys_lapic->write_register(lvt_timer_offset, lvt_masked);
+    m_phys_lapic->write_register(div_conf_offset, div_conf_by_1);
+    m_phys_lapic->write_register(init_count_offset, timer_calibration_count);
+
+    const auto start = ::x64::read_tsc::get();
+    auto now = start;
+
+    while (now - start < timer_calibration_tsc) {
+        now = ::x64::read_tsc::get();
+    }
+
+    const auto ticks = timer_calibration_count - m_phys_lapic->read_register(cur_count_offset);
+    if (ticks == 0U) {
+        throw std::runtime_error("vic: the lapic timer does not count");
+    }
+
+    return ((now - start) << 16U) / ticks;
+}
+
+void
+vic::pass_through_x2apic_reads()
+{
+    for (auto i = 0U; i < lapic_register::attributes.size(); ++i) {
+        if (i == cur_count_offset && m_virt_lapic->timer_emulation_enabled()) {
+            continue;
+        }
+
+        if (lapic_register::readable_in_x2apic(i)) {
+            m_hve->rdmsr()->pass_through_access(lapic_register::offset_to_msr_addr(i));
+        }
+    }
+}
+
+bool
+vic::enable_posted_interrupts(uint64_t notification_vector)
+{
+    expects(notification_vector >= 32U && notification_vector <= 255U);
+
+    if (!this->enable_virtual_interrupt_delivery()) {
+        return false;
+    }
+
+    if (!m_virt_lapic->enable_posted_interrupts(notification_vector)) {
+        return false;
+    }
+
+    m_notification_vector = notification_vector;
+    m_phys_apic_id = m_phys_lapic->read_id();
+
+    this->add_interrupt_handler(
+        notification_vector,
+        handler_delegate_t::create<vic, &vic::handle_posted_interrupt_notification>(this)
+    );
+
+    return true;
+}
+
+void
+vic::post_interrupt(uint64_t vector)
+{
+    expects(m_notification_vector != 0U);
+
+    if (m_virt_lapic->post_interrupt(vector)) {
+
+        // Fixed delivery mode, physical destination mode, so the
+        // notification only reaches the core this vCPU runs on
+
+        this->send_phys_ipi((m_phys_apic_id << 32U) | m_notification_vector);
+    }
+}
+
+void
+vic::enable_ipi_mailbox(uint64_t kick_vector, uint64_t num_vcpus)
+{
+    expects(kick_vector >= 32U && kick_vector <= 255U);
+    expects(num_vcpus != 0U && num_vcpus <= max_ipi_dests);
+    expects(m_kick_vector == 0U);
+
+    const auto id = m_virt_lapic->read_id();
+    expects(id < max_ipi_dests);
+
+    uint64_t num_dests = 0U;
+    if (!g_num_ipi_dests.compare_exchange_strong(num_dests, num_vcpus) &&
+        num_dests != num_vcpus) {
+        throw std::runtime_error(
+            "enable_ipi_mailbox: guest already has " +
+            std::to_string(num_dests) + " vCPUs"
+        );
+    }
+
+    m_mailbox = std::make_unique<interrupt_mailbox>();
+    m_kick_vector = kick_vector;
+    m_virt_apic_id = id;
+    m_phys_apic_id = m_phys_lapic->read_id();
+
+    this->add_interrupt_handler(
+        kick_vector,
+        handler_delegate_t::create<vic, &vic::handle_ipi_mailbox_kick>(this)
+    );
+
+    vic *expected = nullptr;
+    if (!g_vics.at(id).compare_exchange_strong(expected, this)) {
+        throw std::runtime_error(
+            "enable_ipi_mailbox: virtual APIC ID already registered: " +
+            std::to_string(id)
+        );
+    }
+
+    ++g_num_registered_ipi_dests;
+}
+
+void
+vic::post_virt_interrupt(uint64_t vector)
+{
+    if (m_notification_vector != 0U) {
+        this->post_interrupt(vector);
+        return;
+    }
+
+    expects(m_kick_vector != 0U);
+
+    if (m_mailbox->post(vector)) {
+        this->send_phys_ipi((m_phys_apic_id << 32U) | m_kick_vector);
+    }
+}
+
+bool
+vic::send_virt_icr(uint64_t icr)
+{
+    if (m_kick_vector == 0U) {
+        return false;
+    }
+
+    const auto vector = icr & icr_vector_mask;
+    const auto mode = (icr & icr_delivery_mode_mask) >> icr_delivery_mode_from;
+    const auto shorthand = (icr & icr_shorthand_mask) >> icr_shorthand_from;
+
+    if (vector < 32U) {
+        return false;
+    }
+
+    if (mode != delivery_mode_fixed && mode != delivery_mode_lowest_priority) {
+        return false;
+    }
+
+    if (shorthand == shorthand_self) {
+        m_virt_lapic->queue_injection(vector);
+        return true;
+    }
+
+    const auto dest = icr >> 32U;
+    const auto broadcast = (m_xapic_base != 0U) ? xapic_broadcast : x2apic_broadcast;
+    const auto logical = (icr & icr_dest_mode_logical) != 0U;
+
+    if (shorthand == shorthand_none && !logical && dest != broadcast) {
+        if (dest >= max_ipi_dests) {
+            return false;
+        }
+
+        const auto target = g_vics.at(dest).load();
+        if (target == nullptr) {
+            return false;
+        }
+
+        this->deliver_virt_interrupt(target, vector);
+        return true;
+    }
+
+    // Shorthands, broadcasts and logical destinations can target vCPUs
+    // that do not have a mailbox, in which case the whole IPI is sent
+    // physically so that none of its destinations miss it
+
+    if (g_num_registered_ipi_dests.load() != g_num_ipi_dests.load()) {
+        return false;
+    }
+
+    // An IPI that reaches no vCPU is sent physically as well, like any
+    // other IPI the vic does not deliver
+
+    auto delivered = false;
+
+    for (const auto &entry : g_vics) {
+        const auto target = entry.load();
+
+        if (target == nullptr) {
+            continue;
+        }
+
+        if (shorthand == shorthand_others && target == this) {
+            continue;
+        }
+
+        if (shorthand == shorthand_none && logical &&
+            !target->accepts_logical_destination(dest)) {
+            continue;
+        }
+
+        this->deliver_virt_interrupt(target, vector);
+        delivered = true;
+
+        if (mode == delivery_mode_lowest_priority) {
+            break;
+        }
+    }
+
+    return delivered;
+}
+
+bool
+vic::accepts_logical_destination(uint64_t dest) const
+{
+    const auto ldr = m_virt_lapic->read_register(ldr_offset);
+
+    // x2APIC: cluster ID in bits 31:16, one bit per APIC in bits 15:0.
+    // FFFF_FFFFH is the broadcast in both modes.
+
+    if (m_xapic_base == 0U) {
+        if (dest == x2apic_broadcast) {
+            return true;
         }
+
+        return (ldr >> 16U) == (dest >> 16U) && (ldr & dest & 0xFFFFU) != 0U;
+    }
+
+    // xAPIC: an 8-bit logical ID in LDR bits 31:24, interpreted as a flat
+    // bitmask or as a cluster/bitmask pair depending on the DFR model.
+    // FFH is the broadcast in both models.
+
+    if ((dest & xapic_broadcast) == xapic_broadcast) {
+        return true;
+    }
+
+    const auto id = (ldr >> 24U) & 0xFFU;
+    const auto model = m_virt_lapic->read_register(dfr_offset) >> 28U;
+
+    if (model == 0xFU) {
+        return (id & dest & 0xFFU) != 0U;
     }
+
+    return (id >> 4U) == ((dest >> 4U) & 0xFU) && (id & dest & 0xFU) != 0U;
 }
 
+void
+vic::deliver_virt_interrupt(vic *dest, uint64_t vector)
+{
+    if (dest == this) {
+        m_virt_lapic->queue_injection(vector);
+        return;
+    }
+
+    dest->post_virt_interrupt(vector);
+}
+
+void
+vic::drain_ipi_mailbox()
+{
+    interrupt_mailbox::vectors_t vectors{};
+
+    if (!m_mailbox->take(vectors)) {
+        return;
+    }
+
+    for (auto i = vectors.size(); i > 0U; --i) {
+        auto word = vectors[i - 1U];
+
+        while (word != 0U) {
+            const auto bit = bit_scan_reverse(word);
+
+            m_virt_lapic->queue_injection(((i - 1U) << 6U) | bit);
+            word = clear_bit(word, bit);
+        }
+    }
+}
+
+const virt_lapic::injection_stats_t &
+vic::injection_stats() const noexcept
+{ return m_virt_lapic->injection_stats(); }
+
 void
 vic::send_phys_ipi(uint64_t icr)
 { m_phys_lapic->write_icr(icr); }
@@ -102,6 +638,15 @@ vic::init_phys_lapic()
         throw std::runtime_error("lapic not present");
     }
 
+    // Without EPT there is no way to trap the MMIO page, so xAPIC mode
+    // is only supported when the guest's memory map was provided
+
+    const auto state = ::intel_x64::msrs::ia32_apic_base::state::get();
+    if (m_emm != nullptr && state == ::intel_x64::msrs::ia32_apic_base::state::xapic) {
+        this->init_phys_xapic();
+        return;
+    }
+
     if (::intel_x64::lapic::x2apic_supported()) {
         this->init_phys_x2apic();
         return;
@@ -110,6 +655,13 @@ vic::init_phys_lapic()
     throw std::runtime_error("x2apic not supported");
 }
 
+void
+vic::init_phys_xapic()
+{
+    m_xapic_base = ::intel_x64::msrs::ia32_apic_base::get() & xapic_base_mask;
+    m_phys_lapic = std::make_unique<phys_xapic>(m_xapic_base);
+}
+
 void
 vic::init_phys_x2apic()
 {
@@ -141,8 +693,13 @@ vic::init_virt_lapic()
     using namespace ::intel_x64::msrs;
 
     m_virt_apic_base = ia32_apic_base::get();
-    m_virt_apic_base = ia32_apic_base::state::enable_x2apic(m_virt_apic_base);
 
+    if (m_xapic_base != 0U) {
+        m_virt_lapic = std::make_unique<virt_xapic>(m_hve, m_phys_lapic.get());
+        return;
+    }
+
+    m_virt_apic_base = ia32_apic_base::state::enable_x2apic(m_virt_apic_base);
     m_virt_lapic = std::make_unique<virt_x2apic>(m_hve, m_phys_lapic.get());
 }
 
@@ -157,7 +714,9 @@ void
 vic::init_interrupt_map()
 {
     for (auto i = 0U; i < m_interrupt_map.size(); ++i) {
-        this->map(i, i);
+        m_interrupt_map.at(i) = i;
+        m_reverse_map.at(i).fill(0U);
+        m_reverse_map.at(i).at(i >> 6U) = 1ULL << (i & 0x3FU);
     }
 }
 
@@ -169,7 +728,14 @@ void
 vic::add_exit_handlers()
 {
     this->add_cr8_handlers();
-    this->add_x2apic_handlers();
+
+    if (m_xapic_base != 0U) {
+        this->add_xapic_handlers();
+    }
+    else {
+        this->add_x2apic_handlers();
+    }
+
     this->add_apic_base_handlers();
     this->add_external_interrupt_handlers();
 }
@@ -247,6 +813,28 @@ vic::add_x2apic_write_handler(uint64_t offset)
     }
 }
 
+void
+vic::add_xapic_handlers()
+{
+    // Every access to the register page now causes an EPT violation.
+    // The map may be shared with other vCPUs, which see the change once
+    // they flush it themselves.
+
+    ept::split_4k(*m_emm, m_xapic_base);
+    ept::set_access_rights(*m_emm, m_xapic_base, ept::epte::access_rights::tp);
+    ept::flush(*m_emm);
+
+    m_hve->add_ept_read_violation_handler(
+        ept_violation::handler_delegate_t::create<vic,
+        &vic::handle_xapic_read>(this)
+    );
+
+    m_hve->add_ept_write_violation_handler(
+        ept_violation::handler_delegate_t::create<vic,
+        &vic::handle_xapic_write>(this)
+    );
+}
+
 void
 vic::add_apic_base_handlers()
 {
@@ -307,8 +895,17 @@ vic::handle_x2apic_write(
 
     const auto offset = lapic_register::msr_addr_to_offset(info.msr);
 
-    m_virt_lapic->write_register(offset, info.val);
-    m_phys_lapic->write_register(offset, info.val);
+    if (info.msr == ::intel_x64::msrs::ia32_x2apic_tpr::addr) {
+        m_virt_lapic->write_tpr(info.val);
+
+        if (!m_virt_lapic->tpr_shadow_enabled()) {
+            m_phys_lapic->write_tpr(info.val);
+        }
+    }
+    else if (!this->write_virt_timer(offset, info.val)) {
+        m_virt_lapic->write_register(offset, info.val);
+        m_phys_lapic->write_register(offset, info.val);
+    }
 
     info.ignore_write = true;
     info.ignore_advance = false;
@@ -322,6 +919,8 @@ vic::handle_x2apic_eoi_write(
 {
     bfignored(vmcs);
 
+    m_virt_lapic->handle_eoi();
+
     info.ignore_write = true;
     info.ignore_advance = false;
 
@@ -335,7 +934,10 @@ vic::handle_x2apic_icr_write(
     bfignored(vmcs);
 
     m_virt_lapic->write_icr(info.val);
-    m_phys_lapic->write_icr(info.val);
+
+    if (!this->send_virt_icr(info.val)) {
+        m_phys_lapic->write_icr(info.val);
+    }
 
     info.ignore_write = true;
     info.ignore_advance = false;
@@ -365,7 +967,7 @@ vic::handle_x2apic_read(
     bfignored(vmcs);
 
     const auto offset = lapic_register::msr_addr_to_offset(info.msr);
-    info.val = m_virt_lapic->read_register(offset);
+    info.val = this->read_virt_register(offset);
 
     info.ignore_write = false;
     info.ignore_advance = false;
@@ -373,6 +975,152 @@ vic::handle_x2apic_read(
     return true;
 }
 
+// Registers are only accessible with aligned 32-bit accesses; other
+// accesses to the page read as 0 and writes to them are dropped
+
+static inline bool
+is_xapic_register_access(uint64_t gpa) noexcept
+{ return (gpa & 0xFU) == 0U; }
+
+bool
+vic::handle_xapic_read(
+    gsl::not_null<vmcs_t *> vmcs, ept_violation::info_t &info)
+{
+    if ((info.gpa & ~(::x64::page_size - 1U)) != m_xapic_base) {
+        return false;
+    }
+
+    const auto &insn = m_mmio_decoder.decode(vmcs, false);
+    auto val = 0ULL;
+
+    if (is_xapic_register_access(info.gpa)) {
+        val = this->read_xapic(mem_addr_to_offset(info.gpa));
+    }
+
+    guest_gpr(vmcs, insn.reg) = val;
+    vmcs->save_state()->rip += insn.len;
+
+    info.ignore_advance = true;
+    return true;
+}
+
+bool
+vic::handle_xapic_write(
+    gsl::not_null<vmcs_t *> vmcs, ept_violation::info_t &info)
+{
+    if ((info.gpa & ~(::x64::page_size - 1U)) != m_xapic_base) {
+        return false;
+    }
+
+    const auto &insn = m_mmio_decoder.decode(vmcs, true);
+    const auto val = insn.imm_src ? insn.imm : guest_gpr(vmcs, insn.reg);
+
+    if (is_xapic_register_access(info.gpa)) {
+        this->write_xapic(mem_addr_to_offset(info.gpa), val & 0xFFFFFFFFU);
+    }
+
+    vmcs->save_state()->rip += insn.len;
+
+    info.ignore_advance = true;
+    return true;
+}
+
+uint64_t
+vic::read_xapic(lapic_register::offset_t offset)
+{
+    if (!readable_in_xapic(offset)) {
+        return 0U;
+    }
+
+    return this->read_virt_register(offset);
+}
+
+// Same semantics as the x2APIC WRMSR handlers above. The ICR is sent
+// when its low half is written; the destination is converted from the
+// xAPIC format (ICR high bits 31:24) to the x2APIC format the lapic
+// interfaces expect
+
+void
+vic::write_xapic(lapic_register::offset_t offset, uint64_t val)
+{
+    if (!writable_in_xapic(offset)) {
+        return;
+    }
+
+    switch (offset) {
+        case eoi_offset:
+            m_virt_lapic->handle_eoi();
+            break;
+
+        case tpr_offset:
+            m_virt_lapic->write_tpr(val);
+
+            if (!m_virt_lapic->tpr_shadow_enabled()) {
+                m_phys_lapic->write_tpr(val);
+            }
+            break;
+
+        case icr_lo_offset: {
+            const auto dest = m_virt_lapic->read_register(icr_hi_offset) >> xapic_id_from;
+
+            m_virt_lapic->write_register(icr_lo_offset, val);
+
+            if (!this->send_virt_icr((dest << 32U) | val)) {
+                m_phys_lapic->write_icr((dest << 32U) | val);
+            }
+            break;
+        }
+
+        case icr_hi_offset:
+            m_virt_lapic->write_register(icr_hi_offset, val);
+            break;
+
+        default:
+            if (!this->write_virt_timer(offset, val)) {
+                m_virt_lapic->write_register(offset, val);
+                m_phys_lapic->write_register(offset, val);
+            }
+            break;
+    }
+}
+
+uint64_t
+vic::read_virt_register(lapic_register::offset_t offset)
+{
+    if (offset == cur_count_offset && m_virt_lapic->timer_emulation_enabled()) {
+        return m_virt_lapic->read_timer_current_count();
+    }
+
+    return m_virt_lapic->read_register(offset);
+}
+
+// With timer emulation enabled the guest's timer registers only drive the
+// virtual timer; the physical LAPIC timer is left to the host
+
+bool
+vic::write_virt_timer(lapic_register::offset_t offset, uint64_t val)
+{
+    if (!m_virt_lapic->timer_emulation_enabled()) {
+        return false;
+    }
+
+    switch (offset) {
+        case lvt_timer_offset:
+            m_virt_lapic->write_lvt_timer(val);
+            return true;
+
+        case init_count_offset:
+            m_virt_lapic->write_timer_initial_count(val);
+            return true;
+
+        case div_conf_offset:
+            m_virt_lapic->write_timer_divide_config(val);
+            return true;
+
+        default:
+            return false;
+    }
+}
 
 bool
 vic::handle_rdcr8(
@@ -395,7 +1143,10 @@ vic::handle_wrcr8(
     bfignored(vmcs);
 
     m_virt_lapic->write_tpr(info.val << 4U);
-    m_phys_lapic->write_tpr(info.val << 4U);
+
+    if (!m_virt_lapic->tpr_shadow_enabled()) {
+        m_phys_lapic->write_tpr(info.val << 4U);
+    }
 
     info.ignore_write = false;
     info.ignore_advance = false;
@@ -429,6 +1180,34 @@ vic::handle_wrmsr_apic_base(
     return true;
 }
 
+bool
+vic::handle_rdmsr_tsc_deadline(
+    gsl::not_null<vmcs_t *> vmcs, rdmsr::info_t &info)
+{
+    bfignored(vmcs);
+
+    info.val = m_virt_lapic->read_tsc_deadline();
+
+    info.ignore_write = false;
+    info.ignore_advance = false;
+
+    return true;
+}
+
+bool
+vic::handle_wrmsr_tsc_deadline(
+    gsl::not_null<vmcs_t *> vmcs, wrmsr::info_t &info)
+{
+    bfignored(vmcs);
+
+    m_virt_lapic->write_tsc_deadline(info.val);
+
+    info.ignore_write = true;
+    info.ignore_advance = false;
+
+    return true;
+}
+
 bool
 vic::handle_external_interrupt_exit(
     gsl::not_null<vmcs_t *> vmcs, external_interrupt::info_t &info)
@@ -464,10 +1243,56 @@ vic::handle_spurious_interrupt(
     return true;
 }
 
+bool
+vic::handle_posted_interrupt_notification(
+    gsl::not_null<vmcs_t *> vmcs, external_interrupt::info_t &info)
+{
+    bfignored(vmcs);
+    bfignored(info);
+
+    // The notification arrived while this vCPU was in VMX root operation,
+    // so it was acknowledged on exit instead of being processed by the CPU.
+    // Move the posted vectors into the virtual IRR by hand; they are
+    // delivered on the next VM entry.
+
+    m_phys_lapic->write_eoi();
+    m_virt_lapic->sync_posted_interrupts();
+
+    return true;
+}
+
+bool
+vic::handle_ipi_mailbox_kick(
+    gsl::not_null<vmcs_t *> vmcs, external_interrupt::info_t &info)
+{
+    bfignored(vmcs);
+    bfignored(info);
+
+    m_phys_lapic->write_eoi();
+    this->drain_ipi_mailbox();
+
+    return true;
+}
+
+// Notifications that arrive through the host IDT (i.e. while this core is
+// in VMX root operation) are handled here too; they must not be injected
+// into the guest as if they were device interrupts
+
 void
 vic::handle_interrupt(uint64_t phys)
 {
     m_phys_lapic->write_eoi();
+
+    if (phys == m_kick_vector) {
+        this->drain_ipi_mailbox();
+        return;
+    }
+
+    if (phys == m_notification_vector) {
+        m_virt_lapic->sync_posted_interrupts();
+        return;
+    }
+
     m_virt_lapic->queue_injection(this->phys_to_virt(phys));
 }
 
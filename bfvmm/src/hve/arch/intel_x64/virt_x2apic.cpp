@@ -16,7 +16,10 @@
 // License along with this library; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
+#include <atomic>
+
 #include <intrinsics.h>
+#include <bfvmm/memory_manager/memory_manager.h>
 
 #include <hve/arch/intel_x64/hve.h>
 #include <hve/arch/intel_x64/vic.h>
@@ -31,12 +34,44 @@ namespace intel_x64
 using namespace ::intel_x64::msrs;
 using namespace lapic_register;
 
+// Posted-interrupt descriptor layout (see SDM Vol. 3, 29.6): a 256-bit
+// posted-interrupt request bitmap followed by the outstanding-notification
+// bit, in a 64-byte aligned block
+
+constexpr const auto pi_desc_size = 64U;
+constexpr const auto pi_desc_words = pi_desc_size / sizeof(uint64_t);
+constexpr const auto pi_desc_control = 4U;
+constexpr const auto pi_desc_on = 1ULL;
+
+static inline auto
+pi_desc_word(uint64_t *desc, uint64_t index)
+{ return reinterpret_cast<std::atomic<uint64_t> *>(&desc[index]); }
+
+constexpr const auto irr_base = msr_addr_to_offset(ia32_x2apic_irr0::addr);
+constexpr const auto isr_base = msr_addr_to_offset(ia32_x2apic_isr0::addr);
+
+constexpr const auto lvt_timer_offset = msr_addr_to_offset(ia32_x2apic_lvt_timer::addr);
+constexpr const auto init_count_offset = msr_addr_to_offset(ia32_x2apic_init_count::addr);
+constexpr const auto div_conf_offset = msr_addr_to_offset(ia32_x2apic_div_conf::addr);
+
+constexpr const auto lvt_vector_mask = 0xFFULL;
+constexpr const auto lvt_masked = 0x10000ULL;
+constexpr const auto lvt_timer_mode_mask = 0x60000ULL;
+constexpr const auto lvt_timer_mode_from = 17U;
+constexpr const auto div_conf_mask = 0xBULL;
+
+constexpr const auto timer_mode_periodic = 1U;
+constexpr const auto timer_mode_tsc_deadline = 2U;
+
+constexpr const auto preemption_timer_max = 0xFFFFFFFFULL;
+
 ///----------------------------------------------------------------------------
 /// Initialization
 ///----------------------------------------------------------------------------
 
 virt_x2apic::virt_x2apic(gsl::not_null<eapis::intel_x64::hve *> hve) :
-    m_hve{hve}
+    m_hve{hve},
+    m_virt_apic_page{std::make_unique<uint32_t[]>(::x64::page_size / sizeof(uint32_t))}
 {
     lapic_register::init_attributes();
 
@@ -48,7 +83,8 @@ virt_x2apic::virt_x2apic(gsl::not_null<eapis::intel_x64::hve *> hve) :
 virt_x2apic::virt_x2apic(
     gsl::not_null<eapis::intel_x64::hve *> hve,
     gsl::not_null<eapis::intel_x64::phys_lapic *> phys) :
-    m_hve{hve}
+    m_hve{hve},
+    m_virt_apic_page{std::make_unique<uint32_t[]>(::x64::page_size / sizeof(uint32_t))}
 {
     lapic_register::init_attributes();
 
@@ -70,7 +106,7 @@ virt_x2apic::init_registers_from_phys_x2apic(
 {
     phys->disable_interrupts();
 
-    for (auto i = 0U; i < m_registers.size(); ++i) {
+    for (auto i = 0U; i < lapic_register::count; ++i) {
         if (lapic_register::exists_in_x2apic(i)) {
             this->init_virt_from_phys_x2apic(phys, i);
             continue;
@@ -104,13 +140,613 @@ virt_x2apic::init_interrupt_window_handler()
     );
 }
 
+///----------------------------------------------------------------------------
+/// TPR shadow
+///----------------------------------------------------------------------------
+
+bool
+virt_x2apic::enable_tpr_shadow()
+{
+    using namespace vmcs_n;
+    namespace proc_ctls1 = primary_processor_based_vm_execution_controls;
+
+    if (m_tpr_shadow) {
+        return true;
+    }
+
+    if (!proc_ctls1::use_tpr_shadow::is_allowed1()) {
+        return false;
+    }
+
+    virtual_apic_address::set(g_mm->virtptr_to_physint(m_virt_apic_page.get()));
+    tpr_threshold::set(0U);
+
+    m_hve->add_exit_handler(
+        exit_reason::basic_exit_reason::tpr_below_threshold,
+        ::handler_delegate_t::create<virt_x2apic,
+        &virt_x2apic::handle_tpr_below_threshold_exit>(this)
+    );
+
+    proc_ctls1::use_tpr_shadow::enable();
+
+    m_tpr_shadow = true;
+    this->inject_pending(m_hve->interrupt_window()->is_open());
+
+    return true;
+}
+
+bool
+virt_x2apic::tpr_shadow_enabled() const noexcept
+{ return m_tpr_shadow; }
+
+bool
+virt_x2apic::masked_by_tpr(uint64_t vector) const
+{
+    if (!m_tpr_shadow) {
+        return false;
+    }
+
+    return (vector >> 4U) <= (this->read_tpr() >> 4U);
+}
+
+bool
+virt_x2apic::masked_by_isr(uint64_t vector) const
+{ return (vector & 0xF0U) <= (this->top_isr() & 0xF0U); }
+
+///----------------------------------------------------------------------------
+/// Register virtualization
+///----------------------------------------------------------------------------
+
+bool
+virt_x2apic::enable_register_virtualization()
+{
+    using namespace vmcs_n;
+    namespace proc_ctls2 = secondary_processor_based_vm_execution_controls;
+
+    if (m_register_virtualization) {
+        return true;
+    }
+
+    expects(m_tpr_shadow);
+
+    if (!proc_ctls2::virtualize_x2apic_mode::is_allowed1() ||
+        !proc_ctls2::apic_register_virtualization::is_allowed1()) {
+        return false;
+    }
+
+    proc_ctls2::virtualize_apic_accesses::disable();
+    proc_ctls2::virtualize_x2apic_mode::enable();
+    proc_ctls2::apic_register_virtualization::enable();
+
+    m_register_virtualization = true;
+    return true;
+}
+
+bool
+virt_x2apic::register_virtualization_enabled() const noexcept
+{ return m_register_virtualization; }
+
+///----------------------------------------------------------------------------
+/// Virtual-interrupt delivery
+///----------------------------------------------------------------------------
+
+bool
+virt_x2apic::enable_interrupt_delivery()
+{
+    using namespace vmcs_n;
+    namespace proc_ctls2 = secondary_processor_based_vm_execution_controls;
+
+    if (m_interrupt_delivery) {
+        return true;
+    }
+
+    if (!proc_ctls2::virtual_interrupt_delivery::is_allowed1()) {
+        return false;
+    }
+
+    if (!this->enable_register_virtualization()) {
+        return false;
+    }
+
+    eoi_exit_bitmap_0::set(0U);
+    eoi_exit_bitmap_1::set(0U);
+    eoi_exit_bitmap_2::set(0U);
+    eoi_exit_bitmap_3::set(0U);
+
+    for (const auto &handlers : m_eoi_handlers) {
+        this->trap_eoi(handlers.first);
+    }
+
+    // Anything queued in software so far is already in the virtual IRR,
+    // so handing it to the CPU only requires RVI/SVI to reflect it
+
+    guest_interrupt_status::set((this->top_isr() << 8U) | this->top_irr());
+
+    m_hve->add_exit_handler(
+        exit_reason::basic_exit_reason::virtualized_eoi,
+        ::handler_delegate_t::create<virt_x2apic,
+        &virt_x2apic::handle_virtualized_eoi_exit>(this)
+    );
+
+    proc_ctls2::virtual_interrupt_delivery::enable();
+    m_hve->interrupt_window()->disable_exiting();
+
+    m_interrupt_delivery = true;
+    return true;
+}
+
+bool
+virt_x2apic::interrupt_delivery_enabled() const noexcept
+{ return m_interrupt_delivery; }
+
+void
+virt_x2apic::add_eoi_handler(uint64_t vector, eoi_handler_delegate_t &&d)
+{
+    m_eoi_handlers[vector].push_front(std::move(d));
+
+    if (m_interrupt_delivery) {
+        this->trap_eoi(vector);
+    }
+}
+
+void
+virt_x2apic::trap_eoi(uint64_t vector)
+{
+    using namespace vmcs_n;
+
+    const auto bit = vector & 0x3FU;
+
+    switch ((vector & 0xFFU) >> 6U) {
+        case 0:
+            eoi_exit_bitmap_0::set(set_bit(eoi_exit_bitmap_0::get(), bit));
+            break;
+
+        case 1:
+            eoi_exit_bitmap_1::set(set_bit(eoi_exit_bitmap_1::get(), bit));
+            break;
+
+        case 2:
+            eoi_exit_bitmap_2::set(set_bit(eoi_exit_bitmap_2::get(), bit));
+            break;
+
+        default:
+            eoi_exit_bitmap_3::set(set_bit(eoi_exit_bitmap_3::get(), bit));
+            break;
+    }
+}
+
+///----------------------------------------------------------------------------
+/// Posted interrupts
+///----------------------------------------------------------------------------
+
+bool
+virt_x2apic::enable_posted_interrupts(uint64_t notification_vector)
+{
+    using namespace vmcs_n;
+
+    if (m_pi_desc != nullptr) {
+        return true;
+    }
+
+    if (!pin_based_vm_execution_controls::process_posted_interrupts::is_allowed1()) {
+        return false;
+    }
+
+    if (!this->enable_interrupt_delivery()) {
+        return false;
+    }
+
+    // operator new only guarantees 16-byte alignment, so the descriptor is
+    // carved out of a block twice its size
+
+    m_pi_desc_storage = std::make_unique<uint64_t[]>(pi_desc_words * 2U);
+
+    auto addr = reinterpret_cast<uintptr_t>(m_pi_desc_storage.get());
+    addr = (addr + pi_desc_size - 1U) & ~static_cast<uintptr_t>(pi_desc_size - 1U);
+    m_pi_desc = reinterpret_cast<uint64_t *>(addr);
+
+    posted_interrupt_notification_vector::set(notification_vector);
+    posted_interrupt_descriptor_address::set(g_mm->virtptr_to_physint(m_pi_desc));
+    pin_based_vm_execution_controls::process_posted_interrupts::enable();
+
+    return true;
+}
+
+bool
+virt_x2apic::posted_interrupts_enabled() const noexcept
+{ return m_pi_desc != nullptr; }
+
+bool
+virt_x2apic::post_interrupt(uint64_t vector)
+{
+    expects(m_pi_desc != nullptr);
+
+    const auto pir = pi_desc_word(m_pi_desc, (vector & 0xFFU) >> 6U);
+    const auto control = pi_desc_word(m_pi_desc, pi_desc_control);
+
+    pir->fetch_or(1ULL << (vector & 0x3FU));
+    return (control->fetch_or(pi_desc_on) & pi_desc_on) == 0;
+}
+
+void
+virt_x2apic::sync_posted_interrupts()
+{
+    using namespace vmcs_n;
+
+    if (m_pi_desc == nullptr) {
+        return;
+    }
+
+    // ON is cleared first so that a vector posted while the PIR is being
+    // drained sends a new notification instead of being stranded
+
+    pi_desc_word(m_pi_desc, pi_desc_control)->fetch_and(~pi_desc_on);
+
+    auto irr_offset = msr_addr_to_offset(ia32_x2apic_irr0::addr);
+    auto posted = false;
+
+    for (auto i = 0U; i < 4U; ++i) {
+        const auto bits = pi_desc_word(m_pi_desc, i)->exchange(0U);
+
+        if (bits == 0U) {
+            continue;
+        }
+
+        const auto lo = irr_offset | (i << 1U);
+        const auto hi = irr_offset | ((i << 1U) + 1U);
+
+        this->write_register(lo, this->read_register(lo) | (bits & 0xFFFFFFFFU));
+        this->write_register(hi, this->read_register(hi) | (bits >> 32U));
+
+        posted = true;
+    }
+
+    if (posted) {
+        const auto status = guest_interrupt_status::get();
+        const auto rvi = this->top_irr();
+
+        if (rvi > (status & 0xFFU)) {
+            guest_interrupt_status::set((status & 0xFF00U) | rvi);
+        }
+    }
+}
+
+///----------------------------------------------------------------------------
+/// Timer
+///
+/// The timer's input clock is the core crystal (or bus) clock, divided as
+/// set in the divide configuration register. Its rate relative to the TSC
+/// is given by set_timer_clock(); TSC-deadline mode counts the TSC itself.
+/// An armed timer has an absolute TSC deadline,
+/// which is programmed into the VMX-preemption timer. That timer only
+/// counts in VMX non-root operation, so an expiration can be late by the
+/// time spent in the VMM, but never early: the deadline is re-checked on
+/// each preemption-timer exit and the timer re-armed if it is not due,
+/// even if it is only a few ticks away.
+///----------------------------------------------------------------------------
+
+bool
+virt_x2apic::enable_timer_emulation()
+{
+    using namespace vmcs_n;
+    namespace pin_ctls = pin_based_vm_execution_controls;
+
+    if (m_timer_emulation) {
+        return true;
+    }
+
+    if (!pin_ctls::activate_vmx_preemption_timer::is_allowed1() ||
+        !vm_exit_controls::save_vmx_preemption_timer_value::is_allowed1()) {
+        return false;
+    }
+
+    m_preemption_timer_shift = ia32_vmx_misc::preemption_timer_decrement::get();
+
+    m_hve->add_exit_handler(
+        exit_reason::basic_exit_reason::preemption_timer_expired,
+        ::handler_delegate_t::create<virt_x2apic,
+        &virt_x2apic::handle_preemption_timer_exit>(this)
+    );
+
+    vm_exit_controls::save_vmx_preemption_timer_value::enable();
+
+    m_timer_emulation = true;
+    return true;
+}
+
+bool
+virt_x2apic::timer_emulation_enabled() const noexcept
+{ return m_timer_emulation; }
+
+const virt_lapic::timer_stats_t &
+virt_x2apic::timer_stats() const noexcept
+{ return m_timer_stats; }
+
+uint64_t
+virt_x2apic::timer_mode() const
+{ return (this->read_register(lvt_timer_offset) & lvt_timer_mode_mask) >> lvt_timer_mode_from; }
+
+uint64_t
+virt_x2apic::timer_divisor() const
+{
+    const auto dcr = this->read_register(div_conf_offset);
+    const auto val = ((dcr & 0x8U) >> 1U) | (dcr & 0x3U);
+
+    return val == 7U ? 1U : 2ULL << val;
+}
+
+void
+virt_x2apic::write_lvt_timer(uint64_t val)
+{
+    expects(m_timer_emulation);
+
+    const auto prev = this->timer_mode();
+    this->write_register(lvt_timer_offset, val);
+
+    const auto mode = this->timer_mode();
+    if (mode == prev) {
+        return;
+    }
+
+    // Switching to or from TSC-deadline mode disarms the timer. Switching
+    // between one-shot and periodic takes effect at the next expiration.
+
+    if (mode == timer_mode_tsc_deadline || prev == timer_mode_tsc_deadline) {
+        this->disarm_timer();
+        this->write_register(init_count_offset, 0U);
+
+        m_tsc_deadline = 0U;
+        m_timer_period = 0U;
+
+        return;
+    }
+
+    m_timer_period = 0U;
+
+    if (mode == timer_mode_periodic) {
+        m_timer_period = this->ticks_to_tsc(
+                             this->read_register(init_count_offset) * this->timer_divisor()
+                         );
+    }
+}
+
+void
+virt_x2apic::write_timer_initial_count(uint64_t val)
+{
+    expects(m_timer_emulation);
+
+    if (this->timer_mode() == timer_mode_tsc_deadline) {
+        return;
+    }
+
+    this->write_register(init_count_offset, val);
+
+    if (val == 0U) {
+        this->disarm_timer();
+        return;
+    }
+
+    const auto period = this->ticks_to_tsc(val * this->timer_divisor());
+
+    m_timer_period = (this->timer_mode() == timer_mode_periodic) ? period : 0U;
+    this->arm_timer(::x64::read_tsc::get() + period);
+}
+
+void
+virt_x2apic::write_timer_divide_config(uint64_t val)
+{
+    expects(m_timer_emulation);
+    this->write_register(div_conf_offset, val & div_conf_mask);
+}
+
+uint64_t
+virt_x2apic::read_timer_current_count() const
+{
+    expects(m_timer_emulation);
+
+    if (!m_timer_armed || this->timer_mode() == timer_mode_tsc_deadline) {
+        return 0U;
+    }
+
+    const auto now = ::x64::read_tsc::get();
+    if (now >= m_timer_deadline) {
+        return 0U;
+    }
+
+    return this->tsc_to_ticks(m_timer_deadline - now) / this->timer_divisor();
+}
+
+void
+virt_x2apic::write_tsc_deadline(uint64_t val)
+{
+    expects(m_timer_emulation);
+
+    if (this->timer_mode() != timer_mode_tsc_deadline) {
+        return;
+    }
+
+    m_tsc_deadline = val;
+
+    if (val == 0U) {
+        this->disarm_timer();
+        return;
+    }
+
+    this->arm_timer(val);
+}
+
+uint64_t
+virt_x2apic::read_tsc_deadline() const
+{
+    expects(m_timer_emulation);
+    return m_tsc_deadline;
+}
+
+void
+virt_x2apic::set_timer_clock(uint64_t tsc_per_tick)
+{
+    expects(m_timer_emulation);
+    expects(tsc_per_tick != 0U);
+
+    m_timer_tsc_per_tick = tsc_per_tick;
+}
+
+void
+virt_x2apic::resume_timer(uint64_t initial_count, uint64_t current_count)
+{
+    expects(m_timer_emulation);
+
+    if (this->timer_mode() == timer_mode_tsc_deadline) {
+        return;
+    }
+
+    this->write_register(init_count_offset, initial_count);
+
+    if (initial_count == 0U || current_count == 0U) {
+        this->disarm_timer();
+        return;
+    }
+
+    const auto divisor = this->timer_divisor();
+    const auto periodic = this->timer_mode() == timer_mode_periodic;
+
+    m_timer_period = periodic ? this->ticks_to_tsc(initial_count * divisor) : 0U;
+    this->arm_timer(::x64::read_tsc::get() + this->ticks_to_tsc(current_count * divisor));
+}
+
+// The ratio is kept in 48.16 fixed point. Its whole and fractional parts
+// are applied separately so that a full 32-bit count times the largest
+// divisor does not overflow.
+
+uint64_t
+virt_x2apic::ticks_to_tsc(uint64_t ticks) const noexcept
+{
+    const auto whole = m_timer_tsc_per_tick >> 16U;
+    const auto frac = m_timer_tsc_per_tick & 0xFFFFU;
+
+    return (ticks * whole) + ((ticks * frac) >> 16U);
+}
+
+uint64_t
+virt_x2apic::tsc_to_ticks(uint64_t tsc) const noexcept
+{
+    const auto quot = tsc / m_timer_tsc_per_tick;
+    const auto rem = tsc % m_timer_tsc_per_tick;
+
+    return (quot << 16U) + ((rem << 16U) / m_timer_tsc_per_tick);
+}
+
+void
+virt_x2apic::arm_timer(uint64_t deadline)
+{
+    namespace pin_ctls = vmcs_n::pin_based_vm_execution_controls;
+
+    const auto now = ::x64::read_tsc::get();
+
+    m_timer_deadline = deadline;
+    m_timer_armed = true;
+
+    if (deadline <= now) {
+        m_timer_stats.immediate++;
+        this->expire_timer(now);
+        return;
+    }
+
+    // The preemption timer counts in units of 2^shift TSC ticks, so the
+    // remainder is rounded up. A deadline beyond the range of the
+    // preemption timer is reached in several steps; each early exit
+    // re-arms for the remainder
+
+    const auto unit = (1ULL << m_preemption_timer_shift) - 1U;
+
+    auto ticks = (deadline - now + unit) >> m_preemption_timer_shift;
+    if (ticks > preemption_timer_max) {
+        ticks = preemption_timer_max;
+    }
+
+    vmcs_n::vmx_preemption_timer_value::set(ticks);
+    pin_ctls::activate_vmx_preemption_timer::enable();
+}
+
+void
+virt_x2apic::disarm_timer()
+{
+    namespace pin_ctls = vmcs_n::pin_based_vm_execution_controls;
+
+    m_timer_armed = false;
+    pin_ctls::activate_vmx_preemption_timer::disable();
+}
+
+void
+virt_x2apic::expire_timer(uint64_t now)
+{
+    const auto lvt = this->read_register(lvt_timer_offset);
+
+    if (m_timer_period != 0U) {
+
+        // Periods that have already elapsed (e.g. while the guest was not
+        // running) are coalesced into this expiration instead of being
+        // delivered back to back, and the period stays phase-locked to the
+        // original deadline
+
+        auto next = m_timer_deadline + m_timer_period;
+
+        if (next <= now) {
+            const auto missed = ((now - next) / m_timer_period) + 1U;
+
+            m_timer_stats.coalesced += missed;
+            next += missed * m_timer_period;
+        }
+
+        m_timer_deadline = next;
+    }
+    else {
+        this->disarm_timer();
+        m_tsc_deadline = 0U;
+    }
+
+    m_timer_stats.expirations++;
+
+    if ((lvt & lvt_masked) == 0U) {
+        this->queue_injection(lvt & lvt_vector_mask);
+    }
+
+    if (m_timer_period != 0U) {
+        this->arm_timer(m_timer_deadline);
+    }
+}
+
+bool
+virt_x2apic::handle_preemption_timer_exit(gsl::not_null<vmcs_t *> vmcs)
+{
+    bfignored(vmcs);
+
+    if (!m_timer_armed) {
+        this->disarm_timer();
+        return true;
+    }
+
+    const auto now = ::x64::read_tsc::get();
+
+    if (now < m_timer_deadline) {
+        this->arm_timer(m_timer_deadline);
+        return true;
+    }
+
+    this->expire_timer(now);
+    return true;
+}
+
 ///----------------------------------------------------------------------------
 /// Register reads
 ///----------------------------------------------------------------------------
 
 uint64_t
 virt_x2apic::read_register(lapic_register::offset_t offset) const
-{ return m_registers.at(offset); }
+{
+    expects(offset < lapic_register::count);
+    return m_virt_apic_page[offset << 2U];
+}
 
 uint64_t
 virt_x2apic::read_id() const
@@ -133,6 +769,13 @@ virt_x2apic::read_tpr() const
     return this->read_register(offset);
 }
 
+uint64_t
+virt_x2apic::read_ppr() const
+{
+    const auto offset = msr_addr_to_offset(ia32_x2apic_ppr::addr);
+    return this->read_register(offset);
+}
+
 uint64_t
 virt_x2apic::read_icr() const
 {
@@ -158,7 +801,21 @@ virt_x2apic::read_svr() const
 
 void
 virt_x2apic::write_register(lapic_register::offset_t offset, uint64_t val)
-{ m_registers.at(offset) = gsl::narrow_cast<uint32_t>(val); }
+{
+    expects(offset < lapic_register::count);
+    m_virt_apic_page[offset << 2U] = gsl::narrow_cast<uint32_t>(val);
+
+    if (offset - irr_base < 8U) {
+        m_irr_summary = (val & 0xFFFFFFFFU) != 0U ?
+                        set_bit(m_irr_summary, offset - irr_base) :
+                        clear_bit(m_irr_summary, offset - irr_base);
+    }
+    else if (offset - isr_base < 8U) {
+        m_isr_summary = (val & 0xFFFFFFFFU) != 0U ?
+                        set_bit(m_isr_summary, offset - isr_base) :
+                        clear_bit(m_isr_summary, offset - isr_base);
+    }
+}
 
 void
 virt_x2apic::write_eoi()
@@ -166,6 +823,7 @@ virt_x2apic::write_eoi()
     const auto offset = msr_addr_to_offset(ia32_x2apic_eoi::addr);
     this->write_register(offset, 0x0ULL);
     this->pop_isr();
+    this->update_ppr();
 }
 
 void
@@ -173,6 +831,12 @@ virt_x2apic::write_tpr(uint64_t tpr)
 {
     const auto offset = msr_addr_to_offset(ia32_x2apic_tpr::addr);
     this->write_register(offset, tpr);
+
+    this->update_ppr();
+
+    if (m_tpr_shadow && !m_interrupt_delivery) {
+        this->inject_pending(m_hve->interrupt_window()->is_open());
+    }
 }
 
 void
@@ -206,13 +870,80 @@ virt_x2apic::write_svr(uint64_t svr)
 void
 virt_x2apic::queue_injection(uint64_t vector)
 {
-    if (m_hve->interrupt_window()->is_open()) {
+    if (m_interrupt_delivery) {
+        this->queue_virtual_interrupt(vector);
+        return;
+    }
+
+    const auto open = m_hve->interrupt_window()->is_open();
+
+    if (open && this->irr_is_empty() &&
+        !this->masked_by_isr(vector) && !this->masked_by_tpr(vector)) {
         this->inject_interrupt(vector);
+        m_injection_stats.injected++;
         return;
     }
 
     this->queue_interrupt(vector);
-    m_hve->interrupt_window()->enable_exiting();
+    this->inject_pending(open);
+}
+
+void
+virt_x2apic::inject_pending(bool window_open)
+{
+    using namespace vmcs_n;
+
+    auto window_exiting = false;
+    auto threshold = 0ULL;
+
+    // A vector masked by the ISR is released by the guest's EOI, which
+    // exits anyway (see handle_eoi), so it needs neither a window exit nor
+    // a TPR threshold
+
+    if (!this->irr_is_empty() && !this->masked_by_isr(this->top_irr())) {
+        const auto vector = this->top_irr();
+
+        if (this->masked_by_tpr(vector)) {
+            threshold = vector >> 4U;
+        }
+        else if (!window_open) {
+            window_exiting = true;
+        }
+        else {
+            this->pop_irr();
+            this->inject_interrupt(vector);
+
+            // Only one event can be injected per VM entry. Everything still
+            // pending has at most the priority class of the vector now in
+            // service, so it is masked by it until the guest's EOI.
+
+            m_injection_stats.injected++;
+            m_burst_injected++;
+        }
+    }
+
+    if (window_exiting) {
+        m_hve->interrupt_window()->enable_exiting();
+    }
+    else {
+        m_hve->interrupt_window()->disable_exiting();
+    }
+
+    if (m_tpr_shadow) {
+        tpr_threshold::set(threshold);
+    }
+
+    if (this->irr_is_empty() && (m_burst_injected != 0U || m_burst_window_exits != 0U)) {
+        const auto saved =
+            m_burst_injected > m_burst_window_exits ? m_burst_injected - m_burst_window_exits : 0U;
+
+        m_injection_stats.bursts++;
+        m_injection_stats.exits_saved += saved;
+        m_injection_stats.last_burst_exits_saved = saved;
+
+        m_burst_injected = 0;
+        m_burst_window_exits = 0;
+    }
 }
 
 void
@@ -226,6 +957,21 @@ virt_x2apic::queue_interrupt(uint64_t vector)
     this->write_register(offset, set_bit(this->read_register(offset), bit));
 }
 
+void
+virt_x2apic::queue_virtual_interrupt(uint64_t vector)
+{
+    using namespace vmcs_n;
+
+    this->queue_interrupt(vector);
+
+    const auto status = guest_interrupt_status::get();
+    const auto rvi = status & 0xFFU;
+
+    if (vector > rvi) {
+        guest_interrupt_status::set((status & 0xFF00U) | vector);
+    }
+}
+
 void
 virt_x2apic::inject_interrupt(uint64_t vector)
 {
@@ -241,6 +987,7 @@ virt_x2apic::inject_interrupt(uint64_t vector)
     this->write_register(irr_offset, clear_bit(this->read_register(irr_offset), bit));
     this->write_register(isr_offset, set_bit(this->read_register(isr_offset), bit));
 
+    this->update_ppr();
     m_hve->interrupt_window()->inject(vector);
 }
 
@@ -257,96 +1004,110 @@ virt_x2apic::inject_spurious(uint64_t viv)
 ///----------------------------------------------------------------------------
 /// 256-bit register manipulation
 ///
-/// Note: the current implementation uses standard C++ to manipulate
-/// 256-bit registers, represented as eight 32-bit values. Eventually
-/// this could/should be optimized with bit-manipulation instructions
-/// such as popcnt and bsr.
+/// The IRR and ISR are each eight 32-bit registers in the virtual-APIC
+/// page. Alongside each, an 8-bit summary records which of its registers
+/// are non-zero, so the highest set vector is found with two bit scans
+/// (one on the summary, one on the register it selects) instead of a
+/// walk over all 256 bits.
+///
+/// The summaries are maintained by write_register. Once virtual-interrupt
+/// delivery is enabled the CPU also updates the IRR and ISR in the page,
+/// so the summary is rebuilt from the eight registers on each use instead.
 ///----------------------------------------------------------------------------
 
 uint64_t
-virt_x2apic::top_irr()
-{ return this->top_256bit(ia32_x2apic_irr7::addr); }
+virt_x2apic::top_irr() const
+{ return this->top_256bit(irr_base); }
 
 uint64_t
-virt_x2apic::top_isr()
-{ return this->top_256bit(ia32_x2apic_isr7::addr); }
+virt_x2apic::top_isr() const
+{ return this->top_256bit(isr_base); }
 
 uint64_t
-virt_x2apic::top_256bit(uint64_t last)
+virt_x2apic::summary_256bit(lapic_register::offset_t base) const
 {
-    auto vector = 0ULL;
+    if (!m_interrupt_delivery) {
+        return base == irr_base ? m_irr_summary : m_isr_summary;
+    }
+
+    auto summary = 0ULL;
 
     for (auto i = 0U; i < 8U; ++i) {
-        auto addr = last - i;
-        auto offset = lapic_register::msr_addr_to_offset(addr);
-        auto reg = this->read_register(offset);
-
-        if (reg) {
-            for (auto b = 31; b >= 0; --b) {
-                auto uint_b = gsl::narrow_cast<uint64_t>(b);
-                auto masked_reg = (reg & (1ULL << uint_b));
-
-                if (masked_reg != 0ULL) {
-                    vector = ((7ULL - i) << 5ULL) | uint_b;
-                    return vector;
-                }
-            }
+        if (m_virt_apic_page[(base + i) << 2U] != 0U) {
+            summary |= 1ULL << i;
         }
     }
 
-    return vector;
+    return summary;
+}
+
+uint64_t
+virt_x2apic::top_256bit(lapic_register::offset_t base) const
+{
+    const auto summary = this->summary_256bit(base);
+
+    if (summary == 0U) {
+        return 0U;
+    }
+
+    const auto index = bit_scan_reverse(summary);
+    return (index << 5U) | bit_scan_reverse(m_virt_apic_page[(base + index) << 2U]);
 }
 
 void
 virt_x2apic::pop_irr()
-{ this->pop_256bit(ia32_x2apic_irr7::addr); }
+{ this->pop_256bit(irr_base); }
 
 void
 virt_x2apic::pop_isr()
-{ this->pop_256bit(ia32_x2apic_isr7::addr); }
+{ this->pop_256bit(isr_base); }
 
 void
-virt_x2apic::pop_256bit(uint64_t last)
+virt_x2apic::pop_256bit(lapic_register::offset_t base)
 {
-    for (auto i = 0U; i < 8U; ++i) {
-        const auto addr = last - i;
-        auto offset = lapic_register::msr_addr_to_offset(addr);
-        auto reg = this->read_register(offset);
-
-        if (reg) {
-            for (auto b = 31; b >= 0; --b) {
-                auto masked_reg = (reg & (1ULL << gsl::narrow_cast<uint64_t>(b)));
-                if (masked_reg != 0ULL) {
-                    this->write_register(offset, clear_bit(reg, b));
-                    return;
-                }
-            }
-        }
+    const auto summary = this->summary_256bit(base);
+
+    if (summary == 0U) {
+        return;
     }
+
+    const auto offset = base + bit_scan_reverse(summary);
+    const auto reg = this->read_register(offset);
+
+    this->write_register(offset, clear_bit(reg, bit_scan_reverse(reg)));
 }
 
 bool
-virt_x2apic::irr_is_empty()
-{ return this->is_empty_256bit(ia32_x2apic_irr7::addr); }
+virt_x2apic::irr_is_empty() const
+{ return this->is_empty_256bit(irr_base); }
 
 bool
-virt_x2apic::isr_is_empty()
-{ return this->is_empty_256bit(ia32_x2apic_isr7::addr); }
+virt_x2apic::isr_is_empty() const
+{ return this->is_empty_256bit(isr_base); }
 
 bool
-virt_x2apic::is_empty_256bit(uint64_t last)
+virt_x2apic::is_empty_256bit(lapic_register::offset_t base) const
+{ return this->summary_256bit(base) == 0U; }
+
+///----------------------------------------------------------------------------
+/// Processor priority
+///----------------------------------------------------------------------------
+
+void
+virt_x2apic::update_ppr()
 {
-    for (auto i = 0U; i < 8U; ++i) {
-        auto addr = last - i;
-        auto offset = lapic_register::msr_addr_to_offset(addr);
-        auto reg = this->read_register(offset);
+    // With virtual-interrupt delivery the CPU maintains the virtual PPR
+    // in the virtual-APIC page itself
 
-        if (reg != 0U) {
-            return false;
-        }
+    if (m_interrupt_delivery) {
+        return;
     }
 
-    return true;
+    const auto tpr = this->read_tpr() & 0xFFU;
+    const auto isrv = this->top_isr() & 0xF0U;
+
+    const auto offset = msr_addr_to_offset(ia32_x2apic_ppr::addr);
+    this->write_register(offset, (tpr & 0xF0U) >= isrv ? tpr : isrv);
 }
 
 ///----------------------------------------------------------------------------
@@ -358,16 +1119,61 @@ virt_x2apic::handle_interrupt_window_exit(gsl::not_null<vmcs_t *> vmcs)
 {
     bfignored(vmcs);
 
-    auto vector = this->top_irr();
-    this->pop_irr();
-    this->inject_interrupt(vector);
+    if (m_interrupt_delivery) {
+        return false;
+    }
 
-    if (irr_is_empty()) {
-        m_hve->interrupt_window()->disable_exiting();
-        return true;
+    m_injection_stats.window_exits++;
+    m_burst_window_exits++;
+
+    this->inject_pending(true);
+    return true;
+}
+
+const virt_lapic::injection_stats_t &
+virt_x2apic::injection_stats() const noexcept
+{ return m_injection_stats; }
+
+void
+virt_x2apic::handle_eoi()
+{
+    this->write_eoi();
+
+    if (!m_interrupt_delivery) {
+        this->inject_pending(m_hve->interrupt_window()->is_open());
+    }
+}
+
+bool
+virt_x2apic::handle_virtualized_eoi_exit(gsl::not_null<vmcs_t *> vmcs)
+{
+    // The CPU has already updated the virtual ISR and SVI, and the exit is
+    // trap-like, so there is nothing to emulate or advance here
+
+    const auto vector = m_hve->exit_context()->exit_qualification() & 0xFFU;
+    const auto handlers = m_eoi_handlers.find(vector);
+
+    if (handlers != m_eoi_handlers.end()) {
+        for (const auto &d : handlers->second) {
+            if (d(vmcs, vector)) {
+                break;
+            }
+        }
     }
 
-    m_hve->interrupt_window()->enable_exiting();
+    return true;
+}
+
+bool
+virt_x2apic::handle_tpr_below_threshold_exit(gsl::not_null<vmcs_t *> vmcs)
+{
+    bfignored(vmcs);
+
+    // The exit is trap-like: the guest's TPR write has already landed in
+    // the virtual-APIC page, so the software view needs no update beyond
+    // re-evaluating what is now deliverable
+
+    this->inject_pending(m_hve->interrupt_window()->is_open());
     return true;
 }
 
@@ -378,7 +1184,7 @@ virt_x2apic::handle_interrupt_window_exit(gsl::not_null<vmcs_t *> vmcs)
 void
 virt_x2apic::reset_registers()
 {
-    for (auto i = 0U; i < m_registers.size(); ++i) {
+    for (auto i = 0U; i < lapic_register::count; ++i) {
         this->reset_register(i);
     }
 }
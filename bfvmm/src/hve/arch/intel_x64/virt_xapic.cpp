@@ -0,0 +1,72 @@
+//
+// Bareflank Hypervisor
+// Copyright (C) 2017 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <intrinsics.h>
+
+#include <hve/arch/intel_x64/hve.h>
+#include <hve/arch/intel_x64/lapic_register.h>
+#include <hve/arch/intel_x64/virt_xapic.h>
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+using namespace ::intel_x64::msrs;
+using namespace lapic_register;
+
+constexpr const auto xapic_id_from = 24U;
+constexpr const auto dfr_reset = 0xFFFFFFFFULL;
+
+constexpr const auto id_offset = msr_addr_to_offset(ia32_x2apic_apicid::addr);
+constexpr const auto dfr_offset = mem_addr_to_offset(0x0E0ULL);
+
+virt_xapic::virt_xapic(gsl::not_null<eapis::intel_x64::hve *> hve) :
+    virt_x2apic{hve}
+{
+    const auto id = hve->vmcs()->save_state()->vcpuid;
+
+    this->write_register(id_offset, id << xapic_id_from);
+    this->write_register(dfr_offset, dfr_reset);
+}
+
+virt_xapic::virt_xapic(
+    gsl::not_null<eapis::intel_x64::hve *> hve,
+    gsl::not_null<eapis::intel_x64::phys_lapic *> phys) :
+    virt_x2apic{hve, phys}
+{
+    // The x2APIC constructor copied the registers both modes share;
+    // the xAPIC-only ones (DFR and ICR high) are copied here
+
+    for (auto i = 0U; i < lapic_register::count; ++i) {
+        if (readable_in_xapic(i) && !exists_in_x2apic(i)) {
+            this->write_register(i, phys->read_register(i));
+        }
+    }
+}
+
+bool
+virt_xapic::enable_register_virtualization()
+{ return false; }
+
+uint64_t
+virt_xapic::read_id() const
+{ return this->read_register(id_offset) >> xapic_id_from; }
+
+}
+}
@@ -32,26 +32,16 @@ namespace intel_x64
 namespace ept
 {
 
-constexpr const uintptr_t mock_pml4_hpa = 0x000ABCD000000000ULL;
-constexpr const uintptr_t mock_pdpt_hpa = 0x0000000ABCD00000ULL;
-constexpr const uintptr_t mock_pd_hpa = 0x0000000123400000ULL;
-constexpr const uintptr_t mock_pt_hpa = 0x0000000DCBA00000ULL;
 constexpr const uintptr_t mock_page_hpa = 0x000000000F00D000ULL;
 
-constexpr const uint64_t mock_pml4e_offset = 0xFF8;
-constexpr const uint64_t mock_pdpte_offset = 0xFF8;
-constexpr const uint64_t mock_pde_offset = 0xFF8;
-constexpr const uint64_t mock_pte_offset = 0xFF8;
-constexpr const uint64_t mock_page_offset = 0xA55A;
-
 constexpr const uintptr_t mock_1g_hpa = 0xFFFFC0000000ULL;
 constexpr const uintptr_t mock_2m_hpa = 0xFFFFFFE00000ULL;
 constexpr const uintptr_t mock_4k_hpa = 0xFFFFFFFFF000ULL;
 
-// The following gpa is mapped into all mocked memory maps
+// The following gpa uses the last entry of every page table level
 constexpr const uintptr_t g_mapped_gpa = 0x0000FFFFFFFFF000ULL;
 
-// The following gpa is not mapped by any entries in any mocked memory maps
+// The following gpa uses the first entry of every page table level
 constexpr const uintptr_t g_unmapped_gpa = 0x0000000000000000ULL;
 
 std::map<void *, uintptr_t> g_mock_mem;
@@ -136,166 +126,6 @@ setup_mock_ept_memory_manager(MockRepository &mocks)
     return mm;
 }
 
-void
-allocate_mock_empty_pml4(ept::memory_map &map)
-{
-    void *pml4 = operator new (ept::page_table::size_bytes);
-    map.m_pml4_hva = reinterpret_cast<uintptr_t>(pml4);
-    memset(pml4, 0, ept::page_table::size_bytes);
-    g_mock_mem[pml4] = mock_pml4_hpa;
-}
-
-void
-allocate_mock_1g_page(ept::memory_map &map)
-{
-    void *pml4 = operator new (ept::page_table::size_bytes);
-    void *pdpt = operator new (ept::page_table::size_bytes);
-    void *page = operator new (ept::pte::page_size_bytes);
-    memset(pml4, 0xFF, ept::page_table::size_bytes);
-    memset(pdpt, 0xFF, ept::page_table::size_bytes);
-    memset(page, 0xFF, ept::pte::page_size_bytes);
-
-    // Setup mock page tables with one empty entry and one 1G page frame
-    map.m_pml4_hva = reinterpret_cast<uintptr_t>(pml4);
-    epte_t *pml4e = static_cast<epte_t *>(pml4);
-    epte::clear(*pml4e);
-    pml4e += (ept::page_table::num_entries - 1);
-    epte::clear(*pml4e);
-    epte::read_access::enable(*pml4e);
-    epte::write_access::enable(*pml4e);
-    epte::set_hpa(*pml4e, mock_pdpt_hpa & epte::phys_addr_bits::mask);
-
-    epte_t *pdpte = static_cast<epte_t *>(pdpt);
-    epte::clear(*pdpte);
-    pdpte += (ept::page_table::num_entries - 1);
-    epte::clear(*pdpte);
-    epte::read_access::enable(*pdpte);
-    epte::write_access::enable(*pdpte);
-    epte::entry_type::enable(*pdpte);
-    epte::set_hpa(*pdpte, mock_page_hpa);
-
-    // Setup the mock memory manager's virt->phys mappings for the
-    // page table entries allocated above
-    g_mock_mem[pml4] = mock_pml4_hpa;
-    g_mock_mem[pdpt] = mock_pdpt_hpa;
-    g_mock_mem[page] = mock_page_hpa;
-}
-
-void
-allocate_mock_2m_page(ept::memory_map &map)
-{
-    void *pml4 = operator new (ept::page_table::size_bytes);
-    void *pdpt = operator new (ept::page_table::size_bytes);
-    void *pd = operator new (ept::page_table::size_bytes);
-    void *page = operator new (ept::pte::page_size_bytes);
-    memset(pml4, 0xFF, ept::page_table::size_bytes);
-    memset(pdpt, 0xFF, ept::page_table::size_bytes);
-    memset(pd, 0xFF, ept::page_table::size_bytes);
-    memset(page, 0xFF, ept::pte::page_size_bytes);
-
-    // Setup mock page tables with one empty entry and one 2MB page frame
-    map.m_pml4_hva = reinterpret_cast<uintptr_t>(pml4);
-    epte_t *pml4e = static_cast<epte_t *>(pml4);
-    epte::clear(*pml4e);
-    pml4e += (ept::page_table::num_entries - 1);
-    epte::clear(*pml4e);
-    epte::read_access::enable(*pml4e);
-    epte::write_access::enable(*pml4e);
-    epte::set_hpa(*pml4e, mock_pdpt_hpa & epte::phys_addr_bits::mask);
-
-    epte_t *pdpte = static_cast<epte_t *>(pdpt);
-    epte::clear(*pdpte);
-    pdpte += (ept::page_table::num_entries - 1);
-    epte::clear(*pdpte);
-    epte::read_access::enable(*pdpte);
-    epte::write_access::enable(*pdpte);
-    epte::set_hpa(*pdpte, mock_pd_hpa & epte::phys_addr_bits::mask);
-
-    epte_t *pde = static_cast<epte_t *>(pd);
-    epte::clear(*pde);
-    pde += (ept::page_table::num_entries - 1);
-    epte::clear(*pde);
-    epte::read_access::enable(*pde);
-    epte::write_access::enable(*pde);
-    epte::entry_type::enable(*pde);
-    epte::set_hpa(*pde, mock_page_hpa);
-
-    // Setup the mock memory manager's virt->phys mappings for the
-    // page table entries allocated above
-    g_mock_mem[pml4] = mock_pml4_hpa;
-    g_mock_mem[pdpt] = mock_pdpt_hpa;
-    g_mock_mem[pd] = mock_pd_hpa;
-    g_mock_mem[page] = mock_page_hpa;
-}
-
-void
-allocate_mock_4k_page(ept::memory_map &map)
-{
-    void *pml4 = operator new (ept::page_table::size_bytes);
-    void *pdpt = operator new (ept::page_table::size_bytes);
-    void *pd = operator new (ept::page_table::size_bytes);
-    void *pt = operator new (ept::page_table::size_bytes);
-    void *page = operator new (ept::pte::page_size_bytes);
-    memset(pml4, 0xFF, ept::page_table::size_bytes);
-    memset(pdpt, 0xFF, ept::page_table::size_bytes);
-    memset(pd, 0xFF, ept::page_table::size_bytes);
-    memset(pt, 0xFF, ept::page_table::size_bytes);
-    memset(page, 0xFF, ept::pte::page_size_bytes);
-
-    // Setup mock page tables with one empty entry and one 4KB page frame
-    map.m_pml4_hva = reinterpret_cast<uintptr_t>(pml4);
-    epte_t *pml4e = static_cast<epte_t *>(pml4);
-    epte::clear(*pml4e);
-    pml4e += (ept::page_table::num_entries - 1);
-    epte::clear(*pml4e);
-    epte::read_access::enable(*pml4e);
-    epte::write_access::enable(*pml4e);
-    epte::set_hpa(*pml4e, mock_pdpt_hpa & epte::phys_addr_bits::mask);
-
-    epte_t *pdpte = static_cast<epte_t *>(pdpt);
-    epte::clear(*pdpte);
-    pdpte += (ept::page_table::num_entries - 1);
-    epte::clear(*pdpte);
-    epte::read_access::enable(*pdpte);
-    epte::write_access::enable(*pdpte);
-    epte::set_hpa(*pdpte, mock_pd_hpa & epte::phys_addr_bits::mask);
-
-    epte_t *pde = static_cast<epte_t *>(pd);
-    epte::clear(*pde);
-    pde += (ept::page_table::num_entries - 1);
-    epte::clear(*pde);
-    epte::read_access::enable(*pde);
-    epte::write_access::enable(*pde);
-    epte::set_hpa(*pde, mock_pt_hpa & epte::phys_addr_bits::mask);
-
-    epte_t *pte = static_cast<epte_t *>(pt);
-    epte::clear(*pte);
-    pte += (ept::page_table::num_entries - 1);
-    epte::clear(*pte);
-    epte::read_access::enable(*pte);
-    epte::write_access::enable(*pte);
-    epte::entry_type::enable(*pte);
-    epte::set_hpa(*pte, mock_page_hpa);
-
-    // Setup the mock memory manager's virt->phys mappings for the
-    // page table entries allocated above
-    g_mock_mem[pml4] = mock_pml4_hpa;
-    g_mock_mem[pdpt] = mock_pdpt_hpa;
-    g_mock_mem[pd] = mock_pd_hpa;
-    g_mock_mem[pt] = mock_pt_hpa;
-    g_mock_mem[page] = mock_page_hpa;
-}
-
-void
-free_mock_tables()
-{
-    for (auto const &item : g_mock_mem) {
-        operator delete (item.first);
-    }
-    g_mock_mem.clear();
-    g_next_phys_addr = 0xF00D0000;
-}
-
 }
 }
 }
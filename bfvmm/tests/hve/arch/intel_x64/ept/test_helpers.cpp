@@ -35,14 +35,14 @@ TEST_CASE("ept::eptp")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
+    ept::memory_map mem_map;
 
     uint64_t expected{0ULL};
     expected = eptp::memory_type::set(expected, eptp::memory_type::write_back);
     expected = eptp::page_walk_length_minus_one::set(expected, 3ULL);
-    expected = eptp::phys_addr::set(expected, mem_map->m_pml4_hpa);
+    expected = eptp::phys_addr::set(expected, mem_map.m_pml4_hpa);
 
-    uint64_t eptp_val = ept::eptp(*mem_map);
+    uint64_t eptp_val = ept::eptp(mem_map);
     CHECK(eptp_val == expected);
 }
 
@@ -50,14 +50,14 @@ TEST_CASE("ept::map_1g")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
+    ept::memory_map mem_map;
     uintptr_t gpa = g_unmapped_gpa;
     uintptr_t hpa = mock_1g_hpa;
     epte_t result_entry{0ULL};
 
-    ept::map_1g(*mem_map, gpa, hpa);
-    CHECK_THROWS(ept::map_1g(*mem_map, gpa, hpa));
-    result_entry = mem_map->gpa_to_epte(gpa);
+    ept::map_1g(mem_map, gpa, hpa);
+    CHECK_THROWS(ept::map_1g(mem_map, gpa, hpa));
+    result_entry = mem_map.gpa_to_epte(gpa);
     CHECK(epte::hpa(result_entry) == hpa);
 }
 
@@ -65,15 +65,15 @@ TEST_CASE("ept::map_1g with attributes")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
+    ept::memory_map mem_map;
     uintptr_t gpa = g_unmapped_gpa;
     uintptr_t hpa = mock_1g_hpa;
     ept::memory_attr_t mtype = epte::memory_attr::wb_rw;
     epte_t result_entry{0ULL};
 
-    ept::map_1g(*mem_map, gpa, hpa, mtype);
-    CHECK_THROWS(ept::map_1g(*mem_map, gpa, hpa, mtype));
-    result_entry = mem_map->gpa_to_epte(gpa);
+    ept::map_1g(mem_map, gpa, hpa, mtype);
+    CHECK_THROWS(ept::map_1g(mem_map, gpa, hpa, mtype));
+    result_entry = mem_map.gpa_to_epte(gpa);
     CHECK(epte::hpa(result_entry) == hpa);
 }
 
@@ -81,14 +81,14 @@ TEST_CASE("ept::identity_map_1g")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
+    ept::memory_map mem_map;
     uintptr_t gpa = g_unmapped_gpa;
     ept::memory_attr_t mtype = epte::memory_attr::wb_rw;
     epte_t result_entry{0ULL};
 
-    ept::identity_map_1g(*mem_map, gpa);
-    CHECK_THROWS(ept::identity_map_1g(*mem_map, gpa));
-    result_entry = mem_map->gpa_to_epte(gpa);
+    ept::identity_map_1g(mem_map, gpa);
+    CHECK_THROWS(ept::identity_map_1g(mem_map, gpa));
+    result_entry = mem_map.gpa_to_epte(gpa);
     CHECK(epte::hpa(result_entry) == gpa);
 }
 
@@ -96,14 +96,14 @@ TEST_CASE("ept::identity_map_1g with attributes")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
+    ept::memory_map mem_map;
     uintptr_t gpa = g_unmapped_gpa;
     ept::memory_attr_t mtype = epte::memory_attr::wb_rw;
     epte_t result_entry{0ULL};
 
-    ept::identity_map_1g(*mem_map, gpa, mtype);
-    CHECK_THROWS(ept::identity_map_1g(*mem_map, gpa));
-    result_entry = mem_map->gpa_to_epte(gpa);
+    ept::identity_map_1g(mem_map, gpa, mtype);
+    CHECK_THROWS(ept::identity_map_1g(mem_map, gpa));
+    result_entry = mem_map.gpa_to_epte(gpa);
     CHECK(epte::hpa(result_entry) == gpa);
 }
 
@@ -111,14 +111,14 @@ TEST_CASE("ept::map_2m")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
+    ept::memory_map mem_map;
     uintptr_t gpa = g_unmapped_gpa;
     uintptr_t hpa = mock_2m_hpa;
     epte_t result_entry{0ULL};
 
-    ept::map_2m(*mem_map, gpa, hpa);
-    CHECK_THROWS(ept::map_2m(*mem_map, gpa, hpa));
-    result_entry = mem_map->gpa_to_epte(gpa);
+    ept::map_2m(mem_map, gpa, hpa);
+    CHECK_THROWS(ept::map_2m(mem_map, gpa, hpa));
+    result_entry = mem_map.gpa_to_epte(gpa);
     CHECK(epte::hpa(result_entry) == hpa);
 }
 
@@ -126,15 +126,15 @@ TEST_CASE("ept::map_2m with attributes")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
+    ept::memory_map mem_map;
     uintptr_t gpa = g_unmapped_gpa;
     uintptr_t hpa = mock_2m_hpa;
     ept::memory_attr_t mtype = epte::memory_attr::wb_rw;
     epte_t result_entry{0ULL};
 
-    ept::map_2m(*mem_map, gpa, hpa, mtype);
-    CHECK_THROWS(ept::map_2m(*mem_map, gpa, hpa, mtype));
-    result_entry = mem_map->gpa_to_epte(gpa);
+    ept::map_2m(mem_map, gpa, hpa, mtype);
+    CHECK_THROWS(ept::map_2m(mem_map, gpa, hpa, mtype));
+    result_entry = mem_map.gpa_to_epte(gpa);
     CHECK(epte::hpa(result_entry) == hpa);
 }
 
@@ -142,14 +142,14 @@ TEST_CASE("ept::identity_map_2m")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
+    ept::memory_map mem_map;
     uintptr_t gpa = g_unmapped_gpa;
     ept::memory_attr_t mtype = epte::memory_attr::wb_rw;
     epte_t result_entry{0ULL};
 
-    ept::identity_map_2m(*mem_map, gpa);
-    CHECK_THROWS(ept::identity_map_2m(*mem_map, gpa));
-    result_entry = mem_map->gpa_to_epte(gpa);
+    ept::identity_map_2m(mem_map, gpa);
+    CHECK_THROWS(ept::identity_map_2m(mem_map, gpa));
+    result_entry = mem_map.gpa_to_epte(gpa);
     CHECK(epte::hpa(result_entry) == gpa);
 }
 
@@ -157,14 +157,14 @@ TEST_CASE("ept::identity_map_2m with attributes")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
+    ept::memory_map mem_map;
     uintptr_t gpa = g_unmapped_gpa;
     ept::memory_attr_t mtype = epte::memory_attr::wb_rw;
     epte_t result_entry{0ULL};
 
-    ept::identity_map_2m(*mem_map, gpa, mtype);
-    CHECK_THROWS(ept::identity_map_2m(*mem_map, gpa));
-    result_entry = mem_map->gpa_to_epte(gpa);
+    ept::identity_map_2m(mem_map, gpa, mtype);
+    CHECK_THROWS(ept::identity_map_2m(mem_map, gpa));
+    result_entry = mem_map.gpa_to_epte(gpa);
     CHECK(epte::hpa(result_entry) == gpa);
 }
 
@@ -172,14 +172,14 @@ TEST_CASE("ept::map_4k")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
+    ept::memory_map mem_map;
     uintptr_t gpa = g_unmapped_gpa;
     uintptr_t hpa = mock_4k_hpa;
     epte_t result_entry{0ULL};
 
-    ept::map_4k(*mem_map, gpa, hpa);
-    CHECK_THROWS(ept::map_4k(*mem_map, gpa, hpa));
-    result_entry = mem_map->gpa_to_epte(gpa);
+    ept::map_4k(mem_map, gpa, hpa);
+    CHECK_THROWS(ept::map_4k(mem_map, gpa, hpa));
+    result_entry = mem_map.gpa_to_epte(gpa);
     CHECK(epte::hpa(result_entry) == hpa);
 }
 
@@ -187,15 +187,15 @@ TEST_CASE("ept::map_4k with attributes")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
+    ept::memory_map mem_map;
     uintptr_t gpa = g_unmapped_gpa;
     uintptr_t hpa = mock_4k_hpa;
     ept::memory_attr_t mtype = epte::memory_attr::wb_rw;
     epte_t result_entry{0ULL};
 
-    ept::map_4k(*mem_map, gpa, hpa, mtype);
-    CHECK_THROWS(ept::map_4k(*mem_map, gpa, hpa, mtype));
-    result_entry = mem_map->gpa_to_epte(gpa);
+    ept::map_4k(mem_map, gpa, hpa, mtype);
+    CHECK_THROWS(ept::map_4k(mem_map, gpa, hpa, mtype));
+    result_entry = mem_map.gpa_to_epte(gpa);
     CHECK(epte::hpa(result_entry) == hpa);
 }
 
@@ -203,14 +203,14 @@ TEST_CASE("ept::identity_map_4k")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
+    ept::memory_map mem_map;
     uintptr_t gpa = g_unmapped_gpa;
     ept::memory_attr_t mtype = epte::memory_attr::wb_rw;
     epte_t result_entry{0ULL};
 
-    ept::identity_map_4k(*mem_map, gpa);
-    CHECK_THROWS(ept::identity_map_4k(*mem_map, gpa));
-    result_entry = mem_map->gpa_to_epte(gpa);
+    ept::identity_map_4k(mem_map, gpa);
+    CHECK_THROWS(ept::identity_map_4k(mem_map, gpa));
+    result_entry = mem_map.gpa_to_epte(gpa);
     CHECK(epte::hpa(result_entry) == gpa);
 }
 
@@ -218,17 +218,81 @@ TEST_CASE("ept::identity_map_4k with attributes")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
+    ept::memory_map mem_map;
     uintptr_t gpa = g_unmapped_gpa;
     ept::memory_attr_t mtype = epte::memory_attr::wb_rw;
     epte_t result_entry{0ULL};
 
-    ept::identity_map_4k(*mem_map, gpa, mtype);
-    CHECK_THROWS(ept::identity_map_4k(*mem_map, gpa));
-    result_entry = mem_map->gpa_to_epte(gpa);
+    ept::identity_map_4k(mem_map, gpa, mtype);
+    CHECK_THROWS(ept::identity_map_4k(mem_map, gpa));
+    result_entry = mem_map.gpa_to_epte(gpa);
     CHECK(epte::hpa(result_entry) == gpa);
 }
 
+TEST_CASE("ept::map_range")
+{
+    MockRepository mocks;
+    auto mm = setup_mock_ept_memory_manager(mocks);
+    ept::memory_map mem_map;
+    uintptr_t gpa = 0x40000000ULL - 0x200000ULL - 0x1000ULL;
+    uintptr_t hpa = gpa + 0x80000000ULL;
+    auto size = 0x1000ULL + 0x200000ULL + 0x40000000ULL + 0x200000ULL + 0x1000ULL;
+
+    g_msrs[::intel_x64::msrs::ia32_vmx_ept_vpid_cap::addr] =
+        ::intel_x64::msrs::ia32_vmx_ept_vpid_cap::pdpte_1gb_support::mask;
+
+    CHECK(ept::map_range(mem_map, gpa, hpa, size) == 5ULL);
+    CHECK(mem_map.gpa_to_hpa(gpa) == hpa);
+    CHECK(mem_map.gpa_to_hpa(gpa + size - 1U) == hpa + size - 1U);
+    CHECK_THROWS(ept::map_range(mem_map, gpa, hpa, size));
+    CHECK_THROWS(ept::map_range(mem_map, 0x1ULL, 0x1ULL, 0x1000ULL));
+}
+
+TEST_CASE("ept::map_range misaligned hpa")
+{
+    MockRepository mocks;
+    auto mm = setup_mock_ept_memory_manager(mocks);
+    ept::memory_map mem_map;
+    ept::memory_attr_t mtype = epte::memory_attr::wb_rw;
+
+    CHECK(ept::map_range(mem_map, 0ULL, 0x1000ULL, 0x400000ULL, mtype) == 1024ULL);
+    CHECK(mem_map.gpa_to_hpa(0x3FF000ULL) == 0x400000ULL);
+}
+
+TEST_CASE("ept::identity_map_range")
+{
+    MockRepository mocks;
+    auto mm = setup_mock_ept_memory_manager(mocks);
+    ept::memory_map mem_map;
+    ept::memory_attr_t mtype = epte::memory_attr::wb_rw;
+
+    g_msrs[::intel_x64::msrs::ia32_vmx_ept_vpid_cap::addr] =
+        ::intel_x64::msrs::ia32_vmx_ept_vpid_cap::pdpte_1gb_support::mask;
+
+    CHECK(ept::identity_map_range(mem_map, 0ULL, 0x80000000ULL) == 2ULL);
+    CHECK(ept::identity_map_range(mem_map, 0x80000000ULL, 0x400000ULL, mtype) == 2ULL);
+    CHECK(mem_map.gpa_to_hpa(0x80200000ULL) == 0x80200000ULL);
+}
+
+TEST_CASE("ept::identity_map_range without 1g pages")
+{
+    MockRepository mocks;
+    auto mm = setup_mock_ept_memory_manager(mocks);
+    ept::memory_map mem_map;
+
+    g_msrs[::intel_x64::msrs::ia32_vmx_ept_vpid_cap::addr] = 0ULL;
+
+    // A 1g aligned range is mapped with 2m leaves
+
+    CHECK(ept::identity_map_range(mem_map, 0x40000000ULL, 0x40000000ULL) == 512ULL);
+    CHECK(mem_map.gpa_to_hpa(0x7FFFF000ULL) == 0x7FFFF000ULL);
+
+    auto &pml4e = mem_map.gpa_to_pml4e(0x40000000ULL);
+    auto &pdpte = mem_map.gpa_to_pdpte(0x40000000ULL, pml4e);
+    CHECK(!epte::is_leaf_entry(pdpte));
+    CHECK(epte::is_leaf_entry(mem_map.gpa_to_pde(0x40000000ULL, pdpte)));
+}
+
 }
 }
 }
@@ -382,6 +382,23 @@ TEST_CASE("epte: memory_attr")
     CHECK(entry == 0xffffffffffffffc0ULL);
 }
 
+TEST_CASE("epte: access_rights")
+{
+    epte_t entry = 0x7ULL;
+    CHECK(epte::access_rights::get(entry) == epte::access_rights::pt);
+    entry = 0xffffffffffffffffULL;
+    CHECK(epte::access_rights::get(entry) == epte::access_rights::pt);
+    entry = 0ULL;
+    CHECK(epte::access_rights::get(entry) == epte::access_rights::tp);
+
+    entry = 0ULL;
+    epte::access_rights::set(entry, epte::access_rights::rw);
+    CHECK(entry == 0x3ULL);
+    entry = 0xffffffffffffffffULL;
+    epte::access_rights::set(entry, epte::access_rights::eo);
+    CHECK(entry == 0xfffffffffffffffcULL);
+}
+
 TEST_CASE("epte: trap_on_access")
 {
     epte_t entry = 0ULL;
@@ -21,6 +21,8 @@
 
 #ifdef _HIPPOMOCKS__ENABLE_CFUNC_MOCKING_SUPPORT
 
+namespace eptp = intel_x64::vmcs::ept_pointer;
+
 namespace eapis
 {
 namespace intel_x64
@@ -32,25 +34,18 @@ TEST_CASE("memory_map::memory_map")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
-
-    CHECK(mem_map);
-    CHECK(mem_map->m_pml4_hva != 0ULL);
-}
+    ept::memory_map mem_map;
 
-TEST_CASE("memory_map::~memory_map")
-{
-    MockRepository mocks;
-    auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
-    delete mem_map;
+    CHECK(mem_map.m_pml4_hva != 0ULL);
+    CHECK(mem_map.m_pool.hpa_to_hva(mem_map.m_pml4_hpa) ==
+          reinterpret_cast<epte_t *>(mem_map.m_pml4_hva));
 }
 
 TEST_CASE("memory_map::map")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
+    ept::memory_map mem_map;
     uintptr_t gpa{0ULL};
     uintptr_t hpa{0ULL};
     uint64_t size{0ULL};
@@ -65,146 +60,145 @@ TEST_CASE("memory_map::map")
     hpa = mock_1g_hpa;
     size = ept::pdpte::page_size_bytes;
     epte::set_hpa(expected_entry, hpa);
-    entry = mem_map->map(gpa, hpa, size);
+    entry = mem_map.map(gpa, hpa, size);
     CHECK(entry == expected_entry);
-    CHECK_THROWS(mem_map->map(gpa, hpa, size));
-    CHECK_THROWS(mem_map->map(gpa + 0x3fffffffULL, hpa, size));
+    CHECK_THROWS(mem_map.map(gpa, hpa, size));
+    CHECK_THROWS(mem_map.map(gpa + 0x3fffffffULL, hpa, size));
 
     gpa += 0x10000000000ULL;
     hpa = mock_2m_hpa;
     size = ept::pde::page_size_bytes;
     epte::set_hpa(expected_entry, hpa);
-    entry = mem_map->map(gpa, hpa, size);
+    entry = mem_map.map(gpa, hpa, size);
     CHECK(entry == expected_entry);
-    CHECK_THROWS(mem_map->map(gpa, hpa, size));
-    CHECK_THROWS(mem_map->map(gpa + 0x1fffffULL, hpa, size));
+    CHECK_THROWS(mem_map.map(gpa, hpa, size));
+    CHECK_THROWS(mem_map.map(gpa + 0x1fffffULL, hpa, size));
 
     gpa += 0x10000000000ULL;
     hpa = mock_4k_hpa;
     size = ept::pte::page_size_bytes;
     epte::set_hpa(expected_entry, hpa);
-    entry = mem_map->map(gpa, hpa, size);
+    entry = mem_map.map(gpa, hpa, size);
     CHECK(entry == expected_entry);
-    CHECK_THROWS(mem_map->map(gpa, hpa, size));
-    CHECK_THROWS(mem_map->map(gpa + 0xfffULL, hpa, size));
+    CHECK_THROWS(mem_map.map(gpa, hpa, size));
+    CHECK_THROWS(mem_map.map(gpa + 0xfffULL, hpa, size));
 
     gpa += 0x10000000000ULL;
     hpa = mock_4k_hpa;
     size = ept::pte::page_size_bytes - 1ULL;
-    CHECK_THROWS(mem_map->map(gpa, hpa, size));
+    CHECK_THROWS(mem_map.map(gpa, hpa, size));
     size = ept::pte::page_size_bytes + 1ULL;
-    CHECK_THROWS(mem_map->map(gpa, hpa, size));
+    CHECK_THROWS(mem_map.map(gpa, hpa, size));
     size = 0ULL;
-    CHECK_THROWS(mem_map->map(gpa, hpa, size));
+    CHECK_THROWS(mem_map.map(gpa, hpa, size));
     size = 0xffffffffffffffffULL;
-    CHECK_THROWS(mem_map->map(gpa, hpa, size));
+    CHECK_THROWS(mem_map.map(gpa, hpa, size));
 }
 
 TEST_CASE("memory_map::unmap")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
-    uintptr_t gpa{0ULL};
-    uintptr_t hpa{0ULL};
-    uint64_t size{0ULL};
-    epte_t entry{0ULL};
+    ept::memory_map mem_map;
 
-    gpa = g_mapped_gpa;
-    hpa = mock_1g_hpa;
-    g_mock_mem[reinterpret_cast<void *>(gpa)] = hpa;
-    size = ept::pdpte::page_size_bytes;
-    entry = mem_map->map(gpa, hpa, size);
+    auto entry = mem_map.map(g_mapped_gpa, mock_1g_hpa, ept::pdpte::page_size_bytes);
     CHECK(entry != 0ULL);
 
-    mem_map->unmap(gpa);
-    CHECK_THROWS(mem_map->gpa_to_epte(gpa));
-    CHECK_THROWS(mem_map->unmap(gpa));
-
-    g_mock_mem.clear();
+    mem_map.unmap(g_mapped_gpa);
+    CHECK(mem_map.flush_pending());
+    CHECK_THROWS(mem_map.gpa_to_epte(g_mapped_gpa));
+    CHECK_THROWS(mem_map.unmap(g_mapped_gpa));
 }
 
 TEST_CASE("memory_map::gpa_to_epte")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
-    mem_map->m_pml4_hpa = mock_pml4_hpa;
-    epte_t result{0ULL};
-
-    allocate_mock_empty_pml4(*mem_map);
-    CHECK_THROWS(mem_map->gpa_to_epte(g_mapped_gpa));
-    CHECK_THROWS(mem_map->gpa_to_epte(g_unmapped_gpa));
-    free_mock_tables();
-
-    allocate_mock_1g_page(*mem_map);
-    CHECK_THROWS(mem_map->gpa_to_epte(g_unmapped_gpa));
-    result = mem_map->gpa_to_epte(g_mapped_gpa);
-    CHECK(epte::hpa(result) == mock_page_hpa);
-    CHECK(epte::is_leaf_entry(result));
-    free_mock_tables();
-
-    allocate_mock_2m_page(*mem_map);
-    CHECK_THROWS(mem_map->gpa_to_epte(g_unmapped_gpa));
-    result = mem_map->gpa_to_epte(g_mapped_gpa);
-    CHECK(epte::hpa(result) == mock_page_hpa);
-    CHECK(epte::is_leaf_entry(result));
-    free_mock_tables();
-
-    allocate_mock_4k_page(*mem_map);
-    CHECK_THROWS(mem_map->gpa_to_epte(g_unmapped_gpa));
-    result = mem_map->gpa_to_epte(g_mapped_gpa);
-    CHECK(epte::hpa(result) == mock_page_hpa);
-    CHECK(epte::is_leaf_entry(result));
-    free_mock_tables();
+
+    {
+        ept::memory_map mem_map;
+        CHECK_THROWS(mem_map.gpa_to_epte(g_mapped_gpa));
+        CHECK_THROWS(mem_map.gpa_to_epte(g_unmapped_gpa));
+    }
+
+    for (const auto hpa : {mock_1g_hpa, mock_2m_hpa, mock_4k_hpa}) {
+        ept::memory_map mem_map;
+        auto size =
+            hpa == mock_1g_hpa ? ept::pdpte::page_size_bytes :
+            hpa == mock_2m_hpa ? ept::pde::page_size_bytes : ept::pte::page_size_bytes;
+
+        mem_map.map(g_mapped_gpa & ~(size - 1U), hpa, size);
+        CHECK_THROWS(mem_map.gpa_to_epte(g_unmapped_gpa));
+
+        auto result = mem_map.gpa_to_epte(g_mapped_gpa);
+        CHECK(epte::hpa(result) == hpa);
+        CHECK(epte::is_leaf_entry(result));
+    }
+}
+
+TEST_CASE("memory_map::gpa_to_hpa")
+{
+    MockRepository mocks;
+    auto mm = setup_mock_ept_memory_manager(mocks);
+    ept::memory_map mem_map;
+
+    CHECK_THROWS(mem_map.gpa_to_hpa(g_mapped_gpa));
+
+    mem_map.map(0x0ULL, mock_1g_hpa, ept::pdpte::page_size_bytes);
+    mem_map.map(0x40000000ULL, mock_2m_hpa, ept::pde::page_size_bytes);
+    mem_map.map(0x80000000ULL, mock_4k_hpa, ept::pte::page_size_bytes);
+
+    CHECK(mem_map.gpa_to_hpa(0x12345678ULL) == mock_1g_hpa + 0x12345678ULL);
+    CHECK(mem_map.gpa_to_hpa(0x40012345ULL) == mock_2m_hpa + 0x12345ULL);
+    CHECK(mem_map.gpa_to_hpa(0x80000ABCULL) == mock_4k_hpa + 0xABCULL);
+    CHECK_THROWS(mem_map.gpa_to_hpa(0x40200000ULL));
+    CHECK_THROWS(mem_map.gpa_to_hpa(0x80001000ULL));
 }
 
 TEST_CASE("memory_map::hpa")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
+    ept::memory_map mem_map;
 
-    CHECK(mem_map->hpa() == mem_map->m_pml4_hpa);
+    CHECK(mem_map.hpa() == mem_map.m_pml4_hpa);
 }
 
 TEST_CASE("memory_map::allocate_page_table")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
+    ept::memory_map mem_map;
 
     epte_t entry{0ULL};
-    mem_map->allocate_page_table(entry);
+    mem_map.allocate_page_table(entry);
     CHECK(epte::read_access::is_enabled(entry));
     CHECK(epte::write_access::is_enabled(entry));
     CHECK(epte::execute_access::is_enabled(entry));
     CHECK(epte::memory_type::get(entry) == epte::memory_type::wb);
-    CHECK(epte::hpa(entry));
+    CHECK_NOTHROW(mem_map.m_pool.hpa_to_hva(epte::hpa(entry)));
 }
 
 TEST_CASE("memory_map::free_page_table")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
+    ept::memory_map mem_map;
+
     epte_t entry{0ULL};
-    mem_map->allocate_page_table(entry);
-    CHECK(epte::hpa(entry));
-    epte::read_access::enable(entry);
-    epte::write_access::enable(entry);
-    epte::ignore_pat::enable(entry);
-    epte::suppress_ve::enable(entry);
-
-    mem_map->free_page_table(entry);
+    mem_map.allocate_page_table(entry);
+    auto free_count = mem_map.m_pool.free_count();
+
+    mem_map.free_page_table(entry);
     CHECK(entry == 0ULL);
+    CHECK(mem_map.m_pool.free_count() == free_count + 1U);
 }
 
 TEST_CASE("memory_map::map_entry_to_page_frame")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
+    ept::memory_map mem_map;
     uintptr_t test_hpa = 0x0000000ABCDEF0000ULL;
 
     epte_t expected_entry{0ULL};
@@ -215,7 +209,7 @@ TEST_CASE("memory_map::map_entry_to_page_frame")
     epte::entry_type::enable(expected_entry);
 
     epte_t entry{0ULL};
-    mem_map->map_entry_to_page_frame(entry, test_hpa);
+    mem_map.map_entry_to_page_frame(entry, test_hpa);
     CHECK(entry == expected_entry);
 }
 
@@ -223,302 +217,419 @@ TEST_CASE("memory_map::gpa_to_pml4e")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
-    epte_t pml4e{0ULL};
-    mem_map->m_pml4_hpa = mock_pml4_hpa;
+    ept::memory_map mem_map;
 
-    allocate_mock_empty_pml4(*mem_map);
-    pml4e = mem_map->gpa_to_pml4e(g_mapped_gpa);
-    CHECK(pml4e == 0ULL);
-    free_mock_tables();
+    CHECK(mem_map.gpa_to_pml4e(g_mapped_gpa) == 0ULL);
 
-    allocate_mock_4k_page(*mem_map);
-    pml4e = mem_map->gpa_to_pml4e(g_mapped_gpa);
+    mem_map.map(g_mapped_gpa, mock_page_hpa, ept::pte::page_size_bytes);
+    auto pml4e = mem_map.gpa_to_pml4e(g_mapped_gpa);
     CHECK(epte::read_access::is_enabled(pml4e));
     CHECK(epte::write_access::is_enabled(pml4e));
-    CHECK(epte::execute_access::is_disabled(pml4e));
-    CHECK(epte::hpa(pml4e) == mock_pdpt_hpa);
-    free_mock_tables();
+    CHECK(epte::execute_access::is_enabled(pml4e));
+    CHECK(!epte::is_leaf_entry(pml4e));
+    CHECK_NOTHROW(mem_map.m_pool.hpa_to_hva(epte::hpa(pml4e)));
+    CHECK(mem_map.gpa_to_pml4e(g_unmapped_gpa) == 0ULL);
 }
 
 TEST_CASE("memory_map::gpa_to_pdpte")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
-    epte_t pml4e{0ULL};
-    epte_t pdpte{0ULL};
-    mem_map->m_pml4_hpa = mock_pml4_hpa;
-
-    allocate_mock_empty_pml4(*mem_map);
-    pml4e = mem_map->gpa_to_pml4e(g_mapped_gpa);
-    CHECK_THROWS(mem_map->gpa_to_pdpte(g_mapped_gpa, pml4e));
-    free_mock_tables();
-
-    allocate_mock_1g_page(*mem_map);
-    pml4e = mem_map->gpa_to_pml4e(g_mapped_gpa);
-    pdpte = mem_map->gpa_to_pdpte(g_mapped_gpa, pml4e);
-    CHECK(epte::read_access::is_enabled(pdpte));
-    CHECK(epte::write_access::is_enabled(pdpte));
-    CHECK(epte::execute_access::is_disabled(pdpte));
-    CHECK(epte::entry_type::is_enabled(pdpte));
-    CHECK(epte::hpa(pdpte) == mock_page_hpa);
-    free_mock_tables();
-
-    allocate_mock_4k_page(*mem_map);
-    pml4e = mem_map->gpa_to_pml4e(g_mapped_gpa);
-    pdpte = mem_map->gpa_to_pdpte(g_mapped_gpa, pml4e);
-    CHECK(epte::read_access::is_enabled(pdpte));
-    CHECK(epte::write_access::is_enabled(pdpte));
-    CHECK(epte::execute_access::is_disabled(pdpte));
-    CHECK(epte::hpa(pdpte) == mock_pd_hpa);
-    free_mock_tables();
+
+    {
+        ept::memory_map mem_map;
+        mem_map.map(g_mapped_gpa & ~(ept::pdpte::page_size_bytes - 1U), mock_1g_hpa, ept::pdpte::page_size_bytes);
+
+        auto &pml4e = mem_map.gpa_to_pml4e(g_mapped_gpa);
+        auto pdpte = mem_map.gpa_to_pdpte(g_mapped_gpa, pml4e);
+        CHECK(epte::read_access::is_enabled(pdpte));
+        CHECK(epte::write_access::is_enabled(pdpte));
+        CHECK(epte::execute_access::is_disabled(pdpte));
+        CHECK(epte::entry_type::is_enabled(pdpte));
+        CHECK(epte::hpa(pdpte) == mock_1g_hpa);
+    }
+
+    {
+        ept::memory_map mem_map;
+        mem_map.map(g_mapped_gpa, mock_page_hpa, ept::pte::page_size_bytes);
+
+        auto &pml4e = mem_map.gpa_to_pml4e(g_mapped_gpa);
+        auto pdpte = mem_map.gpa_to_pdpte(g_mapped_gpa, pml4e);
+        CHECK(epte::read_access::is_enabled(pdpte));
+        CHECK(epte::write_access::is_enabled(pdpte));
+        CHECK(epte::execute_access::is_enabled(pdpte));
+        CHECK(!epte::is_leaf_entry(pdpte));
+        CHECK_NOTHROW(mem_map.m_pool.hpa_to_hva(epte::hpa(pdpte)));
+    }
 }
 
 TEST_CASE("memory_map::gpa_to_pde")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
-    epte_t pml4e{0ULL};
-    epte_t pdpte{0ULL};
-    epte_t pde{0ULL};
-    mem_map->m_pml4_hpa = mock_pml4_hpa;
-
-    allocate_mock_2m_page(*mem_map);
-    pml4e = mem_map->gpa_to_pml4e(g_mapped_gpa);
-    pdpte = mem_map->gpa_to_pdpte(g_mapped_gpa, pml4e);
-    pde = mem_map->gpa_to_pde(g_mapped_gpa, pdpte);
-    CHECK(epte::read_access::is_enabled(pde));
-    CHECK(epte::write_access::is_enabled(pde));
-    CHECK(epte::execute_access::is_disabled(pde));
-    CHECK(epte::entry_type::is_enabled(pde));
-    CHECK(epte::hpa(pde) == mock_page_hpa);
-    free_mock_tables();
-
-    allocate_mock_4k_page(*mem_map);
-    pml4e = mem_map->gpa_to_pml4e(g_mapped_gpa);
-    pdpte = mem_map->gpa_to_pdpte(g_mapped_gpa, pml4e);
-    pde = mem_map->gpa_to_pde(g_mapped_gpa, pdpte);
-    CHECK(epte::read_access::is_enabled(pde));
-    CHECK(epte::write_access::is_enabled(pde));
-    CHECK(epte::execute_access::is_disabled(pde));
-    CHECK(epte::hpa(pde) == mock_pt_hpa);
-    free_mock_tables();
+
+    {
+        ept::memory_map mem_map;
+        mem_map.map(g_mapped_gpa & ~(ept::pde::page_size_bytes - 1U), mock_2m_hpa, ept::pde::page_size_bytes);
+
+        auto &pml4e = mem_map.gpa_to_pml4e(g_mapped_gpa);
+        auto &pdpte = mem_map.gpa_to_pdpte(g_mapped_gpa, pml4e);
+        auto pde = mem_map.gpa_to_pde(g_mapped_gpa, pdpte);
+        CHECK(epte::read_access::is_enabled(pde));
+        CHECK(epte::write_access::is_enabled(pde));
+        CHECK(epte::execute_access::is_disabled(pde));
+        CHECK(epte::entry_type::is_enabled(pde));
+        CHECK(epte::hpa(pde) == mock_2m_hpa);
+    }
+
+    {
+        ept::memory_map mem_map;
+        mem_map.map(g_mapped_gpa, mock_page_hpa, ept::pte::page_size_bytes);
+
+        auto &pml4e = mem_map.gpa_to_pml4e(g_mapped_gpa);
+        auto &pdpte = mem_map.gpa_to_pdpte(g_mapped_gpa, pml4e);
+        auto pde = mem_map.gpa_to_pde(g_mapped_gpa, pdpte);
+        CHECK(epte::read_access::is_enabled(pde));
+        CHECK(epte::write_access::is_enabled(pde));
+        CHECK(epte::execute_access::is_enabled(pde));
+        CHECK(!epte::is_leaf_entry(pde));
+        CHECK_NOTHROW(mem_map.m_pool.hpa_to_hva(epte::hpa(pde)));
+    }
 }
 
 TEST_CASE("memory_map::gpa_to_pte")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
-    epte_t pml4e{0ULL};
-    epte_t pdpte{0ULL};
-    epte_t pde{0ULL};
-    epte_t pte{0ULL};
-    mem_map->m_pml4_hpa = mock_pml4_hpa;
-
-    allocate_mock_4k_page(*mem_map);
-    pml4e = mem_map->gpa_to_pml4e(g_mapped_gpa);
-    pdpte = mem_map->gpa_to_pdpte(g_mapped_gpa, pml4e);
-    pde = mem_map->gpa_to_pde(g_mapped_gpa, pdpte);
-    pte = mem_map->gpa_to_pte(g_mapped_gpa, pde);
+    ept::memory_map mem_map;
+
+    mem_map.map(g_mapped_gpa, mock_page_hpa, ept::pte::page_size_bytes);
+
+    auto &pml4e = mem_map.gpa_to_pml4e(g_mapped_gpa);
+    auto &pdpte = mem_map.gpa_to_pdpte(g_mapped_gpa, pml4e);
+    auto &pde = mem_map.gpa_to_pde(g_mapped_gpa, pdpte);
+    auto pte = mem_map.gpa_to_pte(g_mapped_gpa, pde);
     CHECK(epte::read_access::is_enabled(pte));
     CHECK(epte::write_access::is_enabled(pte));
     CHECK(epte::execute_access::is_disabled(pte));
     CHECK(epte::entry_type::is_enabled(pte));
     CHECK(epte::hpa(pte) == mock_page_hpa);
-    free_mock_tables();
 }
 
-// TEST_CASE("memory_map::hpa_to_gpa")
-// {
-//     MockRepository mocks;
-//     auto mm = setup_mock_ept_memory_manager(mocks);
-//     auto mem_map = new ept::memory_map();
-//     mem_map->m_pml4_hpa = mock_pml4_hpa;
-//
-//     allocate_mock_empty_pml4(*mem_map);
-//     mem_map->map(0xabcd0000ULL, 0xabcd0000ULL, pte::page_size_bytes);
-//     CHECK(mem_map->hpa_to_gpa(0xabcd0000ULL) == 0xabcd0000ULL);
-//     free_mock_tables();
-//
-//     allocate_mock_4k_page(*mem_map);
-//     mem_map->map(0ULL, 0xabcd0000ULL, pte::page_size_bytes);
-//     CHECK(mem_map->hpa_to_gpa(0ULL) == 0xabcd0000ULL);
-//     free_mock_tables();
-// }
+static void
+check_page_frame(epte_t entry, uintptr_t hpa)
+{
+    CHECK(epte::read_access::is_enabled(entry));
+    CHECK(epte::write_access::is_enabled(entry));
+    CHECK(epte::execute_access::is_disabled(entry));
+    CHECK(epte::entry_type::is_enabled(entry));
+    CHECK(epte::memory_type::get(entry) == epte::memory_type::wb);
+    CHECK(epte::hpa(entry) == hpa);
+}
 
 TEST_CASE("memory_map::map_pdpte_to_page")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
-    mem_map->m_pml4_hpa = mock_pml4_hpa;
-    epte_t result{0ULL};
-
-    allocate_mock_empty_pml4(*mem_map);
-    result = mem_map->map_pdpte_to_page(g_unmapped_gpa, mock_page_hpa);
-    CHECK(epte::read_access::is_enabled(result));
-    CHECK(epte::write_access::is_enabled(result));
-    CHECK(epte::execute_access::is_disabled(result));
-    CHECK(epte::entry_type::is_enabled(result));
-    CHECK(epte::memory_type::get(result) == epte::memory_type::wb);
-    CHECK(epte::hpa(result) == mock_page_hpa);
-    free_mock_tables();
-
-    allocate_mock_1g_page(*mem_map);
-    CHECK_THROWS(mem_map->map_pdpte_to_page(g_mapped_gpa, mock_page_hpa));
-    result = mem_map->map_pdpte_to_page(g_unmapped_gpa, mock_page_hpa);
-    CHECK(epte::read_access::is_enabled(result));
-    CHECK(epte::write_access::is_enabled(result));
-    CHECK(epte::execute_access::is_disabled(result));
-    CHECK(epte::entry_type::is_enabled(result));
-    CHECK(epte::memory_type::get(result) == epte::memory_type::wb);
-    CHECK(epte::hpa(result) == mock_page_hpa);
-    free_mock_tables();
-
-    allocate_mock_2m_page(*mem_map);
-    CHECK_THROWS(mem_map->map_pdpte_to_page(g_mapped_gpa, mock_page_hpa));
-    result = mem_map->map_pdpte_to_page(g_unmapped_gpa, mock_page_hpa);
-    CHECK(epte::read_access::is_enabled(result));
-    CHECK(epte::write_access::is_enabled(result));
-    CHECK(epte::execute_access::is_disabled(result));
-    CHECK(epte::entry_type::is_enabled(result));
-    CHECK(epte::memory_type::get(result) == epte::memory_type::wb);
-    CHECK(epte::hpa(result) == mock_page_hpa);
-    free_mock_tables();
-
-    allocate_mock_4k_page(*mem_map);
-    CHECK_THROWS(mem_map->map_pdpte_to_page(g_mapped_gpa, mock_page_hpa));
-    result = mem_map->map_pdpte_to_page(g_unmapped_gpa, mock_page_hpa);
-    CHECK(epte::read_access::is_enabled(result));
-    CHECK(epte::write_access::is_enabled(result));
-    CHECK(epte::execute_access::is_disabled(result));
-    CHECK(epte::entry_type::is_enabled(result));
-    CHECK(epte::memory_type::get(result) == epte::memory_type::wb);
-    CHECK(epte::hpa(result) == mock_page_hpa);
-    free_mock_tables();
+    ept::memory_map mem_map;
+
+    check_page_frame(mem_map.map_pdpte_to_page(g_unmapped_gpa, mock_1g_hpa), mock_1g_hpa);
+    CHECK_THROWS(mem_map.map_pdpte_to_page(g_unmapped_gpa, mock_1g_hpa));
+
+    // 2MB and 4KB pages occupy the 1GB entry with a page table
+
+    mem_map.map(0x40000000ULL, mock_2m_hpa, ept::pde::page_size_bytes);
+    mem_map.map(0x80000000ULL, mock_4k_hpa, ept::pte::page_size_bytes);
+    CHECK_THROWS(mem_map.map_pdpte_to_page(0x40000000ULL, mock_1g_hpa));
+    CHECK_THROWS(mem_map.map_pdpte_to_page(0x80000000ULL, mock_1g_hpa));
+
+    check_page_frame(mem_map.map_pdpte_to_page(0xC0000000ULL, mock_1g_hpa), mock_1g_hpa);
 }
 
 TEST_CASE("memory_map::map_pde_to_page")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
-    mem_map->m_pml4_hpa = mock_pml4_hpa;
-    epte_t result{0ULL};
-
-    allocate_mock_empty_pml4(*mem_map);
-    result = mem_map->map_pde_to_page(g_unmapped_gpa, mock_page_hpa);
-    CHECK(epte::read_access::is_enabled(result));
-    CHECK(epte::write_access::is_enabled(result));
-    CHECK(epte::execute_access::is_disabled(result));
-    CHECK(epte::entry_type::is_enabled(result));
-    CHECK(epte::memory_type::get(result) == epte::memory_type::wb);
-    CHECK(epte::hpa(result) == mock_page_hpa);
-    free_mock_tables();
-
-    allocate_mock_1g_page(*mem_map);
-    CHECK_THROWS(mem_map->map_pde_to_page(g_mapped_gpa, mock_page_hpa));
-    result = mem_map->map_pde_to_page(g_unmapped_gpa, mock_page_hpa);
-    CHECK(epte::read_access::is_enabled(result));
-    CHECK(epte::write_access::is_enabled(result));
-    CHECK(epte::execute_access::is_disabled(result));
-    CHECK(epte::entry_type::is_enabled(result));
-    CHECK(epte::memory_type::get(result) == epte::memory_type::wb);
-    CHECK(epte::hpa(result) == mock_page_hpa);
-    free_mock_tables();
-
-    allocate_mock_2m_page(*mem_map);
-    CHECK_THROWS(mem_map->map_pde_to_page(g_mapped_gpa, mock_page_hpa));
-    result = mem_map->map_pde_to_page(g_unmapped_gpa, mock_page_hpa);
-    CHECK(epte::read_access::is_enabled(result));
-    CHECK(epte::write_access::is_enabled(result));
-    CHECK(epte::execute_access::is_disabled(result));
-    CHECK(epte::entry_type::is_enabled(result));
-    CHECK(epte::memory_type::get(result) == epte::memory_type::wb);
-    CHECK(epte::hpa(result) == mock_page_hpa);
-    free_mock_tables();
-
-    allocate_mock_4k_page(*mem_map);
-    CHECK_THROWS(mem_map->map_pde_to_page(g_mapped_gpa, mock_page_hpa));
-    result = mem_map->map_pde_to_page(g_unmapped_gpa, mock_page_hpa);
-    CHECK(epte::read_access::is_enabled(result));
-    CHECK(epte::write_access::is_enabled(result));
-    CHECK(epte::execute_access::is_disabled(result));
-    CHECK(epte::entry_type::is_enabled(result));
-    CHECK(epte::memory_type::get(result) == epte::memory_type::wb);
-    CHECK(epte::hpa(result) == mock_page_hpa);
-    free_mock_tables();
+    ept::memory_map mem_map;
+
+    check_page_frame(mem_map.map_pde_to_page(g_unmapped_gpa, mock_2m_hpa), mock_2m_hpa);
+    CHECK_THROWS(mem_map.map_pde_to_page(g_unmapped_gpa, mock_2m_hpa));
+
+    mem_map.map(0x40000000ULL, mock_1g_hpa, ept::pdpte::page_size_bytes);
+    mem_map.map(0x80000000ULL, mock_4k_hpa, ept::pte::page_size_bytes);
+    CHECK_THROWS(mem_map.map_pde_to_page(0x40200000ULL, mock_2m_hpa));
+    CHECK_THROWS(mem_map.map_pde_to_page(0x80000000ULL, mock_2m_hpa));
+
+    check_page_frame(mem_map.map_pde_to_page(0x80200000ULL, mock_2m_hpa), mock_2m_hpa);
 }
 
 TEST_CASE("memory_map::map_pte_to_page")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
-    mem_map->m_pml4_hpa = mock_pml4_hpa;
-    epte_t result{0ULL};
-
-    allocate_mock_empty_pml4(*mem_map);
-    result = mem_map->map_pte_to_page(g_unmapped_gpa, mock_page_hpa);
-    CHECK(epte::read_access::is_enabled(result));
-    CHECK(epte::write_access::is_enabled(result));
-    CHECK(epte::execute_access::is_disabled(result));
-    CHECK(epte::entry_type::is_enabled(result));
-    CHECK(epte::memory_type::get(result) == epte::memory_type::wb);
-    CHECK(epte::hpa(result) == mock_page_hpa);
-    free_mock_tables();
-
-    allocate_mock_1g_page(*mem_map);
-    CHECK_THROWS(mem_map->map_pte_to_page(g_mapped_gpa, mock_page_hpa));
-    result = mem_map->map_pte_to_page(g_unmapped_gpa, mock_page_hpa);
-    CHECK(epte::read_access::is_enabled(result));
-    CHECK(epte::write_access::is_enabled(result));
-    CHECK(epte::execute_access::is_disabled(result));
-    CHECK(epte::entry_type::is_enabled(result));
-    CHECK(epte::memory_type::get(result) == epte::memory_type::wb);
-    CHECK(epte::hpa(result) == mock_page_hpa);
-    free_mock_tables();
-
-    allocate_mock_2m_page(*mem_map);
-    CHECK_THROWS(mem_map->map_pte_to_page(g_mapped_gpa, mock_page_hpa));
-    result = mem_map->map_pte_to_page(g_unmapped_gpa, mock_page_hpa);
-    CHECK(epte::read_access::is_enabled(result));
-    CHECK(epte::write_access::is_enabled(result));
-    CHECK(epte::execute_access::is_disabled(result));
-    CHECK(epte::entry_type::is_enabled(result));
-    CHECK(epte::memory_type::get(result) == epte::memory_type::wb);
-    CHECK(epte::hpa(result) == mock_page_hpa);
-    free_mock_tables();
-
-    allocate_mock_4k_page(*mem_map);
-    CHECK_THROWS(mem_map->map_pte_to_page(g_mapped_gpa, mock_page_hpa));
-    result = mem_map->map_pte_to_page(g_unmapped_gpa, mock_page_hpa);
-    CHECK(epte::read_access::is_enabled(result));
-    CHECK(epte::write_access::is_enabled(result));
-    CHECK(epte::execute_access::is_disabled(result));
-    CHECK(epte::entry_type::is_enabled(result));
-    CHECK(epte::memory_type::get(result) == epte::memory_type::wb);
-    CHECK(epte::hpa(result) == mock_page_hpa);
-    free_mock_tables();
+    ept::memory_map mem_map;
+
+    check_page_frame(mem_map.map_pte_to_page(g_unmapped_gpa, mock_4k_hpa), mock_4k_hpa);
+    CHECK_THROWS(mem_map.map_pte_to_page(g_unmapped_gpa, mock_4k_hpa));
+
+    mem_map.map(0x40000000ULL, mock_1g_hpa, ept::pdpte::page_size_bytes);
+    mem_map.map(0x80000000ULL, mock_2m_hpa, ept::pde::page_size_bytes);
+    CHECK_THROWS(mem_map.map_pte_to_page(0x40001000ULL, mock_4k_hpa));
+    CHECK_THROWS(mem_map.map_pte_to_page(0x80001000ULL, mock_4k_hpa));
+
+    check_page_frame(mem_map.map_pte_to_page(0x80200000ULL, mock_4k_hpa), mock_4k_hpa);
 }
 
 TEST_CASE("memory_map::to_mdl")
 {
     MockRepository mocks;
     auto mm = setup_mock_ept_memory_manager(mocks);
-    auto mem_map = new ept::memory_map();
-    mem_map->map(0xf00d0000ULL, 0ULL, ept::pte::page_size_bytes);
+    ept::memory_map mem_map;
+    mem_map.map(0xf00d0000ULL, 0ULL, ept::pte::page_size_bytes);
 
-    auto result = mem_map->to_mdl();
+    auto result = mem_map.to_mdl();
     CHECK(result.size() == 4ULL);
 
-    mem_map->map(0xbeef00000ULL, 0ULL, ept::pte::page_size_bytes);
-    result = mem_map->to_mdl();
+    mem_map.map(0xbeef00000ULL, 0ULL, ept::pte::page_size_bytes);
+    result = mem_map.to_mdl();
     CHECK(result.size() == 6ULL);
-    free_mock_tables();
+}
+
+TEST_CASE("memory_map::split")
+{
+    MockRepository mocks;
+    auto mm = setup_mock_ept_memory_manager(mocks);
+    ept::memory_map mem_map;
+    uintptr_t gpa = 0x40000000ULL;
+    uintptr_t hpa = 0x80000000ULL;
+
+    CHECK_THROWS(mem_map.split(gpa, ept::pte::page_size_bytes));
+    CHECK_THROWS(mem_map.split(gpa, ept::pdpte::page_size_bytes));
+
+    auto &entry_1g = mem_map.map(gpa, hpa, ept::pdpte::page_size_bytes);
+    epte::execute_access::enable(entry_1g);
+
+    auto &entry_2m = mem_map.split(gpa + 0x201000ULL, ept::pde::page_size_bytes);
+    CHECK(mem_map.flush_pending());
+    CHECK(epte::hpa(entry_2m) == hpa + 0x200000ULL);
+    CHECK(epte::execute_access::is_enabled(entry_2m));
+    CHECK(epte::entry_type::is_enabled(entry_2m));
+
+    auto &entry_4k = mem_map.split(gpa + 0x201000ULL, ept::pte::page_size_bytes);
+    CHECK(epte::hpa(entry_4k) == hpa + 0x201000ULL);
+    CHECK(epte::execute_access::is_enabled(entry_4k));
+    CHECK(mem_map.gpa_to_hpa(gpa + 0x3FFFFFFFULL) == hpa + 0x3FFFFFFFULL);
+    CHECK(mem_map.gpa_to_hpa(gpa + 0x201ABCULL) == hpa + 0x201ABCULL);
+
+    CHECK(&mem_map.split(gpa + 0x201000ULL, ept::pte::page_size_bytes) == &entry_4k);
+}
+
+TEST_CASE("memory_map::merge")
+{
+    MockRepository mocks;
+    auto mm = setup_mock_ept_memory_manager(mocks);
+    ept::memory_map mem_map;
+    uintptr_t gpa = 0x40000000ULL;
+    uintptr_t hpa = 0x80000000ULL;
+
+    CHECK_THROWS(mem_map.merge(gpa, ept::pte::page_size_bytes));
+    CHECK(!mem_map.merge(gpa, ept::pdpte::page_size_bytes));
+
+    mem_map.map(gpa, hpa, ept::pdpte::page_size_bytes);
+    CHECK(mem_map.merge(gpa, ept::pdpte::page_size_bytes));
+
+    auto &entry_4k = mem_map.split(gpa + 0x1000ULL, ept::pte::page_size_bytes);
+    epte::write_access::disable(entry_4k);
+    epte::dirty::enable(mem_map.gpa_to_epte(gpa));
+    CHECK(!mem_map.merge(gpa, ept::pde::page_size_bytes));
+    CHECK(!mem_map.merge(gpa, ept::pdpte::page_size_bytes));
+
+    epte::write_access::enable(entry_4k);
+    CHECK(mem_map.merge(gpa, ept::pdpte::page_size_bytes));
+
+    auto &entry_1g = mem_map.gpa_to_epte(gpa + 0x1000ULL);
+    CHECK(epte::hpa(entry_1g) == hpa);
+    CHECK(epte::dirty::is_enabled(entry_1g));
+    CHECK(mem_map.gpa_to_hpa(gpa + 0x201ABCULL) == hpa + 0x201ABCULL);
+}
+
+TEST_CASE("memory_map::merge misaligned")
+{
+    MockRepository mocks;
+    auto mm = setup_mock_ept_memory_manager(mocks);
+    ept::memory_map mem_map;
+
+    for (auto i = 0ULL; i < ept::page_table::num_entries; i++) {
+        auto offset = i * ept::pte::page_size_bytes;
+        mem_map.map(offset, 0x1000ULL + offset, ept::pte::page_size_bytes);
+    }
+
+    CHECK(!mem_map.merge(0ULL, ept::pde::page_size_bytes));
+}
+
+TEST_CASE("memory_map::set_access_rights")
+{
+    MockRepository mocks;
+    auto mm = setup_mock_ept_memory_manager(mocks);
+    mocks.NeverCallFunc(::intel_x64::vmx::invept_single_context);
+
+    ept::memory_map mem_map;
+
+    mem_map.map(0x0ULL, 0x0ULL, ept::pde::page_size_bytes);
+    mem_map.map(0x200000ULL, 0x200000ULL, ept::pte::page_size_bytes);
+    CHECK(!mem_map.flush_pending());
+
+    // Only the rights of the leaf that maps the address change, and the
+    // flush is left to the caller
+
+    mem_map.set_access_rights(0x1000ULL, epte::access_rights::ro);
+
+    auto &entry_2m = mem_map.gpa_to_epte(0x0ULL);
+    CHECK(epte::access_rights::get(entry_2m) == epte::access_rights::ro);
+    CHECK(epte::entry_type::is_enabled(entry_2m));
+    CHECK(epte::hpa(entry_2m) == 0x0ULL);
+    CHECK(mem_map.flush_pending());
+
+    mem_map.set_access_rights(0x200000ULL, epte::access_rights::eo);
+
+    auto &entry_4k = mem_map.gpa_to_epte(0x200000ULL);
+    CHECK(epte::access_rights::get(entry_4k) == epte::access_rights::eo);
+    CHECK(epte::read_access::is_disabled(entry_4k));
+    CHECK(epte::write_access::is_disabled(entry_4k));
+    CHECK(epte::execute_access::is_enabled(entry_4k));
+    CHECK(epte::hpa(entry_4k) == 0x200000ULL);
+    CHECK(epte::access_rights::get(entry_2m) == epte::access_rights::ro);
+
+    CHECK_THROWS(mem_map.set_access_rights(0x40000000ULL, epte::access_rights::rw));
+}
+
+TEST_CASE("memory_map::flush")
+{
+    MockRepository mocks;
+    auto mm = setup_mock_ept_memory_manager(mocks);
+    ept::memory_map mem_map;
+
+    mem_map.map(0x0ULL, 0x0ULL, ept::pde::page_size_bytes);
+    mem_map.map(0x200000ULL, 0x200000ULL, ept::pte::page_size_bytes);
+
+    // One INVEPT per batch of changes, however many entries it touched,
+    // and none once the batch has been flushed
+
+    mocks.ExpectCallFunc(::intel_x64::vmx::invept_single_context).With(ept::eptp(mem_map));
+
+    mem_map.set_access_rights(0x0ULL, epte::access_rights::ro);
+    mem_map.set_access_rights(0x100000ULL, epte::access_rights::re);
+    mem_map.set_access_rights(0x200000ULL, epte::access_rights::tp);
+
+    mem_map.flush();
+    CHECK(!mem_map.flush_pending());
+
+    mem_map.flush();
+    CHECK(!mem_map.flush_pending());
+
+    mocks.ExpectCallFunc(::intel_x64::vmx::invept_single_context).With(ept::eptp(mem_map));
+
+    mem_map.mark_flush_pending();
+    mem_map.flush();
+    mem_map.flush();
+    CHECK(!mem_map.flush_pending());
+}
+
+TEST_CASE("memory_map::flush nothing pending")
+{
+    MockRepository mocks;
+    auto mm = setup_mock_ept_memory_manager(mocks);
+    mocks.NeverCallFunc(::intel_x64::vmx::invept_single_context);
+
+    ept::memory_map mem_map;
+    mem_map.map(0x0ULL, 0x0ULL, ept::pde::page_size_bytes);
+
+    CHECK(!mem_map.flush_pending());
+    CHECK_NOTHROW(mem_map.flush());
+    CHECK_NOTHROW(mem_map.flush());
+}
+
+TEST_CASE("memory_map::harvest_dirty")
+{
+    MockRepository mocks;
+    auto mm = setup_mock_ept_memory_manager(mocks);
+    mocks.OnCallFunc(::intel_x64::vmx::invept_single_context);
+
+    ept::memory_map mem_map;
+    std::array<uint64_t, 1024> bitmap{};
+
+    mem_map.map(0x0ULL, 0x0ULL, ept::pde::page_size_bytes);
+    mem_map.map(0x200000ULL, 0x200000ULL, ept::pte::page_size_bytes);
+    mem_map.map(0x203000ULL, 0x203000ULL, ept::pte::page_size_bytes);
+
+    CHECK_THROWS(mem_map.harvest_dirty(0x0ULL, 0x400000ULL, gsl::make_span(bitmap.data(), 1)));
+    CHECK(mem_map.harvest_dirty(0x0ULL, 0x400000ULL, bitmap) == 0);
+    CHECK(!mem_map.flush_pending());
+
+    epte::dirty::enable(mem_map.gpa_to_epte(0x0ULL));
+    epte::dirty::enable(mem_map.gpa_to_epte(0x203000ULL));
+    epte::accessed_flag::enable(mem_map.gpa_to_epte(0x200000ULL));
+
+    CHECK(mem_map.harvest_dirty(0x100000ULL, 0x200000ULL, bitmap) == 257);
+    CHECK(bitmap[0] == ~0ULL);
+    CHECK(bitmap[3] == ~0ULL);
+    CHECK(bitmap[4] == 0x8ULL);
+    CHECK(epte::dirty::is_enabled(mem_map.gpa_to_epte(0x0ULL)));
+    CHECK(epte::dirty::is_disabled(mem_map.gpa_to_epte(0x203000ULL)));
+    CHECK(epte::accessed_flag::is_enabled(mem_map.gpa_to_epte(0x200000ULL)));
+
+    CHECK(mem_map.harvest_dirty(0x0ULL, 0x400000ULL, bitmap) == 512);
+    CHECK(bitmap[7] == ~0ULL);
+    CHECK(bitmap[8] == 0x0ULL);
+    CHECK(epte::dirty::is_disabled(mem_map.gpa_to_epte(0x0ULL)));
+
+    CHECK(mem_map.harvest_dirty(0x0ULL, 0x400000ULL, bitmap) == 0);
+    CHECK(mem_map.harvest_accessed(0x0ULL, 0x400000ULL, bitmap) == 1);
+    CHECK(bitmap[8] == 0x1ULL);
+}
+
+TEST_CASE("memory_map::harvest_dirty partial large page")
+{
+    MockRepository mocks;
+    auto mm = setup_mock_ept_memory_manager(mocks);
+    ept::memory_map mem_map;
+    std::array<uint64_t, 8> bitmap{};
+
+    mem_map.map(0x0ULL, 0x0ULL, ept::pde::page_size_bytes);
+    epte::dirty::enable(mem_map.gpa_to_epte(0x0ULL));
+
+    // Harvesting part of the 2MB page must not lose the dirty state of the
+    // rest of it, so nothing is cleared (and nothing needs to be flushed)
+
+    mocks.NeverCallFunc(::intel_x64::vmx::invept_single_context);
+
+    CHECK(mem_map.harvest_dirty(0x1000ULL, 0x1000ULL, bitmap) == 1);
+    CHECK(bitmap[0] == 0x1ULL);
+    CHECK(epte::dirty::is_enabled(mem_map.gpa_to_epte(0x0ULL)));
+
+    CHECK(mem_map.harvest_dirty(0x100000ULL, 0x100000ULL, bitmap) == 256);
+    CHECK(bitmap[3] == ~0ULL);
+    CHECK(bitmap[4] == 0x0ULL);
+    CHECK(epte::dirty::is_enabled(mem_map.gpa_to_epte(0x0ULL)));
+}
+
+TEST_CASE("memory_map::enable_accessed_dirty_flags")
+{
+    MockRepository mocks;
+    auto mm = setup_mock_ept_memory_manager(mocks);
+    ept::memory_map mem_map;
+
+    CHECK(!mem_map.accessed_dirty_flags_enabled());
+    CHECK(eptp::accessed_and_dirty_flags::is_disabled(ept::eptp(mem_map)));
+
+    g_msrs[::intel_x64::msrs::ia32_vmx_ept_vpid_cap::addr] = 0;
+    CHECK_THROWS(mem_map.enable_accessed_dirty_flags());
+
+    g_msrs[::intel_x64::msrs::ia32_vmx_ept_vpid_cap::addr] =
+        ::intel_x64::msrs::ia32_vmx_ept_vpid_cap::accessed_dirty_support::mask;
+    CHECK_NOTHROW(mem_map.enable_accessed_dirty_flags());
+    CHECK(mem_map.accessed_dirty_flags_enabled());
+    CHECK(eptp::accessed_and_dirty_flags::is_enabled(ept::eptp(mem_map)));
 }
 
 }
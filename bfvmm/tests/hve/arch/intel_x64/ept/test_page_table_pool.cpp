@@ -0,0 +1,124 @@
+//
+// Bareflank Extended APIs
+//
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <intrinsics.h>
+#include "ept_test_support.h"
+
+#ifdef _HIPPOMOCKS__ENABLE_CFUNC_MOCKING_SUPPORT
+
+namespace eapis
+{
+namespace intel_x64
+{
+namespace ept
+{
+
+TEST_CASE("page_table_pool: constructor")
+{
+    CHECK_NOTHROW(page_table_pool{});
+    CHECK_THROWS(page_table_pool{0});
+
+    page_table_pool pool{4};
+    CHECK(pool.size() == 0);
+    CHECK(pool.free_count() == 0);
+}
+
+TEST_CASE("page_table_pool: allocate")
+{
+    MockRepository mocks;
+    auto mm = setup_mock_ept_memory_manager(mocks);
+
+    page_table_pool pool{4};
+    auto hpa = pool.allocate();
+
+    CHECK(pool.size() == 4);
+    CHECK(pool.free_count() == 3);
+    CHECK((hpa & (page_size_4k - 1U)) == 0);
+
+    auto hva = pool.hpa_to_hva(hpa);
+    CHECK((reinterpret_cast<uintptr_t>(hva) & (page_size_4k - 1U)) == 0);
+
+    for (auto i = 0U; i < page_table::num_entries; i++) {
+        CHECK(hva[i] == 0);
+    }
+
+    for (auto i = 0U; i < 4; i++) {
+        pool.allocate();
+    }
+
+    CHECK(pool.size() == 8);
+    CHECK(pool.free_count() == 3);
+}
+
+TEST_CASE("page_table_pool: free")
+{
+    MockRepository mocks;
+    auto mm = setup_mock_ept_memory_manager(mocks);
+
+    page_table_pool pool{4};
+    auto hpa = pool.allocate();
+    auto hva = pool.hpa_to_hva(hpa);
+
+    hva[0] = 0xFFFFFFFFFFFFFFFFULL;
+    hva[page_table::num_entries - 1] = 0xFFFFFFFFFFFFFFFFULL;
+
+    pool.free(hpa);
+    CHECK(pool.free_count() == 4);
+    CHECK(pool.allocate() == hpa);
+    CHECK(hva[0] == 0);
+    CHECK(hva[page_table::num_entries - 1] == 0);
+}
+
+TEST_CASE("page_table_pool: reserve")
+{
+    MockRepository mocks;
+    auto mm = setup_mock_ept_memory_manager(mocks);
+
+    page_table_pool pool{4};
+    pool.reserve(9);
+
+    CHECK(pool.size() == 12);
+    CHECK(pool.free_count() == 12);
+
+    pool.reserve(2);
+    CHECK(pool.size() == 12);
+}
+
+TEST_CASE("page_table_pool: hpa_to_hva")
+{
+    MockRepository mocks;
+    auto mm = setup_mock_ept_memory_manager(mocks);
+
+    page_table_pool pool{4};
+    CHECK_THROWS(pool.hpa_to_hva(0));
+
+    auto hpa1 = pool.allocate();
+    auto hpa2 = pool.allocate();
+
+    CHECK(pool.hpa_to_hva(hpa1) != pool.hpa_to_hva(hpa2));
+    CHECK(pool.hpa_to_hva(hpa1 + 0x8) == pool.hpa_to_hva(hpa1) + 1);
+    CHECK(g_mm->virtptr_to_physint(pool.hpa_to_hva(hpa2)) == hpa2);
+    CHECK_THROWS(pool.hpa_to_hva(0));
+}
+
+}
+}
+}
+
+#endif
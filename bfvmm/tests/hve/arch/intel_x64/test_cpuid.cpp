@@ -0,0 +1,191 @@
+//
+// Bareflank Extended APIs
+//
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+#include <catch/catch.hpp>
+#include <hippomocks.h>
+#include <intrinsics.h>
+
+#include <hve/arch/intel_x64/hve.h>
+#include <support/arch/intel_x64/test_support.h>
+
+#ifdef _HIPPOMOCKS__ENABLE_CFUNC_MOCKING_SUPPORT
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+using reg_t = cpuid::reg_t;
+
+static bool
+test_handler(gsl::not_null<vmcs_t *> vmcs, cpuid::info_t &info)
+{
+    bfignored(vmcs);
+    bfignored(info);
+
+    return true;
+}
+
+static auto
+cpuid_exit(gsl::not_null<hve *> hve, uint64_t leaf, uint64_t subleaf)
+{
+    hve->vmcs()->save_state()->rax = leaf;
+    hve->vmcs()->save_state()->rcx = subleaf;
+
+    return hve->cpuid()->handle(hve->vmcs());
+}
+
+TEST_CASE("cpuid: dispatch table")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+
+    // One leaf from each part of the table: basic, extended and sparse
+
+    g_edx_cpuid[0x7U] = 0x7U;
+    g_edx_cpuid[0x80000001U] = 0x80000001U;
+    g_edx_cpuid[0x40000000U] = 0x40000000U;
+
+    for (const auto leaf : {0x7ULL, 0x80000001ULL, 0x40000000ULL}) {
+        hve->add_cpuid_handler(leaf, 0U, cpuid::handler_delegate_t::create<test_handler>());
+    }
+
+    for (const auto leaf : {0x7ULL, 0x80000001ULL, 0x40000000ULL}) {
+        CHECK(cpuid_exit(hve.get(), leaf, 0U));
+        CHECK(hve->vmcs()->save_state()->rdx == leaf);
+    }
+}
+
+TEST_CASE("cpuid: any subleaf")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+
+    g_edx_cpuid[0x4U] = 0x4U;
+    hve->add_cpuid_handler(0x4U, cpuid::handler_delegate_t::create<test_handler>());
+
+    CHECK(cpuid_exit(hve.get(), 0x4U, 0U));
+    CHECK(hve->vmcs()->save_state()->rdx == 0x4U);
+    CHECK(cpuid_exit(hve.get(), 0x4U, 3U));
+    CHECK(hve->vmcs()->save_state()->rdx == 0x4U);
+}
+
+TEST_CASE("cpuid: policies")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+
+    g_ecx_cpuid[0x7U] = 0xAAU;
+
+    hve->force_cpuid_set_bits(0x7U, 0U, reg_t::rcx, 0xF0U);
+    hve->force_cpuid_clear_bits(0x7U, 0U, reg_t::rcx, 0x0FU);
+    CHECK(cpuid_exit(hve.get(), 0x7U, 0U));
+    CHECK(hve->vmcs()->save_state()->rcx == 0xF0U);
+
+    // A later policy on the same bit overrides an earlier one
+
+    hve->force_cpuid_set_bits(0x7U, 0U, reg_t::rcx, 0x01U);
+    CHECK(cpuid_exit(hve.get(), 0x7U, 0U));
+    CHECK(hve->vmcs()->save_state()->rcx == 0xF1U);
+
+    hve->force_cpuid_value(0x7U, 0U, 1U, 2U, 3U, 4U);
+    CHECK(cpuid_exit(hve.get(), 0x7U, 0U));
+    CHECK(hve->vmcs()->save_state()->rax == 1U);
+    CHECK(hve->vmcs()->save_state()->rbx == 2U);
+    CHECK(hve->vmcs()->save_state()->rcx == 3U);
+    CHECK(hve->vmcs()->save_state()->rdx == 4U);
+
+    hve->force_cpuid_clear_bits(0x7U, 0U, reg_t::rcx, 0x01U);
+    CHECK(cpuid_exit(hve.get(), 0x7U, 0U));
+    CHECK(hve->vmcs()->save_state()->rcx == 2U);
+}
+
+TEST_CASE("cpuid: policies keep the upper 32 bits")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+
+    g_ecx_cpuid[0x7U] = 0x0U;
+    hve->force_cpuid_set_bits(0x7U, 0U, reg_t::rcx, 0xFFFFFFFF00000001ULL);
+
+    hve->vmcs()->save_state()->rcx = 0xFFFFFFFF00000000ULL;
+    CHECK(cpuid_exit(hve.get(), 0x7U, 0xFFFFFFFF00000000ULL));
+    CHECK(hve->vmcs()->save_state()->rcx == 0xFFFFFFFF00000001ULL);
+}
+
+TEST_CASE("cpuid: cached leaf")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+
+    g_ecx_cpuid[0x80000001U] = 0x10U;
+    hve->force_cpuid_set_bits(0x80000001U, 0U, reg_t::rcx, 0x1U);
+
+    g_ecx_cpuid[0x80000001U] = 0x20U;
+    CHECK(cpuid_exit(hve.get(), 0x80000001U, 0U));
+    CHECK(hve->vmcs()->save_state()->rcx == 0x11U);
+
+    hve->cpuid()->disable_result_cache(0x80000001U, 0U);
+    CHECK(cpuid_exit(hve.get(), 0x80000001U, 0U));
+    CHECK(hve->vmcs()->save_state()->rcx == 0x21U);
+}
+
+TEST_CASE("cpuid: dynamic leaf")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+
+    // Leaf 0xD reports XSAVE sizes that follow XCR0, so it is executed on
+    // every exit with the policies applied to the live result
+
+    g_ecx_cpuid[0xDU] = 0x240U;
+    g_edx_cpuid[0xDU] = 0x1U;
+    hve->force_cpuid_clear_bits(0xDU, 0U, reg_t::rdx, 0xFFFFFFFFU);
+
+    CHECK(cpuid_exit(hve.get(), 0xDU, 0U));
+    CHECK(hve->vmcs()->save_state()->rcx == 0x240U);
+    CHECK(hve->vmcs()->save_state()->rdx == 0U);
+
+    g_ecx_cpuid[0xDU] = 0x340U;
+    CHECK(cpuid_exit(hve.get(), 0xDU, 0U));
+    CHECK(hve->vmcs()->save_state()->rcx == 0x340U);
+    CHECK(hve->vmcs()->save_state()->rdx == 0U);
+
+    // Leaf 0x7's OSPKE follows CR4.PKE
+
+    g_ecx_cpuid[0x7U] = 0x0U;
+    hve->force_cpuid_set_bits(0x7U, 0U, reg_t::rcx, 0x1U);
+
+    g_ecx_cpuid[0x7U] = 0x10U;
+    CHECK(cpuid_exit(hve.get(), 0x7U, 0U));
+    CHECK(hve->vmcs()->save_state()->rcx == 0x11U);
+
+    // Leaf 0x1F's EDX is the x2APIC ID of the core the guest runs on
+
+    g_edx_cpuid[0x1FU] = 0x0U;
+    hve->add_cpuid_handler(0x1FU, 0U, cpuid::handler_delegate_t::create<test_handler>());
+
+    g_edx_cpuid[0x1FU] = 0x3U;
+    CHECK(cpuid_exit(hve.get(), 0x1FU, 0U));
+    CHECK(hve->vmcs()->save_state()->rdx == 0x3U);
+}
+
+}
+}
+
+#endif
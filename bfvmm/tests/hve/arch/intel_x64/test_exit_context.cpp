@@ -0,0 +1,171 @@
+//
+// Bareflank Extended APIs
+//
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <intrinsics.h>
+
+#include <hve/arch/intel_x64/hve.h>
+#include <hve/arch/intel_x64/exit_context.h>
+#include <support/arch/intel_x64/test_support.h>
+
+#ifdef _HIPPOMOCKS__ENABLE_CFUNC_MOCKING_SUPPORT
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+static bool
+test_rdcr8_handler(gsl::not_null<vmcs_t *> vmcs, control_register::info_t &info)
+{
+    bfignored(vmcs);
+
+    info.val = 0x5U;
+    return true;
+}
+
+uint64_t g_cpuid_qual{0};
+exit_context *g_context{nullptr};
+
+static bool
+test_cpuid_handler(gsl::not_null<vmcs_t *> vmcs, cpuid::info_t &info)
+{
+    bfignored(vmcs);
+    bfignored(info);
+
+    g_cpuid_qual = g_context->exit_qualification();
+    return true;
+}
+
+TEST_CASE("exit_context: read")
+{
+    MockRepository mocks;
+    setup_hve(mocks);
+
+    exit_context context;
+
+    g_vmcs_fields[vmcs_n::exit_qualification::addr] = 0x1U;
+    g_vmcs_fields[vmcs_n::guest_physical_address::addr] = 0x1000U;
+
+    context.begin();
+    CHECK(context.exit_qualification() == 0x1U);
+    CHECK(context.guest_physical_address() == 0x1000U);
+
+    g_vmcs_fields[vmcs_n::exit_qualification::addr] = 0x2U;
+    CHECK(context.exit_qualification() == 0x1U);
+
+    CHECK(context.stats().exits == 1U);
+    CHECK(context.stats().vmreads == 2U);
+    CHECK(context.stats().hits == 1U);
+
+    context.begin();
+    CHECK(context.exit_qualification() == 0x2U);
+
+    CHECK(context.stats().exits == 2U);
+    CHECK(context.stats().vmreads == 3U);
+    CHECK(context.stats().hits == 1U);
+
+    CHECK_NOTHROW(context.dump_log());
+
+    context.reset_stats();
+    CHECK(context.stats().exits == 0U);
+    CHECK(context.stats().vmreads == 0U);
+}
+
+TEST_CASE("exit_context: control register exit")
+{
+    using namespace vmcs_n::exit_qualification::control_register_access;
+
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+
+    hve->add_rdcr8_handler(
+        control_register::handler_delegate_t::create<test_rdcr8_handler>()
+    );
+
+    g_vmcs_fields[vmcs_n::exit_qualification::addr] =
+        8U |
+        (access_type::mov_from_cr << access_type::from) |
+        (general_purpose_register::rcx << general_purpose_register::from);
+
+    g_vmcs_fields[vmcs_n::exit_reason::addr] =
+        vmcs_n::exit_reason::basic_exit_reason::control_register_accesses;
+
+    g_save_state.rcx = 0U;
+    hve->exit_context()->reset_stats();
+
+    auto ehlr = hve->exit_handler();
+    CHECK_NOTHROW(ehlr->handle(ehlr));
+    CHECK(g_save_state.rcx == 0x5U);
+
+    // The register number, the access type and the gpr are all decoded
+    // from a single VMREAD of the exit qualification
+
+    CHECK(hve->exit_context()->stats().exits == 1U);
+    CHECK(hve->exit_context()->stats().vmreads == 1U);
+    CHECK(hve->exit_context()->stats().hits == 2U);
+}
+
+TEST_CASE("exit_context: invalidated on every exit")
+{
+    using namespace vmcs_n::exit_qualification::control_register_access;
+
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto ehlr = hve->exit_handler();
+
+    g_context = hve->exit_context().get();
+
+    hve->add_rdcr8_handler(
+        control_register::handler_delegate_t::create<test_rdcr8_handler>()
+    );
+    hve->add_cpuid_handler(
+        0x1U, cpuid::handler_delegate_t::create<test_cpuid_handler>()
+    );
+
+    g_vmcs_fields[vmcs_n::exit_reason::addr] =
+        vmcs_n::exit_reason::basic_exit_reason::control_register_accesses;
+    g_vmcs_fields[vmcs_n::exit_qualification::addr] =
+        8U |
+        (access_type::mov_from_cr << access_type::from) |
+        (general_purpose_register::rcx << general_purpose_register::from);
+
+    CHECK_NOTHROW(ehlr->handle(ehlr));
+
+    // The cpuid handler never reads the context itself, but a delegate
+    // that does must see the fields of its own exit
+
+    g_vmcs_fields[vmcs_n::exit_reason::addr] =
+        vmcs_n::exit_reason::basic_exit_reason::cpuid;
+    g_vmcs_fields[vmcs_n::exit_qualification::addr] = 0x0U;
+
+    g_save_state.rax = 0x1U;
+    g_save_state.rcx = 0x0U;
+    g_cpuid_qual = 0xFFU;
+
+    CHECK_NOTHROW(ehlr->handle(ehlr));
+    CHECK(g_cpuid_qual == 0x0U);
+    CHECK(g_context->stats().exits == 2U);
+
+    g_context = nullptr;
+}
+
+}
+}
+
+#endif
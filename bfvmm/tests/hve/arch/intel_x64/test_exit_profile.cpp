@@ -0,0 +1,157 @@
+//
+// Bareflank Extended APIs
+//
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <intrinsics.h>
+
+#include <hve/arch/intel_x64/hve.h>
+#include <hve/arch/intel_x64/exit_profile.h>
+#include <support/arch/intel_x64/test_support.h>
+
+#ifdef _HIPPOMOCKS__ENABLE_CFUNC_MOCKING_SUPPORT
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+namespace reason = vmcs_n::exit_reason::basic_exit_reason;
+
+uint64_t g_tsc{0};
+
+static uint64_t
+test_read_tsc() noexcept
+{ return g_tsc; }
+
+static bool
+test_rdmsr_handler(gsl::not_null<vmcs_t *> vmcs, rdmsr::info_t &info)
+{
+    bfignored(vmcs);
+    bfignored(info);
+
+    g_tsc += 0x300U;
+    return true;
+}
+
+TEST_CASE("exit_profile: histogram")
+{
+    exit_profile::histogram_t hist{};
+
+    hist.add(0U);
+    hist.add(1U);
+    hist.add(0x3FFU);
+    hist.add(0x400U);
+
+    CHECK(hist.count == 4U);
+    CHECK(hist.total == 0x800U);
+    CHECK(hist.max == 0x400U);
+    CHECK(hist.buckets.at(0) == 2U);
+    CHECK(hist.buckets.at(9) == 1U);
+    CHECK(hist.buckets.at(10) == 1U);
+}
+
+TEST_CASE("exit_profile: disabled")
+{
+    MockRepository mocks;
+    mocks.NeverCallFunc(_read_tsc);
+
+    exit_profile profile;
+    CHECK(!profile.enabled());
+
+    {
+        auto probe = profile.probe(reason::cpuid, 0x1U);
+    }
+
+    CHECK(profile.reason_histogram(reason::cpuid).count == 0U);
+    CHECK(profile.key_histogram(reason::cpuid, 0x1U) == nullptr);
+}
+
+TEST_CASE("exit_profile: probe")
+{
+    MockRepository mocks;
+    mocks.OnCallFunc(_read_tsc).Do(test_read_tsc);
+
+    exit_profile profile;
+    profile.enable();
+
+    {
+        auto probe = profile.probe(reason::cpuid, 0x1U);
+        g_tsc += 0x100U;
+    }
+
+    {
+        auto probe = profile.probe(reason::cpuid, 0x80000001U);
+        g_tsc += 0x1000U;
+    }
+
+    {
+        auto probe = profile.probe(reason::interrupt_window);
+        g_tsc += 0x10U;
+    }
+
+    {
+        auto probe = profile.probe(exit_profile::reason_count, 0x1U);
+        g_tsc += 0x10U;
+    }
+
+    const auto &cpuid = profile.reason_histogram(reason::cpuid);
+    CHECK(cpuid.count == 2U);
+    CHECK(cpuid.total == 0x1100U);
+    CHECK(cpuid.max == 0x1000U);
+    CHECK(cpuid.buckets.at(8) == 1U);
+    CHECK(cpuid.buckets.at(12) == 1U);
+
+    CHECK(profile.key_histogram(reason::cpuid, 0x1U)->total == 0x100U);
+    CHECK(profile.key_histogram(reason::cpuid, 0x80000001U)->total == 0x1000U);
+    CHECK(profile.key_histogram(reason::cpuid, 0x2U) == nullptr);
+    CHECK(profile.reason_histogram(reason::interrupt_window).count == 1U);
+    CHECK_THROWS(profile.reason_histogram(exit_profile::reason_count));
+
+    CHECK_NOTHROW(profile.dump_log());
+
+    profile.reset();
+    CHECK(profile.reason_histogram(reason::cpuid).count == 0U);
+    CHECK(profile.key_histogram(reason::cpuid, 0x1U) == nullptr);
+}
+
+TEST_CASE("exit_profile: rdmsr exit")
+{
+    MockRepository mocks;
+    mocks.OnCallFunc(_read_tsc).Do(test_read_tsc);
+
+    auto hve = setup_hve(mocks);
+    hve->exit_profile()->enable();
+
+    hve->add_rdmsr_handler(
+        0x1BU, rdmsr::handler_delegate_t::create<test_rdmsr_handler>()
+    );
+
+    g_save_state.rcx = 0x1BU;
+    CHECK(hve->rdmsr()->handle(hve->vmcs()));
+
+    const auto hist = hve->exit_profile()->key_histogram(reason::rdmsr, 0x1BU);
+    CHECK(hist != nullptr);
+    CHECK(hist->count == 1U);
+    CHECK(hist->total == 0x300U);
+    CHECK(hve->exit_profile()->reason_histogram(reason::rdmsr).count == 1U);
+}
+
+}
+}
+
+#endif
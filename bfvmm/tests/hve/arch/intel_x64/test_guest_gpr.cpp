@@ -0,0 +1,97 @@
+//
+// Bareflank Extended APIs
+//
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <intrinsics.h>
+
+#include <hve/arch/intel_x64/hve.h>
+#include <support/arch/intel_x64/test_support.h>
+
+#ifdef _HIPPOMOCKS__ENABLE_CFUNC_MOCKING_SUPPORT
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+uint64_t g_wrcr8_val{0};
+
+static bool
+test_wrcr8_handler(gsl::not_null<vmcs_t *> vmcs, control_register::info_t &info)
+{
+    bfignored(vmcs);
+
+    g_wrcr8_val = info.val;
+    return true;
+}
+
+TEST_CASE("guest_gpr: encoding")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vmcs = hve->vmcs();
+
+    for (auto i = 0ULL; i < gpr_members.size(); ++i) {
+        guest_gpr(vmcs, i) = i + 1U;
+    }
+
+    CHECK(g_save_state.rax == 0x1U);
+    CHECK(g_save_state.rcx == 0x2U);
+    CHECK(g_save_state.rdx == 0x3U);
+    CHECK(g_save_state.rbx == 0x4U);
+    CHECK(g_save_state.rsp == 0x5U);
+    CHECK(g_save_state.rbp == 0x6U);
+    CHECK(g_save_state.rsi == 0x7U);
+    CHECK(g_save_state.rdi == 0x8U);
+    CHECK(g_save_state.r08 == 0x9U);
+    CHECK(g_save_state.r09 == 0xAU);
+    CHECK(g_save_state.r10 == 0xBU);
+    CHECK(g_save_state.r11 == 0xCU);
+    CHECK(g_save_state.r12 == 0xDU);
+    CHECK(g_save_state.r13 == 0xEU);
+    CHECK(g_save_state.r14 == 0xFU);
+    CHECK(g_save_state.r15 == 0x10U);
+
+    CHECK(guest_gpr(vmcs, 0x13U) == g_save_state.rbx);
+}
+
+TEST_CASE("guest_gpr: mov to cr")
+{
+    using namespace vmcs_n::exit_qualification::control_register_access;
+
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+
+    hve->add_wrcr8_handler(
+        control_register::handler_delegate_t::create<test_wrcr8_handler>()
+    );
+
+    g_vmcs_fields[vmcs_n::exit_qualification::addr] =
+        8U |
+        (access_type::mov_to_cr << access_type::from) |
+        (general_purpose_register::r13 << general_purpose_register::from);
+
+    g_save_state.r13 = 0x7U;
+    CHECK(hve->control_register()->handle(hve->vmcs()));
+    CHECK(g_wrcr8_val == 0x7U);
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,95 @@
+//
+// Bareflank Extended APIs
+//
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <catch/catch.hpp>
+#include <vector>
+
+#include <hve/arch/intel_x64/base.h>
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+static std::vector<int>
+visit(const handler_chain<int, 2> &chain)
+{
+    std::vector<int> order;
+
+    for (const auto &i : chain) {
+        order.push_back(i);
+    }
+
+    return order;
+}
+
+TEST_CASE("handler_chain: empty")
+{
+    handler_chain<int, 2> chain;
+
+    CHECK(chain.empty());
+    CHECK(chain.size() == 0);
+    CHECK(chain.begin() == chain.end());
+}
+
+TEST_CASE("handler_chain: push_front inline")
+{
+    handler_chain<int, 2> chain;
+
+    chain.push_front(1);
+    chain.push_front(2);
+
+    CHECK(!chain.empty());
+    CHECK(chain.size() == 2);
+    CHECK(visit(chain) == std::vector<int>({2, 1}));
+}
+
+TEST_CASE("handler_chain: push_front overflow")
+{
+    handler_chain<int, 2> chain;
+
+    for (auto i = 1; i <= 5; ++i) {
+        chain.push_front(int{i});
+    }
+
+    CHECK(chain.size() == 5);
+    CHECK(visit(chain) == std::vector<int>({5, 4, 3, 2, 1}));
+}
+
+TEST_CASE("handler_chain: move")
+{
+    handler_chain<int, 2> chain1;
+
+    for (auto i = 1; i <= 3; ++i) {
+        chain1.push_front(int{i});
+    }
+
+    handler_chain<int, 2> chain2{std::move(chain1)};
+    CHECK(chain1.empty());
+    CHECK(visit(chain2) == std::vector<int>({3, 2, 1}));
+
+    handler_chain<int, 2> chain3;
+    chain3.push_front(42);
+    chain3 = std::move(chain2);
+    CHECK(chain2.empty());
+    CHECK(visit(chain3) == std::vector<int>({3, 2, 1}));
+}
+
+}
+}
@@ -0,0 +1,100 @@
+//
+// Bareflank Extended APIs
+//
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <intrinsics.h>
+
+#include <hve/arch/intel_x64/hve.h>
+#include <support/arch/intel_x64/test_support.h>
+
+#ifdef _HIPPOMOCKS__ENABLE_CFUNC_MOCKING_SUPPORT
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+TEST_CASE("io_instruction: string_chunk forward")
+{
+    auto chunk = io_instruction::string_chunk(0x1000U, 4U, 2U, false);
+    CHECK(chunk.lowest == 0x1000U);
+    CHECK(chunk.num == 4U);
+
+    // Only 0x10 bytes are left in the page, so the chunk stops there and
+    // the next one starts on the next page
+
+    chunk = io_instruction::string_chunk(0x1FF0U, 100U, 4U, false);
+    CHECK(chunk.lowest == 0x1FF0U);
+    CHECK(chunk.num == 4U);
+
+    // An element that straddles the page boundary belongs to the page it
+    // starts in
+
+    chunk = io_instruction::string_chunk(0x1FFEU, 100U, 4U, false);
+    CHECK(chunk.lowest == 0x1FFEU);
+    CHECK(chunk.num == 1U);
+}
+
+TEST_CASE("io_instruction: string_chunk reverse")
+{
+    // With DF set the elements are at address, address - bytes, ... so
+    // the chunk is every element that starts at or above the page base
+
+    auto chunk = io_instruction::string_chunk(0x1010U, 100U, 4U, true);
+    CHECK(chunk.lowest == 0x1000U);
+    CHECK(chunk.num == 5U);
+
+    chunk = io_instruction::string_chunk(0x1010U, 2U, 4U, true);
+    CHECK(chunk.lowest == 0x100CU);
+    CHECK(chunk.num == 2U);
+
+    chunk = io_instruction::string_chunk(0x1000U, 100U, 2U, true);
+    CHECK(chunk.lowest == 0x1000U);
+    CHECK(chunk.num == 1U);
+}
+
+TEST_CASE("io_instruction: string_address_mask")
+{
+    CHECK(io_instruction::string_address_mask(0x0U << 7U) == 0xFFFFU);
+    CHECK(io_instruction::string_address_mask(0x1U << 7U) == 0xFFFFFFFFU);
+    CHECK(io_instruction::string_address_mask(0x2U << 7U) == 0xFFFFFFFFFFFFFFFFU);
+    CHECK(io_instruction::string_address_mask(0xFFFFFC7FU) == 0xFFFFU);
+}
+
+TEST_CASE("io_instruction: string_index")
+{
+    // 16 bit: SI wraps and the upper bits of RSI are kept
+
+    CHECK(io_instruction::string_index(0x12340000FFF0U, 0x20U, false, 0xFFFFU) == 0x123400000010U);
+    CHECK(io_instruction::string_index(0x123400000010U, 0x20U, true, 0xFFFFU) == 0x12340000FFF0U);
+
+    // 32 bit: ESI wraps and the upper bits of RSI are kept
+
+    CHECK(io_instruction::string_index(0xAAAAAAAAFFFFFFF0U, 0x20U, false, 0xFFFFFFFFU) == 0xAAAAAAAA00000010U);
+    CHECK(io_instruction::string_index(0xAAAAAAAA00000010U, 0x20U, true, 0xFFFFFFFFU) == 0xAAAAAAAAFFFFFFF0U);
+
+    // 64 bit: all of RSI moves, including counts of 2^32 and above
+
+    CHECK(io_instruction::string_index(0xFFFFFFF0U, 0x100000000U, false, 0xFFFFFFFFFFFFFFFFU) == 0x1FFFFFFF0U);
+    CHECK(io_instruction::string_index(0x1FFFFFFF0U, 0x100000000U, true, 0xFFFFFFFFFFFFFFFFU) == 0xFFFFFFF0U);
+}
+
+}
+}
+
+#endif
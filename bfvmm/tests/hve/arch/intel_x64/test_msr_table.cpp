@@ -0,0 +1,159 @@
+//
+// Bareflank Extended APIs
+//
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <catch/catch.hpp>
+#include <intrinsics.h>
+
+#include <hve/arch/intel_x64/hve.h>
+#include <hve/arch/intel_x64/msr_table.h>
+#include <support/arch/intel_x64/test_support.h>
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+TEST_CASE("msr_table: find empty")
+{
+    msr_table<uint64_t> table;
+
+    CHECK(table.find(0x00000000ULL) == nullptr);
+    CHECK(table.find(0x00001FFFULL) == nullptr);
+    CHECK(table.find(0xC0000000ULL) == nullptr);
+    CHECK(table.find(0xC0001FFFULL) == nullptr);
+    CHECK(table.find(0x40000000ULL) == nullptr);
+}
+
+TEST_CASE("msr_table: get dense")
+{
+    msr_table<uint64_t> table;
+
+    table.get(0x0000001BULL) = 1;
+    table.get(0x00000808ULL) = 2;
+    table.get(0xC0000080ULL) = 3;
+    table.get(0xC0001FFFULL) = 4;
+
+    CHECK(*table.find(0x0000001BULL) == 1);
+    CHECK(*table.find(0x00000808ULL) == 2);
+    CHECK(*table.find(0xC0000080ULL) == 3);
+    CHECK(*table.find(0xC0001FFFULL) == 4);
+
+    CHECK(*table.find(0x0000001CULL) == 0);
+    CHECK(table.find(0x00001000ULL) == nullptr);
+    CHECK(table.find(0xC0000180ULL) == nullptr);
+}
+
+TEST_CASE("msr_table: get sparse")
+{
+    msr_table<uint64_t> table;
+
+    table.get(0x00002000ULL) = 1;
+    table.get(0xBFFFFFFFULL) = 2;
+    table.get(0xC0002000ULL) = 3;
+
+    CHECK(*table.find(0x00002000ULL) == 1);
+    CHECK(*table.find(0xBFFFFFFFULL) == 2);
+    CHECK(*table.find(0xC0002000ULL) == 3);
+
+    CHECK(table.find(0x00002001ULL) == nullptr);
+    CHECK(table.find(0x00000000ULL) == nullptr);
+    CHECK(table.find(0xC0000000ULL) == nullptr);
+}
+
+TEST_CASE("msr_table: ranges do not alias")
+{
+    msr_table<uint64_t> table;
+
+    table.get(0x00000080ULL) = 1;
+    table.get(0xC0000080ULL) = 2;
+
+    CHECK(*table.find(0x00000080ULL) == 1);
+    CHECK(*table.find(0xC0000080ULL) == 2);
+}
+
+// -----------------------------------------------------------------------------
+// Exit Dispatch
+// -----------------------------------------------------------------------------
+
+#ifdef _HIPPOMOCKS__ENABLE_CFUNC_MOCKING_SUPPORT
+
+static bool
+test_rdmsr_handler(gsl::not_null<vmcs_t *> vmcs, rdmsr::info_t &info)
+{
+    bfignored(vmcs);
+    bfignored(info);
+
+    return true;
+}
+
+static bool
+test_wrmsr_handler(gsl::not_null<vmcs_t *> vmcs, wrmsr::info_t &info)
+{
+    bfignored(vmcs);
+    bfignored(info);
+
+    return true;
+}
+
+// 0x1C shares 0x1B's group in the MSR table but has no handler, so its
+// exits must not emulate (or record) the access
+
+TEST_CASE("msr_table: rdmsr exit without a handler")
+{
+    MockRepository mocks;
+    mocks.OnCallFunc(_read_tsc).Return(0U);
+
+    auto hve = setup_hve(mocks);
+    hve->add_rdmsr_handler(
+        0x1BU, rdmsr::handler_delegate_t::create<test_rdmsr_handler>()
+    );
+
+    hve->rdmsr()->enable_log();
+    g_save_state.rcx = 0x1CU;
+    hve->rdmsr()->handle(hve->vmcs());
+
+    CHECK(hve->trace_ring()->head() == 0U);
+}
+
+TEST_CASE("msr_table: wrmsr exit without a handler")
+{
+    MockRepository mocks;
+    mocks.OnCallFunc(_read_tsc).Return(0U);
+
+    auto hve = setup_hve(mocks);
+    hve->add_wrmsr_handler(
+        0x1BU, wrmsr::handler_delegate_t::create<test_wrmsr_handler>()
+    );
+
+    g_msrs[0x1CU] = 0x0U;
+
+    hve->wrmsr()->enable_log();
+    g_save_state.rcx = 0x1CU;
+    g_save_state.rax = 0x42U;
+    g_save_state.rdx = 0x0U;
+    hve->wrmsr()->handle(hve->vmcs());
+
+    CHECK(hve->trace_ring()->head() == 0U);
+    CHECK(g_msrs[0x1CU] == 0x0U);
+}
+
+#endif
+
+}
+}
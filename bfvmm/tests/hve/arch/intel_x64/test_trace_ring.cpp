@@ -0,0 +1,216 @@
+//
+// Bareflank Extended APIs
+//
+// Copyright (C) 2018 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <intrinsics.h>
+#include <bfvmm/memory_manager/memory_manager.h>
+
+#include <hve/arch/intel_x64/hve.h>
+#include <hve/arch/intel_x64/trace_ring.h>
+#include <support/arch/intel_x64/test_support.h>
+
+#ifdef _HIPPOMOCKS__ENABLE_CFUNC_MOCKING_SUPPORT
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+using type_t = trace_ring::type_t;
+
+uint64_t g_tsc{0};
+
+static uint64_t
+test_read_tsc() noexcept
+{ return ++g_tsc; }
+
+static bool
+test_rdmsr_handler(gsl::not_null<vmcs_t *> vmcs, rdmsr::info_t &info)
+{
+    bfignored(vmcs);
+    bfignored(info);
+
+    return true;
+}
+
+TEST_CASE("trace_ring: constructor")
+{
+    CHECK_THROWS(trace_ring(0U));
+    CHECK_THROWS(trace_ring(3U));
+    CHECK_NOTHROW(trace_ring(4U));
+}
+
+TEST_CASE("trace_ring: region")
+{
+    trace_ring ring{4U};
+    auto region = ring.region();
+
+    CHECK(region.size() == ::x64::page_size);
+    CHECK((reinterpret_cast<uintptr_t>(region.data()) & (::x64::page_size - 1U)) == 0U);
+
+    auto header = reinterpret_cast<const trace_ring::header_t *>(region.data());
+    CHECK(header->magic == trace_ring::magic);
+    CHECK(header->capacity == 4U);
+    CHECK(header->head.load() == 0U);
+}
+
+TEST_CASE("trace_ring: page_hpa")
+{
+    MockRepository mocks;
+
+    auto mm = mocks.Mock<bfvmm::memory_manager>();
+    mocks.OnCallFunc(bfvmm::memory_manager::instance).Return(mm);
+    mocks.OnCall(mm, bfvmm::memory_manager::virtptr_to_physint).Do([](auto ptr) {
+        return reinterpret_cast<uintptr_t>(ptr) ^ 0xFFFF000000000000ULL;
+    });
+
+    // 1 header and 127 slots fill the first two pages, the last slot
+    // spills into a third
+
+    trace_ring ring{128U};
+    auto region = ring.region();
+
+    CHECK(ring.page_count() == 3U);
+    CHECK(region.size() == 3U * ::x64::page_size);
+
+    for (auto i = 0U; i < ring.page_count(); ++i) {
+        const auto hva = reinterpret_cast<uintptr_t>(region.data() + (i * ::x64::page_size));
+        CHECK(ring.page_hpa(i) == (hva ^ 0xFFFF000000000000ULL));
+    }
+
+    CHECK_THROWS(ring.page_hpa(3U));
+}
+
+TEST_CASE("trace_ring: record")
+{
+    MockRepository mocks;
+    mocks.OnCallFunc(_read_tsc).Do(test_read_tsc);
+
+    trace_ring ring{4U};
+
+    ring.record(type_t::rdmsr, 0x1BU, 0x10U);
+    ring.record(type_t::wrmsr, 0x1BU, 0x20U);
+    ring.record(type_t::rdmsr, 0x3AU, 0x30U, 1U, 2U, 3U);
+
+    CHECK(ring.head() == 3U);
+
+    std::vector<trace_ring::entry_t> entries;
+    ring.for_each(type_t::rdmsr, [&](const trace_ring::entry_t & entry) {
+        entries.push_back(entry);
+    });
+
+    CHECK(entries.size() == 2U);
+    CHECK(entries.at(0).seq == 0U);
+    CHECK(entries.at(0).data.at(0) == 0x1BU);
+    CHECK(entries.at(0).data.at(1) == 0x10U);
+    CHECK(entries.at(1).seq == 2U);
+    CHECK(entries.at(1).data.at(4) == 3U);
+    CHECK(entries.at(0).tsc < entries.at(1).tsc);
+}
+
+TEST_CASE("trace_ring: overwrite oldest")
+{
+    MockRepository mocks;
+    mocks.OnCallFunc(_read_tsc).Do(test_read_tsc);
+
+    trace_ring ring{4U};
+
+    for (auto i = 0U; i < 6U; ++i) {
+        ring.record(type_t::cpuid, i);
+    }
+
+    std::vector<uint64_t> data;
+    ring.for_each(type_t::cpuid, [&](const trace_ring::entry_t & entry) {
+        data.push_back(entry.data.at(0));
+    });
+
+    CHECK(data == std::vector<uint64_t>({2U, 3U, 4U, 5U}));
+}
+
+TEST_CASE("trace_ring: read")
+{
+    MockRepository mocks;
+    mocks.OnCallFunc(_read_tsc).Do(test_read_tsc);
+
+    trace_ring ring{4U};
+    std::array<trace_ring::entry_t, 2> out{};
+    uint64_t next = 0;
+
+    CHECK(trace_ring::read(ring.region().data(), next, out) == 0U);
+
+    ring.record(type_t::cpuid, 0U);
+    ring.record(type_t::cpuid, 1U);
+    ring.record(type_t::cpuid, 2U);
+
+    CHECK(trace_ring::read(ring.region().data(), next, out) == 2U);
+    CHECK(out.at(0).data.at(0) == 0U);
+    CHECK(out.at(1).data.at(0) == 1U);
+    CHECK(next == 2U);
+
+    CHECK(trace_ring::read(ring.region().data(), next, out) == 1U);
+    CHECK(out.at(0).data.at(0) == 2U);
+    CHECK(next == 3U);
+
+    for (auto i = 3U; i < 10U; ++i) {
+        ring.record(type_t::cpuid, i);
+    }
+
+    CHECK(trace_ring::read(ring.region().data(), next, out) == 2U);
+    CHECK(out.at(0).seq == 6U);
+    CHECK(out.at(0).data.at(0) == 6U);
+    CHECK(out.at(1).data.at(0) == 7U);
+    CHECK(next == 8U);
+}
+
+TEST_CASE("trace_ring: rdmsr exit")
+{
+    MockRepository mocks;
+    mocks.OnCallFunc(_read_tsc).Do(test_read_tsc);
+
+    auto hve = setup_hve(mocks);
+    hve->add_rdmsr_handler(
+        0x1BU, rdmsr::handler_delegate_t::create<test_rdmsr_handler>()
+    );
+
+    g_msrs[0x1BU] = 0x42U;
+    g_save_state.rcx = 0x1BU;
+    CHECK(hve->rdmsr()->handle(hve->vmcs()));
+    CHECK(hve->trace_ring()->head() == 0U);
+
+    hve->rdmsr()->enable_log();
+    CHECK(hve->rdmsr()->handle(hve->vmcs()));
+    CHECK(hve->trace_ring()->head() == 1U);
+
+    std::vector<trace_ring::entry_t> entries;
+    hve->trace_ring()->for_each(type_t::rdmsr, [&](const trace_ring::entry_t & entry) {
+        entries.push_back(entry);
+    });
+
+    CHECK(entries.size() == 1U);
+    CHECK(entries.at(0).data.at(0) == 0x1BU);
+    CHECK(entries.at(0).data.at(1) == 0x42U);
+
+    hve->rdmsr()->disable_log();
+    CHECK(hve->rdmsr()->handle(hve->vmcs()));
+    CHECK(hve->trace_ring()->head() == 1U);
+}
+
+}
+}
+
+#endif
@@ -60,6 +60,13 @@ setup_external_interrupt_exit(uint64_t vector)
     g_vmcs_fields[info::addr] = vec;
 }
 
+static void
+guest_eoi(eapis::intel_x64::vic &vic, gsl::not_null<vmcs_t *> vmcs)
+{
+    wrmsr::info_t info = {};
+    vic.handle_x2apic_eoi_write(vmcs, info);
+}
+
 static bool
 handle_external_interrupt_stub(
     gsl::not_null<vmcs_t *> vmcs,
@@ -200,6 +207,40 @@ TEST_CASE("vic: virt_to_phys")
     CHECK(vic.virt_to_phys(virt + 1U) == virt + 1U);
 }
 
+TEST_CASE("vic: remap")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vic = setup_vic(hve.get());
+
+    vic.map(40U, 60U);
+    CHECK(vic.phys_to_virt(40U) == 60U);
+    CHECK(vic.virt_to_phys(40U) == 0U);
+    CHECK(vic.virt_to_phys(60U) == 60U);
+
+    vic.map(60U, 61U);
+    CHECK(vic.virt_to_phys(60U) == 40U);
+    CHECK(vic.virt_to_phys(61U) == 61U);
+
+    vic.map(200U, 60U);
+    CHECK(vic.virt_to_phys(60U) == 200U);
+
+    vic.unmap(60U);
+    CHECK(vic.phys_to_virt(40U) == 0U);
+    CHECK(vic.phys_to_virt(200U) == 0U);
+    CHECK(vic.virt_to_phys(60U) == 0U);
+    CHECK(vic.virt_to_phys(0U) == 200U);
+
+    vic.map(200U, 200U);
+    CHECK(vic.virt_to_phys(0U) == 40U);
+    CHECK(vic.virt_to_phys(200U) == 200U);
+
+    vic.map(5U, 61U);
+    CHECK(vic.virt_to_phys(61U) == 61U);
+    vic.unmap(61U);
+    CHECK(vic.phys_to_virt(5U) == 61U);
+}
+
 TEST_CASE("vic: ipi - window closed")
 {
     MockRepository mocks;
@@ -231,9 +272,31 @@ TEST_CASE("vic: ipi - window open")
         CHECK_NOTHROW(vic.send_virt_ipi(i));
         CHECK(vmcs_n::vm_entry_interruption_information::vector::get() == i);
         CHECK(vmcs_n::vm_entry_interruption_information::valid_bit::is_enabled());
+        guest_eoi(vic, hve->vmcs());
     }
 }
 
+TEST_CASE("vic: handle_x2apic_eoi_write")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vic = setup_vic(hve.get());
+
+    open_interrupt_window();
+    vic.send_virt_ipi(0x80U);
+    vic.send_virt_ipi(0x81U);
+    CHECK(vmcs_n::vm_entry_interruption_information::vector::get() == 0x80U);
+
+    guest_eoi(vic, hve->vmcs());
+    CHECK(vmcs_n::vm_entry_interruption_information::vector::get() == 0x81U);
+
+    guest_eoi(vic, hve->vmcs());
+    CHECK(vic.injection_stats().injected == 2U);
+    CHECK(vic.injection_stats().window_exits == 0U);
+    CHECK(vic.injection_stats().bursts == 1U);
+    CHECK(vic.injection_stats().last_burst_exits_saved == 1U);
+}
+
 TEST_CASE("vic: handle_interrupt - window closed")
 {
     MockRepository mocks;
@@ -271,6 +334,7 @@ TEST_CASE("vic: handle_interrupt - window open")
         CHECK(g_msrs[msrs_n::ia32_x2apic_eoi::addr] == 0U);
         CHECK(vmcs_n::vm_entry_interruption_information::vector::get() == i);
         CHECK(vmcs_n::vm_entry_interruption_information::valid_bit::is_enabled());
+        guest_eoi(vic, hve->vmcs());
     }
 }
 
@@ -379,6 +443,7 @@ TEST_CASE("vic: handle_interrupt_from_exit - window open")
         CHECK(g_msrs[msrs_n::ia32_x2apic_eoi::addr] == 0U);
         CHECK(entry_intr_info::vector::get() == v);
         CHECK(entry_intr_info::valid_bit::is_enabled());
+        guest_eoi(vic, hve->vmcs());
     }
 }
 
@@ -452,6 +517,280 @@ TEST_CASE("vic: handle_wrcr8")
     CHECK_NOTHROW(ehlr->handle(ehlr));
 }
 
+TEST_CASE("vic: enable_tpr_shadow")
+{
+    namespace proc_ctls1 = vmcs_n::primary_processor_based_vm_execution_controls;
+
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vic = setup_vic(hve.get());
+
+    CHECK(proc_ctls1::cr8_load_exiting::is_enabled());
+    CHECK(proc_ctls1::cr8_store_exiting::is_enabled());
+
+    CHECK(vic.enable_tpr_shadow());
+    CHECK(proc_ctls1::use_tpr_shadow::is_enabled());
+    CHECK(proc_ctls1::cr8_load_exiting::is_disabled());
+    CHECK(proc_ctls1::cr8_store_exiting::is_disabled());
+    CHECK(g_msrs[::intel_x64::msrs::ia32_x2apic_tpr::addr] == 0U);
+}
+
+TEST_CASE("vic: enable_apic_register_virtualization")
+{
+    namespace proc_ctls1 = vmcs_n::primary_processor_based_vm_execution_controls;
+
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vic = setup_vic(hve.get());
+
+    const auto tpr = ::intel_x64::msrs::ia32_x2apic_tpr::addr;
+    const auto eoi = ::intel_x64::msrs::ia32_x2apic_eoi::addr;
+    auto bitmap = hve->msr_bitmap();
+
+    g_msrs[tpr] = 0x40U;
+
+    CHECK(is_bit_set(bitmap[tpr >> 3U], tpr & 7U));
+    CHECK(vic.enable_apic_register_virtualization());
+    CHECK(!is_bit_set(bitmap[tpr >> 3U], tpr & 7U));
+    CHECK(is_bit_set(bitmap[0x800U + (eoi >> 3U)], eoi & 7U));
+
+    // The TPR shadow is enabled through the vic
+
+    CHECK(proc_ctls1::use_tpr_shadow::is_enabled());
+    CHECK(proc_ctls1::cr8_load_exiting::is_disabled());
+    CHECK(proc_ctls1::cr8_store_exiting::is_disabled());
+    CHECK(g_msrs[tpr] == 0U);
+}
+
+TEST_CASE("vic: enable_virtual_interrupt_delivery")
+{
+    namespace proc_ctls1 = vmcs_n::primary_processor_based_vm_execution_controls;
+
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vic = setup_vic(hve.get());
+
+    const auto tpr = ::intel_x64::msrs::ia32_x2apic_tpr::addr;
+    g_msrs[tpr] = 0x40U;
+
+    CHECK(vic.enable_virtual_interrupt_delivery());
+    CHECK(proc_ctls1::use_tpr_shadow::is_enabled());
+    CHECK(proc_ctls1::cr8_load_exiting::is_disabled());
+    CHECK(proc_ctls1::cr8_store_exiting::is_disabled());
+    CHECK(g_msrs[tpr] == 0U);
+}
+
+TEST_CASE("vic: enable_posted_interrupts - not supported")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vic = setup_vic(hve.get());
+
+    g_msrs[::intel_x64::msrs::ia32_vmx_true_pinbased_ctls::addr] = 0x0ULL;
+
+    CHECK(!vic.enable_posted_interrupts(0xF2U));
+    CHECK_THROWS(vic.post_interrupt(0x42U));
+}
+
+TEST_CASE("vic: post_interrupt")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto ehlr = hve->exit_handler();
+    auto vic = setup_vic(hve.get());
+
+    const auto icr = ::intel_x64::msrs::ia32_x2apic_icr::addr;
+    const auto eoi = ::intel_x64::msrs::ia32_x2apic_eoi::addr;
+    const auto id = ::intel_x64::msrs::ia32_x2apic_apicid::addr;
+
+    g_msrs[id] = 0x3U;
+
+    CHECK_THROWS(vic.enable_posted_interrupts(0x10U));
+    CHECK(vic.enable_posted_interrupts(0xF2U));
+
+    g_msrs[icr] = 0U;
+    vic.post_interrupt(0x42U);
+    CHECK(g_msrs[icr] == 0x3000000F2ULL);
+
+    g_msrs[icr] = 0U;
+    vic.post_interrupt(0x43U);
+    CHECK(g_msrs[icr] == 0U);
+
+    g_msrs[eoi] = 0xCAFEBABEU;
+    setup_external_interrupt_exit(0xF2U);
+    CHECK_NOTHROW(ehlr->handle(ehlr));
+    CHECK(g_msrs[eoi] == 0U);
+    CHECK(vmcs_n::guest_interrupt_status::get() == 0x43U);
+
+    vic.post_interrupt(0x44U);
+    CHECK(g_msrs[icr] == 0x3000000F2ULL);
+}
+
+TEST_CASE("vic: interrupt_mailbox")
+{
+    interrupt_mailbox mailbox;
+    interrupt_mailbox::vectors_t vectors{};
+
+    CHECK(!mailbox.pending());
+    CHECK(!mailbox.take(vectors));
+
+    CHECK(mailbox.post(0x42U));
+    CHECK(!mailbox.post(0xF0U));
+    CHECK(!mailbox.post(0x42U));
+    CHECK(mailbox.pending());
+
+    CHECK(mailbox.take(vectors));
+    CHECK(vectors[1] == (1ULL << 2U));
+    CHECK(vectors[3] == (1ULL << 0x30U));
+    CHECK(!mailbox.pending());
+
+    CHECK(mailbox.post(0x20U));
+}
+
+TEST_CASE("vic: enable_ipi_mailbox")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+
+    const auto id = ::intel_x64::msrs::ia32_x2apic_apicid::addr;
+
+    g_msrs[id] = 0x1U;
+    auto vic1 = setup_vic(hve.get());
+
+    CHECK_THROWS(vic1.post_virt_interrupt(0x42U));
+    CHECK_THROWS(vic1.enable_ipi_mailbox(0x10U, 2U));
+    CHECK_THROWS(vic1.enable_ipi_mailbox(0xF1U, 0U));
+    CHECK(!vic1.send_virt_icr(0x42U));
+    CHECK_NOTHROW(vic1.enable_ipi_mailbox(0xF1U, 2U));
+    CHECK_THROWS(vic1.enable_ipi_mailbox(0xF1U, 2U));
+
+    {
+        auto vic2 = setup_vic(hve.get());
+        CHECK_THROWS(vic2.enable_ipi_mailbox(0xF1U, 2U));
+    }
+
+    g_msrs[id] = 0x2U;
+    auto vic3 = setup_vic(hve.get());
+    CHECK_THROWS(vic3.enable_ipi_mailbox(0xF1U, 3U));
+
+    g_msrs[id] = 0x100U;
+    auto vic4 = setup_vic(hve.get());
+    CHECK_THROWS(vic4.enable_ipi_mailbox(0xF1U, 2U));
+}
+
+TEST_CASE("vic: send_virt_icr")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vmcs = hve->vmcs();
+
+    const auto icr = ::intel_x64::msrs::ia32_x2apic_icr::addr;
+    const auto id = ::intel_x64::msrs::ia32_x2apic_apicid::addr;
+    const auto ldr = ::intel_x64::msrs::ia32_x2apic_ldr::addr;
+
+    g_msrs[id] = 0x0U;
+    g_msrs[ldr] = 0x1U;
+    auto vic0 = setup_vic(hve.get());
+
+    g_msrs[id] = 0x1U;
+    g_msrs[ldr] = 0x2U;
+    auto vic1 = setup_vic(hve.get());
+
+    vic0.enable_ipi_mailbox(0xF1U, 2U);
+    vic1.enable_ipi_mailbox(0xF1U, 2U);
+    open_interrupt_window();
+
+    // Physical destination: the first IPI kicks vCPU 1, the second
+    // is coalesced with it
+
+    g_msrs[icr] = 0U;
+    CHECK(vic0.send_virt_icr(0x0000000100000050ULL));
+    CHECK(g_msrs[icr] == 0x00000001000000F1ULL);
+
+    g_msrs[icr] = 0U;
+    CHECK(vic0.send_virt_icr(0x0000000100000051ULL));
+    CHECK(g_msrs[icr] == 0U);
+
+    external_interrupt::info_t info = {0xF1U};
+    CHECK(vic1.handle_external_interrupt_exit(vmcs, info));
+    CHECK(vmcs_n::vm_entry_interruption_information::vector::get() == 0x51U);
+
+    // Logical destination (cluster 0, APIC 1)
+
+    CHECK(vic0.send_virt_icr(0x0000000200000852ULL));
+    CHECK(g_msrs[icr] == 0x00000001000000F1ULL);
+
+    // Self shorthand is injected without a kick
+
+    g_msrs[icr] = 0U;
+    CHECK(vic0.send_virt_icr(0x0000000000040060ULL));
+    CHECK(vmcs_n::vm_entry_interruption_information::vector::get() == 0x60U);
+    CHECK(g_msrs[icr] == 0U);
+
+    // Unknown destinations and non-fixed delivery modes are sent
+    // physically
+
+    CHECK(!vic0.send_virt_icr(0x0000000700000050ULL));
+    CHECK(!vic0.send_virt_icr(0x0000000400000850ULL));
+    CHECK(!vic0.send_virt_icr(0x0000000100000402ULL));
+
+    // The logical broadcast reaches every vCPU, and a logical destination
+    // no vCPU accepts is sent physically
+
+    CHECK(vic1.handle_external_interrupt_exit(vmcs, info));
+
+    g_msrs[icr] = 0U;
+    CHECK(vic0.send_virt_icr(0xFFFFFFFF00000856ULL));
+    CHECK(g_msrs[icr] == 0x00000001000000F1ULL);
+    CHECK(vic1.m_mailbox->pending());
+
+    CHECK(!vic0.send_virt_icr(0x0001000300000856ULL));
+
+    // Every vCPU has a mailbox, so IPIs to all (but self) are delivered
+    // virtually
+
+    CHECK(vic0.send_virt_icr(0x00000000000C0053ULL));
+    CHECK(vic0.send_virt_icr(0x0000000000080054ULL));
+    CHECK(vic0.send_virt_icr(0xFFFFFFFF00000055ULL));
+}
+
+TEST_CASE("vic: send_virt_icr with vCPUs that have no mailbox")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+
+    const auto icr = ::intel_x64::msrs::ia32_x2apic_icr::addr;
+    const auto id = ::intel_x64::msrs::ia32_x2apic_apicid::addr;
+    const auto ldr = ::intel_x64::msrs::ia32_x2apic_ldr::addr;
+
+    g_msrs[id] = 0x0U;
+    g_msrs[ldr] = 0x1U;
+    auto vic0 = setup_vic(hve.get());
+
+    g_msrs[id] = 0x1U;
+    g_msrs[ldr] = 0x2U;
+    auto vic1 = setup_vic(hve.get());
+
+    vic0.enable_ipi_mailbox(0xF1U, 3U);
+    vic1.enable_ipi_mailbox(0xF1U, 3U);
+    open_interrupt_window();
+
+    // vCPU 2 has no mailbox, so anything that can target it (or that can
+    // target a vCPU only known by its logical ID) is sent physically
+
+    g_msrs[icr] = 0U;
+    CHECK(!vic0.send_virt_icr(0x00000000000C0050ULL));
+    CHECK(!vic0.send_virt_icr(0x0000000000080050ULL));
+    CHECK(!vic0.send_virt_icr(0xFFFFFFFF00000050ULL));
+    CHECK(!vic0.send_virt_icr(0x0000000200000850ULL));
+    CHECK(g_msrs[icr] == 0U);
+
+    // A physical destination with a mailbox is still delivered virtually
+
+    CHECK(vic0.send_virt_icr(0x0000000100000050ULL));
+    CHECK(g_msrs[icr] == 0x00000001000000F1ULL);
+}
+
 TEST_CASE("vic: handle_x2apic_read")
 {
     MockRepository mocks;
@@ -485,6 +824,188 @@ TEST_CASE("vic: handle_x2apic_write")
         }
     }
 }
+
+uint64_t g_tsc{0};
+uint64_t g_tsc_step{0};
+
+static uint64_t
+test_read_tsc() noexcept
+{ return g_tsc += g_tsc_step; }
+
+// The timer clock runs at 1/25th of the TSC (e.g. a 24 MHz crystal and a
+// 600 MHz TSC), as reported by CPUID 0x15
+
+static void
+setup_timer_clock(uint32_t max_leaf)
+{
+    g_eax_cpuid[0x0U] = max_leaf;
+    g_eax_cpuid[0x15U] = 2U;
+    g_ebx_cpuid[0x15U] = 50U;
+    g_ecx_cpuid[0x15U] = 24000000U;
+}
+
+static void
+setup_phys_timer(uint64_t lvt, uint64_t init, uint64_t cur)
+{
+    g_msrs[msrs_n::ia32_vmx_misc::addr] = 0x0ULL;
+    g_msrs[msrs_n::ia32_x2apic_lvt_timer::addr] = lvt;
+    g_msrs[msrs_n::ia32_x2apic_div_conf::addr] = 0xBU;
+    g_msrs[msrs_n::ia32_x2apic_init_count::addr] = init;
+    g_msrs[msrs_n::ia32_x2apic_cur_count::addr] = cur;
+}
+
+TEST_CASE("vic: enable_timer_emulation")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vic = setup_vic(hve.get());
+
+    g_tsc = 0x100000U;
+    g_tsc_step = 0U;
+    mocks.OnCallFunc(_read_tsc).Do(test_read_tsc);
+
+    setup_timer_clock(0x16U);
+    setup_phys_timer(0x10000U, 0U, 0U);
+
+    CHECK(vic.enable_timer_emulation());
+
+    wrmsr::info_t winfo = {};
+
+    winfo.msr = msrs_n::ia32_x2apic_lvt_timer::addr;
+    winfo.val = 0x40031U;
+    CHECK(vic.handle_x2apic_write(hve->vmcs(), winfo));
+
+    winfo.val = 0x200000U;
+    CHECK(vic.handle_wrmsr_tsc_deadline(hve->vmcs(), winfo));
+    CHECK(winfo.ignore_write);
+    CHECK(pin_ctls::activate_vmx_preemption_timer::is_enabled());
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x100000U);
+
+    rdmsr::info_t rinfo = {};
+    CHECK(vic.handle_rdmsr_tsc_deadline(hve->vmcs(), rinfo));
+    CHECK(rinfo.val == 0x200000U);
+
+    winfo.msr = msrs_n::ia32_x2apic_lvt_timer::addr;
+    winfo.val = 0x31U;
+    CHECK(vic.handle_x2apic_write(hve->vmcs(), winfo));
+
+    winfo.msr = msrs_n::ia32_x2apic_init_count::addr;
+    winfo.val = 0x1000U;
+    CHECK(vic.handle_x2apic_write(hve->vmcs(), winfo));
+    CHECK(g_msrs[msrs_n::ia32_x2apic_init_count::addr] == 0U);
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x19000U);
+
+    rinfo.msr = msrs_n::ia32_x2apic_cur_count::addr;
+    CHECK(vic.handle_x2apic_read(hve->vmcs(), rinfo));
+    CHECK(rinfo.val == 0x1000U);
+
+    g_tsc += 0x6400U;
+    CHECK(vic.handle_x2apic_read(hve->vmcs(), rinfo));
+    CHECK(rinfo.val == 0xC00U);
+}
+
+TEST_CASE("vic: enable_timer_emulation takes over a periodic timer")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vic = setup_vic(hve.get());
+
+    g_tsc = 0x100000U;
+    g_tsc_step = 0U;
+    mocks.OnCallFunc(_read_tsc).Do(test_read_tsc);
+
+    setup_timer_clock(0x16U);
+    setup_phys_timer(0x20031U, 0x1000U, 0x400U);
+
+    CHECK(vic.enable_timer_emulation());
+
+    // The physical timer is masked and stopped
+
+    CHECK(g_msrs[msrs_n::ia32_x2apic_lvt_timer::addr] == 0x30031U);
+    CHECK(g_msrs[msrs_n::ia32_x2apic_init_count::addr] == 0U);
+
+    // The virtual one fires when the physical one would have, then keeps
+    // the period of the initial count
+
+    CHECK(pin_ctls::activate_vmx_preemption_timer::is_enabled());
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x2800U);
+    CHECK(vic.read_virt_register(lapic_register::msr_addr_to_offset(
+                                     msrs_n::ia32_x2apic_init_count::addr)) == 0x1000U);
+
+    open_interrupt_window();
+
+    g_tsc += 0x2800U;
+    g_vmcs_fields[vmcs_n::exit_reason::addr] =
+        vmcs_n::exit_reason::basic_exit_reason::preemption_timer_expired;
+
+    auto ehlr = hve->exit_handler();
+    CHECK_NOTHROW(ehlr->handle(ehlr));
+    CHECK(vic.m_virt_lapic->timer_stats().expirations == 1U);
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x19000U);
+}
+
+TEST_CASE("vic: enable_timer_emulation takes over a tsc deadline")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vic = setup_vic(hve.get());
+
+    g_tsc = 0x100000U;
+    g_tsc_step = 0U;
+    mocks.OnCallFunc(_read_tsc).Do(test_read_tsc);
+
+    setup_timer_clock(0x16U);
+    setup_phys_timer(0x40031U, 0U, 0U);
+    g_msrs[0x6E0U] = 0x105000U;
+
+    CHECK(vic.enable_timer_emulation());
+
+    CHECK(g_msrs[0x6E0U] == 0U);
+    CHECK(g_msrs[msrs_n::ia32_x2apic_lvt_timer::addr] == 0x50031U);
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x5000U);
+
+    rdmsr::info_t rinfo = {};
+    CHECK(vic.handle_rdmsr_tsc_deadline(hve->vmcs(), rinfo));
+    CHECK(rinfo.val == 0x105000U);
+}
+
+TEST_CASE("vic: enable_timer_emulation calibrates the timer clock")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vic = setup_vic(hve.get());
+
+    // Without CPUID 0x15 the physical timer is timed against the TSC:
+    // 0x8000 timer ticks in 0x100000 TSC ticks
+
+    g_tsc = 0x100000U;
+    g_tsc_step = 0x1000U;
+    mocks.OnCallFunc(_read_tsc).Do(test_read_tsc);
+
+    setup_timer_clock(0xDU);
+    setup_phys_timer(0x10031U, 0U, 0xFFFFFFFFU - 0x8000U);
+
+    CHECK(vic.enable_timer_emulation());
+    CHECK(g_msrs[msrs_n::ia32_x2apic_lvt_timer::addr] == 0x10031U);
+    CHECK(g_msrs[msrs_n::ia32_x2apic_init_count::addr] == 0U);
+    CHECK(g_msrs[msrs_n::ia32_x2apic_div_conf::addr] == 0xBU);
+
+    g_tsc_step = 0U;
+
+    wrmsr::info_t winfo = {};
+    winfo.msr = msrs_n::ia32_x2apic_init_count::addr;
+    winfo.val = 0x100U;
+    CHECK(vic.handle_x2apic_write(hve->vmcs(), winfo));
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x2000U);
+
+    // A timer that does not count cannot be emulated
+
+    auto vic2 = setup_vic(hve.get());
+
+    g_tsc_step = 0x1000U;
+    setup_phys_timer(0x10031U, 0U, 0xFFFFFFFFU);
+    CHECK_THROWS(vic2.enable_timer_emulation());
+}
 }
 }
 
@@ -18,6 +18,8 @@
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 #include <algorithm>
+#include <chrono>
+#include <iostream>
 #include <intrinsics.h>
 
 #include <hve/arch/intel_x64/hve.h>
@@ -35,6 +37,7 @@ namespace msrs_n = ::intel_x64::msrs;
 namespace lapic_n = ::intel_x64::lapic;
 namespace proc_ctls1 = vmcs_n::primary_processor_based_vm_execution_controls;
 namespace proc_ctls2 = vmcs_n::secondary_processor_based_vm_execution_controls;
+namespace pin_ctls = vmcs_n::pin_based_vm_execution_controls;
 
 std::unique_ptr<bfvmm::intel_x64::vmcs> g_vmcs{nullptr};
 std::unique_ptr<bfvmm::intel_x64::exit_handler> g_ehlr{nullptr};
@@ -122,6 +125,241 @@ TEST_CASE("virt_x2apic: clear values")
     }
 }
 
+TEST_CASE("virt_x2apic: enable_register_virtualization - not supported")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    g_msrs[msrs_n::ia32_vmx_procbased_ctls2::addr] = 0x0ULL;
+
+    CHECK(vapic.enable_tpr_shadow());
+    CHECK(!vapic.enable_register_virtualization());
+    CHECK(!vapic.register_virtualization_enabled());
+    CHECK(proc_ctls2::virtualize_x2apic_mode::is_disabled());
+    CHECK(proc_ctls2::apic_register_virtualization::is_disabled());
+}
+
+TEST_CASE("virt_x2apic: enable_register_virtualization")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    // The TPR shadow is enabled by the vic, which also stops CR8 exiting
+
+    CHECK_THROWS(vapic.enable_register_virtualization());
+    CHECK(vapic.enable_tpr_shadow());
+
+    CHECK(vapic.enable_register_virtualization());
+    CHECK(vapic.register_virtualization_enabled());
+    CHECK(vapic.enable_register_virtualization());
+
+    CHECK(proc_ctls1::use_tpr_shadow::is_enabled());
+    CHECK(proc_ctls2::virtualize_x2apic_mode::is_enabled());
+    CHECK(proc_ctls2::apic_register_virtualization::is_enabled());
+    CHECK(vmcs_n::virtual_apic_address::get() != 0U);
+    CHECK(vmcs_n::tpr_threshold::get() == 0U);
+
+    vapic.write_tpr(0x40U);
+    CHECK(vapic.read_tpr() == 0x40U);
+}
+
+TEST_CASE("virt_x2apic: enable_tpr_shadow - not supported")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    g_msrs[msrs_n::ia32_vmx_true_procbased_ctls::addr] = 0x0ULL;
+
+    CHECK(!vapic.enable_tpr_shadow());
+    CHECK(!vapic.tpr_shadow_enabled());
+    CHECK(proc_ctls1::use_tpr_shadow::is_disabled());
+}
+
+TEST_CASE("virt_x2apic: enable_tpr_shadow")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    CHECK(vapic.enable_tpr_shadow());
+    CHECK(vapic.tpr_shadow_enabled());
+    CHECK(proc_ctls1::use_tpr_shadow::is_enabled());
+    CHECK(vmcs_n::virtual_apic_address::get() != 0U);
+    CHECK(vmcs_n::tpr_threshold::get() == 0U);
+}
+
+TEST_CASE("virt_x2apic: tpr shadow - masked injection")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto ehlr = hve->exit_handler();
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    CHECK(vapic.enable_tpr_shadow());
+    vapic.write_tpr(0x50U);
+
+    vmcs_n::guest_rflags::interrupt_enable_flag::disable();
+    vapic.queue_injection(0x42U);
+
+    CHECK(vapic.top_irr() == 0x42U);
+    CHECK(vmcs_n::tpr_threshold::get() == 0x4U);
+    CHECK(proc_ctls1::interrupt_window_exiting::is_disabled());
+
+    vapic.write_tpr(0x40U);
+    CHECK(vmcs_n::tpr_threshold::get() == 0x4U);
+
+    vapic.write_tpr(0x30U);
+    g_vmcs_fields[vmcs_n::exit_reason::addr] =
+        vmcs_n::exit_reason::basic_exit_reason::tpr_below_threshold;
+    CHECK_NOTHROW(ehlr->handle(ehlr));
+    CHECK(vmcs_n::tpr_threshold::get() == 0U);
+    CHECK(proc_ctls1::interrupt_window_exiting::is_enabled());
+
+    CHECK(vapic.handle_interrupt_window_exit(hve->vmcs()));
+    CHECK(vapic.irr_is_empty());
+    CHECK(vapic.top_isr() == 0x42U);
+    CHECK(proc_ctls1::interrupt_window_exiting::is_disabled());
+}
+
+TEST_CASE("virt_x2apic: enable_interrupt_delivery - not supported")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    g_msrs[msrs_n::ia32_vmx_procbased_ctls2::addr] = 0x0ULL;
+
+    CHECK(!vapic.enable_interrupt_delivery());
+    CHECK(!vapic.interrupt_delivery_enabled());
+    CHECK(proc_ctls2::virtual_interrupt_delivery::is_disabled());
+}
+
+TEST_CASE("virt_x2apic: enable_interrupt_delivery")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    vmcs_n::guest_rflags::interrupt_enable_flag::disable();
+    vapic.queue_injection(0x31U);
+    CHECK(proc_ctls1::interrupt_window_exiting::is_enabled());
+
+    CHECK(vapic.enable_tpr_shadow());
+    CHECK(vapic.enable_interrupt_delivery());
+    CHECK(vapic.interrupt_delivery_enabled());
+    CHECK(vapic.register_virtualization_enabled());
+    CHECK(proc_ctls2::virtual_interrupt_delivery::is_enabled());
+    CHECK(proc_ctls1::interrupt_window_exiting::is_disabled());
+    CHECK(vmcs_n::guest_interrupt_status::get() == 0x31U);
+
+    vapic.queue_injection(0x51U);
+    vapic.queue_injection(0x41U);
+    CHECK(vmcs_n::guest_interrupt_status::get() == 0x51U);
+    CHECK(vapic.top_irr() == 0x51U);
+    CHECK(proc_ctls1::interrupt_window_exiting::is_disabled());
+    CHECK(vmcs_n::vm_entry_interruption_information::valid_bit::is_disabled());
+}
+
+static uint64_t g_eoi_vector{0};
+
+static bool
+handle_eoi_stub(gsl::not_null<vmcs_t *> vmcs, uint64_t vector)
+{
+    bfignored(vmcs);
+
+    g_eoi_vector = vector;
+    return true;
+}
+
+TEST_CASE("virt_x2apic: add_eoi_handler")
+{
+    using eoi_handler_delegate_t = eapis::intel_x64::virt_lapic::eoi_handler_delegate_t;
+
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto ehlr = hve->exit_handler();
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    vapic.add_eoi_handler(0x42U, eoi_handler_delegate_t::create<handle_eoi_stub>());
+
+    CHECK(vapic.enable_tpr_shadow());
+    CHECK(vapic.enable_interrupt_delivery());
+    CHECK(vmcs_n::eoi_exit_bitmap_1::get() == (1ULL << 2U));
+
+    vapic.add_eoi_handler(0xC0U, eoi_handler_delegate_t::create<handle_eoi_stub>());
+    CHECK(vmcs_n::eoi_exit_bitmap_3::get() == 1ULL);
+
+    g_eoi_vector = 0;
+    g_vmcs_fields[vmcs_n::exit_reason::addr] =
+        vmcs_n::exit_reason::basic_exit_reason::virtualized_eoi;
+    g_vmcs_fields[vmcs_n::exit_qualification::addr] = 0x42U;
+
+    CHECK_NOTHROW(ehlr->handle(ehlr));
+    CHECK(g_eoi_vector == 0x42U);
+}
+
+TEST_CASE("virt_x2apic: enable_posted_interrupts - not supported")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    g_msrs[msrs_n::ia32_vmx_true_pinbased_ctls::addr] = 0x0ULL;
+
+    CHECK(!vapic.enable_posted_interrupts(0xF2U));
+    CHECK(!vapic.posted_interrupts_enabled());
+    CHECK(pin_ctls::process_posted_interrupts::is_disabled());
+    CHECK_THROWS(vapic.post_interrupt(0x42U));
+}
+
+TEST_CASE("virt_x2apic: enable_posted_interrupts")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    CHECK(vapic.enable_tpr_shadow());
+    CHECK(vapic.enable_posted_interrupts(0xF2U));
+    CHECK(vapic.posted_interrupts_enabled());
+    CHECK(vapic.interrupt_delivery_enabled());
+    CHECK(pin_ctls::process_posted_interrupts::is_enabled());
+    CHECK(vmcs_n::posted_interrupt_notification_vector::get() == 0xF2U);
+    CHECK(vmcs_n::posted_interrupt_descriptor_address::get() != 0U);
+    CHECK((vmcs_n::posted_interrupt_descriptor_address::get() & 0x3FU) == 0U);
+
+    CHECK(vapic.enable_posted_interrupts(0xF2U));
+}
+
+TEST_CASE("virt_x2apic: post_interrupt")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    CHECK(vapic.enable_tpr_shadow());
+    CHECK(vapic.enable_posted_interrupts(0xF2U));
+
+    CHECK(vapic.post_interrupt(0x42U));
+    CHECK(!vapic.post_interrupt(0xC1U));
+    CHECK(!vapic.post_interrupt(0x42U));
+    CHECK(vapic.top_irr() == 0U);
+
+    vapic.sync_posted_interrupts();
+    CHECK(vapic.top_irr() == 0xC1U);
+    CHECK(vmcs_n::guest_interrupt_status::get() == 0xC1U);
+
+    auto irr2 = lapic_register::msr_addr_to_offset(msrs_n::ia32_x2apic_irr2::addr);
+    CHECK(vapic.read_register(irr2) == (1ULL << 2U));
+
+    CHECK(vapic.post_interrupt(0x35U));
+    vapic.sync_posted_interrupts();
+    CHECK(vapic.top_irr() == 0xC1U);
+    CHECK(vmcs_n::guest_interrupt_status::get() == 0xC1U);
+}
+
 TEST_CASE("virt_x2apic: tpr")
 {
     MockRepository mocks;
@@ -331,7 +569,7 @@ TEST_CASE("virt_x2apic: top_isr")
 
     do {
         for (const auto v : vec) {
-            vapic.queue_injection(v);
+            vapic.inject_interrupt(v);
         }
         CHECK(vapic.top_isr() == max);
 
@@ -344,6 +582,132 @@ TEST_CASE("virt_x2apic: top_isr")
     while (std::next_permutation(vec.begin(), vec.end()));
 }
 
+TEST_CASE("virt_x2apic: 256-bit summary")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+    auto irr0 = lapic_register::msr_addr_to_offset(msrs_n::ia32_x2apic_irr0::addr);
+    auto irr5 = lapic_register::msr_addr_to_offset(msrs_n::ia32_x2apic_irr5::addr);
+
+    CHECK(vapic.irr_is_empty());
+
+    vapic.write_register(irr5, 0x80000001U);
+    vapic.write_register(irr0, 0x00010000U);
+    CHECK(vapic.top_irr() == 0xBFU);
+
+    vapic.pop_irr();
+    CHECK(vapic.top_irr() == 0xA0U);
+
+    vapic.pop_irr();
+    CHECK(vapic.top_irr() == 0x10U);
+
+    vapic.write_register(irr0, 0U);
+    CHECK(vapic.irr_is_empty());
+    CHECK(vapic.top_irr() == 0U);
+
+    vapic.pop_irr();
+    CHECK(vapic.irr_is_empty());
+}
+
+TEST_CASE("virt_x2apic: read_ppr")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    vmcs_n::guest_rflags::interrupt_enable_flag::enable();
+
+    vapic.write_tpr(0x35U);
+    CHECK(vapic.read_ppr() == 0x35U);
+
+    vapic.queue_injection(0x62U);
+    CHECK(vapic.top_isr() == 0x62U);
+    CHECK(vapic.read_ppr() == 0x60U);
+
+    vapic.write_tpr(0x6AU);
+    CHECK(vapic.read_ppr() == 0x6AU);
+
+    vapic.write_tpr(0x10U);
+    CHECK(vapic.read_ppr() == 0x60U);
+
+    vapic.write_eoi();
+    CHECK(vapic.read_ppr() == 0x10U);
+}
+
+// -----------------------------------------------------------------------------
+// Benchmark
+// -----------------------------------------------------------------------------
+
+constexpr const auto bench_iterations = 100000;
+
+// The bit-by-bit scan the summary replaced, kept as a reference point
+
+static uint64_t
+bench_scan_top_irr(const eapis::intel_x64::virt_x2apic &vapic)
+{
+    for (auto i = 0U; i < 8U; ++i) {
+        auto offset = lapic_register::msr_addr_to_offset(msrs_n::ia32_x2apic_irr7::addr - i);
+        auto reg = vapic.read_register(offset);
+
+        for (auto b = 31; reg != 0U && b >= 0; --b) {
+            if ((reg & (1ULL << gsl::narrow_cast<uint64_t>(b))) != 0U) {
+                return ((7ULL - i) << 5U) | gsl::narrow_cast<uint64_t>(b);
+            }
+        }
+    }
+
+    return 0U;
+}
+
+TEST_CASE("virt_x2apic: 256-bit scan benchmark")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    // Worst case for the bit-by-bit scan: only the lowest vector pending
+
+    vapic.queue_interrupt(0x20U);
+
+    auto sum = 0ULL;
+    auto start = std::chrono::steady_clock::now();
+
+    for (auto i = 0; i < bench_iterations; ++i) {
+        sum += bench_scan_top_irr(vapic);
+    }
+
+    auto stop = std::chrono::steady_clock::now();
+    const auto scan_ns = std::chrono::duration<double, std::nano>(stop - start).count() / bench_iterations;
+
+    start = std::chrono::steady_clock::now();
+
+    for (auto i = 0; i < bench_iterations; ++i) {
+        sum += vapic.top_irr();
+    }
+
+    stop = std::chrono::steady_clock::now();
+    const auto top_ns = std::chrono::duration<double, std::nano>(stop - start).count() / bench_iterations;
+
+    start = std::chrono::steady_clock::now();
+
+    for (auto i = 0; i < bench_iterations; ++i) {
+        vapic.queue_interrupt(0x21U + gsl::narrow_cast<uint64_t>(i % 0xDF));
+        vapic.pop_irr();
+    }
+
+    stop = std::chrono::steady_clock::now();
+    const auto pop_ns = std::chrono::duration<double, std::nano>(stop - start).count() / bench_iterations;
+
+    std::cout << "virt_x2apic 256-bit benchmark:\n"
+              << "  bit-by-bit top_irr: " << scan_ns << " ns\n"
+              << "  summary top_irr:    " << top_ns << " ns\n"
+              << "  queue + pop_irr:    " << pop_ns << " ns\n";
+
+    CHECK(sum == 0x40ULL * bench_iterations);
+    CHECK(vapic.top_irr() == 0x20U);
+}
+
 TEST_CASE("virt_x2apic: interrupt_window_exit - single")
 {
     MockRepository mocks;
@@ -410,6 +774,376 @@ TEST_CASE("virt_x2apic: interrupt_window_exit - permuted")
     while (std::next_permutation(vec.begin(), vec.end()));
 }
 
+TEST_CASE("virt_x2apic: interrupt_window_exit - burst")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    close_interrupt_window();
+    vapic.queue_injection(0x30U);
+    vapic.queue_injection(0x50U);
+    vapic.queue_injection(0x40U);
+    CHECK(proc_ctls1::interrupt_window_exiting::is_enabled());
+
+    open_interrupt_window();
+    CHECK(vapic.handle_interrupt_window_exit(hve->vmcs()));
+    check_vmentry_interrupt_info(0x50U);
+
+    // The rest is masked by the vector in service, so the next chance to
+    // inject is the guest's EOI rather than another window exit
+
+    CHECK(proc_ctls1::interrupt_window_exiting::is_disabled());
+    CHECK(vapic.top_irr() == 0x40U);
+
+    vapic.handle_eoi();
+    check_vmentry_interrupt_info(0x40U);
+    CHECK(vapic.top_isr() == 0x40U);
+    CHECK(proc_ctls1::interrupt_window_exiting::is_disabled());
+
+    close_interrupt_window();
+    vapic.handle_eoi();
+    CHECK(vapic.isr_is_empty());
+    CHECK(vapic.top_irr() == 0x30U);
+    CHECK(proc_ctls1::interrupt_window_exiting::is_enabled());
+
+    open_interrupt_window();
+    CHECK(vapic.handle_interrupt_window_exit(hve->vmcs()));
+    check_vmentry_interrupt_info(0x30U);
+    CHECK(vapic.irr_is_empty());
+    CHECK(proc_ctls1::interrupt_window_exiting::is_disabled());
+
+    vapic.handle_eoi();
+    CHECK(vapic.isr_is_empty());
+
+    const auto &stats = vapic.injection_stats();
+    CHECK(stats.injected == 3U);
+    CHECK(stats.window_exits == 2U);
+    CHECK(stats.bursts == 1U);
+    CHECK(stats.exits_saved == 1U);
+    CHECK(stats.last_burst_exits_saved == 1U);
+}
+
+TEST_CASE("virt_x2apic: queue_injection - masked by isr")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    open_interrupt_window();
+    vapic.queue_injection(0x55U);
+    CHECK(vapic.top_isr() == 0x55U);
+
+    vapic.queue_injection(0x51U);
+    CHECK(vapic.top_irr() == 0x51U);
+    CHECK(proc_ctls1::interrupt_window_exiting::is_disabled());
+
+    vapic.queue_injection(0x61U);
+    CHECK(vapic.top_isr() == 0x61U);
+    CHECK(vapic.top_irr() == 0x51U);
+
+    vapic.handle_eoi();
+    CHECK(vapic.top_isr() == 0x55U);
+    CHECK(vapic.top_irr() == 0x51U);
+
+    vapic.handle_eoi();
+    CHECK(vapic.top_isr() == 0x51U);
+    CHECK(vapic.irr_is_empty());
+}
+
+uint64_t g_tsc{0};
+
+static uint64_t
+test_read_tsc() noexcept
+{ return g_tsc; }
+
+static auto
+setup_timer(MockRepository &mocks, virt_x2apic &vapic)
+{
+    g_tsc = 0x100000U;
+    g_msrs[msrs_n::ia32_vmx_misc::addr] = 0x0ULL;
+    mocks.OnCallFunc(_read_tsc).Do(test_read_tsc);
+
+    CHECK(vapic.enable_timer_emulation());
+    vapic.write_timer_divide_config(0xBU);
+    open_interrupt_window();
+}
+
+TEST_CASE("virt_x2apic: enable_timer_emulation - not supported")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    g_msrs[msrs_n::ia32_vmx_true_pinbased_ctls::addr] = 0x0ULL;
+
+    CHECK(!vapic.enable_timer_emulation());
+    CHECK(!vapic.timer_emulation_enabled());
+    CHECK_THROWS(vapic.write_timer_initial_count(0x1000U));
+}
+
+TEST_CASE("virt_x2apic: timer - one-shot")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    setup_timer(mocks, vapic);
+    CHECK(vmcs_n::vm_exit_controls::save_vmx_preemption_timer_value::is_enabled());
+
+    vapic.write_lvt_timer(0x31U);
+    vapic.write_timer_initial_count(0x10000U);
+    CHECK(pin_ctls::activate_vmx_preemption_timer::is_enabled());
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x10000U);
+
+    g_tsc += 0x4000U;
+    CHECK(vapic.read_timer_current_count() == 0xC000U);
+
+    // An early exit (e.g. the preemption timer counted at a higher rate
+    // than expected) re-arms for the remainder
+
+    vapic.handle_preemption_timer_exit(hve->vmcs());
+    CHECK(pin_ctls::activate_vmx_preemption_timer::is_enabled());
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0xC000U);
+    CHECK(vapic.timer_stats().expirations == 0U);
+
+    g_tsc += 0xC000U;
+    vapic.handle_preemption_timer_exit(hve->vmcs());
+    CHECK(pin_ctls::activate_vmx_preemption_timer::is_disabled());
+    CHECK(vapic.timer_stats().expirations == 1U);
+    CHECK(vapic.read_timer_current_count() == 0U);
+    check_vmentry_interrupt_info(0x31U);
+}
+
+TEST_CASE("virt_x2apic: timer - masked")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    setup_timer(mocks, vapic);
+
+    vapic.write_lvt_timer(0x10031U);
+    vapic.write_timer_initial_count(0x10000U);
+
+    g_tsc += 0x10000U;
+    vapic.handle_preemption_timer_exit(hve->vmcs());
+    CHECK(vapic.timer_stats().expirations == 1U);
+    CHECK(vapic.irr_is_empty());
+    CHECK(vapic.isr_is_empty());
+}
+
+TEST_CASE("virt_x2apic: timer - periodic")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    setup_timer(mocks, vapic);
+
+    vapic.write_timer_divide_config(0x0U);
+    vapic.write_lvt_timer(0x20031U);
+    vapic.write_timer_initial_count(0x8000U);
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x10000U);
+
+    g_tsc += 0x10000U;
+    vapic.handle_preemption_timer_exit(hve->vmcs());
+    CHECK(pin_ctls::activate_vmx_preemption_timer::is_enabled());
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x10000U);
+    CHECK(vapic.timer_stats().expirations == 1U);
+    CHECK(vapic.timer_stats().coalesced == 0U);
+
+    // Three and a half periods late: the two periods that were missed
+    // are coalesced, and the next deadline stays on the original phase
+
+    g_tsc += 0x38000U;
+    vapic.handle_preemption_timer_exit(hve->vmcs());
+    CHECK(vapic.timer_stats().expirations == 2U);
+    CHECK(vapic.timer_stats().coalesced == 2U);
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x8000U);
+
+    vapic.write_timer_initial_count(0U);
+    CHECK(pin_ctls::activate_vmx_preemption_timer::is_disabled());
+}
+
+TEST_CASE("virt_x2apic: timer - tsc deadline")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    setup_timer(mocks, vapic);
+
+    vapic.write_tsc_deadline(g_tsc + 0x10000U);
+    CHECK(vapic.read_tsc_deadline() == 0U);
+
+    vapic.write_lvt_timer(0x40031U);
+    vapic.write_timer_initial_count(0x10000U);
+    CHECK(pin_ctls::activate_vmx_preemption_timer::is_disabled());
+
+    vapic.write_tsc_deadline(g_tsc + 0x10000U);
+    CHECK(vapic.read_tsc_deadline() == g_tsc + 0x10000U);
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x10000U);
+    CHECK(vapic.read_timer_current_count() == 0U);
+
+    g_tsc += 0x10000U;
+    vapic.handle_preemption_timer_exit(hve->vmcs());
+    CHECK(vapic.read_tsc_deadline() == 0U);
+    CHECK(pin_ctls::activate_vmx_preemption_timer::is_disabled());
+    check_vmentry_interrupt_info(0x31U);
+}
+
+TEST_CASE("virt_x2apic: timer - deadline in the past")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    setup_timer(mocks, vapic);
+
+    vapic.write_lvt_timer(0x40031U);
+    vapic.write_tsc_deadline(g_tsc - 0x10000U);
+
+    CHECK(vapic.timer_stats().immediate == 1U);
+    CHECK(vapic.timer_stats().expirations == 1U);
+    CHECK(pin_ctls::activate_vmx_preemption_timer::is_disabled());
+    check_vmentry_interrupt_info(0x31U);
+}
+
+TEST_CASE("virt_x2apic: timer - never early")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    setup_timer(mocks, vapic);
+
+    vapic.write_lvt_timer(0x40031U);
+    vapic.write_tsc_deadline(g_tsc + 0x400U);
+    CHECK(vapic.timer_stats().immediate == 0U);
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x400U);
+
+    // One tick short of the deadline, the timer is re-armed, however
+    // close the deadline is
+
+    g_tsc += 0x3FFU;
+    vapic.handle_preemption_timer_exit(hve->vmcs());
+    CHECK(vapic.timer_stats().expirations == 0U);
+    CHECK(pin_ctls::activate_vmx_preemption_timer::is_enabled());
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x1U);
+
+    g_tsc += 0x1U;
+    vapic.handle_preemption_timer_exit(hve->vmcs());
+    CHECK(vapic.timer_stats().expirations == 1U);
+    CHECK(pin_ctls::activate_vmx_preemption_timer::is_disabled());
+    check_vmentry_interrupt_info(0x31U);
+}
+
+TEST_CASE("virt_x2apic: timer - preemption timer rate")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    setup_timer(mocks, vapic);
+
+    // The preemption timer counts every 32 TSC ticks; a remainder that
+    // is not a multiple of that is rounded up
+
+    vapic.m_preemption_timer_shift = 5U;
+
+    vapic.write_lvt_timer(0x40031U);
+    vapic.write_tsc_deadline(g_tsc + 0x30U);
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x2U);
+
+    vapic.write_tsc_deadline(g_tsc + 0x40U);
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x2U);
+
+    vapic.write_tsc_deadline(g_tsc + 0x1U);
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x1U);
+    CHECK(vapic.timer_stats().immediate == 0U);
+}
+
+TEST_CASE("virt_x2apic: timer - clock")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+
+    setup_timer(mocks, vapic);
+
+    CHECK_THROWS(vapic.set_timer_clock(0U));
+
+    // 25 TSC ticks per timer tick
+
+    vapic.set_timer_clock(25ULL << 16U);
+    vapic.write_lvt_timer(0x31U);
+    vapic.write_timer_initial_count(0x100U);
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x1900U);
+
+    g_tsc += 0x640U;
+    CHECK(vapic.read_timer_current_count() == 0xC0U);
+
+    // 1.5 TSC ticks per timer tick, divided by 2
+
+    vapic.set_timer_clock(0x18000U);
+    vapic.write_timer_divide_config(0x0U);
+    vapic.write_timer_initial_count(0x1000U);
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x3000U);
+
+    g_tsc += 0x1800U;
+    CHECK(vapic.read_timer_current_count() == 0x800U);
+
+    // TSC-deadline mode counts TSC ticks
+
+    vapic.write_lvt_timer(0x40031U);
+    vapic.write_tsc_deadline(g_tsc + 0x1000U);
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x1000U);
+}
+
+TEST_CASE("virt_x2apic: timer - resume")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+    auto init_count = lapic_register::msr_addr_to_offset(msrs_n::ia32_x2apic_init_count::addr);
+
+    setup_timer(mocks, vapic);
+
+    vapic.set_timer_clock(4ULL << 16U);
+    vapic.write_lvt_timer(0x20031U);
+    vapic.resume_timer(0x1000U, 0x100U);
+
+    CHECK(vapic.read_register(init_count) == 0x1000U);
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x400U);
+
+    g_tsc += 0x400U;
+    vapic.handle_preemption_timer_exit(hve->vmcs());
+    CHECK(vapic.timer_stats().expirations == 1U);
+    CHECK(vmcs_n::vmx_preemption_timer_value::get() == 0x4000U);
+
+    vapic.resume_timer(0U, 0U);
+    CHECK(pin_ctls::activate_vmx_preemption_timer::is_disabled());
+}
+
+TEST_CASE("virt_x2apic: timer - mode switch disarms")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = eapis::intel_x64::virt_x2apic(hve.get());
+    auto init_count = lapic_register::msr_addr_to_offset(msrs_n::ia32_x2apic_init_count::addr);
+
+    setup_timer(mocks, vapic);
+
+    vapic.write_lvt_timer(0x31U);
+    vapic.write_timer_initial_count(0x10000U);
+    CHECK(pin_ctls::activate_vmx_preemption_timer::is_enabled());
+
+    vapic.write_lvt_timer(0x40031U);
+    CHECK(pin_ctls::activate_vmx_preemption_timer::is_disabled());
+    CHECK(vapic.read_register(init_count) == 0U);
+}
+
 }
 }
 
@@ -0,0 +1,483 @@
+//
+// Bareflank Hypervisor
+// Copyright (C) 2017 Assured Information Security, Inc.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include <array>
+#include <vector>
+#include <intrinsics.h>
+
+#include <hve/arch/intel_x64/hve.h>
+#include <hve/arch/intel_x64/mmio_decoder.h>
+#include <hve/arch/intel_x64/phys_xapic.h>
+#include <hve/arch/intel_x64/vic.h>
+#include <hve/arch/intel_x64/virt_xapic.h>
+#include <support/arch/intel_x64/test_support.h>
+
+#ifdef _HIPPOMOCKS__ENABLE_CFUNC_MOCKING_SUPPORT
+
+namespace eapis
+{
+namespace intel_x64
+{
+
+namespace msrs_n = ::intel_x64::msrs;
+namespace proc_ctls1 = vmcs_n::primary_processor_based_vm_execution_controls;
+
+std::unique_ptr<bfvmm::intel_x64::vmcs> g_vmcs{nullptr};
+std::unique_ptr<bfvmm::intel_x64::exit_handler> g_ehlr{nullptr};
+
+constexpr const auto xapic_base = 0xFEE00000ULL;
+
+constexpr const auto id_offset = lapic_register::msr_addr_to_offset(msrs_n::ia32_x2apic_apicid::addr);
+constexpr const auto tpr_offset = lapic_register::msr_addr_to_offset(msrs_n::ia32_x2apic_tpr::addr);
+constexpr const auto eoi_offset = lapic_register::msr_addr_to_offset(msrs_n::ia32_x2apic_eoi::addr);
+constexpr const auto icr_lo_offset = lapic_register::msr_addr_to_offset(msrs_n::ia32_x2apic_icr::addr);
+constexpr const auto icr_hi_offset = icr_lo_offset + 1U;
+constexpr const auto ldr_offset = lapic_register::msr_addr_to_offset(msrs_n::ia32_x2apic_ldr::addr);
+constexpr const auto dfr_offset = lapic_register::mem_addr_to_offset(0x0E0U);
+
+mmio_decoder::insn_bytes_t g_guest_insn{};
+std::vector<uint64_t> g_mapped_lens;
+
+template<size_t N> static bool
+decode(const std::array<uint8_t, N> &bytes, bool long_mode, mmio_decoder::insn_t &insn)
+{ return mmio_decoder::decode(gsl::make_span(bytes), long_mode, insn); }
+
+static const uint8_t *
+test_map_guest(
+    uint64_t rip, uint64_t cr3, uint64_t len, bfvmm::x64::unique_map<uint8_t> &map)
+{
+    bfignored(rip);
+    bfignored(cr3);
+    bfignored(map);
+
+    g_mapped_lens.push_back(len);
+    return g_guest_insn.data();
+}
+
+static void
+setup_ept_violation_exit(uint64_t gpa, uint64_t qual, uint64_t rip)
+{
+    g_vmcs_fields[vmcs_n::exit_reason::addr] =
+        vmcs_n::exit_reason::basic_exit_reason::ept_violation;
+
+    g_vmcs_fields[vmcs_n::exit_qualification::addr] = qual;
+    g_vmcs_fields[vmcs_n::guest_physical_address::addr] = gpa;
+
+    g_save_state.rip = rip;
+}
+
+// Trapping the APIC page requires the guest's EPT memory map and a VMM
+// mapping of the physical page. Neither is needed to exercise the
+// handlers, so the vic is switched to xAPIC mode by hand, on top of a
+// register page in memory.
+
+static void
+setup_xapic_vic(
+    eapis::intel_x64::vic &vic,
+    gsl::not_null<eapis::intel_x64::hve *> hve,
+    std::array<uint32_t, 1024> &page)
+{
+    vic.m_xapic_base = xapic_base;
+    vic.m_phys_lapic = std::make_unique<phys_xapic>(page.data());
+    vic.m_virt_lapic = std::make_unique<virt_xapic>(hve, vic.m_phys_lapic.get());
+
+    hve->add_ept_read_violation_handler(
+        ept_violation::handler_delegate_t::create<eapis::intel_x64::vic,
+        &eapis::intel_x64::vic::handle_xapic_read>(&vic)
+    );
+
+    hve->add_ept_write_violation_handler(
+        ept_violation::handler_delegate_t::create<eapis::intel_x64::vic,
+        &eapis::intel_x64::vic::handle_xapic_write>(&vic)
+    );
+}
+
+TEST_CASE("mmio_decoder: mov load")
+{
+    mmio_decoder::insn_t insn{};
+
+    // mov eax, [rdi + 0x20]
+    CHECK(decode(std::array<uint8_t, 3> {0x8B, 0x47, 0x20}, true, insn));
+    CHECK(insn.len == 3U);
+    CHECK(insn.reg == 0U);
+    CHECK(!insn.write);
+
+    // mov r9d, [rip + disp32]
+    CHECK(decode(std::array<uint8_t, 7> {0x44, 0x8B, 0x0D, 0x10, 0x20, 0x30, 0x40}, true, insn));
+    CHECK(insn.len == 7U);
+    CHECK(insn.reg == 9U);
+
+    // mov edx, fs:[ecx*4 + disp32] (SIB, no base)
+    CHECK(decode(std::array<uint8_t, 8> {0x64, 0x8B, 0x14, 0x8D, 0x00, 0x03, 0xE0, 0xFE}, false, insn));
+    CHECK(insn.len == 8U);
+    CHECK(insn.reg == 2U);
+}
+
+TEST_CASE("mmio_decoder: mov store")
+{
+    mmio_decoder::insn_t insn{};
+
+    // mov [rbx + 0xb0], esi
+    CHECK(decode(std::array<uint8_t, 6> {0x89, 0xB3, 0xB0, 0x00, 0x00, 0x00}, true, insn));
+    CHECK(insn.len == 6U);
+    CHECK(insn.reg == 6U);
+    CHECK(insn.write);
+    CHECK(!insn.imm_src);
+
+    // mov dword [0xfee000b0], 0
+    CHECK(decode(std::array<uint8_t, 10> {0xC7, 0x05, 0xB0, 0x00, 0xE0, 0xFE, 0x00, 0x00, 0x00, 0x00}, false, insn));
+    CHECK(insn.len == 10U);
+    CHECK(insn.write);
+    CHECK(insn.imm_src);
+    CHECK(insn.imm == 0U);
+
+    // mov dword [rax + 0x300], 0x000c4500
+    CHECK(decode(std::array<uint8_t, 10> {0xC7, 0x80, 0x00, 0x03, 0x00, 0x00, 0x00, 0x45, 0x0C, 0x00}, true, insn));
+    CHECK(insn.imm == 0x000C4500U);
+}
+
+TEST_CASE("mmio_decoder: unsupported forms")
+{
+    mmio_decoder::insn_t insn{};
+
+    // mov rax, [rdi] (REX.W)
+    CHECK(!decode(std::array<uint8_t, 3> {0x48, 0x8B, 0x07}, true, insn));
+
+    // mov ax, [rdi] (operand-size prefix)
+    CHECK(!decode(std::array<uint8_t, 3> {0x66, 0x8B, 0x07}, true, insn));
+
+    // mov eax, ecx (register operand)
+    CHECK(!decode(std::array<uint8_t, 2> {0x8B, 0xC1}, true, insn));
+
+    // C7 /1 is undefined
+    CHECK(!decode(std::array<uint8_t, 6> {0xC7, 0x08, 0x00, 0x00, 0x00, 0x00}, true, insn));
+
+    // truncated displacement
+    CHECK(!decode(std::array<uint8_t, 3> {0x8B, 0x87, 0x00}, true, insn));
+
+    // 0x40 is inc eax outside of 64-bit mode
+    CHECK(!decode(std::array<uint8_t, 3> {0x40, 0x8B, 0x07}, false, insn));
+}
+
+TEST_CASE("mmio_decoder: cache")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vmcs = hve->vmcs();
+
+    mocks.OnCallFunc(mmio_decoder::map_guest).Do(test_map_guest);
+
+    mmio_decoder decoder;
+
+    vmcs->save_state()->rip = 0x1000U;
+    vmcs_n::guest_cr3::set(0x2000U);
+
+    // mov [rdi + 0x20], ecx
+    g_guest_insn = {0x89, 0x4F, 0x20};
+    g_mapped_lens.clear();
+
+    // A hit neither walks the guest's page tables nor maps its memory
+
+    CHECK(decoder.decode(vmcs, true).len == 3U);
+    CHECK(decoder.decode(vmcs, true).reg == 1U);
+    CHECK(decoder.hits() == 1U);
+    CHECK(decoder.misses() == 1U);
+    CHECK(g_mapped_lens.size() == 1U);
+
+    // mov [rdi + 0x20], edx: same RIP and CR3, different code
+
+    g_guest_insn = {0x89, 0x57, 0x20};
+
+    CHECK(decoder.decode(vmcs, true).reg == 2U);
+    CHECK(decoder.hits() == 1U);
+    CHECK(decoder.misses() == 2U);
+
+    // The bytes past the instruction are not part of the entry
+
+    g_guest_insn.at(3) = 0xCC;
+
+    CHECK(decoder.decode(vmcs, true).reg == 2U);
+    CHECK(decoder.hits() == 2U);
+    CHECK(decoder.misses() == 2U);
+
+    // mov edx, [rdi + 0x20]: a write exit at a load is not emulated
+
+    g_guest_insn = {0x8B, 0x57, 0x20};
+    CHECK_THROWS(decoder.decode(vmcs, true));
+}
+
+TEST_CASE("mmio_decoder: end of page")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vmcs = hve->vmcs();
+
+    mocks.OnCallFunc(mmio_decoder::map_guest).Do(test_map_guest);
+
+    mmio_decoder decoder;
+    vmcs_n::guest_cr3::set(0x2000U);
+
+    // mov [rdi + 0x20], ecx, in the last 3 bytes of a page: the next page
+    // is not mapped
+
+    g_guest_insn = {0x89, 0x4F, 0x20};
+    g_mapped_lens.clear();
+
+    vmcs->save_state()->rip = 0x1FFDU;
+    CHECK(decoder.decode(vmcs, true).len == 3U);
+    CHECK(g_mapped_lens == std::vector<uint64_t>({3U}));
+
+    // mov [rbx + 0xb0], esi, crossing into the next page
+
+    g_guest_insn = {0x89, 0xB3, 0xB0, 0x00, 0x00, 0x00};
+    g_mapped_lens.clear();
+
+    vmcs->save_state()->rip = 0x2FFDU;
+    CHECK(decoder.decode(vmcs, true).len == 6U);
+    CHECK(g_mapped_lens == std::vector<uint64_t>({3U, 15U}));
+
+    // An instruction far from the end of the page is mapped in one go
+
+    g_mapped_lens.clear();
+
+    vmcs->save_state()->rip = 0x3100U;
+    CHECK(decoder.decode(vmcs, true).len == 6U);
+    CHECK(g_mapped_lens == std::vector<uint64_t>({15U}));
+}
+
+TEST_CASE("phys_xapic: registers")
+{
+    std::array<uint32_t, 1024> page{};
+    phys_xapic papic(page.data());
+
+    page.at(id_offset << 2U) = 0x03000000U;
+    CHECK(papic.read_id() == 3U);
+    CHECK(papic.read_register(id_offset) == 0x03000000U);
+
+    papic.write_register(dfr_offset, 0xFFFFFFFFU);
+    CHECK(page.at(dfr_offset << 2U) == 0xFFFFFFFFU);
+
+    papic.write_eoi();
+    CHECK(page.at(eoi_offset << 2U) == 0U);
+}
+
+TEST_CASE("phys_xapic: icr")
+{
+    std::array<uint32_t, 1024> page{};
+    phys_xapic papic(page.data());
+
+    papic.write_icr(0x0000000500004031ULL);
+    CHECK(page.at(icr_hi_offset << 2U) == 0x05000000U);
+    CHECK(page.at(icr_lo_offset << 2U) == 0x00004031U);
+    CHECK(papic.read_icr() == 0x0000000500004031ULL);
+
+    papic.write_self_ipi(0x31U);
+    CHECK(page.at(icr_lo_offset << 2U) == 0x00040031U);
+}
+
+TEST_CASE("virt_xapic::virt_xapic(hve)")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+
+    hve->vmcs()->save_state()->vcpuid = 2U;
+    auto vapic = virt_xapic(hve.get());
+
+    CHECK(vapic.read_id() == 2U);
+    CHECK(vapic.read_register(id_offset) == 0x02000000U);
+    CHECK(vapic.read_register(dfr_offset) == 0xFFFFFFFFU);
+
+    hve->vmcs()->save_state()->vcpuid = 0U;
+}
+
+TEST_CASE("virt_xapic::virt_xapic(hve, phys_lapic)")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+
+    std::array<uint32_t, 1024> page{};
+    phys_xapic papic(page.data());
+
+    page.at(id_offset << 2U) = 0x01000000U;
+    page.at(dfr_offset << 2U) = 0x0FFFFFFFU;
+
+    auto vapic = virt_xapic(hve.get(), &papic);
+    CHECK(vapic.read_id() == 1U);
+    CHECK(vapic.read_register(dfr_offset) == 0x0FFFFFFFU);
+}
+
+TEST_CASE("virt_xapic: no register virtualization")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto vapic = virt_xapic(hve.get());
+
+    CHECK(!vapic.enable_register_virtualization());
+    CHECK(!vapic.enable_interrupt_delivery());
+    CHECK(!vapic.register_virtualization_enabled());
+}
+
+TEST_CASE("vic: handle_xapic_write")
+{
+    namespace qual_n = vmcs_n::exit_qualification::ept_violation;
+
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto ehlr = hve->exit_handler();
+
+    mocks.OnCallFunc(mmio_decoder::map_guest).Do(test_map_guest);
+
+    std::array<uint32_t, 1024> page{};
+    auto vic = setup_vic(hve.get());
+    setup_xapic_vic(vic, hve.get(), page);
+
+    // mov [rax + 0x80], ecx
+
+    g_guest_insn = {0x89, 0x88, 0x80, 0x00, 0x00, 0x00};
+    g_save_state.rcx = 0x20U;
+
+    setup_ept_violation_exit(xapic_base + 0x80U, qual_n::data_write::mask, 0x1000U);
+    CHECK_NOTHROW(ehlr->handle(ehlr));
+    CHECK(vic.m_virt_lapic->read_register(tpr_offset) == 0x20U);
+    CHECK(g_save_state.rip == 0x1006U);
+
+    // mov dword [rax + 0x80], 0x30
+
+    g_guest_insn = {0xC7, 0x80, 0x80, 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00};
+
+    setup_ept_violation_exit(xapic_base + 0x80U, qual_n::data_write::mask, 0x2000U);
+    CHECK_NOTHROW(ehlr->handle(ehlr));
+    CHECK(vic.m_virt_lapic->read_register(tpr_offset) == 0x30U);
+    CHECK(g_save_state.rip == 0x200AU);
+
+    // Unaligned writes are dropped, but the instruction still retires
+
+    g_guest_insn = {0x89, 0x88, 0x81, 0x00, 0x00, 0x00};
+
+    setup_ept_violation_exit(xapic_base + 0x81U, qual_n::data_write::mask, 0x3000U);
+    CHECK_NOTHROW(ehlr->handle(ehlr));
+    CHECK(vic.m_virt_lapic->read_register(tpr_offset) == 0x30U);
+    CHECK(g_save_state.rip == 0x3006U);
+
+    // Writes outside of the APIC page are not the vic's
+
+    setup_ept_violation_exit(xapic_base + 0x1080U, qual_n::data_write::mask, 0x3000U);
+    CHECK_THROWS(ehlr->handle(ehlr));
+}
+
+TEST_CASE("vic: handle_xapic_read")
+{
+    namespace qual_n = vmcs_n::exit_qualification::ept_violation;
+
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+    auto ehlr = hve->exit_handler();
+
+    mocks.OnCallFunc(mmio_decoder::map_guest).Do(test_map_guest);
+
+    std::array<uint32_t, 1024> page{};
+    auto vic = setup_vic(hve.get());
+    setup_xapic_vic(vic, hve.get(), page);
+
+    vic.m_virt_lapic->write_register(tpr_offset, 0x40U);
+
+    // mov edx, [rax + 0x80]
+
+    g_guest_insn = {0x8B, 0x90, 0x80, 0x00, 0x00, 0x00};
+    g_save_state.rdx = 0xFFFFFFFFFFFFFFFFULL;
+
+    setup_ept_violation_exit(xapic_base + 0x80U, qual_n::data_read::mask, 0x1000U);
+    CHECK_NOTHROW(ehlr->handle(ehlr));
+    CHECK(g_save_state.rdx == 0x40U);
+    CHECK(g_save_state.rip == 0x1006U);
+
+    // Unaligned reads return 0
+
+    g_guest_insn = {0x8B, 0x90, 0x82, 0x00, 0x00, 0x00};
+
+    setup_ept_violation_exit(xapic_base + 0x82U, qual_n::data_read::mask, 0x2000U);
+    CHECK_NOTHROW(ehlr->handle(ehlr));
+    CHECK(g_save_state.rdx == 0U);
+    CHECK(g_save_state.rip == 0x2006U);
+
+    // A read exit at a store is not emulated
+
+    g_guest_insn = {0x89, 0x90, 0x80, 0x00, 0x00, 0x00};
+
+    setup_ept_violation_exit(xapic_base + 0x80U, qual_n::data_read::mask, 0x3000U);
+    CHECK_THROWS(ehlr->handle(ehlr));
+}
+
+TEST_CASE("vic: send_virt_icr in xAPIC mode")
+{
+    MockRepository mocks;
+    auto hve = setup_hve(mocks);
+
+    std::array<uint32_t, 1024> page0{};
+    std::array<uint32_t, 1024> page1{};
+
+    auto vic0 = setup_vic(hve.get());
+    setup_xapic_vic(vic0, hve.get(), page0);
+    vic0.m_virt_lapic->write_register(id_offset, 0x0U << 24U);
+
+    auto vic1 = setup_vic(hve.get());
+    setup_xapic_vic(vic1, hve.get(), page1);
+    vic1.m_virt_lapic->write_register(id_offset, 0x1U << 24U);
+
+    vic0.enable_ipi_mailbox(0xF1U, 2U);
+    vic1.enable_ipi_mailbox(0xF1U, 2U);
+    open_interrupt_window();
+
+    interrupt_mailbox::vectors_t vectors{};
+
+    // Cluster model: cluster 1 holds both vCPUs, as APICs 0 and 1
+
+    vic0.m_virt_lapic->write_register(dfr_offset, 0x0FFFFFFFU);
+    vic0.m_virt_lapic->write_register(ldr_offset, 0x11U << 24U);
+    vic1.m_virt_lapic->write_register(dfr_offset, 0x0FFFFFFFU);
+    vic1.m_virt_lapic->write_register(ldr_offset, 0x12U << 24U);
+
+    CHECK(vic0.send_virt_icr(0x0000001200000850ULL));
+    CHECK(vic1.m_mailbox->take(vectors));
+    CHECK(!vic0.send_virt_icr(0x0000002300000851ULL));
+    CHECK(!vic0.send_virt_icr(0x0000001400000851ULL));
+
+    // The logical broadcast is FFH, not FFFF_FFFFH as in x2APIC mode
+
+    CHECK(vic0.send_virt_icr(0x000000FF00000852ULL));
+    CHECK(vic1.m_mailbox->take(vectors));
+
+    // Flat model: one bit per vCPU
+
+    vic0.m_virt_lapic->write_register(dfr_offset, 0xFFFFFFFFU);
+    vic0.m_virt_lapic->write_register(ldr_offset, 0x01U << 24U);
+    vic1.m_virt_lapic->write_register(dfr_offset, 0xFFFFFFFFU);
+    vic1.m_virt_lapic->write_register(ldr_offset, 0x02U << 24U);
+
+    CHECK(vic0.send_virt_icr(0x0000000200000853ULL));
+    CHECK(vic1.m_mailbox->take(vectors));
+    CHECK(!vic0.send_virt_icr(0x0000000400000853ULL));
+
+    CHECK(vic0.send_virt_icr(0x000000FF00000854ULL));
+    CHECK(vic1.m_mailbox->take(vectors));
+}
+
+}
+}
+
+#endif